@@ -51,6 +51,8 @@ enum upipe_dvbcsa_command {
     UPIPE_DVBCSA_ADD_PID,
     /** delete a pid from the encryption/decryption list (uint64_t) */
     UPIPE_DVBCSA_DEL_PID,
+    /** set the number of threads processing the batches (unsigned) */
+    UPIPE_DVBCSA_SET_THREADS,
 
     /** custom dvbcsa commands start here */
     UPIPE_DVBCSA_CONTROL_LOCAL,
@@ -107,6 +109,21 @@ static inline int upipe_dvbcsa_del_pid(struct upipe *upipe,
                          UPIPE_DVBCSA_COMMON_SIGNATURE, pid);
 }
 
+/** @This sets the number of threads processing the batches of a bitslice
+ * pipe. With 0, the default, batches are processed in the thread of the
+ * pipe.
+ *
+ * @param upipe description structure of the pipe
+ * @param nb_threads number of threads
+ * @return an error code
+ */
+static inline int upipe_dvbcsa_set_threads(struct upipe *upipe,
+                                           unsigned nb_threads)
+{
+    return upipe_control(upipe, UPIPE_DVBCSA_SET_THREADS,
+                         UPIPE_DVBCSA_COMMON_SIGNATURE, nb_threads);
+}
+
 /** @This stores a parsed dvbcsa control word. */
 struct ustring_dvbcsa_cw {
     /** matching part of the string */
@@ -31,7 +31,8 @@ extern "C" {
 
 #include <upipe/ubuf_block_stream.h>
 
-/** @This scans for an MPEG-style 3-octet start code in a linear buffer.
+/** @This scans for an MPEG-style 3-octet start code in a linear buffer,
+ * using SIMD instructions when available.
  *
  * @param p linear buffer
  * @param end end of linear buffer
@@ -42,6 +43,18 @@ const uint8_t *upipe_framers_mpeg_scan(const uint8_t *restrict p,
                                        const uint8_t *end,
                                        uint32_t *restrict state);
 
+/** @This scans for an MPEG-style 3-octet start code in a linear buffer,
+ * one octet at a time. This is the reference implementation.
+ *
+ * @param p linear buffer
+ * @param end end of linear buffer
+ * @param state state of the algorithm
+ * @return pointer to start code, or end if not found
+ */
+const uint8_t *upipe_framers_mpeg_scan_c(const uint8_t *restrict p,
+                                         const uint8_t *end,
+                                         uint32_t *restrict state);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short Upipe source module for AF_PACKET (TPACKET_V3) mmap rings
+ *
+ * The uri of the pipe is the name of the network interface to capture from.
+ * UDP/IPv4 flows are then selected by allocating output subpipes with
+ * @ref upipe_void_alloc_sub, and setting their uri to @tt{[@]group[:port]}
+ * (a port of 0 or no port matches all ports). Multicast groups are joined
+ * on the interface, and a BPF filter makes sure only the selected datagrams
+ * reach the ring. Output buffers point directly into the ring, which is
+ * given back to the kernel block per block once all buffers are released.
+ */
+
+#ifndef _UPIPE_MODULES_UPIPE_PACKET_SOURCE_H_
+/** @hidden */
+#define _UPIPE_MODULES_UPIPE_PACKET_SOURCE_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <upipe/upipe.h>
+
+#define UPIPE_PKTSRC_SIGNATURE UBASE_FOURCC('p','s','r','c')
+#define UPIPE_PKTSRC_OUTPUT_SIGNATURE UBASE_FOURCC('p','s','r','o')
+
+/** @This extends upipe_command with specific commands. */
+enum upipe_pktsrc_command {
+    UPIPE_PKTSRC_SENTINEL = UPIPE_CONTROL_LOCAL,
+
+    /** get the ring geometry (unsigned int *, unsigned int *) **/
+    UPIPE_PKTSRC_GET_RING,
+    /** set the ring geometry (unsigned int, unsigned int) **/
+    UPIPE_PKTSRC_SET_RING,
+};
+
+/** @This returns the geometry of the capture ring.
+ *
+ * @param upipe description structure of the pipe
+ * @param block_size_p filled in with the size of a ring block, in octets
+ * @param block_nr_p filled in with the number of blocks in the ring
+ * @return an error code
+ */
+static inline int upipe_pktsrc_get_ring(struct upipe *upipe,
+                                        unsigned int *block_size_p,
+                                        unsigned int *block_nr_p)
+{
+    return upipe_control(upipe, UPIPE_PKTSRC_GET_RING, UPIPE_PKTSRC_SIGNATURE,
+                         block_size_p, block_nr_p);
+}
+
+/** @This sets the geometry of the capture ring. It is applied the next time
+ * an interface is opened. Buffers remain in the ring until they are released
+ * downstream, so the ring must be large enough to hold all the data retained
+ * by the pipeline.
+ *
+ * @param upipe description structure of the pipe
+ * @param block_size size of a ring block, in octets (multiple of the page
+ * size)
+ * @param block_nr number of blocks in the ring
+ * @return an error code
+ */
+static inline int upipe_pktsrc_set_ring(struct upipe *upipe,
+                                        unsigned int block_size,
+                                        unsigned int block_nr)
+{
+    return upipe_control(upipe, UPIPE_PKTSRC_SET_RING, UPIPE_PKTSRC_SIGNATURE,
+                         block_size, block_nr);
+}
+
+/** @This returns the management structure for all packet sources.
+ *
+ * @return pointer to manager
+ */
+struct upipe_mgr *upipe_pktsrc_mgr_alloc(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -36,6 +36,7 @@ extern "C" {
 #endif
 
 #include <upipe/upipe.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 
@@ -51,6 +52,28 @@ enum upipe_udpsink_command {
     UPIPE_UDPSINK_SET_FD,
     /** set remote address (const struct sockaddr *, socklen_t) **/
     UPIPE_UDPSINK_SET_PEER,
+    /** get the batching window (uint64_t *) **/
+    UPIPE_UDPSINK_GET_BATCH_WINDOW,
+    /** set the batching window (uint64_t) **/
+    UPIPE_UDPSINK_SET_BATCH_WINDOW,
+    /** get the batching counters (struct upipe_udpsink_stats *) **/
+    UPIPE_UDPSINK_GET_STATS,
+};
+
+/** number of buckets in the histogram of batch sizes */
+#define UPIPE_UDPSINK_BATCH_BUCKETS 7
+
+/** @This stores the counters of a udp sink in batching mode. */
+struct upipe_udpsink_stats {
+    /** number of send system calls */
+    uint64_t syscalls;
+    /** number of datagrams sent */
+    uint64_t datagrams;
+    /** number of system calls using UDP segmentation offload */
+    uint64_t gso;
+    /** histogram of datagrams per system call, bucket n counts calls
+     * sending between 2^n and 2^(n+1)-1 datagrams */
+    uint64_t batch_sizes[UPIPE_UDPSINK_BATCH_BUCKETS];
 };
 
 /** @This returns the management structure for all udp sinks.
@@ -96,6 +119,48 @@ static inline int upipe_udpsink_set_peer(struct upipe *upipe,
     return upipe_control(upipe, UPIPE_UDPSINK_SET_PEER, UPIPE_UDPSINK_SIGNATURE,
             addr, addrlen);
 }
+
+/** @This returns the batching window.
+ *
+ * @param upipe description structure of the pipe
+ * @param window_p filled in with the window in 27 MHz ticks
+ * @return an error code
+ */
+static inline int upipe_udpsink_get_batch_window(struct upipe *upipe,
+                                                 uint64_t *window_p)
+{
+    return upipe_control(upipe, UPIPE_UDPSINK_GET_BATCH_WINDOW,
+                         UPIPE_UDPSINK_SIGNATURE, window_p);
+}
+
+/** @This sets the batching window. When a packet is due, all held packets
+ * whose deadline falls within the window are sent with a single
+ * sendmmsg(2) system call, or a single UDP segmentation offload send if
+ * they have the same size. This is not supported on all platforms.
+ *
+ * @param upipe description structure of the pipe
+ * @param window window in 27 MHz ticks (0 to disable batching)
+ * @return an error code
+ */
+static inline int upipe_udpsink_set_batch_window(struct upipe *upipe,
+                                                 uint64_t window)
+{
+    return upipe_control(upipe, UPIPE_UDPSINK_SET_BATCH_WINDOW,
+                         UPIPE_UDPSINK_SIGNATURE, window);
+}
+
+/** @This returns the batching counters.
+ *
+ * @param upipe description structure of the pipe
+ * @param stats_p filled in with the counters
+ * @return an error code
+ */
+static inline int upipe_udpsink_get_stats(struct upipe *upipe,
+                                          struct upipe_udpsink_stats *stats_p)
+{
+    return upipe_control(upipe, UPIPE_UDPSINK_GET_STATS,
+                         UPIPE_UDPSINK_SIGNATURE, stats_p);
+}
 #ifdef __cplusplus
 }
 #endif
@@ -47,6 +47,10 @@ enum upipe_udpsrc_command {
     UPIPE_UDPSRC_GET_FD,
     /** set socket fd (int) **/
     UPIPE_UDPSRC_SET_FD,
+    /** get the maximum number of datagrams read per wakeup (unsigned int *) **/
+    UPIPE_UDPSRC_GET_BATCH,
+    /** set the maximum number of datagrams read per wakeup (unsigned int) **/
+    UPIPE_UDPSRC_SET_BATCH,
 };
 
 /** @This extends uprobe_throw with specific events . */
@@ -81,6 +85,35 @@ static inline int upipe_udpsrc_set_fd(struct upipe *upipe, int fd)
                          fd);
 }
 
+/** @This returns the maximum number of datagrams read per wakeup.
+ *
+ * @param upipe description structure of the pipe
+ * @param batch_p filled in with the batch depth
+ * @return an error code
+ */
+static inline int upipe_udpsrc_get_batch(struct upipe *upipe,
+                                         unsigned int *batch_p)
+{
+    return upipe_control(upipe, UPIPE_UDPSRC_GET_BATCH, UPIPE_UDPSRC_SIGNATURE,
+                         batch_p);
+}
+
+/** @This sets the maximum number of datagrams read per wakeup. With a
+ * depth greater than 1, datagrams are received with recvmmsg(2) into
+ * pre-allocated buffers, and cr_sys is taken from the kernel reception
+ * timestamp when available. This is not supported on all platforms.
+ *
+ * @param upipe description structure of the pipe
+ * @param batch batch depth (1 to disable batched reception)
+ * @return an error code
+ */
+static inline int upipe_udpsrc_set_batch(struct upipe *upipe,
+                                         unsigned int batch)
+{
+    return upipe_control(upipe, UPIPE_UDPSRC_SET_BATCH, UPIPE_UDPSRC_SIGNATURE,
+                         batch);
+}
+
 /** @This returns the management structure for all udp socket sources.
  *
  * @return pointer to manager
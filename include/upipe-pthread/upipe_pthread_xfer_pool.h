@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short pool of POSIX threads running event loops, to which pipelines are
+ * transferred
+ *
+ * The pool starts a number of threads, each running its own event loop and
+ * possibly pinned to a CPU, and hands out the transfer manager of the least
+ * loaded thread (see @ref upipe_pthread_xfer_pool_get_mgr). All pipes of a
+ * pipeline must be transferred with the same transfer manager, for instance
+ * by allocating one @ref upipe_work_mgr_alloc per pipeline.
+ */
+
+#ifndef _UPIPE_PTHREAD_UPIPE_PTHREAD_XFER_POOL_H_
+/** @hidden */
+#define _UPIPE_PTHREAD_UPIPE_PTHREAD_XFER_POOL_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <upipe/ubase.h>
+#include <upipe/urefcount.h>
+#include <upipe/uprobe.h>
+#include <upipe/upump.h>
+#include <upipe/upipe.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** @This is a pool of threads running event loops. */
+struct upipe_pthread_xfer_pool {
+    /** pointer to refcount management structure */
+    struct urefcount *refcount;
+};
+
+/** @This increments the reference count of a pool.
+ *
+ * @param pool pointer to pool
+ * @return same pointer to pool
+ */
+static inline struct upipe_pthread_xfer_pool *
+    upipe_pthread_xfer_pool_use(struct upipe_pthread_xfer_pool *pool)
+{
+    if (pool == NULL)
+        return NULL;
+    urefcount_use(pool->refcount);
+    return pool;
+}
+
+/** @This decrements the reference count of a pool or frees it. The threads
+ * exit when all the pipes they run have been released.
+ *
+ * @param pool pointer to pool
+ */
+static inline void
+    upipe_pthread_xfer_pool_release(struct upipe_pthread_xfer_pool *pool)
+{
+    if (pool != NULL)
+        urefcount_release(pool->refcount);
+}
+
+/** @This returns the transfer manager of the least loaded thread of the
+ * pool. The load of a thread is its CPU usage, plus an estimate for the
+ * pipelines handed to it since the last measure. This must always be called
+ * from the same thread.
+ *
+ * @param pool pointer to pool
+ * @return pointer to xfer manager (to be released by the caller)
+ */
+struct upipe_mgr *
+    upipe_pthread_xfer_pool_get_mgr(struct upipe_pthread_xfer_pool *pool);
+
+/** @This returns the load of a thread of the pool.
+ *
+ * @param pool pointer to pool
+ * @param index index of the thread
+ * @param load_p filled in with the CPU usage of the thread during the last
+ * measure, in per mille (may be NULL)
+ * @param assigned_p filled in with the number of transfer managers handed
+ * out for this thread (may be NULL)
+ * @return an error code
+ */
+int upipe_pthread_xfer_pool_get_load(struct upipe_pthread_xfer_pool *pool,
+                                     unsigned int index,
+                                     unsigned int *load_p,
+                                     unsigned int *assigned_p);
+
+/** @This allocates a pool of threads, each running an event loop.
+ *
+ * @param nb_threads number of threads (0 for the number of online CPUs)
+ * @param pin true to pin each thread to a CPU
+ * @param lock true to protect each event loop with a mutex, so that it
+ * may be frozen (see @ref upipe_xfer_mgr_freeze)
+ * @param queue_length maximum length of the internal queue of commands
+ * @param msg_pool_depth maximum number of messages in the pool
+ * @param uprobe_pthread_upump_mgr pointer to optional probe, that will be set
+ * with the created upump_mgr
+ * @param upump_mgr_alloc alloc function provided by the upump manager
+ * @param upump_pool_depth maximum number of upump structures in the pool
+ * @param upump_blocker_pool_depth maximum number of upump_blocker structures in
+ * the pool
+ * @return pointer to pool, or NULL in case of error
+ */
+struct upipe_pthread_xfer_pool *upipe_pthread_xfer_pool_alloc(
+        unsigned int nb_threads, bool pin, bool lock,
+        uint8_t queue_length, uint16_t msg_pool_depth,
+        struct uprobe *uprobe_pthread_upump_mgr,
+        upump_mgr_alloc upump_mgr_alloc, uint16_t upump_pool_depth,
+        uint16_t upump_blocker_pool_depth);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -34,6 +34,22 @@ enum rtp_fec_command {
     UPIPE_RTP_FEC_GET_ROWS,
     /** returns the number of columns (uint64_t *) */
     UPIPE_RTP_FEC_GET_COLUMNS,
+    /** returns the per-matrix statistics (struct upipe_rtp_fec_stats *) */
+    UPIPE_RTP_FEC_GET_STATS,
+};
+
+/** @This stores the per-matrix statistics of a rtp fec pipe. */
+struct upipe_rtp_fec_stats {
+    /** number of matrices output */
+    uint64_t matrices;
+    /** number of matrices in which packets were recovered */
+    uint64_t matrices_recovered;
+    /** number of matrices in which packets could not be recovered */
+    uint64_t matrices_lost;
+    /** highest number of packets recovered in a matrix */
+    uint64_t max_recovered;
+    /** highest number of packets not recovered in a matrix */
+    uint64_t max_lost;
 };
 
 static inline int upipe_rtp_fec_get_rows(struct upipe *upipe,
@@ -64,6 +80,19 @@ static inline int upipe_rtp_fec_get_packets_recovered(struct upipe *upipe,
             UPIPE_RTP_FEC_SIGNATURE, recovered);
 }
 
+/** @This returns the per-matrix statistics, and resets them.
+ *
+ * @param upipe description structure of the pipe
+ * @param stats_p filled in with the statistics
+ * @return an error code
+ */
+static inline int upipe_rtp_fec_get_stats(struct upipe *upipe,
+                                          struct upipe_rtp_fec_stats *stats_p)
+{
+    return upipe_control(upipe, UPIPE_RTP_FEC_GET_STATS,
+                         UPIPE_RTP_FEC_SIGNATURE, stats_p);
+}
+
 /** @This returns the pic subpipe. The refcount is not incremented so you
  * have to use it if you want to keep the pointer.
  *
@@ -122,6 +122,13 @@ enum upipe_ts_demux_mgr_command {
 
     UPIPE_TS_DEMUX_MGR_GET_SET_MGR(autof, AUTOF)
 #undef UPIPE_TS_DEMUX_MGR_GET_SET_MGR
+
+    /** returns the number of worker threads for program outputs
+     * (unsigned int *) */
+    UPIPE_TS_DEMUX_MGR_GET_WORKERS,
+    /** sets the worker managers for program outputs
+     * (struct upipe_mgr **, unsigned int, struct uprobe *) */
+    UPIPE_TS_DEMUX_MGR_SET_WORKERS,
 };
 
 /** @hidden */
@@ -176,6 +183,48 @@ UPIPE_TS_DEMUX_MGR_GET_SET_MGR2(ts_scte35d, TS_SCTE35D)
 UPIPE_TS_DEMUX_MGR_GET_SET_MGR2(autof, AUTOF)
 #undef UPIPE_TS_DEMUX_MGR_GET_SET_MGR2
 
+/** @This returns the number of worker threads program outputs are
+ * distributed on.
+ *
+ * @param mgr pointer to manager
+ * @param nb_workers_p filled in with the number of workers (0 if the outputs
+ * run in the thread of the demux)
+ * @return an error code
+ */
+static inline int upipe_ts_demux_mgr_get_workers(struct upipe_mgr *mgr,
+                                                 unsigned int *nb_workers_p)
+{
+    return upipe_mgr_control(mgr, UPIPE_TS_DEMUX_MGR_GET_WORKERS,
+                             UPIPE_TS_DEMUX_SIGNATURE, nb_workers_p);
+}
+
+/** @This sets the worker managers program outputs are distributed on. Each
+ * program is assigned a worker in a round-robin fashion, and the framers of
+ * its outputs then run in the thread of this worker, while ts_split, PSI
+ * tables, PCRs and PES decapsulation (and therefore clock_ref and clock_ts
+ * events) stay in the thread of the demux. PES are assembled before being
+ * queued, so that each transfer carries a whole PES. This only has an effect
+ * when an autof manager is set, and may only be called before any pipe has
+ * been allocated.
+ *
+ * @param mgr pointer to manager
+ * @param worker_mgrs array of upipe_wlin managers, one per thread
+ * @param nb_workers number of managers in the array (0 to disable)
+ * @param uprobe_remote probe hierarchy for the framers and the remote end of
+ * the queues, which must be usable from the worker threads and answer their
+ * requests
+ * @return an error code
+ */
+static inline int upipe_ts_demux_mgr_set_workers(struct upipe_mgr *mgr,
+                                                 struct upipe_mgr **worker_mgrs,
+                                                 unsigned int nb_workers,
+                                                 struct uprobe *uprobe_remote)
+{
+    return upipe_mgr_control(mgr, UPIPE_TS_DEMUX_MGR_SET_WORKERS,
+                             UPIPE_TS_DEMUX_SIGNATURE, worker_mgrs,
+                             nb_workers, uprobe_remote);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -34,6 +34,49 @@ extern "C" {
 
 #define UPIPE_TS_EITD_SIGNATURE UBASE_FOURCC('t','s',0x4e,'d')
 
+/** @This extends upipe_command with specific commands for ts_eitd. */
+enum upipe_ts_eitd_command {
+    UPIPE_TS_EITD_SENTINEL = UPIPE_CONTROL_LOCAL,
+
+    /** returns the maximum number of events exported (unsigned int *) */
+    UPIPE_TS_EITD_GET_MAX_EVENTS,
+    /** sets the maximum number of events exported (unsigned int) */
+    UPIPE_TS_EITD_SET_MAX_EVENTS
+};
+
+/** @This returns the maximum number of events exported in the flow
+ * definition.
+ *
+ * @param upipe description structure of the pipe
+ * @param max_events_p filled in with the maximum number of events (0 for
+ * no limit)
+ * @return an error code
+ */
+static inline int upipe_ts_eitd_get_max_events(struct upipe *upipe,
+                                               unsigned int *max_events_p)
+{
+    return upipe_control(upipe, UPIPE_TS_EITD_GET_MAX_EVENTS,
+                         UPIPE_TS_EITD_SIGNATURE, max_events_p);
+}
+
+/** @This sets the maximum number of events exported in the flow definition.
+ * Events are taken in the order of the sections, so that the events furthest
+ * in the future of a large schedule are ignored. This bounds the size of the
+ * flow definition and of the index of exported events, but not the sections
+ * of the table, which are kept whole to detect its changes. It takes effect
+ * at the next version of the table.
+ *
+ * @param upipe description structure of the pipe
+ * @param max_events maximum number of events (0 for no limit)
+ * @return an error code
+ */
+static inline int upipe_ts_eitd_set_max_events(struct upipe *upipe,
+                                               unsigned int max_events)
+{
+    return upipe_control(upipe, UPIPE_TS_EITD_SET_MAX_EVENTS,
+                         UPIPE_TS_EITD_SIGNATURE, max_events);
+}
+
 /** @This returns the management structure for all ts_eitd pipes.
  *
  * @return pointer to manager
@@ -158,6 +158,10 @@ enum upipe_ts_mux_command {
     /** prepares the next access unit/section for the given date
      * (uint64_t, uint64_t) */
     UPIPE_TS_MUX_PREPARE,
+    /** returns the current bulk output size (unsigned int *) */
+    UPIPE_TS_MUX_GET_BULK_SIZE,
+    /** sets the bulk output size (unsigned int) */
+    UPIPE_TS_MUX_SET_BULK_SIZE,
 
     /** ts_encaps commands begin here */
     UPIPE_TS_MUX_ENCAPS = UPIPE_CONTROL_LOCAL + 0x1000,
@@ -712,6 +716,41 @@ static inline int upipe_ts_mux_prepare(struct upipe *upipe, uint64_t cr_sys,
                                UPIPE_TS_MUX_SIGNATURE, cr_sys, latency);
 }
 
+/** @This returns the current bulk output size.
+ *
+ * @param upipe description structure of the pipe
+ * @param bulk_size_p filled in with the size of output blocks in bulk mode,
+ * or 0 if bulk mode is disabled
+ * @return an error code
+ */
+static inline int upipe_ts_mux_get_bulk_size(struct upipe *upipe,
+                                             unsigned int *bulk_size_p)
+{
+    return upipe_control(upipe, UPIPE_TS_MUX_GET_BULK_SIZE,
+                         UPIPE_TS_MUX_SIGNATURE, bulk_size_p);
+}
+
+/** @This sets the bulk output size. In bulk mode, consecutive output
+ * packets (of the configured output size) are gathered into contiguous,
+ * page-aligned blocks of the given size, which is rounded up to a multiple
+ * of both the output size and the page size. Each block carries the size of
+ * the output packets and the cr_sys of each of them as a side table (see
+ * @ref uref_block_get_chunk_delay), so that network sinks may still pace
+ * individual datagrams. This is intended for file mode, as a block is only
+ * output once it is full, or when an input is flushed or reaches the end of
+ * its stream.
+ *
+ * @param upipe description structure of the pipe
+ * @param bulk_size size of output blocks, or 0 to disable bulk mode
+ * @return an error code
+ */
+static inline int upipe_ts_mux_set_bulk_size(struct upipe *upipe,
+                                             unsigned int bulk_size)
+{
+    return upipe_control(upipe, UPIPE_TS_MUX_SET_BULK_SIZE,
+                         UPIPE_TS_MUX_SIGNATURE, bulk_size);
+}
+
 /** @This returns a description string for local commands.
  *
  * @param cmd control command
@@ -33,12 +33,58 @@ extern "C" {
 
 #define UPIPE_TS_PESD_SIGNATURE UBASE_FOURCC('t','s','p','d')
 
+/** @This extends upipe_command with specific commands for ts pesd. */
+enum upipe_ts_pesd_command {
+    UPIPE_TS_PESD_SENTINEL = UPIPE_CONTROL_LOCAL,
+
+    /** returns true if PES are assembled before being output (int *) */
+    UPIPE_TS_PESD_GET_ASSEMBLE,
+    /** sets whether PES are assembled before being output (int) */
+    UPIPE_TS_PESD_SET_ASSEMBLE
+};
+
 /** @This returns the management structure for all ts_pesd pipes.
  *
  * @return pointer to manager
  */
 struct upipe_mgr *upipe_ts_pesd_mgr_alloc(void);
 
+/** @This returns whether PES are assembled before being output.
+ *
+ * @param upipe description structure of the pipe
+ * @param assemble_p filled in with true if PES are assembled
+ * @return an error code
+ */
+static inline int upipe_ts_pesd_get_assemble(struct upipe *upipe,
+                                             bool *assemble_p)
+{
+    int assemble;
+    UBASE_RETURN(upipe_control(upipe, UPIPE_TS_PESD_GET_ASSEMBLE,
+                               UPIPE_TS_PESD_SIGNATURE, &assemble))
+    *assemble_p = !!assemble;
+    return UBASE_ERR_NONE;
+}
+
+/** @This sets whether PES are assembled before being output. By default,
+ * the payload of each TS packet is output as soon as it is received. When
+ * PES are assembled, the payloads of a PES are chained into the block of a
+ * single uref without being copied, and the uref is output once the PES is
+ * complete (or when the next PES starts, if the PES length is unbounded).
+ * The attributes of the output uref are those of the first TS packet.
+ * Receivers needing linear access may then use @ref uref_block_linearize
+ * once.
+ *
+ * @param upipe description structure of the pipe
+ * @param assemble true if PES are to be assembled
+ * @return an error code
+ */
+static inline int upipe_ts_pesd_set_assemble(struct upipe *upipe,
+                                             bool assemble)
+{
+    return upipe_control(upipe, UPIPE_TS_PESD_SET_ASSEMBLE,
+                         UPIPE_TS_PESD_SIGNATURE, assemble ? 1 : 0);
+}
+
 #ifdef __cplusplus
 }
 #endif
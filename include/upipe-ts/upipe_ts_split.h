@@ -20,6 +20,12 @@
 
 /** @file
  * @short Upipe module splitting PIDs of a transport stream
+ *
+ * The input may either be single TS packets (block.mpegts.) or runs of
+ * aligned TS packets (block.mpegtsaligned.). In the latter case, the runs
+ * are sliced without copying; outputs whose flow definition is
+ * block.mpegtsaligned. receive consecutive packets of their PID in a single
+ * buffer, other outputs receive one buffer per packet.
  */
 
 #ifndef _UPIPE_TS_UPIPE_TS_SPLIT_H_
@@ -29,6 +29,10 @@
  * @item 196 @item TS packet followed by an 8-octet timestamp or checksum
  * @item 204 @item TS packet followed by a 16-octet checksum
  * @end table
+ *
+ * With standard TS size, the pipe may be configured with
+ * @ref upipe_ts_sync_set_batch to output runs of consecutive TS packets in a
+ * single buffer (block.mpegtsaligned.), instead of one buffer per packet.
  */
 
 #ifndef _UPIPE_TS_UPIPE_TS_SYNC_H_
@@ -49,7 +53,12 @@ enum upipe_ts_sync_command {
     /** returns the configured number of packets to synchronize with (int *) */
     UPIPE_TS_SYNC_GET_SYNC,
     /** sets the configured number of packets to synchronize with (int) */
-    UPIPE_TS_SYNC_SET_SYNC
+    UPIPE_TS_SYNC_SET_SYNC,
+    /** returns the maximum number of packets per output buffer
+     * (unsigned int *) */
+    UPIPE_TS_SYNC_GET_BATCH,
+    /** sets the maximum number of packets per output buffer (unsigned int) */
+    UPIPE_TS_SYNC_SET_BATCH
 };
 
 /** @This returns the management structure for all ts_sync pipes.
@@ -84,6 +93,40 @@ static inline int upipe_ts_sync_set_sync(struct upipe *upipe, int sync)
                          sync);
 }
 
+/** @This returns the maximum number of TS packets per output buffer.
+ *
+ * @param upipe description structure of the pipe
+ * @param batch_p filled in with number of packets
+ * @return an error code
+ */
+static inline int upipe_ts_sync_get_batch(struct upipe *upipe,
+                                          unsigned int *batch_p)
+{
+    return upipe_control(upipe, UPIPE_TS_SYNC_GET_BATCH,
+                         UPIPE_TS_SYNC_SIGNATURE, batch_p);
+}
+
+/** @This sets the maximum number of TS packets per output buffer. With a
+ * value greater than 1 (the default), consecutive synchronized TS packets are
+ * output in a single buffer, and the output flow definition is
+ * block.mpegtsaligned. This is only supported with standard TS size.
+ *
+ * Only the pipes accepting block.mpegtsaligned. (such as ts_split) benefit
+ * from it. ts_demux does not enable it for its inner ts_sync, as its inner
+ * setrap pipe dates random access points per buffer, and packets following
+ * a PAT in the same run would be tagged with the previous one.
+ *
+ * @param upipe description structure of the pipe
+ * @param batch number of packets
+ * @return an error code
+ */
+static inline int upipe_ts_sync_set_batch(struct upipe *upipe,
+                                          unsigned int batch)
+{
+    return upipe_control(upipe, UPIPE_TS_SYNC_SET_BATCH,
+                         UPIPE_TS_SYNC_SIGNATURE, batch);
+}
+
 #ifdef __cplusplus
 }
 #endif
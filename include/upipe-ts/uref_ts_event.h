@@ -51,6 +51,53 @@ UREF_ATTR_UNSIGNED_VA(ts_event, descriptors, "te.descs[%" PRIu64"]",
 UREF_TS_ATTR_SUBDESCRIPTOR(ts_event, descriptor,
         "te.desc[%" PRIu64"][%" PRIu64"]")
 
+/** @internal @This copies an event from a flow def to another.
+ *
+ * @param uref1 destination flow definition
+ * @param event1 event number in the destination
+ * @param uref2 source flow definition
+ * @param event2 event number in the source
+ */
+static inline void uref_ts_event_copy(struct uref *uref1, uint64_t event1,
+                                      struct uref *uref2, uint64_t event2)
+{
+    uint64_t tmp;
+    if (ubase_check(uref_event_get_id(uref2, &tmp, event2)))
+        uref_event_set_id(uref1, tmp, event1);
+    if (ubase_check(uref_event_get_start(uref2, &tmp, event2)))
+        uref_event_set_start(uref1, tmp, event1);
+    if (ubase_check(uref_event_get_duration(uref2, &tmp, event2)))
+        uref_event_set_duration(uref1, tmp, event1);
+
+    const char *str;
+    if (ubase_check(uref_event_get_language(uref2, &str, event2)))
+        uref_event_set_language(uref1, str, event1);
+    if (ubase_check(uref_event_get_name(uref2, &str, event2)))
+        uref_event_set_name(uref1, str, event1);
+    if (ubase_check(uref_event_get_description(uref2, &str, event2)))
+        uref_event_set_description(uref1, str, event1);
+
+    uint8_t small;
+    if (ubase_check(uref_ts_event_get_running_status(uref2, &small, event2)))
+        uref_ts_event_set_running_status(uref1, small, event1);
+
+    if (ubase_check(uref_ts_event_get_scrambled(uref2, event2)))
+        uref_ts_event_set_scrambled(uref1, event1);
+
+    uint64_t descriptors = 0;
+    if (ubase_check(uref_ts_event_get_descriptors(uref2, &descriptors,
+                                                  event2)))
+        uref_ts_event_set_descriptors(uref1, descriptors, event1);
+
+    for (uint64_t descriptor = 0; descriptor < descriptors; descriptor++) {
+        const uint8_t *p;
+        size_t size;
+        if (ubase_check(uref_ts_event_get_descriptor(uref2, &p, &size,
+                                                     event2, descriptor)))
+            uref_ts_event_set_descriptor(uref1, p, size, event1, descriptor);
+    }
+}
+
 /** @internal @This imports events into a flow def.
  *
  * @param uref1 output flow definition
@@ -64,42 +111,7 @@ static int uref_ts_event_import(struct uref *uref1, struct uref *uref2,
     UBASE_RETURN(uref_event_get_events(uref2, &events))
 
     for (uint64_t event = 0; event < events; event++) {
-        uint64_t tmp;
-        if (ubase_check(uref_event_get_id(uref2, &tmp, event)))
-            uref_event_set_id(uref1, tmp, *event_p);
-        if (ubase_check(uref_event_get_start(uref2, &tmp, event)))
-            uref_event_set_start(uref1, tmp, *event_p);
-        if (ubase_check(uref_event_get_duration(uref2, &tmp, event)))
-            uref_event_set_duration(uref1, tmp, *event_p);
-
-        const char *str;
-        if (ubase_check(uref_event_get_language(uref2, &str, event)))
-            uref_event_set_language(uref1, str, *event_p);
-        if (ubase_check(uref_event_get_name(uref2, &str, event)))
-            uref_event_set_name(uref1, str, *event_p);
-        if (ubase_check(uref_event_get_description(uref2, &str, event)))
-            uref_event_set_description(uref1, str, *event_p);
-
-        uint8_t small;
-        if (ubase_check(uref_ts_event_get_running_status(uref2, &small, event)))
-            uref_ts_event_set_running_status(uref1, small, *event_p);
-
-        if (ubase_check(uref_ts_event_get_scrambled(uref2, event)))
-            uref_ts_event_set_scrambled(uref1, *event_p);
-
-        uint64_t descriptors = 0;
-        if (ubase_check(uref_ts_event_get_descriptors(uref2, &descriptors, event)))
-            uref_ts_event_set_descriptors(uref1, descriptors, *event_p);
-
-        for (uint64_t descriptor = 0; descriptor < descriptors; descriptor++) {
-            const uint8_t *p;
-            size_t size;
-            if (ubase_check(uref_ts_event_get_descriptor(uref2, &p, &size,
-                                                         event, descriptor)))
-                uref_ts_event_set_descriptor(uref1, p, size,
-                                             *event_p, descriptor);
-        }
-
+        uref_ts_event_copy(uref1, *event_p, uref2, event);
         (*event_p)++;
     }
 
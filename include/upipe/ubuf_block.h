@@ -917,6 +917,26 @@ static inline int ubuf_block_merge(struct ubuf_mgr *mgr, struct ubuf **ubuf_p,
     return UBASE_ERR_NONE;
 }
 
+/** @This makes sure a block ubuf is not segmented. If it is, all segments
+ * are copied to a newly allocated ubuf in a single pass, which replaces the
+ * old ubuf. Unlike @ref ubuf_block_merge, nothing is copied if the ubuf is
+ * already linear, so it may be called each time linear access is needed.
+ *
+ * @param mgr management structure for this ubuf type
+ * @param ubuf_p reference to a pointer to ubuf to replace with a
+ * non-segmented block ubuf if needed
+ * @return an error code
+ */
+static inline int ubuf_block_linearize(struct ubuf_mgr *mgr,
+                                       struct ubuf **ubuf_p)
+{
+    if (unlikely((*ubuf_p)->mgr->signature != UBUF_ALLOC_BLOCK))
+        return UBASE_ERR_INVALID;
+    if (ubuf_block_from_ubuf(*ubuf_p)->next_ubuf == NULL)
+        return UBASE_ERR_NONE;
+    return ubuf_block_merge(mgr, ubuf_p, 0, -1);
+}
+
 /** @This allocates a new ubuf and copies data from an opaque pointer to it.
  *
  * @param mgr management structure for this ubuf type
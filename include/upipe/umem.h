@@ -39,6 +39,7 @@ extern "C" {
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdarg.h>
 #include <assert.h>
 
 /** @hidden */
@@ -80,6 +81,13 @@ static inline size_t umem_size(struct umem *umem)
     return umem->size;
 }
 
+/** @This defines standard commands which umem managers may implement. */
+enum umem_mgr_command {
+    /** non-standard commands implemented by a umem manager can start from
+     * there (first arg = signature) */
+    UMEM_MGR_CONTROL_LOCAL = 0x8000
+};
+
 /** @This defines a memory allocator management structure.
  */
 struct umem_mgr {
@@ -95,6 +103,9 @@ struct umem_mgr {
 
     /** function to release all buffers kept in pools */
     void (*umem_mgr_vacuum)(struct umem_mgr *);
+    /** control function for standard or local manager commands - all
+     * parameters belong to the caller */
+    int (*umem_mgr_control)(struct umem_mgr *, int, va_list);
 };
 
 /** @This allocates a new umem buffer space.
@@ -151,6 +162,42 @@ static inline void umem_mgr_vacuum(struct umem_mgr *mgr)
         mgr->umem_mgr_vacuum(mgr);
 }
 
+/** @internal @This sends a control command to the umem manager. Note that all
+ * arguments are owned by the caller.
+ *
+ * @param mgr pointer to umem manager
+ * @param command manager control command to send
+ * @param args optional read or write parameters
+ * @return an error code
+ */
+static inline int umem_mgr_control_va(struct umem_mgr *mgr,
+                                      int command, va_list args)
+{
+    assert(mgr != NULL);
+    if (mgr->umem_mgr_control == NULL)
+        return UBASE_ERR_UNHANDLED;
+
+    return mgr->umem_mgr_control(mgr, command, args);
+}
+
+/** @internal @This sends a control command to the umem manager. Note that all
+ * arguments are owned by the caller.
+ *
+ * @param mgr pointer to umem manager
+ * @param command manager control command to send, followed by optional read
+ * or write parameters
+ * @return an error code
+ */
+static inline int umem_mgr_control(struct umem_mgr *mgr, int command, ...)
+{
+    int err;
+    va_list args;
+    va_start(args, command);
+    err = umem_mgr_control_va(mgr, command, args);
+    va_end(args);
+    return err;
+}
+
 /** @This increments the reference count of a umem manager.
  *
  * @param mgr pointer to umem manager
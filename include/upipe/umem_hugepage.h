@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short Upipe memory allocator using huge-page arenas
+ * This memory allocator reserves an arena of memory at allocation time,
+ * preferably backed by 2 MB huge pages and bound to a NUMA node, and carves
+ * buffers out of it in power of 2's sizes. Released buffers are kept in
+ * pools for reuse. Small buffers, and buffers which do not fit in the arena
+ * anymore, are allocated with malloc().
+ *
+ * A manager is meant to be used by the pipes running on a given NUMA node,
+ * so an application would allocate one manager per node, and give each
+ * worker thread the manager of its node.
+ */
+
+#ifndef _UPIPE_UMEM_HUGEPAGE_H_
+/** @hidden */
+#define _UPIPE_UMEM_HUGEPAGE_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <upipe/umem.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define UMEM_HUGEPAGE_SIGNATURE UBASE_FOURCC('h','u','g','e')
+
+/** @This describes the usage of the arena of a manager. */
+struct umem_hugepage_usage {
+    /** size of the arena, in octets */
+    size_t arena_size;
+    /** octets of the arena carved into buffers */
+    size_t arena_used;
+    /** octets of the arena in buffers currently allocated */
+    size_t arena_busy;
+    /** number of allocations served by malloc() */
+    uint64_t fallbacks;
+    /** true if the arena is backed by explicit huge pages (hugetlbfs) */
+    bool hugetlb;
+    /** NUMA node the arena is bound to, or -1 */
+    int node;
+};
+
+/** @This extends umem_mgr_command with specific commands. */
+enum umem_hugepage_mgr_command {
+    UMEM_HUGEPAGE_MGR_SENTINEL = UMEM_MGR_CONTROL_LOCAL,
+
+    /** returns the usage of the arena (struct umem_hugepage_usage *) */
+    UMEM_HUGEPAGE_MGR_GET_USAGE
+};
+
+/** @This returns the usage of the arena of a manager.
+ *
+ * @param mgr pointer to umem manager
+ * @param usage_p filled in with the usage of the arena
+ * @return an error code
+ */
+static inline int umem_hugepage_mgr_get_usage(struct umem_mgr *mgr,
+        struct umem_hugepage_usage *usage_p)
+{
+    return umem_mgr_control(mgr, UMEM_HUGEPAGE_MGR_GET_USAGE,
+                            UMEM_HUGEPAGE_SIGNATURE, usage_p);
+}
+
+/** @This allocates a new instance of the huge-page umem manager. If huge
+ * pages are not available, the arena is allocated with regular pages.
+ *
+ * @param arena_size size of the arena to reserve, rounded up to a multiple of
+ * 2 MB
+ * @param node NUMA node to bind the arena to, or -1 for the node of the
+ * calling thread
+ * @return pointer to manager, or NULL in case of error
+ */
+struct umem_mgr *umem_hugepage_mgr_alloc(size_t arena_size, int node);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -25,6 +25,12 @@
 
 /** @file
  * @short Upipe pool of buffers, based on @ref ulifo
+ *
+ * Optionally (see @ref upool_cache_init), each thread keeps a private cache
+ * of free elements, organized in magazines of @ref UPOOL_MAGAZINE_SIZE
+ * elements, and exchanges full and empty magazines with a depot shared by
+ * all threads. This avoids contention on the shared LIFO when elements are
+ * allocated in a thread and freed in another.
  */
 
 #ifndef _UPIPE_UPOOL_H_
@@ -38,8 +44,16 @@ extern "C" {
 #include <upipe/urefcount.h>
 #include <upipe/ulifo.h>
 
+#include <stdint.h>
+#include <stdbool.h>
+
+/** number of elements in a magazine */
+#define UPOOL_MAGAZINE_SIZE 16
+
 /** @hidden */
 struct upool;
+/** @hidden */
+struct upool_depot;
 
 /** @This is a call-back to allocate new elements */
 typedef void *(*upool_alloc_cb)(struct upool *);
@@ -56,6 +70,22 @@ struct upool {
     upool_alloc_cb alloc_cb;
     /** call-back to release unused elements */
     upool_free_cb free_cb;
+    /** depot of magazines, or NULL if per-thread caches are disabled */
+    struct upool_depot *depot;
+};
+
+/** @This holds the counters of the per-thread caches of a upool. */
+struct upool_stats {
+    /** allocations and releases served by the cache of the thread */
+    uint64_t local_hits;
+    /** elements taken from the depot in full magazines */
+    uint64_t depot_allocs;
+    /** elements handed over to the depot in full magazines, typically
+     * because they were released by a thread which did not allocate them */
+    uint64_t remote_frees;
+    /** elements returned to the shared LIFO, or freed, because the depot
+     * was full */
+    uint64_t spills;
 };
 
 /** @This returns the required size of extra data space for upool.
@@ -81,8 +111,61 @@ static inline void upool_init(struct upool *upool, struct urefcount *refcount,
     ulifo_init(&upool->lifo, length, extra);
     upool->alloc_cb = alloc_cb;
     upool->free_cb = free_cb;
+    upool->depot = NULL;
 }
 
+/** @This enables per-thread caches on a upool. It must be called after
+ * @ref upool_init and before any allocation. Besides the elements kept in
+ * the shared LIFO and in the depot, each thread using the pool may keep up
+ * to 2 * @ref UPOOL_MAGAZINE_SIZE unused elements, which are handed back
+ * to the depot when the thread exits, and released by @ref upool_clean.
+ *
+ * @param upool pointer to a upool structure
+ * @return an error code (the pool keeps working without caches in case of
+ * error)
+ */
+int upool_cache_init(struct upool *upool);
+
+/** @internal @This allocates an element from the cache of the current
+ * thread.
+ *
+ * @param upool pointer to a upool structure
+ * @return allocated element, or NULL if the cache and depot are empty
+ */
+void *upool_cache_pop(struct upool *upool);
+
+/** @internal @This returns an element to the cache of the current thread.
+ *
+ * @param upool pointer to a upool structure
+ * @param obj element to free
+ * @return false if the element couldn't be cached
+ */
+bool upool_cache_push(struct upool *upool, void *obj);
+
+/** @internal @This releases all the elements kept in the depot and in the
+ * cache of the current thread.
+ *
+ * @param upool pointer to a upool structure
+ */
+void upool_cache_vacuum(struct upool *upool);
+
+/** @internal @This releases all the elements kept in the caches of all
+ * threads, and frees the depot. No other thread may use the pool.
+ *
+ * @param upool pointer to a upool structure
+ */
+void upool_cache_clean(struct upool *upool);
+
+/** @This returns the counters of the per-thread caches of a upool. The
+ * counters of other threads are read without synchronization, so they may
+ * be slightly outdated.
+ *
+ * @param upool pointer to a upool structure
+ * @param stats filled in with the counters
+ * @return an error code
+ */
+int upool_get_stats(struct upool *upool, struct upool_stats *stats);
+
 /** @This increments the reference count of a upool.
  *
  * @param upool pointer to upool
@@ -113,7 +196,11 @@ static inline void upool_release(struct upool *upool)
  */
 static inline void *upool_alloc_internal(struct upool *upool)
 {
-    void *obj = ulifo_pop(&upool->lifo, void *);
+    void *obj = NULL;
+    if (upool->depot != NULL)
+        obj = upool_cache_pop(upool);
+    if (obj == NULL)
+        obj = ulifo_pop(&upool->lifo, void *);
     if (unlikely(obj == NULL))
         obj = upool->alloc_cb(upool);
     if (obj != NULL)
@@ -136,8 +223,10 @@ static inline void *upool_alloc_internal(struct upool *upool)
  */
 static inline void upool_free(struct upool *upool, void *obj)
 {
-    if (unlikely(!ulifo_push(&upool->lifo, obj)))
-        upool->free_cb(upool, obj);
+    if (upool->depot == NULL || unlikely(!upool_cache_push(upool, obj))) {
+        if (unlikely(!ulifo_push(&upool->lifo, obj)))
+            upool->free_cb(upool, obj);
+    }
     upool_release(upool);
 }
 
@@ -148,6 +237,8 @@ static inline void upool_free(struct upool *upool, void *obj)
 static inline void upool_vacuum(struct upool *upool)
 {
     void *obj;
+    if (upool->depot != NULL)
+        upool_cache_vacuum(upool);
     while ((obj = ulifo_pop(&upool->lifo, void *)) != NULL) {
         upool->free_cb(upool, obj);
         upool_release(upool);
@@ -160,6 +251,8 @@ static inline void upool_vacuum(struct upool *upool)
  */
 static inline void upool_clean(struct upool *upool)
 {
+    if (upool->depot != NULL)
+        upool_cache_clean(upool);
     upool_vacuum(upool);
     ulifo_clean(&upool->lifo);
 }
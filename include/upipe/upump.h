@@ -131,6 +131,8 @@ enum upump_mgr_command {
     UPUMP_MGR_RUN,
     /** release all buffers kept in pools (void) */
     UPUMP_MGR_VACUUM,
+    /** set the resolution of the timer wheel (uint64_t) */
+    UPUMP_MGR_SET_TIMER_TICK,
 
     /** non-standard manager commands implemented by a upump handler can start
      * from there (first arg = signature) */
@@ -504,6 +506,23 @@ static inline int upump_mgr_vacuum(struct upump_mgr *mgr)
     return upump_mgr_control(mgr, UPUMP_MGR_VACUUM);
 }
 
+/** @This sets the resolution of the timer wheel of a upump manager. Timers
+ * allocated afterwards are then rounded up to the next tick, and all timers
+ * expiring in the same tick are triggered by a single timer of the event
+ * loop, which makes the cost of arming a timer independent of the number of
+ * armed timers.
+ *
+ * @param mgr pointer to upump manager
+ * @param tick resolution of the wheel, in ticks of a 27 MHz monotonic clock
+ * (0 to disable the wheel for new timers)
+ * @return an error code
+ */
+static inline int upump_mgr_set_timer_tick(struct upump_mgr *mgr,
+                                           uint64_t tick)
+{
+    return upump_mgr_control(mgr, UPUMP_MGR_SET_TIMER_TICK, tick);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -44,6 +44,8 @@ extern "C" {
 
 /** @hidden */
 struct upump_blocker;
+/** @hidden */
+struct upump_common_wheel;
 
 /** @This stores upump parameters invisible from modules but usually common.
  */
@@ -55,6 +57,21 @@ struct upump_common {
     /** list of blockers registered on this pump */
     struct uchain blockers;
 
+    /** true if the pump is a timer handled by the timer wheel */
+    bool wheel;
+    /** true if the timer is armed in the wheel */
+    bool wheel_armed;
+    /** true if the timer was armed as blocking */
+    bool wheel_status;
+    /** timer delay before the first trigger, in 27 MHz ticks */
+    uint64_t wheel_after;
+    /** timer repeat period, in 27 MHz ticks */
+    uint64_t wheel_repeat;
+    /** expiry of the timer, in ticks of the wheel */
+    uint64_t wheel_expiry;
+    /** structure for the lists of the wheel */
+    struct uchain wheel_uchain;
+
     /** public upump structure */
     struct upump upump;
 };
@@ -80,6 +97,19 @@ void upump_common_blocker_free(struct upump_blocker *blocker);
  */
 void upump_common_init(struct upump *upump);
 
+/** @This initializes the common part of a timer pump, and hands it over to
+ * the timer wheel if it is enabled. This must be called after
+ * @ref upump_common_init.
+ *
+ * @param upump description structure of the pump
+ * @param after time after which it triggers, in 27 MHz ticks
+ * @param repeat repeat period, in 27 MHz ticks (0 to disable)
+ * @return true if the timer is handled by the wheel, in which case the
+ * manager must not set up a timer of the event loop
+ */
+bool upump_common_init_timer(struct upump *upump,
+                             uint64_t after, uint64_t repeat);
+
 /** @This dispatches a pump.
  *
  * @param upump description structure of the pump
@@ -132,6 +162,9 @@ struct upump_common_mgr {
     /** function to really stop a watcher */
     void (*upump_real_stop)(struct upump *, bool);
 
+    /** timer wheel, or NULL */
+    struct upump_common_wheel *wheel;
+
     /** structure exported to modules */
     struct upump_mgr mgr;
 };
@@ -148,6 +181,16 @@ UBASE_FROM_TO(upump_common_mgr, upool, upump_blocker_pool, upump_blocker_pool)
  */
 void upump_common_mgr_vacuum(struct upump_mgr *mgr);
 
+/** @This sets the resolution of the timer wheel. Only timers allocated
+ * afterwards are affected.
+ *
+ * @param mgr pointer to a upump_mgr structure wrapped into a
+ * upump_common_mgr structure
+ * @param tick resolution of the wheel, in 27 MHz ticks (0 to disable)
+ * @return an error code
+ */
+int upump_common_mgr_set_timer_tick(struct upump_mgr *mgr, uint64_t tick);
+
 /** @This returns the extra buffer space needed for pools.
  *
  * @param upump_pool_depth maximum number of upump structures in the pool
@@ -46,6 +46,69 @@ extern "C" {
 UREF_ATTR_VOID_UREF(block, start, UREF_FLAG_BLOCK_START, start of logical block)
 UREF_ATTR_VOID_UREF(block, end, UREF_FLAG_BLOCK_END, end of logical block)
 UREF_ATTR_UNSIGNED(block, header_size, "b.header", global headers size)
+UREF_ATTR_UNSIGNED(block, chunk_size, "b.chunk",
+        size of the chunks of a bulk block)
+UREF_ATTR_OPAQUE(block, chunk_delays, "b.chunk_delays",
+        delays of the chunks of a bulk block)
+
+/** @This returns the number of chunks of a bulk block, that is a block
+ * gathering several consecutive packets (chunks) of the same size.
+ *
+ * @param uref pointer to the uref
+ * @param nb_chunks_p filled in with the number of chunks
+ * @return an error code
+ */
+static inline int uref_block_get_chunks(struct uref *uref,
+                                        unsigned int *nb_chunks_p)
+{
+    const uint8_t *delays;
+    size_t size;
+    UBASE_RETURN(uref_block_get_chunk_delays(uref, &delays, &size))
+    *nb_chunks_p = size / 4;
+    return UBASE_ERR_NONE;
+}
+
+/** @This returns the delay of a chunk of a bulk block, relative to the
+ * cr_sys of the block.
+ *
+ * @param uref pointer to the uref
+ * @param chunk index of the chunk
+ * @param delay_p filled in with the delay, in 27 MHz units
+ * @return an error code
+ */
+static inline int uref_block_get_chunk_delay(struct uref *uref,
+                                             unsigned int chunk,
+                                             uint64_t *delay_p)
+{
+    const uint8_t *delays;
+    size_t size;
+    UBASE_RETURN(uref_block_get_chunk_delays(uref, &delays, &size))
+    if (unlikely((chunk + 1) * 4 > size))
+        return UBASE_ERR_INVALID;
+    delays += chunk * 4;
+    *delay_p = ((uint64_t)delays[0] << 24) | (delays[1] << 16) |
+               (delays[2] << 8) | delays[3];
+    return UBASE_ERR_NONE;
+}
+
+/** @This writes the delay of a chunk to a side table, in the format of the
+ * chunk_delays attribute.
+ *
+ * @param delays side table, 4 octets per chunk
+ * @param chunk index of the chunk
+ * @param delay delay of the chunk relative to the block, in 27 MHz units
+ * (lower than 2^32)
+ */
+static inline void uref_block_set_chunk_delay(uint8_t *delays,
+                                              unsigned int chunk,
+                                              uint64_t delay)
+{
+    delays += chunk * 4;
+    delays[0] = delay >> 24;
+    delays[1] = delay >> 16;
+    delays[2] = delay >> 8;
+    delays[3] = delay;
+}
 
 /** @This returns a new uref pointing to a new ubuf pointing to a block.
  * This is equivalent to the two operations sequentially, and is a shortcut.
@@ -286,6 +349,15 @@ static inline int uref_block_merge(struct uref *uref, struct ubuf_mgr *ubuf_mgr,
     return ubuf_block_merge(ubuf_mgr, &uref->ubuf, skip, new_size);
 }
 
+/** @see ubuf_block_linearize */
+static inline int uref_block_linearize(struct uref *uref,
+                                       struct ubuf_mgr *ubuf_mgr)
+{
+    if (uref->ubuf == NULL)
+        return UBASE_ERR_INVALID;
+    return ubuf_block_linearize(ubuf_mgr, &uref->ubuf);
+}
+
 /** @see ubuf_block_compare */
 static inline int uref_block_compare(struct uref *uref, int offset,
                                      struct uref *uref_small)
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short declarations for a Upipe main loop using Linux io_uring
+ *
+ * Besides the standard pump types, this manager implements read pumps
+ * (@ref upump_uring_alloc_read), which complete when data has been read
+ * into a buffer given beforehand, instead of triggering when the file
+ * descriptor becomes readable.
+ */
+
+#ifndef _UPUMP_URING_UPUMP_URING_H_
+/** @hidden */
+#define _UPUMP_URING_UPUMP_URING_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <upipe/upump.h>
+
+#include <sys/types.h>
+
+#define UPUMP_URING_SIGNATURE UBASE_FOURCC('u','r','n','g')
+
+/** @This extends upump_type with specific types. */
+enum upump_uring_type {
+    UPUMP_URING_TYPE_SENTINEL = UPUMP_TYPE_LOCAL,
+
+    /** event triggers when a read into the given buffer completes
+     * (int) */
+    UPUMP_URING_TYPE_READ
+};
+
+/** @This extends upump_command with specific commands. */
+enum upump_uring_command {
+    UPUMP_URING_SENTINEL = UPUMP_CONTROL_LOCAL,
+
+    /** sets the buffer of the next read (void *, size_t) */
+    UPUMP_URING_SET_BUFFER,
+    /** gets the result of the last completed read (ssize_t *) */
+    UPUMP_URING_GET_RESULT
+};
+
+/** @This allocates and initializes a pump reading from a file descriptor.
+ * The pump triggers when a read into the buffer given by
+ * @ref upump_uring_set_buffer has completed, and the result may then be
+ * retrieved with @ref upump_uring_get_result.
+ *
+ * @param mgr management structure for this event loop
+ * @param cb function to call when the pump triggers
+ * @param opaque pointer to the module's internal structure
+ * @param refcount pointer to urefcount structure to increment during callback,
+ * or NULL
+ * @param fd file descriptor to read from
+ * @return pointer to allocated pump, or NULL in case of failure (also if
+ * the manager is not an io_uring manager)
+ */
+static inline struct upump *upump_uring_alloc_read(struct upump_mgr *mgr,
+                                                   upump_cb cb, void *opaque,
+                                                   struct urefcount *refcount,
+                                                   int fd)
+{
+    if (mgr->signature != UPUMP_URING_SIGNATURE)
+        return NULL;
+    return upump_alloc(mgr, cb, opaque, refcount, UPUMP_URING_TYPE_READ,
+                       UPUMP_URING_SIGNATURE, fd);
+}
+
+/** @This sets the buffer of the next read of a read pump. The buffer is
+ * owned by the kernel until the pump triggers, is stopped or is freed, and
+ * is used for a single read: a new buffer must be set after each completion
+ * for the pump to trigger again.
+ *
+ * @param upump description structure of the pump
+ * @param buffer buffer to read into
+ * @param size size of the buffer
+ * @return an error code
+ */
+static inline int upump_uring_set_buffer(struct upump *upump,
+                                         void *buffer, size_t size)
+{
+    return upump_control(upump, UPUMP_URING_SET_BUFFER, UPUMP_URING_SIGNATURE,
+                         buffer, size);
+}
+
+/** @This gets the result of the last completed read of a read pump.
+ *
+ * @param upump description structure of the pump
+ * @param result_p filled in with the number of octets read, or a negative
+ * errno value
+ * @return an error code
+ */
+static inline int upump_uring_get_result(struct upump *upump,
+                                         ssize_t *result_p)
+{
+    return upump_control(upump, UPUMP_URING_GET_RESULT, UPUMP_URING_SIGNATURE,
+                         result_p);
+}
+
+/** @This allocates and initializes a upump_mgr structure bound to a new
+ * io_uring instance.
+ *
+ * @param upump_pool_depth maximum number of upump structures in the pool
+ * @param upump_blocker_pool_depth maximum number of upump_blocker structures in
+ * the pool
+ * @return pointer to the wrapped upump_mgr structure, or NULL if io_uring is
+ * not available
+ */
+struct upump_mgr *upump_uring_mgr_alloc(uint16_t upump_pool_depth,
+                                        uint16_t upump_blocker_pool_depth);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
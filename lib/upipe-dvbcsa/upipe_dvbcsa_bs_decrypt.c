@@ -45,6 +45,7 @@
 #include <dvbcsa/dvbcsa.h>
 
 #include "common.h"
+#include "upipe_dvbcsa_bs_pool.h"
 
 /** expected input flow format */
 #define EXPECTED_FLOW_DEF "block.mpegts."
@@ -96,6 +97,28 @@ struct upipe_dvbcsa_bs_dec {
     unsigned current;
     /** common dvbcsa structure */
     struct upipe_dvbcsa_common common;
+    /** maximum number of packets per batch */
+    unsigned max_batch_size;
+    /** control word of the key */
+    dvbcsa_cw_t cw;
+    /** system date of the last packet to descramble */
+    uint64_t last_cr_sys;
+    /** number of packets to descramble received at the last date */
+    unsigned nb_last;
+    /** average interval between packets to descramble */
+    uint64_t interval;
+    /** number of threads processing the batches */
+    unsigned nb_threads;
+    /** pool of threads, or NULL to process the batches in the pipe */
+    struct upipe_dvbcsa_bs_pool *pool;
+    /** watcher of processed batches */
+    struct upump *upump_pool;
+    /** list of submitted batches, in submission order */
+    struct uchain jobs;
+    /** list of unused batches */
+    struct uchain spare_jobs;
+    /** number of retained urefs covered by the submitted batches */
+    unsigned nb_pending;
 };
 
 /** @hidden */
@@ -117,6 +140,7 @@ UPIPE_HELPER_UCLOCK(upipe_dvbcsa_bs_dec, uclock, uclock_request,
                     upipe_dvbcsa_bs_dec_unregister_output_request);
 UPIPE_HELPER_UPUMP_MGR(upipe_dvbcsa_bs_dec, upump_mgr);
 UPIPE_HELPER_UPUMP(upipe_dvbcsa_bs_dec, upump, upump_mgr);
+UPIPE_HELPER_UPUMP(upipe_dvbcsa_bs_dec, upump_pool, upump_mgr);
 UPIPE_HELPER_INPUT(upipe_dvbcsa_bs_dec, urefs, nb_urefs, max_urefs, blockers,
                    NULL);
 
@@ -133,6 +157,20 @@ static void upipe_dvbcsa_bs_dec_free(struct upipe *upipe)
 
     upipe_throw_dead(upipe);
 
+    upipe_dvbcsa_bs_dec_clean_upump_pool(upipe);
+    if (upipe_dvbcsa_bs_dec->pool)
+        upipe_dvbcsa_bs_pool_free(upipe_dvbcsa_bs_dec->pool);
+    struct uchain *uchain;
+    while ((uchain = ulist_pop(&upipe_dvbcsa_bs_dec->jobs))) {
+        struct upipe_dvbcsa_bs_job *job =
+            upipe_dvbcsa_bs_job_from_uchain(uchain);
+        for (unsigned i = 0; i < job->count; i++)
+            uref_block_unmap(job->mapped[i], 0);
+        upipe_dvbcsa_bs_job_free(job);
+    }
+    while ((uchain = ulist_pop(&upipe_dvbcsa_bs_dec->spare_jobs)))
+        upipe_dvbcsa_bs_job_free(upipe_dvbcsa_bs_job_from_uchain(uchain));
+
     for (unsigned i = 0; i < upipe_dvbcsa_bs_dec->current; i++)
         uref_block_unmap(upipe_dvbcsa_bs_dec->mapped[i], 0);
     dvbcsa_bs_key_free(upipe_dvbcsa_bs_dec->key);
@@ -184,6 +222,17 @@ static struct upipe *upipe_dvbcsa_bs_dec_alloc(struct upipe_mgr *mgr,
                                         sizeof (struct dvbcsa_bs_batch_s));
     upipe_dvbcsa_bs_dec->mapped = malloc(bs_size * sizeof (struct uref *));
     upipe_dvbcsa_bs_dec->current = 0;
+    upipe_dvbcsa_bs_dec->max_batch_size = bs_size;
+    memset(upipe_dvbcsa_bs_dec->cw, 0, sizeof (upipe_dvbcsa_bs_dec->cw));
+    upipe_dvbcsa_bs_dec->last_cr_sys = UINT64_MAX;
+    upipe_dvbcsa_bs_dec->nb_last = 0;
+    upipe_dvbcsa_bs_dec->interval = 0;
+    upipe_dvbcsa_bs_dec->nb_threads = 0;
+    upipe_dvbcsa_bs_dec->pool = NULL;
+    upipe_dvbcsa_bs_dec_init_upump_pool(upipe);
+    ulist_init(&upipe_dvbcsa_bs_dec->jobs);
+    ulist_init(&upipe_dvbcsa_bs_dec->spare_jobs);
+    upipe_dvbcsa_bs_dec->nb_pending = 0;
 
     upipe_throw_ready(upipe);
 
@@ -218,9 +267,118 @@ static int upipe_dvbcsa_bs_dec_set_flow_def_real(struct upipe *upipe,
     return UBASE_ERR_NONE;
 }
 
+/** @internal @This outputs retained urefs, in order.
+ *
+ * @param upipe description structure of the pipe
+ * @param nb_urefs maximum number of urefs to output
+ * @param upump_p reference to the pump that generated the buffer
+ */
+static void upipe_dvbcsa_bs_dec_output_urefs(struct upipe *upipe,
+                                             unsigned nb_urefs,
+                                             struct upump **upump_p)
+{
+    if (!nb_urefs || upipe_dvbcsa_bs_dec_check_input(upipe))
+        return;
+
+    struct uref *uref;
+    while (nb_urefs-- && (uref = upipe_dvbcsa_bs_dec_pop_input(upipe)))
+        if (unlikely(ubase_check(uref_flow_get_def(uref, NULL))))
+            /* handle flow format */
+            upipe_dvbcsa_bs_dec_set_flow_def_real(upipe, uref);
+        else
+            upipe_dvbcsa_bs_dec_output(upipe, uref, upump_p);
+
+    if (upipe_dvbcsa_bs_dec_check_input(upipe))
+        /* no more buffered urefs */
+        upipe_release(upipe);
+}
+
+/** @internal @This outputs the retained urefs covered by the processed
+ * batches. Batches may be processed out of order by the pool, so this stops
+ * at the first batch still being processed.
+ *
+ * @param upipe description structure of the pipe
+ * @param upump_p reference to the pump that generated the buffer
+ */
+static void upipe_dvbcsa_bs_dec_output_jobs(struct upipe *upipe,
+                                            struct upump **upump_p)
+{
+    struct upipe_dvbcsa_bs_dec *upipe_dvbcsa_bs_dec =
+        upipe_dvbcsa_bs_dec_from_upipe(upipe);
+    struct uchain *uchain;
+
+    upipe_use(upipe);
+    while ((uchain = ulist_peek(&upipe_dvbcsa_bs_dec->jobs))) {
+        struct upipe_dvbcsa_bs_job *job =
+            upipe_dvbcsa_bs_job_from_uchain(uchain);
+        if (upipe_dvbcsa_bs_dec->pool &&
+            !upipe_dvbcsa_bs_pool_done(upipe_dvbcsa_bs_dec->pool, job))
+            break;
+
+        ulist_pop(&upipe_dvbcsa_bs_dec->jobs);
+        for (unsigned i = 0; i < job->count; i++)
+            uref_block_unmap(job->mapped[i], 0);
+        unsigned nb_urefs = job->nb_urefs;
+        upipe_dvbcsa_bs_dec->nb_pending -= nb_urefs;
+        ulist_add(&upipe_dvbcsa_bs_dec->spare_jobs, &job->uchain);
+        upipe_dvbcsa_bs_dec_output_urefs(upipe, nb_urefs, upump_p);
+    }
+    upipe_release(upipe);
+}
+
+/** @internal @This hands the current batch over to the pool, along with the
+ * retained urefs it covers.
+ *
+ * @param upipe description structure of the pipe
+ * @param upump_p reference to the pump that generated the buffer
+ */
+static void upipe_dvbcsa_bs_dec_submit(struct upipe *upipe,
+                                       struct upump **upump_p)
+{
+    struct upipe_dvbcsa_bs_dec *upipe_dvbcsa_bs_dec =
+        upipe_dvbcsa_bs_dec_from_upipe(upipe);
+
+    if (upipe_dvbcsa_bs_dec->nb_urefs == upipe_dvbcsa_bs_dec->nb_pending)
+        return;
+
+    struct upipe_dvbcsa_bs_job *job;
+    struct uchain *uchain = ulist_pop(&upipe_dvbcsa_bs_dec->spare_jobs);
+    if (uchain)
+        job = upipe_dvbcsa_bs_job_from_uchain(uchain);
+    else {
+        job = upipe_dvbcsa_bs_job_alloc(upipe_dvbcsa_bs_dec->max_batch_size);
+        if (unlikely(!job)) {
+            upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+            return;
+        }
+    }
+
+    struct dvbcsa_bs_batch_s *batch = job->batch;
+    job->batch = upipe_dvbcsa_bs_dec->batch;
+    upipe_dvbcsa_bs_dec->batch = batch;
+    struct uref **mapped = job->mapped;
+    job->mapped = upipe_dvbcsa_bs_dec->mapped;
+    upipe_dvbcsa_bs_dec->mapped = mapped;
+    job->count = upipe_dvbcsa_bs_dec->current;
+    upipe_dvbcsa_bs_dec->current = 0;
+    memcpy(job->cw, upipe_dvbcsa_bs_dec->cw, sizeof (job->cw));
+    job->nb_urefs =
+        upipe_dvbcsa_bs_dec->nb_urefs - upipe_dvbcsa_bs_dec->nb_pending;
+    upipe_dvbcsa_bs_dec->nb_pending = upipe_dvbcsa_bs_dec->nb_urefs;
+    ulist_add(&upipe_dvbcsa_bs_dec->jobs, &job->uchain);
+
+    if (job->count)
+        upipe_dvbcsa_bs_pool_submit(upipe_dvbcsa_bs_dec->pool, job);
+    else {
+        job->done = true;
+        upipe_dvbcsa_bs_dec_output_jobs(upipe, upump_p);
+    }
+}
+
 /** @internal @This flushes the retained urefs.
  *
  * @param upipe description structure of the pipe
+ * @param upump_p reference to the pump that generated the buffer
  */
 static void upipe_dvbcsa_bs_dec_flush(struct upipe *upipe,
                                       struct upump **upump_p)
@@ -230,6 +388,11 @@ static void upipe_dvbcsa_bs_dec_flush(struct upipe *upipe,
 
     upipe_dvbcsa_bs_dec_set_upump(upipe, NULL);
 
+    if (upipe_dvbcsa_bs_dec->pool) {
+        upipe_dvbcsa_bs_dec_submit(upipe, upump_p);
+        return;
+    }
+
     /* descramble remaining packets */
     unsigned current = upipe_dvbcsa_bs_dec->current;
     if (current) {
@@ -247,17 +410,8 @@ static void upipe_dvbcsa_bs_dec_flush(struct upipe *upipe,
             uref_block_unmap(upipe_dvbcsa_bs_dec->mapped[i], 0);
     }
 
-    /* output */
-    struct uref *uref;
-    while ((uref = upipe_dvbcsa_bs_dec_pop_input(upipe)))
-        if (unlikely(ubase_check(uref_flow_get_def(uref, NULL))))
-            /* handle flow format */
-            upipe_dvbcsa_bs_dec_set_flow_def_real(upipe, uref);
-        else
-            upipe_dvbcsa_bs_dec_output(upipe, uref, upump_p);
-
-    /* no more buffered urefs */
-    upipe_release(upipe);
+    upipe_dvbcsa_bs_dec_output_urefs(upipe, upipe_dvbcsa_bs_dec->nb_urefs,
+                                     upump_p);
 }
 
 /** @internal @This is called when the upump triggers.
@@ -270,6 +424,84 @@ static void upipe_dvbcsa_bs_dec_worker(struct upump *upump)
     return upipe_dvbcsa_bs_dec_flush(upipe, &upump);
 }
 
+/** @internal @This is called when batches were processed by the pool.
+ *
+ * @param upump pool watcher
+ */
+static void upipe_dvbcsa_bs_dec_pool_worker(struct upump *upump)
+{
+    struct upipe *upipe = upump_get_opaque(upump, struct upipe *);
+    struct upipe_dvbcsa_bs_dec *upipe_dvbcsa_bs_dec =
+        upipe_dvbcsa_bs_dec_from_upipe(upipe);
+
+    upipe_dvbcsa_bs_pool_ack(upipe_dvbcsa_bs_dec->pool);
+    upipe_dvbcsa_bs_dec_output_jobs(upipe, &upump);
+}
+
+/** @internal @This retains a uref until the batch covering it is processed.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref uref to retain
+ */
+static void upipe_dvbcsa_bs_dec_hold(struct upipe *upipe, struct uref *uref)
+{
+    struct upipe_dvbcsa_bs_dec *upipe_dvbcsa_bs_dec =
+        upipe_dvbcsa_bs_dec_from_upipe(upipe);
+    struct upipe_dvbcsa_common *common =
+        upipe_dvbcsa_bs_dec_to_common(upipe_dvbcsa_bs_dec);
+
+    if (upipe_dvbcsa_bs_dec_check_input(upipe))
+        /* make sure to send all buffered urefs */
+        upipe_use(upipe);
+    upipe_dvbcsa_bs_dec_hold_input(upipe, uref);
+    if (!upipe_dvbcsa_bs_dec->upump)
+        upipe_dvbcsa_bs_dec_wait_upump(upipe, common->latency,
+                                       upipe_dvbcsa_bs_dec_worker);
+}
+
+/** @internal @This adapts the batch size to the rate of the packets to
+ * descramble, so that filling a batch takes at most half of the maximum latency.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref packet to descramble
+ */
+static void upipe_dvbcsa_bs_dec_adapt(struct upipe *upipe, struct uref *uref)
+{
+    struct upipe_dvbcsa_bs_dec *upipe_dvbcsa_bs_dec =
+        upipe_dvbcsa_bs_dec_from_upipe(upipe);
+    struct upipe_dvbcsa_common *common =
+        upipe_dvbcsa_bs_dec_to_common(upipe_dvbcsa_bs_dec);
+
+    uint64_t cr_sys;
+    if (unlikely(!ubase_check(uref_clock_get_cr_sys(uref, &cr_sys))))
+        return;
+
+    /* packets of a datagram share the same date */
+    if (cr_sys == upipe_dvbcsa_bs_dec->last_cr_sys) {
+        upipe_dvbcsa_bs_dec->nb_last++;
+        return;
+    }
+
+    if (upipe_dvbcsa_bs_dec->last_cr_sys != UINT64_MAX &&
+        cr_sys > upipe_dvbcsa_bs_dec->last_cr_sys) {
+        uint64_t interval =
+            (cr_sys - upipe_dvbcsa_bs_dec->last_cr_sys) / upipe_dvbcsa_bs_dec->nb_last;
+        upipe_dvbcsa_bs_dec->interval = upipe_dvbcsa_bs_dec->interval ?
+            (upipe_dvbcsa_bs_dec->interval * 7 + interval) / 8 : interval;
+
+        uint64_t batch_size = upipe_dvbcsa_bs_dec->max_batch_size;
+        if (upipe_dvbcsa_bs_dec->interval)
+            batch_size = common->latency / 2 / upipe_dvbcsa_bs_dec->interval;
+        if (batch_size < 1)
+            batch_size = 1;
+        else if (batch_size > upipe_dvbcsa_bs_dec->max_batch_size)
+            batch_size = upipe_dvbcsa_bs_dec->max_batch_size;
+        upipe_dvbcsa_bs_dec->batch_size = batch_size;
+    }
+    upipe_dvbcsa_bs_dec->last_cr_sys = cr_sys;
+    upipe_dvbcsa_bs_dec->nb_last = 1;
+}
+
 /** @internal @This handles the input buffers.
  *
  * @param upipe description structure of the pipe
@@ -291,15 +523,17 @@ static void upipe_dvbcsa_bs_dec_input(struct upipe *upipe,
         if (first)
             upipe_dvbcsa_bs_dec_set_flow_def_real(upipe, uref);
         else
-            upipe_dvbcsa_bs_dec_hold_input(upipe, uref);
+            upipe_dvbcsa_bs_dec_hold(upipe, uref);
         return;
     }
 
     /* output if no dvbcsa key set */
     if (unlikely(!upipe_dvbcsa_bs_dec->key)) {
-        if (unlikely(!first))
+        if (unlikely(!first)) {
+            upipe_dvbcsa_bs_dec_hold(upipe, uref);
             upipe_dvbcsa_bs_dec_flush(upipe, upump_p);
-        upipe_dvbcsa_bs_dec_output(upipe, uref, upump_p);
+        } else
+            upipe_dvbcsa_bs_dec_output(upipe, uref, upump_p);
         return;
     }
 
@@ -323,7 +557,7 @@ static void upipe_dvbcsa_bs_dec_input(struct upipe *upipe,
         if (first)
             upipe_dvbcsa_bs_dec_output(upipe, uref, upump_p);
         else
-            upipe_dvbcsa_bs_dec_hold_input(upipe, uref);
+            upipe_dvbcsa_bs_dec_hold(upipe, uref);
         return;
     }
 
@@ -371,13 +605,8 @@ static void upipe_dvbcsa_bs_dec_input(struct upipe *upipe,
     ts_set_scrambling(ts, 0);
 
     /* hold uref */
-    upipe_dvbcsa_bs_dec_hold_input(upipe, uref);
-    if (unlikely(first)) {
-        /* make sure to send all buffered urefs */
-        upipe_use(upipe);
-        upipe_dvbcsa_bs_dec_wait_upump(upipe, common->latency,
-                                       upipe_dvbcsa_bs_dec_worker);
-    }
+    upipe_dvbcsa_bs_dec_adapt(upipe, uref);
+    upipe_dvbcsa_bs_dec_hold(upipe, uref);
 
     /* descramble if we have enough buffered scrambled TS packets */
     if (upipe_dvbcsa_bs_dec->current >= upipe_dvbcsa_bs_dec->batch_size)
@@ -401,6 +630,18 @@ static int upipe_dvbcsa_bs_dec_check(struct upipe *upipe, struct uref *flow_def)
     if (unlikely(!upipe_dvbcsa_bs_dec->upump_mgr))
         return UBASE_ERR_NONE;
 
+    if (upipe_dvbcsa_bs_dec->pool && !upipe_dvbcsa_bs_dec->upump_pool) {
+        struct upump *upump = upipe_dvbcsa_bs_pool_upump_alloc(
+            upipe_dvbcsa_bs_dec->pool, upipe_dvbcsa_bs_dec->upump_mgr,
+            upipe_dvbcsa_bs_dec_pool_worker, upipe, upipe->refcount);
+        if (unlikely(!upump)) {
+            upipe_err(upipe, "can't create pool watcher");
+            return UBASE_ERR_UPUMP;
+        }
+        upipe_dvbcsa_bs_dec_set_upump_pool(upipe, upump);
+        upump_start(upump);
+    }
+
     return UBASE_ERR_NONE;
 }
 
@@ -431,6 +672,10 @@ static int upipe_dvbcsa_bs_dec_set_key(struct upipe *upipe, const char *key)
     struct upipe_dvbcsa_bs_dec *upipe_dvbcsa_bs_dec =
         upipe_dvbcsa_bs_dec_from_upipe(upipe);
 
+    /* the pending packets are processed with the previous key */
+    if (upipe_dvbcsa_bs_dec->current)
+        upipe_dvbcsa_bs_dec_flush(upipe, NULL);
+
     dvbcsa_bs_key_free(upipe_dvbcsa_bs_dec->key);
     upipe_dvbcsa_bs_dec->key = NULL;
 
@@ -445,6 +690,42 @@ static int upipe_dvbcsa_bs_dec_set_key(struct upipe *upipe, const char *key)
     upipe_dvbcsa_bs_dec->key = dvbcsa_bs_key_alloc();
     UBASE_ALLOC_RETURN(upipe_dvbcsa_bs_dec->key);
     dvbcsa_bs_key_set(cw.value, upipe_dvbcsa_bs_dec->key);
+    memcpy(upipe_dvbcsa_bs_dec->cw, cw.value, sizeof (upipe_dvbcsa_bs_dec->cw));
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This sets the number of threads processing the batches.
+ *
+ * @param upipe description structure of the pipe
+ * @param nb_threads number of threads, or 0 to process the batches in the
+ * pipe
+ * @return an error code
+ */
+static int upipe_dvbcsa_bs_dec_set_threads(struct upipe *upipe,
+                                           unsigned nb_threads)
+{
+    struct upipe_dvbcsa_bs_dec *upipe_dvbcsa_bs_dec =
+        upipe_dvbcsa_bs_dec_from_upipe(upipe);
+
+    if (nb_threads == upipe_dvbcsa_bs_dec->nb_threads)
+        return UBASE_ERR_NONE;
+
+    if (upipe_dvbcsa_bs_dec->pool) {
+        /* wait for the submitted batches */
+        upipe_dvbcsa_bs_dec_flush(upipe, NULL);
+        upipe_dvbcsa_bs_dec_set_upump_pool(upipe, NULL);
+        upipe_dvbcsa_bs_pool_free(upipe_dvbcsa_bs_dec->pool);
+        upipe_dvbcsa_bs_dec->pool = NULL;
+        upipe_dvbcsa_bs_dec_output_jobs(upipe, NULL);
+    }
+    upipe_dvbcsa_bs_dec->nb_threads = 0;
+    if (!nb_threads)
+        return UBASE_ERR_NONE;
+
+    upipe_dvbcsa_bs_dec->pool = upipe_dvbcsa_bs_pool_alloc(nb_threads, dvbcsa_bs_decrypt);
+    UBASE_ALLOC_RETURN(upipe_dvbcsa_bs_dec->pool);
+    upipe_dvbcsa_bs_dec->nb_threads = nb_threads;
+    upipe_notice_va(upipe, "processing batches in %u threads", nb_threads);
     return UBASE_ERR_NONE;
 }
 
@@ -480,6 +761,11 @@ static int upipe_dvbcsa_bs_dec_control_real(struct upipe *upipe,
             const char *key = va_arg(args, const char *);
             return upipe_dvbcsa_bs_dec_set_key(upipe, key);
         }
+        case UPIPE_DVBCSA_SET_THREADS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_DVBCSA_COMMON_SIGNATURE);
+            unsigned nb_threads = va_arg(args, unsigned);
+            return upipe_dvbcsa_bs_dec_set_threads(upipe, nb_threads);
+        }
         case UPIPE_DVBCSA_ADD_PID:
         case UPIPE_DVBCSA_DEL_PID:
         case UPIPE_DVBCSA_SET_MAX_LATENCY:
@@ -44,6 +44,7 @@
 #include <bitstream/mpeg/ts.h>
 
 #include "common.h"
+#include "upipe_dvbcsa_bs_pool.h"
 
 /** expected input flow format */
 #define EXPECTED_FLOW_DEF "block.mpegts."
@@ -94,6 +95,28 @@ struct upipe_dvbcsa_bs_enc {
     struct uref **mapped;
     /** common dvbcsa structure */
     struct upipe_dvbcsa_common common;
+    /** maximum number of packets per batch */
+    unsigned max_batch_size;
+    /** control word of the key */
+    dvbcsa_cw_t cw;
+    /** system date of the last packet to scramble */
+    uint64_t last_cr_sys;
+    /** number of packets to scramble received at the last date */
+    unsigned nb_last;
+    /** average interval between packets to scramble */
+    uint64_t interval;
+    /** number of threads processing the batches */
+    unsigned nb_threads;
+    /** pool of threads, or NULL to process the batches in the pipe */
+    struct upipe_dvbcsa_bs_pool *pool;
+    /** watcher of processed batches */
+    struct upump *upump_pool;
+    /** list of submitted batches, in submission order */
+    struct uchain jobs;
+    /** list of unused batches */
+    struct uchain spare_jobs;
+    /** number of retained urefs covered by the submitted batches */
+    unsigned nb_pending;
 };
 
 /** @hidden */
@@ -117,6 +140,7 @@ UPIPE_HELPER_UCLOCK(upipe_dvbcsa_bs_enc, uclock, uclock_request,
                     upipe_dvbcsa_bs_enc_unregister_output_request);
 UPIPE_HELPER_UPUMP_MGR(upipe_dvbcsa_bs_enc, upump_mgr);
 UPIPE_HELPER_UPUMP(upipe_dvbcsa_bs_enc, upump, upump_mgr);
+UPIPE_HELPER_UPUMP(upipe_dvbcsa_bs_enc, upump_pool, upump_mgr);
 
 /** @internal @This frees a dvbcsa encryption pipe.
  *
@@ -131,6 +155,20 @@ static void upipe_dvbcsa_bs_enc_free(struct upipe *upipe)
 
     upipe_throw_dead(upipe);
 
+    upipe_dvbcsa_bs_enc_clean_upump_pool(upipe);
+    if (upipe_dvbcsa_bs_enc->pool)
+        upipe_dvbcsa_bs_pool_free(upipe_dvbcsa_bs_enc->pool);
+    struct uchain *uchain;
+    while ((uchain = ulist_pop(&upipe_dvbcsa_bs_enc->jobs))) {
+        struct upipe_dvbcsa_bs_job *job =
+            upipe_dvbcsa_bs_job_from_uchain(uchain);
+        for (unsigned i = 0; i < job->count; i++)
+            uref_block_unmap(job->mapped[i], 0);
+        upipe_dvbcsa_bs_job_free(job);
+    }
+    while ((uchain = ulist_pop(&upipe_dvbcsa_bs_enc->spare_jobs)))
+        upipe_dvbcsa_bs_job_free(upipe_dvbcsa_bs_job_from_uchain(uchain));
+
     for (unsigned i = 0; i < upipe_dvbcsa_bs_enc->current; i++)
         uref_block_unmap(upipe_dvbcsa_bs_enc->mapped[i], 0);
     dvbcsa_bs_key_free(upipe_dvbcsa_bs_enc->key);
@@ -139,6 +177,7 @@ static void upipe_dvbcsa_bs_enc_free(struct upipe *upipe)
     upipe_dvbcsa_common_clean(common);
     upipe_dvbcsa_bs_enc_clean_upump(upipe);
     upipe_dvbcsa_bs_enc_clean_upump_mgr(upipe);
+    upipe_dvbcsa_bs_enc_clean_uclock(upipe);
     upipe_dvbcsa_bs_enc_clean_output(upipe);
     upipe_dvbcsa_bs_enc_clean_input(upipe);
     upipe_dvbcsa_bs_enc_clean_urefcount(upipe);
@@ -170,6 +209,7 @@ static struct upipe *upipe_dvbcsa_bs_enc_alloc(struct upipe_mgr *mgr,
     upipe_dvbcsa_bs_enc_init_urefcount(upipe);
     upipe_dvbcsa_bs_enc_init_input(upipe);
     upipe_dvbcsa_bs_enc_init_output(upipe);
+    upipe_dvbcsa_bs_enc_init_uclock(upipe);
     upipe_dvbcsa_bs_enc_init_upump_mgr(upipe);
     upipe_dvbcsa_bs_enc_init_upump(upipe);
     upipe_dvbcsa_common_init(common);
@@ -180,6 +220,17 @@ static struct upipe *upipe_dvbcsa_bs_enc_alloc(struct upipe_mgr *mgr,
                                         sizeof (struct dvbcsa_bs_batch_s));
     upipe_dvbcsa_bs_enc->mapped = malloc(bs_size * sizeof (struct uref *));
     upipe_dvbcsa_bs_enc->current = 0;
+    upipe_dvbcsa_bs_enc->max_batch_size = bs_size;
+    memset(upipe_dvbcsa_bs_enc->cw, 0, sizeof (upipe_dvbcsa_bs_enc->cw));
+    upipe_dvbcsa_bs_enc->last_cr_sys = UINT64_MAX;
+    upipe_dvbcsa_bs_enc->nb_last = 0;
+    upipe_dvbcsa_bs_enc->interval = 0;
+    upipe_dvbcsa_bs_enc->nb_threads = 0;
+    upipe_dvbcsa_bs_enc->pool = NULL;
+    upipe_dvbcsa_bs_enc_init_upump_pool(upipe);
+    ulist_init(&upipe_dvbcsa_bs_enc->jobs);
+    ulist_init(&upipe_dvbcsa_bs_enc->spare_jobs);
+    upipe_dvbcsa_bs_enc->nb_pending = 0;
 
     upipe_throw_ready(upipe);
 
@@ -213,9 +264,118 @@ static int upipe_dvbcsa_bs_enc_set_flow_def_real(struct upipe *upipe,
     return UBASE_ERR_NONE;
 }
 
+/** @internal @This outputs retained urefs, in order.
+ *
+ * @param upipe description structure of the pipe
+ * @param nb_urefs maximum number of urefs to output
+ * @param upump_p reference to the pump that generated the buffer
+ */
+static void upipe_dvbcsa_bs_enc_output_urefs(struct upipe *upipe,
+                                             unsigned nb_urefs,
+                                             struct upump **upump_p)
+{
+    if (!nb_urefs || upipe_dvbcsa_bs_enc_check_input(upipe))
+        return;
+
+    struct uref *uref;
+    while (nb_urefs-- && (uref = upipe_dvbcsa_bs_enc_pop_input(upipe)))
+        if (unlikely(ubase_check(uref_flow_get_def(uref, NULL))))
+            /* handle flow format */
+            upipe_dvbcsa_bs_enc_set_flow_def_real(upipe, uref);
+        else
+            upipe_dvbcsa_bs_enc_output(upipe, uref, upump_p);
+
+    if (upipe_dvbcsa_bs_enc_check_input(upipe))
+        /* no more buffered urefs */
+        upipe_release(upipe);
+}
+
+/** @internal @This outputs the retained urefs covered by the processed
+ * batches. Batches may be processed out of order by the pool, so this stops
+ * at the first batch still being processed.
+ *
+ * @param upipe description structure of the pipe
+ * @param upump_p reference to the pump that generated the buffer
+ */
+static void upipe_dvbcsa_bs_enc_output_jobs(struct upipe *upipe,
+                                            struct upump **upump_p)
+{
+    struct upipe_dvbcsa_bs_enc *upipe_dvbcsa_bs_enc =
+        upipe_dvbcsa_bs_enc_from_upipe(upipe);
+    struct uchain *uchain;
+
+    upipe_use(upipe);
+    while ((uchain = ulist_peek(&upipe_dvbcsa_bs_enc->jobs))) {
+        struct upipe_dvbcsa_bs_job *job =
+            upipe_dvbcsa_bs_job_from_uchain(uchain);
+        if (upipe_dvbcsa_bs_enc->pool &&
+            !upipe_dvbcsa_bs_pool_done(upipe_dvbcsa_bs_enc->pool, job))
+            break;
+
+        ulist_pop(&upipe_dvbcsa_bs_enc->jobs);
+        for (unsigned i = 0; i < job->count; i++)
+            uref_block_unmap(job->mapped[i], 0);
+        unsigned nb_urefs = job->nb_urefs;
+        upipe_dvbcsa_bs_enc->nb_pending -= nb_urefs;
+        ulist_add(&upipe_dvbcsa_bs_enc->spare_jobs, &job->uchain);
+        upipe_dvbcsa_bs_enc_output_urefs(upipe, nb_urefs, upump_p);
+    }
+    upipe_release(upipe);
+}
+
+/** @internal @This hands the current batch over to the pool, along with the
+ * retained urefs it covers.
+ *
+ * @param upipe description structure of the pipe
+ * @param upump_p reference to the pump that generated the buffer
+ */
+static void upipe_dvbcsa_bs_enc_submit(struct upipe *upipe,
+                                       struct upump **upump_p)
+{
+    struct upipe_dvbcsa_bs_enc *upipe_dvbcsa_bs_enc =
+        upipe_dvbcsa_bs_enc_from_upipe(upipe);
+
+    if (upipe_dvbcsa_bs_enc->nb_urefs == upipe_dvbcsa_bs_enc->nb_pending)
+        return;
+
+    struct upipe_dvbcsa_bs_job *job;
+    struct uchain *uchain = ulist_pop(&upipe_dvbcsa_bs_enc->spare_jobs);
+    if (uchain)
+        job = upipe_dvbcsa_bs_job_from_uchain(uchain);
+    else {
+        job = upipe_dvbcsa_bs_job_alloc(upipe_dvbcsa_bs_enc->max_batch_size);
+        if (unlikely(!job)) {
+            upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+            return;
+        }
+    }
+
+    struct dvbcsa_bs_batch_s *batch = job->batch;
+    job->batch = upipe_dvbcsa_bs_enc->batch;
+    upipe_dvbcsa_bs_enc->batch = batch;
+    struct uref **mapped = job->mapped;
+    job->mapped = upipe_dvbcsa_bs_enc->mapped;
+    upipe_dvbcsa_bs_enc->mapped = mapped;
+    job->count = upipe_dvbcsa_bs_enc->current;
+    upipe_dvbcsa_bs_enc->current = 0;
+    memcpy(job->cw, upipe_dvbcsa_bs_enc->cw, sizeof (job->cw));
+    job->nb_urefs =
+        upipe_dvbcsa_bs_enc->nb_urefs - upipe_dvbcsa_bs_enc->nb_pending;
+    upipe_dvbcsa_bs_enc->nb_pending = upipe_dvbcsa_bs_enc->nb_urefs;
+    ulist_add(&upipe_dvbcsa_bs_enc->jobs, &job->uchain);
+
+    if (job->count)
+        upipe_dvbcsa_bs_pool_submit(upipe_dvbcsa_bs_enc->pool, job);
+    else {
+        job->done = true;
+        upipe_dvbcsa_bs_enc_output_jobs(upipe, upump_p);
+    }
+}
+
 /** @internal @This flushes the retained urefs.
  *
  * @param upipe description structure of the pipe
+ * @param upump_p reference to the pump that generated the buffer
  */
 static void upipe_dvbcsa_bs_enc_flush(struct upipe *upipe,
                                       struct upump **upump_p)
@@ -225,6 +385,11 @@ static void upipe_dvbcsa_bs_enc_flush(struct upipe *upipe,
 
     upipe_dvbcsa_bs_enc_set_upump(upipe, NULL);
 
+    if (upipe_dvbcsa_bs_enc->pool) {
+        upipe_dvbcsa_bs_enc_submit(upipe, upump_p);
+        return;
+    }
+
     /* scramble remaining packets */
     unsigned current = upipe_dvbcsa_bs_enc->current;
     if (upipe_dvbcsa_bs_enc->current) {
@@ -243,18 +408,8 @@ static void upipe_dvbcsa_bs_enc_flush(struct upipe *upipe,
             uref_block_unmap(upipe_dvbcsa_bs_enc->mapped[i], 0);
     }
 
-    /* output */
-    struct uref *uref;
-    while ((uref = upipe_dvbcsa_bs_enc_pop_input(upipe))) {
-        if (unlikely(ubase_check(uref_flow_get_def(uref, NULL))))
-            /* handle flow format */
-            upipe_dvbcsa_bs_enc_set_flow_def_real(upipe, uref);
-        else
-            upipe_dvbcsa_bs_enc_output(upipe, uref, upump_p);
-    }
-
-    /* all buffered urefs has been sent */
-    upipe_release(upipe);
+    upipe_dvbcsa_bs_enc_output_urefs(upipe, upipe_dvbcsa_bs_enc->nb_urefs,
+                                     upump_p);
 }
 
 /** @internal @This is called when maximum latency is reached to flush all
@@ -268,6 +423,84 @@ static void upipe_dvbcsa_bs_enc_worker(struct upump *upump)
     return upipe_dvbcsa_bs_enc_flush(upipe, &upump);
 }
 
+/** @internal @This is called when batches were processed by the pool.
+ *
+ * @param upump pool watcher
+ */
+static void upipe_dvbcsa_bs_enc_pool_worker(struct upump *upump)
+{
+    struct upipe *upipe = upump_get_opaque(upump, struct upipe *);
+    struct upipe_dvbcsa_bs_enc *upipe_dvbcsa_bs_enc =
+        upipe_dvbcsa_bs_enc_from_upipe(upipe);
+
+    upipe_dvbcsa_bs_pool_ack(upipe_dvbcsa_bs_enc->pool);
+    upipe_dvbcsa_bs_enc_output_jobs(upipe, &upump);
+}
+
+/** @internal @This retains a uref until the batch covering it is processed.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref uref to retain
+ */
+static void upipe_dvbcsa_bs_enc_hold(struct upipe *upipe, struct uref *uref)
+{
+    struct upipe_dvbcsa_bs_enc *upipe_dvbcsa_bs_enc =
+        upipe_dvbcsa_bs_enc_from_upipe(upipe);
+    struct upipe_dvbcsa_common *common =
+        upipe_dvbcsa_bs_enc_to_common(upipe_dvbcsa_bs_enc);
+
+    if (upipe_dvbcsa_bs_enc_check_input(upipe))
+        /* make sure to send all buffered urefs */
+        upipe_use(upipe);
+    upipe_dvbcsa_bs_enc_hold_input(upipe, uref);
+    if (!upipe_dvbcsa_bs_enc->upump)
+        upipe_dvbcsa_bs_enc_wait_upump(upipe, common->latency,
+                                       upipe_dvbcsa_bs_enc_worker);
+}
+
+/** @internal @This adapts the batch size to the rate of the packets to
+ * scramble, so that filling a batch takes at most half of the maximum latency.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref packet to scramble
+ */
+static void upipe_dvbcsa_bs_enc_adapt(struct upipe *upipe, struct uref *uref)
+{
+    struct upipe_dvbcsa_bs_enc *upipe_dvbcsa_bs_enc =
+        upipe_dvbcsa_bs_enc_from_upipe(upipe);
+    struct upipe_dvbcsa_common *common =
+        upipe_dvbcsa_bs_enc_to_common(upipe_dvbcsa_bs_enc);
+
+    uint64_t cr_sys;
+    if (unlikely(!ubase_check(uref_clock_get_cr_sys(uref, &cr_sys))))
+        return;
+
+    /* packets of a datagram share the same date */
+    if (cr_sys == upipe_dvbcsa_bs_enc->last_cr_sys) {
+        upipe_dvbcsa_bs_enc->nb_last++;
+        return;
+    }
+
+    if (upipe_dvbcsa_bs_enc->last_cr_sys != UINT64_MAX &&
+        cr_sys > upipe_dvbcsa_bs_enc->last_cr_sys) {
+        uint64_t interval =
+            (cr_sys - upipe_dvbcsa_bs_enc->last_cr_sys) / upipe_dvbcsa_bs_enc->nb_last;
+        upipe_dvbcsa_bs_enc->interval = upipe_dvbcsa_bs_enc->interval ?
+            (upipe_dvbcsa_bs_enc->interval * 7 + interval) / 8 : interval;
+
+        uint64_t batch_size = upipe_dvbcsa_bs_enc->max_batch_size;
+        if (upipe_dvbcsa_bs_enc->interval)
+            batch_size = common->latency / 2 / upipe_dvbcsa_bs_enc->interval;
+        if (batch_size < 1)
+            batch_size = 1;
+        else if (batch_size > upipe_dvbcsa_bs_enc->max_batch_size)
+            batch_size = upipe_dvbcsa_bs_enc->max_batch_size;
+        upipe_dvbcsa_bs_enc->batch_size = batch_size;
+    }
+    upipe_dvbcsa_bs_enc->last_cr_sys = cr_sys;
+    upipe_dvbcsa_bs_enc->nb_last = 1;
+}
+
 /** @internal @This handles input buffers.
  *
  * @param upipe description structure of the pipe
@@ -290,7 +523,7 @@ static void upipe_dvbcsa_bs_enc_input(struct upipe *upipe,
         if (first)
             upipe_dvbcsa_bs_enc_set_flow_def_real(upipe, uref);
         else
-            upipe_dvbcsa_bs_enc_hold_input(upipe, uref);
+            upipe_dvbcsa_bs_enc_hold(upipe, uref);
         return;
     }
 
@@ -317,7 +550,7 @@ static void upipe_dvbcsa_bs_enc_input(struct upipe *upipe,
         if (first)
             upipe_dvbcsa_bs_enc_output(upipe, uref, upump_p);
         else
-            upipe_dvbcsa_bs_enc_hold_input(upipe, uref);
+            upipe_dvbcsa_bs_enc_hold(upipe, uref);
         return;
     }
 
@@ -371,13 +604,8 @@ static void upipe_dvbcsa_bs_enc_input(struct upipe *upipe,
     upipe_dvbcsa_bs_enc->current++;
 
     /* hold uref */
-    upipe_dvbcsa_bs_enc_hold_input(upipe, uref);
-    if (unlikely(first)) {
-        /* make sure to send all buffered urefs */
-        upipe_use(upipe);
-        upipe_dvbcsa_bs_enc_wait_upump(upipe, common->latency,
-                                       upipe_dvbcsa_bs_enc_worker);
-    }
+    upipe_dvbcsa_bs_enc_adapt(upipe, uref);
+    upipe_dvbcsa_bs_enc_hold(upipe, uref);
 
     /* scramble if we have enough packets */
     if (upipe_dvbcsa_bs_enc->current >= upipe_dvbcsa_bs_enc->batch_size)
@@ -401,6 +629,18 @@ static int upipe_dvbcsa_bs_enc_check(struct upipe *upipe, struct uref *flow_def)
     if (unlikely(!upipe_dvbcsa_bs_enc->upump_mgr))
         return UBASE_ERR_NONE;
 
+    if (upipe_dvbcsa_bs_enc->pool && !upipe_dvbcsa_bs_enc->upump_pool) {
+        struct upump *upump = upipe_dvbcsa_bs_pool_upump_alloc(
+            upipe_dvbcsa_bs_enc->pool, upipe_dvbcsa_bs_enc->upump_mgr,
+            upipe_dvbcsa_bs_enc_pool_worker, upipe, upipe->refcount);
+        if (unlikely(!upump)) {
+            upipe_err(upipe, "can't create pool watcher");
+            return UBASE_ERR_UPUMP;
+        }
+        upipe_dvbcsa_bs_enc_set_upump_pool(upipe, upump);
+        upump_start(upump);
+    }
+
     return UBASE_ERR_NONE;
 }
 
@@ -432,6 +672,10 @@ static int upipe_dvbcsa_bs_enc_set_key(struct upipe *upipe,
     struct upipe_dvbcsa_bs_enc *upipe_dvbcsa_bs_enc =
         upipe_dvbcsa_bs_enc_from_upipe(upipe);
 
+    /* the pending packets are processed with the previous key */
+    if (upipe_dvbcsa_bs_enc->current)
+        upipe_dvbcsa_bs_enc_flush(upipe, NULL);
+
     dvbcsa_bs_key_free(upipe_dvbcsa_bs_enc->key);
     upipe_dvbcsa_bs_enc->key = NULL;
     if (!key)
@@ -445,10 +689,46 @@ static int upipe_dvbcsa_bs_enc_set_key(struct upipe *upipe,
     upipe_dvbcsa_bs_enc->key = dvbcsa_bs_key_alloc();
     UBASE_ALLOC_RETURN(upipe_dvbcsa_bs_enc->key);
     dvbcsa_bs_key_set(cw.value, upipe_dvbcsa_bs_enc->key);
+    memcpy(upipe_dvbcsa_bs_enc->cw, cw.value, sizeof (upipe_dvbcsa_bs_enc->cw));
     return UBASE_ERR_NONE;
 
 }
 
+/** @internal @This sets the number of threads processing the batches.
+ *
+ * @param upipe description structure of the pipe
+ * @param nb_threads number of threads, or 0 to process the batches in the
+ * pipe
+ * @return an error code
+ */
+static int upipe_dvbcsa_bs_enc_set_threads(struct upipe *upipe,
+                                           unsigned nb_threads)
+{
+    struct upipe_dvbcsa_bs_enc *upipe_dvbcsa_bs_enc =
+        upipe_dvbcsa_bs_enc_from_upipe(upipe);
+
+    if (nb_threads == upipe_dvbcsa_bs_enc->nb_threads)
+        return UBASE_ERR_NONE;
+
+    if (upipe_dvbcsa_bs_enc->pool) {
+        /* wait for the submitted batches */
+        upipe_dvbcsa_bs_enc_flush(upipe, NULL);
+        upipe_dvbcsa_bs_enc_set_upump_pool(upipe, NULL);
+        upipe_dvbcsa_bs_pool_free(upipe_dvbcsa_bs_enc->pool);
+        upipe_dvbcsa_bs_enc->pool = NULL;
+        upipe_dvbcsa_bs_enc_output_jobs(upipe, NULL);
+    }
+    upipe_dvbcsa_bs_enc->nb_threads = 0;
+    if (!nb_threads)
+        return UBASE_ERR_NONE;
+
+    upipe_dvbcsa_bs_enc->pool = upipe_dvbcsa_bs_pool_alloc(nb_threads, dvbcsa_bs_encrypt);
+    UBASE_ALLOC_RETURN(upipe_dvbcsa_bs_enc->pool);
+    upipe_dvbcsa_bs_enc->nb_threads = nb_threads;
+    upipe_notice_va(upipe, "processing batches in %u threads", nb_threads);
+    return UBASE_ERR_NONE;
+}
+
 /** @internal @This handles the dvbcsa encryption pipe control commands.
  *
  * @param upipe description structure of the pipe
@@ -481,6 +761,11 @@ static int upipe_dvbcsa_bs_enc_control_real(struct upipe *upipe,
             return upipe_dvbcsa_bs_enc_set_key(upipe, key);
         }
 
+        case UPIPE_DVBCSA_SET_THREADS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_DVBCSA_COMMON_SIGNATURE);
+            unsigned nb_threads = va_arg(args, unsigned);
+            return upipe_dvbcsa_bs_enc_set_threads(upipe, nb_threads);
+        }
         case UPIPE_DVBCSA_ADD_PID:
         case UPIPE_DVBCSA_DEL_PID:
         case UPIPE_DVBCSA_SET_MAX_LATENCY:
@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2026 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short pool of threads processing dvbcsa bitslice batches
+ */
+
+#include <upipe/ubase.h>
+#include <upipe/ulist.h>
+#include <upipe/ueventfd.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "upipe_dvbcsa_bs_pool.h"
+
+/** @internal @This is a thread of the pool. */
+struct upipe_dvbcsa_bs_pool_thread {
+    /** pointer to the pool */
+    struct upipe_dvbcsa_bs_pool *pool;
+    /** thread ID */
+    pthread_t pthread_id;
+    /** key of the thread */
+    dvbcsa_bs_key_t *key;
+    /** control word of the key */
+    dvbcsa_cw_t cw;
+    /** true if the key was set */
+    bool has_cw;
+};
+
+/** @internal @This is the private structure of a pool. */
+struct upipe_dvbcsa_bs_pool {
+    /** mutex protecting the queue and the batches */
+    pthread_mutex_t mutex;
+    /** condition signaled when the queue is not empty */
+    pthread_cond_t cond;
+    /** queue of submitted batches */
+    struct uchain queue;
+    /** true if the threads must exit once the queue is empty */
+    bool exit;
+    /** event signaled when batches are processed */
+    struct ueventfd event;
+    /** dvbcsa function to apply */
+    upipe_dvbcsa_bs_process process;
+    /** number of threads */
+    unsigned nb_threads;
+    /** threads */
+    struct upipe_dvbcsa_bs_pool_thread threads[];
+};
+
+/** @This allocates a batch.
+ *
+ * @param batch_size maximum number of TS packets in the batch
+ * @return pointer to the batch, or NULL in case of allocation failure
+ */
+struct upipe_dvbcsa_bs_job *upipe_dvbcsa_bs_job_alloc(unsigned batch_size)
+{
+    struct upipe_dvbcsa_bs_job *job = malloc(sizeof (*job));
+    if (unlikely(!job))
+        return NULL;
+    uchain_init(&job->uchain);
+    uchain_init(&job->queue);
+    job->batch = malloc((batch_size + 1) * sizeof (struct dvbcsa_bs_batch_s));
+    job->mapped = malloc(batch_size * sizeof (struct uref *));
+    job->count = 0;
+    job->nb_urefs = 0;
+    job->done = false;
+    if (unlikely(!job->batch || !job->mapped)) {
+        upipe_dvbcsa_bs_job_free(job);
+        return NULL;
+    }
+    return job;
+}
+
+/** @This frees a batch.
+ *
+ * @param job pointer to the batch
+ */
+void upipe_dvbcsa_bs_job_free(struct upipe_dvbcsa_bs_job *job)
+{
+    free(job->batch);
+    free(job->mapped);
+    free(job);
+}
+
+/** @internal @This is the main loop of the threads of the pool.
+ *
+ * @param opaque pointer to the thread structure
+ * @return NULL
+ */
+static void *upipe_dvbcsa_bs_pool_run(void *opaque)
+{
+    struct upipe_dvbcsa_bs_pool_thread *thread = opaque;
+    struct upipe_dvbcsa_bs_pool *pool = thread->pool;
+
+    pthread_mutex_lock(&pool->mutex);
+    for ( ; ; ) {
+        struct uchain *uchain;
+        while (!(uchain = ulist_pop(&pool->queue)) && !pool->exit)
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+        if (!uchain)
+            break;
+        pthread_mutex_unlock(&pool->mutex);
+
+        struct upipe_dvbcsa_bs_job *job = upipe_dvbcsa_bs_job_from_queue(uchain);
+        if (!thread->has_cw || memcmp(thread->cw, job->cw, sizeof (job->cw))) {
+            dvbcsa_bs_key_set(job->cw, thread->key);
+            memcpy(thread->cw, job->cw, sizeof (job->cw));
+            thread->has_cw = true;
+        }
+        job->batch[job->count].data = NULL;
+        job->batch[job->count].len = 0;
+        pool->process(thread->key, job->batch, 184);
+
+        pthread_mutex_lock(&pool->mutex);
+        job->done = true;
+        ueventfd_write(&pool->event);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+/** @This allocates a pool and starts its threads.
+ *
+ * @param nb_threads number of threads
+ * @param process dvbcsa function to apply to the batches
+ * @return pointer to the pool, or NULL in case of failure
+ */
+struct upipe_dvbcsa_bs_pool *
+    upipe_dvbcsa_bs_pool_alloc(unsigned nb_threads,
+                               upipe_dvbcsa_bs_process process)
+{
+    if (unlikely(!nb_threads))
+        return NULL;
+
+    struct upipe_dvbcsa_bs_pool *pool =
+        malloc(sizeof (*pool) +
+               nb_threads * sizeof (struct upipe_dvbcsa_bs_pool_thread));
+    if (unlikely(!pool))
+        return NULL;
+
+    if (unlikely(!ueventfd_init(&pool->event, false))) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    ulist_init(&pool->queue);
+    pool->exit = false;
+    pool->process = process;
+    pool->nb_threads = 0;
+
+    for (unsigned i = 0; i < nb_threads; i++) {
+        struct upipe_dvbcsa_bs_pool_thread *thread = &pool->threads[i];
+        thread->pool = pool;
+        thread->has_cw = false;
+        thread->key = dvbcsa_bs_key_alloc();
+        if (unlikely(!thread->key))
+            break;
+        if (unlikely(pthread_create(&thread->pthread_id, NULL,
+                                    upipe_dvbcsa_bs_pool_run, thread))) {
+            dvbcsa_bs_key_free(thread->key);
+            break;
+        }
+        pool->nb_threads++;
+    }
+
+    if (unlikely(pool->nb_threads != nb_threads)) {
+        upipe_dvbcsa_bs_pool_free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/** @This stops the threads of a pool, once all submitted batches are
+ * processed, and frees it.
+ *
+ * @param pool pointer to the pool
+ */
+void upipe_dvbcsa_bs_pool_free(struct upipe_dvbcsa_bs_pool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->exit = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (unsigned i = 0; i < pool->nb_threads; i++) {
+        pthread_join(pool->threads[i].pthread_id, NULL);
+        dvbcsa_bs_key_free(pool->threads[i].key);
+    }
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+    ueventfd_clean(&pool->event);
+    free(pool);
+}
+
+/** @This submits a batch to a pool.
+ *
+ * @param pool pointer to the pool
+ * @param job batch to process
+ */
+void upipe_dvbcsa_bs_pool_submit(struct upipe_dvbcsa_bs_pool *pool,
+                                 struct upipe_dvbcsa_bs_job *job)
+{
+    pthread_mutex_lock(&pool->mutex);
+    job->done = false;
+    ulist_add(&pool->queue, &job->queue);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/** @This checks whether a submitted batch is processed.
+ *
+ * @param pool pointer to the pool
+ * @param job submitted batch
+ * @return true if the batch is processed
+ */
+bool upipe_dvbcsa_bs_pool_done(struct upipe_dvbcsa_bs_pool *pool,
+                               struct upipe_dvbcsa_bs_job *job)
+{
+    pthread_mutex_lock(&pool->mutex);
+    bool done = job->done;
+    pthread_mutex_unlock(&pool->mutex);
+    return done;
+}
+
+/** @This allocates a watcher triggering when batches of the pool are
+ * processed.
+ *
+ * @param pool pointer to the pool
+ * @param upump_mgr management structure for this event loop
+ * @param cb function to call when the watcher triggers
+ * @param opaque pointer to the module's internal structure
+ * @param refcount pointer to urefcount structure to increment during callback,
+ * or NULL
+ * @return pointer to allocated watcher, or NULL in case of failure
+ */
+struct upump *upipe_dvbcsa_bs_pool_upump_alloc(
+        struct upipe_dvbcsa_bs_pool *pool, struct upump_mgr *upump_mgr,
+        upump_cb cb, void *opaque, struct urefcount *refcount)
+{
+    return ueventfd_upump_alloc(&pool->event, upump_mgr, cb, opaque,
+                                refcount);
+}
+
+/** @This acknowledges the notification of processed batches, before they
+ * are checked.
+ *
+ * @param pool pointer to the pool
+ */
+void upipe_dvbcsa_bs_pool_ack(struct upipe_dvbcsa_bs_pool *pool)
+{
+    ueventfd_read(&pool->event);
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2026 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short pool of threads processing dvbcsa bitslice batches
+ *
+ * The batches are handed out to the first idle thread of the pool. A batch
+ * may complete before batches submitted earlier, so the pipes keep their
+ * input in order and only release it once all the batches covering it are
+ * processed.
+ */
+
+#ifndef _UPIPE_DVBCSA_BS_POOL_H_
+#define _UPIPE_DVBCSA_BS_POOL_H_
+
+#include <upipe/ubase.h>
+#include <upipe/ulist.h>
+#include <upipe/upump.h>
+#include <upipe/uref.h>
+
+#include <dvbcsa/dvbcsa.h>
+
+/** @This is the prototype of dvbcsa_bs_decrypt and dvbcsa_bs_encrypt. */
+typedef void (*upipe_dvbcsa_bs_process)(const struct dvbcsa_bs_key_s *,
+                                        const struct dvbcsa_bs_batch_s *,
+                                        unsigned int);
+
+/** @This is a batch of TS packets processed by a pool. */
+struct upipe_dvbcsa_bs_job {
+    /** link into the list of batches of the pipe */
+    struct uchain uchain;
+    /** link into the queue of the pool */
+    struct uchain queue;
+    /** control word */
+    dvbcsa_cw_t cw;
+    /** batch items, with room for the terminating item */
+    struct dvbcsa_bs_batch_s *batch;
+    /** mapped urefs */
+    struct uref **mapped;
+    /** number of batch items */
+    unsigned count;
+    /** number of retained urefs to output once the batch is processed */
+    unsigned nb_urefs;
+    /** true once the batch is processed, protected by the pool mutex */
+    bool done;
+};
+
+UBASE_FROM_TO(upipe_dvbcsa_bs_job, uchain, uchain, uchain);
+UBASE_FROM_TO(upipe_dvbcsa_bs_job, uchain, queue, queue);
+
+/** @hidden */
+struct upipe_dvbcsa_bs_pool;
+
+/** @This allocates a batch.
+ *
+ * @param batch_size maximum number of TS packets in the batch
+ * @return pointer to the batch, or NULL in case of allocation failure
+ */
+struct upipe_dvbcsa_bs_job *upipe_dvbcsa_bs_job_alloc(unsigned batch_size);
+
+/** @This frees a batch.
+ *
+ * @param job pointer to the batch
+ */
+void upipe_dvbcsa_bs_job_free(struct upipe_dvbcsa_bs_job *job);
+
+/** @This allocates a pool and starts its threads.
+ *
+ * @param nb_threads number of threads
+ * @param process dvbcsa function to apply to the batches
+ * @return pointer to the pool, or NULL in case of failure
+ */
+struct upipe_dvbcsa_bs_pool *
+    upipe_dvbcsa_bs_pool_alloc(unsigned nb_threads,
+                               upipe_dvbcsa_bs_process process);
+
+/** @This stops the threads of a pool, once all submitted batches are
+ * processed, and frees it.
+ *
+ * @param pool pointer to the pool
+ */
+void upipe_dvbcsa_bs_pool_free(struct upipe_dvbcsa_bs_pool *pool);
+
+/** @This submits a batch to a pool.
+ *
+ * @param pool pointer to the pool
+ * @param job batch to process
+ */
+void upipe_dvbcsa_bs_pool_submit(struct upipe_dvbcsa_bs_pool *pool,
+                                 struct upipe_dvbcsa_bs_job *job);
+
+/** @This checks whether a submitted batch is processed.
+ *
+ * @param pool pointer to the pool
+ * @param job submitted batch
+ * @return true if the batch is processed
+ */
+bool upipe_dvbcsa_bs_pool_done(struct upipe_dvbcsa_bs_pool *pool,
+                               struct upipe_dvbcsa_bs_job *job);
+
+/** @This allocates a watcher triggering when batches of the pool are
+ * processed.
+ *
+ * @param pool pointer to the pool
+ * @param upump_mgr management structure for this event loop
+ * @param cb function to call when the watcher triggers
+ * @param opaque pointer to the module's internal structure
+ * @param refcount pointer to urefcount structure to increment during callback,
+ * or NULL
+ * @return pointer to allocated watcher, or NULL in case of failure
+ */
+struct upump *upipe_dvbcsa_bs_pool_upump_alloc(
+        struct upipe_dvbcsa_bs_pool *pool, struct upump_mgr *upump_mgr,
+        upump_cb cb, void *opaque, struct urefcount *refcount);
+
+/** @This acknowledges the notification of processed batches, before they
+ * are checked.
+ *
+ * @param pool pointer to the pool
+ */
+void upipe_dvbcsa_bs_pool_ack(struct upipe_dvbcsa_bs_pool *pool);
+
+#endif
@@ -19,35 +19,62 @@
  * along with this program; if not, write to the Free Software Foundation,
  * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
  */
-
 /** @file
  * @short Upipe common utils for framers
  */
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include <upipe-framers/upipe_framers_common.h>
+#include "upipe_framers_mpeg_scan.h"
+
+#ifdef UPIPE_HAVE_X86_SIMD
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-/** @This scans for an MPEG-style 3-octet start code in a linear buffer.
+/* Code from libav/libavcodec/mpegvideo.c, published under LGPL 2.1+ */
+/** @internal @This feeds the first 3 octets of a linear buffer to the
+ * state, to find a start code spanning the previous buffer.
  *
- * @param p linear buffer
+ * @param p_p pointer to the linear buffer, advanced by 3 octets
  * @param end end of linear buffer
  * @param state state of the algorithm
- * @return pointer to start code, or end if not found
+ * @return true if a start code was found or the buffer is exhausted
  */
-/* Code from libav/libavcodec/mpegvideo.c, published under LGPL 2.1+ */
-const uint8_t *upipe_framers_mpeg_scan(const uint8_t *restrict p,
-                                       const uint8_t *end,
-                                       uint32_t *restrict state)
+static inline bool
+    upipe_framers_mpeg_scan_head(const uint8_t *restrict *p_p,
+                                 const uint8_t *end,
+                                 uint32_t *restrict state)
 {
+    const uint8_t *p = *p_p;
     int i;
     for (i = 0; i < 3; i++) {
         uint32_t tmp = *state << 8;
         *state = tmp + *(p++);
-        if (tmp == 0x100 || p == end)
-            return p;
+        if (tmp == 0x100 || p == end) {
+            *p_p = p;
+            return true;
+        }
     }
+    *p_p = p;
+    return false;
+}
 
+/** @internal @This scans for a start code ending at or after p[-1].
+ *
+ * @param p linear buffer, at least 3 octets after its start
+ * @param end end of linear buffer
+ * @param state state of the algorithm
+ * @return pointer to start code, or end if not found
+ */
+static inline const uint8_t *
+    upipe_framers_mpeg_scan_tail(const uint8_t *restrict p,
+                                 const uint8_t *end,
+                                 uint32_t *restrict state)
+{
     while (p < end) {
         if      (p[-1] > 1      ) p += 3;
         else if (p[-2]          ) p += 2;
@@ -64,5 +91,121 @@ const uint8_t *upipe_framers_mpeg_scan(const uint8_t *restrict p,
 
     return p;
 }
+
+/** @This scans for an MPEG-style 3-octet start code in a linear buffer,
+ * one octet at a time. This is the reference implementation.
+ *
+ * @param p linear buffer
+ * @param end end of linear buffer
+ * @param state state of the algorithm
+ * @return pointer to start code, or end if not found
+ */
+const uint8_t *upipe_framers_mpeg_scan_c(const uint8_t *restrict p,
+                                         const uint8_t *end,
+                                         uint32_t *restrict state)
+{
+    if (upipe_framers_mpeg_scan_head(&p, end, state))
+        return p;
+    return upipe_framers_mpeg_scan_tail(p, end, state);
+}
 /* End code */
 
+#if defined(__SSE2__)
+/** @This scans for an MPEG-style 3-octet start code with SSE2, 16 candidate
+ * positions at a time.
+ *
+ * @param p linear buffer
+ * @param end end of linear buffer
+ * @param state state of the algorithm
+ * @return pointer to start code, or end if not found
+ */
+const uint8_t *upipe_framers_mpeg_scan_sse2(const uint8_t *restrict p,
+                                            const uint8_t *end,
+                                            uint32_t *restrict state)
+{
+    if (upipe_framers_mpeg_scan_head(&p, end, state))
+        return p;
+
+    /* candidates start at p - 3 and need their ID octet in the buffer */
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    for ( ; end - p >= 16; p += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p - 3));
+        __m128i b = _mm_loadu_si128((const __m128i *)(p - 2));
+        __m128i c = _mm_loadu_si128((const __m128i *)(p - 1));
+        __m128i m = _mm_and_si128(
+                _mm_and_si128(_mm_cmpeq_epi8(a, zero),
+                              _mm_cmpeq_epi8(b, zero)),
+                _mm_cmpeq_epi8(c, one));
+        unsigned int mask = _mm_movemask_epi8(m);
+        if (mask) {
+            p += __builtin_ctz(mask) + 1;
+            *state = 0x100 | p[-1];
+            return p;
+        }
+    }
+    return upipe_framers_mpeg_scan_tail(p, end, state);
+}
+#endif
+
+#ifdef UPIPE_HAVE_X86_SIMD
+/** @This scans for an MPEG-style 3-octet start code with AVX2, 32 candidate
+ * positions at a time. The CPU must support the avx2 feature.
+ *
+ * @param p linear buffer
+ * @param end end of linear buffer
+ * @param state state of the algorithm
+ * @return pointer to start code, or end if not found
+ */
+__attribute__((target("avx2")))
+const uint8_t *upipe_framers_mpeg_scan_avx2(const uint8_t *restrict p,
+                                            const uint8_t *end,
+                                            uint32_t *restrict state)
+{
+    if (upipe_framers_mpeg_scan_head(&p, end, state))
+        return p;
+
+    /* candidates start at p - 3 and need their ID octet in the buffer */
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    for ( ; end - p >= 32; p += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p - 3));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p - 2));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(p - 1));
+        __m256i m = _mm256_and_si256(
+                _mm256_and_si256(_mm256_cmpeq_epi8(a, zero),
+                                 _mm256_cmpeq_epi8(b, zero)),
+                _mm256_cmpeq_epi8(c, one));
+        unsigned int mask = _mm256_movemask_epi8(m);
+        if (mask) {
+            p += __builtin_ctz(mask) + 1;
+            *state = 0x100 | p[-1];
+            return p;
+        }
+    }
+    return upipe_framers_mpeg_scan_tail(p, end, state);
+}
+#endif
+
+/** @This scans for an MPEG-style 3-octet start code in a linear buffer,
+ * using SIMD instructions when available.
+ *
+ * @param p linear buffer
+ * @param end end of linear buffer
+ * @param state state of the algorithm
+ * @return pointer to start code, or end if not found
+ */
+const uint8_t *upipe_framers_mpeg_scan(const uint8_t *restrict p,
+                                       const uint8_t *end,
+                                       uint32_t *restrict state)
+{
+#ifdef UPIPE_HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2"))
+        return upipe_framers_mpeg_scan_avx2(p, end, state);
+#endif
+#if defined(__SSE2__)
+    return upipe_framers_mpeg_scan_sse2(p, end, state);
+#else
+    return upipe_framers_mpeg_scan_c(p, end, state);
+#endif
+}
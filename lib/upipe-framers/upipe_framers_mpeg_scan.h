@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2026 OpenHeadend S.A.R.L.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ */
+
+/** @file
+ * @short Upipe internal SIMD implementations of the MPEG start code scan
+ */
+
+#ifndef _UPIPE_FRAMERS_UPIPE_FRAMERS_MPEG_SCAN_H_
+/** @hidden */
+#define _UPIPE_FRAMERS_UPIPE_FRAMERS_MPEG_SCAN_H_
+
+#include <upipe/config.h>
+
+#include <stdint.h>
+
+#ifdef __SSE2__
+/** @This scans for an MPEG-style 3-octet start code with SSE2, 16 candidate
+ * positions at a time.
+ *
+ * @param p linear buffer
+ * @param end end of linear buffer
+ * @param state state of the algorithm
+ * @return pointer to start code, or end if not found
+ */
+const uint8_t *upipe_framers_mpeg_scan_sse2(const uint8_t *restrict p,
+                                            const uint8_t *end,
+                                            uint32_t *restrict state);
+#endif
+
+#ifdef UPIPE_HAVE_X86_SIMD
+/** @This scans for an MPEG-style 3-octet start code with AVX2, 32 candidate
+ * positions at a time. The CPU must support the avx2 feature.
+ *
+ * @param p linear buffer
+ * @param end end of linear buffer
+ * @param state state of the algorithm
+ * @return pointer to start code, or end if not found
+ */
+const uint8_t *upipe_framers_mpeg_scan_avx2(const uint8_t *restrict p,
+                                            const uint8_t *end,
+                                            uint32_t *restrict state);
+#endif
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2015 Arnaud de Turckheim <quarium@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short Upipe internal AES-128 CBC decryption functions
+ */
+
+#ifndef _UPIPE_MODULES_UPIPE_AES_CBC_H_
+/** @hidden */
+#define _UPIPE_MODULES_UPIPE_AES_CBC_H_
+
+#include <upipe/config.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** @This is the state of an AES-128 CBC decryption. */
+struct upipe_aes_cbc {
+    /** round keys */
+    uint8_t round_keys[11][4][4];
+    /** round keys of the equivalent inverse cipher (AES-NI) */
+    uint8_t dec_keys[11][16];
+    /** initialization vector, then last ciphertext block */
+    uint8_t iv[16];
+};
+
+/** @This decrypts consecutive blocks in place. */
+typedef void (*upipe_aes_cbc_decrypt)(struct upipe_aes_cbc *,
+                                      uint8_t *buffer, size_t nb_blocks);
+
+/** @This initializes a CBC decryption state.
+ *
+ * @param cbc decryption state
+ * @param key AES-128 key
+ * @param iv initialization vector
+ */
+void upipe_aes_cbc_init(struct upipe_aes_cbc *cbc, const uint8_t key[16],
+                        const uint8_t iv[16]);
+
+/** @This decrypts consecutive AES blocks in place (portable version).
+ *
+ * @param cbc decryption state
+ * @param buffer the blocks to decrypt inplace
+ * @param nb_blocks number of blocks
+ */
+void upipe_aes_cbc_decrypt_c(struct upipe_aes_cbc *cbc,
+                             uint8_t *buffer, size_t nb_blocks);
+
+#ifdef UPIPE_HAVE_X86_SIMD
+/** @This decrypts consecutive AES blocks in place with AES-NI. The CPU must
+ * support the aes feature.
+ *
+ * @param cbc decryption state
+ * @param buffer the blocks to decrypt inplace
+ * @param nb_blocks number of blocks
+ */
+void upipe_aes_cbc_decrypt_aesni(struct upipe_aes_cbc *cbc,
+                                 uint8_t *buffer, size_t nb_blocks);
+
+/** @This decrypts consecutive AES blocks in place with VAES. The CPU must
+ * support the aes, vaes and avx2 features.
+ *
+ * @param cbc decryption state
+ * @param buffer the blocks to decrypt inplace
+ * @param nb_blocks number of blocks
+ */
+void upipe_aes_cbc_decrypt_vaes(struct upipe_aes_cbc *cbc,
+                                uint8_t *buffer, size_t nb_blocks);
+#endif
+
+#endif
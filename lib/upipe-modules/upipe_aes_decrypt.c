@@ -22,7 +22,6 @@
  */
 
 #include <upipe-modules/upipe_aes_decrypt.h>
-#include <upipe/upipe_helper_uref_stream.h>
 #include <upipe/upipe_helper_input.h>
 #include <upipe/upipe_helper_ubuf_mgr.h>
 #include <upipe/upipe_helper_output.h>
@@ -35,6 +34,12 @@
 #include <upipe/uref_block.h>
 #include <upipe/urefcount.h>
 
+#include "upipe_aes_cbc.h"
+
+#ifdef UPIPE_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
 #define EXPECTED_FLOW_DEF       "block.aes."
 
 /** @internal @This is the private context of an aes pipe. */
@@ -53,12 +58,8 @@ struct upipe_aes_decrypt {
     enum upipe_helper_output_state output_state;
     /** list of output requests */
     struct uchain requests;
-    /** next uref */
-    struct uref *next_uref;
-    /** next uref size */
-    size_t next_uref_size;
-    /** list of uref */
-    struct uchain urefs;
+    /** incomplete block at the end of the previous buffer, or NULL */
+    struct ubuf *remainder;
     /** ubuf manager */
     struct ubuf_mgr *ubuf_mgr;
     /** ubuf manager request */
@@ -76,10 +77,10 @@ struct upipe_aes_decrypt {
 
     /** reset aes state */
     bool restart;
-    /** store round keys */
-    uint8_t round_keys[11][4][4];
-    /** store initialization vector */
-    uint8_t iv[16];
+    /** CBC decryption state */
+    struct upipe_aes_cbc cbc;
+    /** CBC decryption function */
+    upipe_aes_cbc_decrypt cbc_decrypt;
 };
 
 static int upipe_aes_decrypt_check(struct upipe *upipe, struct uref *uref);
@@ -99,8 +100,6 @@ UPIPE_HELPER_UBUF_MGR(upipe_aes_decrypt, ubuf_mgr, flow_format,
                       upipe_aes_decrypt_unregister_output_request);
 UPIPE_HELPER_INPUT(upipe_aes_decrypt, input_urefs, input_nb_urefs,
                    input_max_urefs, blockers, upipe_aes_decrypt_handle);
-UPIPE_HELPER_UREF_STREAM(upipe_aes_decrypt, next_uref, next_uref_size, urefs,
-                         NULL);
 
 static const uint8_t sbox[256] = {
     0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5,
@@ -369,18 +368,170 @@ static inline void aes_xor_iv(uint8_t state[4][4],
             state[i][j] ^= iv[i * 4 + j];
 }
 
-/** @internal @This decrypts an AES block.
+/** @This decrypts consecutive AES blocks in place (portable version).
  *
- * @param buffer the block to decrypt inplace
- * @param round_keys the generated round keys
- * @param iv the initialization vector
+ * @param cbc decryption state
+ * @param buffer the blocks to decrypt inplace
+ * @param nb_blocks number of blocks
+ */
+void upipe_aes_cbc_decrypt_c(struct upipe_aes_cbc *cbc,
+                             uint8_t *buffer, size_t nb_blocks)
+{
+    for (size_t i = 0; i < nb_blocks; i++, buffer += 16) {
+        uint8_t iv[16];
+        memcpy(iv, buffer, sizeof (iv));
+        aes_inv_cipher((uint8_t (*)[])buffer, cbc->round_keys);
+        aes_xor_iv((uint8_t (*)[])buffer, cbc->iv);
+        memcpy(cbc->iv, iv, sizeof (iv));
+    }
+}
+
+#ifdef UPIPE_HAVE_X86_SIMD
+/** @internal @This derives the round keys of the equivalent inverse cipher
+ * from the round keys.
+ *
+ * @param cbc decryption state
+ */
+__attribute__((target("aes,sse2")))
+static void aes_aesni_dec_keys(struct upipe_aes_cbc *cbc)
+{
+    _mm_storeu_si128((__m128i *)cbc->dec_keys[0],
+        _mm_loadu_si128((const __m128i *)cbc->round_keys[10]));
+    for (unsigned i = 1; i < 10; i++)
+        _mm_storeu_si128((__m128i *)cbc->dec_keys[i],
+            _mm_aesimc_si128(_mm_loadu_si128(
+                (const __m128i *)cbc->round_keys[10 - i])));
+    _mm_storeu_si128((__m128i *)cbc->dec_keys[10],
+        _mm_loadu_si128((const __m128i *)cbc->round_keys[0]));
+}
+
+/** @This decrypts consecutive AES blocks in place with AES-NI, four blocks
+ * at a time.
+ *
+ * @param cbc decryption state
+ * @param buffer the blocks to decrypt inplace
+ * @param nb_blocks number of blocks
+ */
+__attribute__((target("aes,sse2")))
+void upipe_aes_cbc_decrypt_aesni(struct upipe_aes_cbc *cbc,
+                                 uint8_t *buffer, size_t nb_blocks)
+{
+    __m128i k[11];
+    for (unsigned i = 0; i < 11; i++)
+        k[i] = _mm_loadu_si128((const __m128i *)cbc->dec_keys[i]);
+    __m128i iv = _mm_loadu_si128((const __m128i *)cbc->iv);
+    __m128i *p = (__m128i *)buffer;
+
+    for ( ; nb_blocks >= 4; nb_blocks -= 4, p += 4) {
+        __m128i c0 = _mm_loadu_si128(p);
+        __m128i c1 = _mm_loadu_si128(p + 1);
+        __m128i c2 = _mm_loadu_si128(p + 2);
+        __m128i c3 = _mm_loadu_si128(p + 3);
+        __m128i x0 = _mm_xor_si128(c0, k[0]);
+        __m128i x1 = _mm_xor_si128(c1, k[0]);
+        __m128i x2 = _mm_xor_si128(c2, k[0]);
+        __m128i x3 = _mm_xor_si128(c3, k[0]);
+        for (unsigned i = 1; i < 10; i++) {
+            x0 = _mm_aesdec_si128(x0, k[i]);
+            x1 = _mm_aesdec_si128(x1, k[i]);
+            x2 = _mm_aesdec_si128(x2, k[i]);
+            x3 = _mm_aesdec_si128(x3, k[i]);
+        }
+        x0 = _mm_aesdeclast_si128(x0, k[10]);
+        x1 = _mm_aesdeclast_si128(x1, k[10]);
+        x2 = _mm_aesdeclast_si128(x2, k[10]);
+        x3 = _mm_aesdeclast_si128(x3, k[10]);
+        _mm_storeu_si128(p, _mm_xor_si128(x0, iv));
+        _mm_storeu_si128(p + 1, _mm_xor_si128(x1, c0));
+        _mm_storeu_si128(p + 2, _mm_xor_si128(x2, c1));
+        _mm_storeu_si128(p + 3, _mm_xor_si128(x3, c2));
+        iv = c3;
+    }
+
+    for ( ; nb_blocks; nb_blocks--, p++) {
+        __m128i c = _mm_loadu_si128(p);
+        __m128i x = _mm_xor_si128(c, k[0]);
+        for (unsigned i = 1; i < 10; i++)
+            x = _mm_aesdec_si128(x, k[i]);
+        x = _mm_aesdeclast_si128(x, k[10]);
+        _mm_storeu_si128(p, _mm_xor_si128(x, iv));
+        iv = c;
+    }
+    _mm_storeu_si128((__m128i *)cbc->iv, iv);
+}
+
+/** @This decrypts consecutive AES blocks in place with VAES, eight blocks
+ * at a time.
+ *
+ * @param cbc decryption state
+ * @param buffer the blocks to decrypt inplace
+ * @param nb_blocks number of blocks
+ */
+__attribute__((target("vaes,avx2,aes")))
+void upipe_aes_cbc_decrypt_vaes(struct upipe_aes_cbc *cbc,
+                                uint8_t *buffer, size_t nb_blocks)
+{
+    __m256i k[11];
+    for (unsigned i = 0; i < 11; i++)
+        k[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128(
+                (const __m128i *)cbc->dec_keys[i]));
+    __m128i iv = _mm_loadu_si128((const __m128i *)cbc->iv);
+    uint8_t *p = buffer;
+
+    for ( ; nb_blocks >= 8; nb_blocks -= 8, p += 128) {
+        __m256i c0 = _mm256_loadu_si256((const __m256i *)p);
+        __m256i c1 = _mm256_loadu_si256((const __m256i *)(p + 32));
+        __m256i c2 = _mm256_loadu_si256((const __m256i *)(p + 64));
+        __m256i c3 = _mm256_loadu_si256((const __m256i *)(p + 96));
+        /* previous ciphertext blocks, loaded before anything is written */
+        __m256i v0 = _mm256_set_m128i(_mm_loadu_si128((const __m128i *)p),
+                                      iv);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(p + 16));
+        __m256i v2 = _mm256_loadu_si256((const __m256i *)(p + 48));
+        __m256i v3 = _mm256_loadu_si256((const __m256i *)(p + 80));
+        iv = _mm_loadu_si128((const __m128i *)(p + 112));
+
+        __m256i x0 = _mm256_xor_si256(c0, k[0]);
+        __m256i x1 = _mm256_xor_si256(c1, k[0]);
+        __m256i x2 = _mm256_xor_si256(c2, k[0]);
+        __m256i x3 = _mm256_xor_si256(c3, k[0]);
+        for (unsigned i = 1; i < 10; i++) {
+            x0 = _mm256_aesdec_epi128(x0, k[i]);
+            x1 = _mm256_aesdec_epi128(x1, k[i]);
+            x2 = _mm256_aesdec_epi128(x2, k[i]);
+            x3 = _mm256_aesdec_epi128(x3, k[i]);
+        }
+        x0 = _mm256_aesdeclast_epi128(x0, k[10]);
+        x1 = _mm256_aesdeclast_epi128(x1, k[10]);
+        x2 = _mm256_aesdeclast_epi128(x2, k[10]);
+        x3 = _mm256_aesdeclast_epi128(x3, k[10]);
+        _mm256_storeu_si256((__m256i *)p, _mm256_xor_si256(x0, v0));
+        _mm256_storeu_si256((__m256i *)(p + 32), _mm256_xor_si256(x1, v1));
+        _mm256_storeu_si256((__m256i *)(p + 64), _mm256_xor_si256(x2, v2));
+        _mm256_storeu_si256((__m256i *)(p + 96), _mm256_xor_si256(x3, v3));
+    }
+    _mm_storeu_si128((__m128i *)cbc->iv, iv);
+
+    if (nb_blocks)
+        upipe_aes_cbc_decrypt_aesni(cbc, p, nb_blocks);
+}
+#endif
+
+/** @This initializes a CBC decryption state.
+ *
+ * @param cbc decryption state
+ * @param key AES-128 key
+ * @param iv initialization vector
  */
-static inline void aes_cbc_decrypt(uint8_t buffer[16],
-                                   uint8_t round_keys[11][4][4],
-                                   const uint8_t iv[16])
+void upipe_aes_cbc_init(struct upipe_aes_cbc *cbc, const uint8_t key[16],
+                        const uint8_t iv[16])
 {
-    aes_inv_cipher((uint8_t (*)[])buffer, round_keys);
-    aes_xor_iv((uint8_t (*)[])buffer, iv);
+    aes_key_expansion(key, cbc->round_keys);
+#ifdef UPIPE_HAVE_X86_SIMD
+    if (__builtin_cpu_supports("aes"))
+        aes_aesni_dec_keys(cbc);
+#endif
+    memcpy(cbc->iv, iv, sizeof (cbc->iv));
 }
 
 /** @internal @This allocates an aes decryption pipe.
@@ -408,9 +559,17 @@ static struct upipe *upipe_aes_decrypt_alloc(struct upipe_mgr *mgr,
     upipe_aes_decrypt_init_output(upipe);
     upipe_aes_decrypt_init_ubuf_mgr(upipe);
     upipe_aes_decrypt_init_input(upipe);
-    upipe_aes_decrypt_init_uref_stream(upipe);
+    upipe_aes_decrypt->remainder = NULL;
     upipe_aes_decrypt->input_flow_def = NULL;
     upipe_aes_decrypt->restart = true;
+    upipe_aes_decrypt->cbc_decrypt = upipe_aes_cbc_decrypt_c;
+#ifdef UPIPE_HAVE_X86_SIMD
+    if (__builtin_cpu_supports("aes"))
+        upipe_aes_decrypt->cbc_decrypt = upipe_aes_cbc_decrypt_aesni;
+    if (__builtin_cpu_supports("aes") && __builtin_cpu_supports("vaes") &&
+        __builtin_cpu_supports("avx2"))
+        upipe_aes_decrypt->cbc_decrypt = upipe_aes_cbc_decrypt_vaes;
+#endif
 
     upipe_throw_ready(upipe);
 
@@ -428,7 +587,7 @@ static void upipe_aes_decrypt_no_ref(struct upipe *upipe)
 
     upipe_throw_dead(upipe);
     uref_free(upipe_aes_decrypt->input_flow_def);
-    upipe_aes_decrypt_clean_uref_stream(upipe);
+    ubuf_free(upipe_aes_decrypt->remainder);
     upipe_aes_decrypt_clean_input(upipe);
     upipe_aes_decrypt_clean_ubuf_mgr(upipe);
     upipe_aes_decrypt_clean_output(upipe);
@@ -471,87 +630,186 @@ static int upipe_aes_decrypt_restart(struct upipe *upipe)
         return ret;
     }
 
-    aes_key_expansion(key, upipe_aes_decrypt->round_keys);
+    upipe_aes_cbc_init(&upipe_aes_decrypt->cbc, key, iv);
     return UBASE_ERR_NONE;
 }
 
-/** @internal @This outputs the decrypted blocks.
+/** @internal @This decrypts a block straddling several segments of a
+ * buffer.
  *
  * @param upipe description structure of the pipe
- * @param upump_p reference to the pump that generated the buffer
+ * @param ubuf_p reference to the buffer to decrypt in place, replaced by a
+ * copy if one of the segments is shared
+ * @param offset offset of the block in the buffer
+ * @return an error code
  */
-static void upipe_aes_decrypt_worker(struct upipe *upipe,
-                                     struct upump **upump_p)
+static int upipe_aes_decrypt_straddling(struct upipe *upipe,
+                                        struct ubuf **ubuf_p, int offset)
 {
     struct upipe_aes_decrypt *upipe_aes_decrypt =
         upipe_aes_decrypt_from_upipe(upipe);
-
-    if (upipe_aes_decrypt->restart) {
-        if (unlikely(!ubase_check(upipe_aes_decrypt_restart(upipe)))) {
-            upipe_throw_fatal(upipe, UBASE_ERR_INVALID);
-            return;
+    uint8_t block[16];
+    UBASE_RETURN(ubuf_block_extract(*ubuf_p, offset, 16, block))
+    upipe_aes_decrypt->cbc_decrypt(&upipe_aes_decrypt->cbc, block, 1);
+
+    bool merged = false;
+    for (int done = 0; done < 16; ) {
+        int size = 16 - done;
+        uint8_t *buffer;
+        if (unlikely(!ubase_check(ubuf_block_write(*ubuf_p, offset + done,
+                                                   &size, &buffer)))) {
+            if (merged)
+                return UBASE_ERR_INVALID;
+            /* shared segment, write into a copy */
+            merged = true;
+            UBASE_RETURN(ubuf_block_merge(upipe_aes_decrypt->ubuf_mgr,
+                                          ubuf_p, 0, -1))
+            done = 0;
+            continue;
         }
-        upipe_aes_decrypt->restart = false;
+        memcpy(buffer, block + done, size);
+        ubuf_block_unmap(*ubuf_p, offset + done);
+        done += size;
     }
+    return UBASE_ERR_NONE;
+}
 
-    size_t block_size;
-    ubase_assert(uref_block_size(upipe_aes_decrypt->next_uref, &block_size));
-    for (size_t size = block_size; size >= 16; size -= 16) {
-        int ret;
+/** @internal @This decrypts a buffer in place, segment by segment. If a
+ * segment is shared, the buffer is first merged into a new one.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref uref carrying the buffer, whose size is a multiple of 16
+ * @param size size of the buffer
+ * @return an error code
+ */
+static int upipe_aes_decrypt_buffer(struct upipe *upipe, struct uref *uref,
+                                    size_t size)
+{
+    struct upipe_aes_decrypt *upipe_aes_decrypt =
+        upipe_aes_decrypt_from_upipe(upipe);
+    bool merged = false;
+    int offset = 0;
+    while (offset < size) {
+        int segment = -1;
+        uint8_t *buffer;
+        if (unlikely(!ubase_check(uref_block_write(uref, offset, &segment,
+                                                   &buffer)))) {
+            if (merged)
+                return UBASE_ERR_INVALID;
+            /* shared segment, decrypt into a copy */
+            merged = true;
+            UBASE_RETURN(ubuf_block_merge(upipe_aes_decrypt->ubuf_mgr,
+                                          &uref->ubuf, 0, -1))
+            continue;
+        }
 
-        struct uref *uref = upipe_aes_decrypt_extract_uref_stream(upipe, 16);
-        if (unlikely(!uref)) {
-            upipe_throw_fatal(upipe, UBASE_ERR_INVALID);
-            return;
+        int nb_blocks = segment / 16;
+        if (nb_blocks)
+            upipe_aes_decrypt->cbc_decrypt(&upipe_aes_decrypt->cbc, buffer,
+                                           nb_blocks);
+        uref_block_unmap(uref, offset);
+        offset += nb_blocks * 16;
+
+        if (segment % 16) {
+            UBASE_RETURN(upipe_aes_decrypt_straddling(upipe, &uref->ubuf,
+                                                      offset))
+            offset += 16;
         }
+    }
+    return UBASE_ERR_NONE;
+}
 
-        uint8_t iv[16];
-        ret = uref_block_extract(uref, 0, 16, iv);
-        if (unlikely(!ubase_check(ret))) {
+/** @internal @This decrypts and outputs a buffer. The trailing incomplete
+ * block is kept for the next buffer.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref uref carrying the buffer
+ * @param upump_p reference to the pump that generated the buffer
+ */
+static void upipe_aes_decrypt_worker(struct upipe *upipe, struct uref *uref,
+                                     struct upump **upump_p)
+{
+    struct upipe_aes_decrypt *upipe_aes_decrypt =
+        upipe_aes_decrypt_from_upipe(upipe);
+
+    if (upipe_aes_decrypt->restart) {
+        if (unlikely(!ubase_check(upipe_aes_decrypt_restart(upipe)))) {
             uref_free(uref);
             upipe_throw_fatal(upipe, UBASE_ERR_INVALID);
             return;
         }
+        upipe_aes_decrypt->restart = false;
+    }
 
-        struct ubuf *ubuf =
-            ubuf_block_alloc(upipe_aes_decrypt->ubuf_mgr, 16);
-        if (unlikely(!ubuf)) {
+    if (upipe_aes_decrypt->remainder != NULL) {
+        struct ubuf *ubuf = upipe_aes_decrypt->remainder;
+        upipe_aes_decrypt->remainder = NULL;
+        if (unlikely(!ubase_check(ubuf_block_append(ubuf,
+                                                    uref_detach_ubuf(uref))))) {
+            ubuf_free(ubuf);
             uref_free(uref);
             upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
             return;
         }
         uref_attach_ubuf(uref, ubuf);
+    }
+
+    size_t size;
+    if (unlikely(!ubase_check(uref_block_size(uref, &size)))) {
+        uref_free(uref);
+        upipe_throw_fatal(upipe, UBASE_ERR_INVALID);
+        return;
+    }
 
-        int wsize = 16;
-        uint8_t *wbuf;
-        ret = uref_block_write(uref, 0, &wsize, &wbuf);
-        if (unlikely(!ubase_check(ret)) || wsize != 16) {
+    size_t remainder = size % 16;
+    size -= remainder;
+    if (remainder) {
+        /* copy the incomplete block so that the buffer is not shared */
+        uint8_t block[16];
+        struct ubuf *ubuf = NULL;
+        uint8_t *buffer;
+        int wsize = remainder;
+        if (unlikely(!ubase_check(uref_block_extract(uref, size, remainder,
+                                                     block)) ||
+                     (ubuf = ubuf_block_alloc(upipe_aes_decrypt->ubuf_mgr,
+                                              remainder)) == NULL ||
+                     !ubase_check(ubuf_block_write(ubuf, 0, &wsize,
+                                                   &buffer)))) {
+            ubuf_free(ubuf);
             uref_free(uref);
-            upipe_throw_fatal(upipe, UBASE_ERR_INVALID);
+            upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
             return;
         }
-        memcpy(wbuf, iv, wsize);
-        aes_cbc_decrypt(wbuf,
-                        upipe_aes_decrypt->round_keys,
-                        upipe_aes_decrypt->iv);
-        ubase_assert(uref_block_unmap(uref, 0));
-        memcpy(upipe_aes_decrypt->iv, iv, sizeof (upipe_aes_decrypt->iv));
-        upipe_aes_decrypt_output(upipe, uref, upump_p);
+        memcpy(buffer, block, remainder);
+        ubuf_block_unmap(ubuf, 0);
+        upipe_aes_decrypt->remainder = ubuf;
     }
+
+    if (!size) {
+        uref_free(uref);
+        return;
+    }
+    uref_block_resize(uref, 0, size);
+
+    if (unlikely(!ubase_check(upipe_aes_decrypt_buffer(upipe, uref, size)))) {
+        uref_free(uref);
+        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+        return;
+    }
+    upipe_aes_decrypt_output(upipe, uref, upump_p);
 }
 
-/** @internal @This outputs the last block.
+/** @internal @This resets the decryption on a new flow definition.
  *
  * @param upipe description structure of the pipe
- * @param upump_p reference to the pump that generated the buffer
  */
 static void upipe_aes_decrypt_flush(struct upipe *upipe)
 {
     struct upipe_aes_decrypt *upipe_aes_decrypt =
         upipe_aes_decrypt_from_upipe(upipe);
 
-    upipe_aes_decrypt_clean_uref_stream(upipe);
-    upipe_aes_decrypt_init_uref_stream(upipe);
+    ubuf_free(upipe_aes_decrypt->remainder);
+    upipe_aes_decrypt->remainder = NULL;
     upipe_aes_decrypt->restart = true;
 }
 
@@ -573,8 +831,7 @@ static bool upipe_aes_decrypt_handle(struct upipe *upipe,
     if (upipe_aes_decrypt->flow_def == NULL)
         return false;
 
-    upipe_aes_decrypt_append_uref_stream(upipe, uref);
-    upipe_aes_decrypt_worker(upipe, upump_p);
+    upipe_aes_decrypt_worker(upipe, uref, upump_p);
     return true;
 }
 
@@ -702,7 +959,7 @@ static int upipe_aes_decrypt_control(struct upipe *upipe,
     case UPIPE_GET_OUTPUT:
     case UPIPE_SET_OUTPUT:
     case UPIPE_GET_FLOW_DEF:
-        return upipe_aes_decrypt_control(upipe, command, args);
+        return upipe_aes_decrypt_control_output(upipe, command, args);
     case UPIPE_SET_FLOW_DEF: {
         struct uref *flow_def = va_arg(args, struct uref *);
         return upipe_aes_decrypt_set_flow_def(upipe, flow_def);
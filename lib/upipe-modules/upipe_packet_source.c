@@ -0,0 +1,1474 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short Upipe source module for AF_PACKET (TPACKET_V3) mmap rings
+ *
+ * The kernel fills a ring of blocks shared with the process. Each UDP
+ * datagram is output as a ubuf pointing into its block, and a block is
+ * given back to the kernel when all the ubufs pointing into it are freed.
+ */
+
+#define _GNU_SOURCE
+
+#include <upipe/ubase.h>
+#include <upipe/uatomic.h>
+#include <upipe/urefcount.h>
+#include <upipe/upool.h>
+#include <upipe/uprobe.h>
+#include <upipe/uclock.h>
+#include <upipe/uref.h>
+#include <upipe/uref_block_flow.h>
+#include <upipe/uref_clock.h>
+#include <upipe/upump.h>
+#include <upipe/ueventfd.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block.h>
+#include <upipe/ubuf_block_common.h>
+#include <upipe/upipe.h>
+#include <upipe/upipe_helper_upipe.h>
+#include <upipe/upipe_helper_urefcount.h>
+#include <upipe/upipe_helper_urefcount_real.h>
+#include <upipe/upipe_helper_void.h>
+#include <upipe/upipe_helper_uref_mgr.h>
+#include <upipe/upipe_helper_output.h>
+#include <upipe/upipe_helper_upump_mgr.h>
+#include <upipe/upipe_helper_upump.h>
+#include <upipe/upipe_helper_uclock.h>
+#include <upipe/upipe_helper_subpipe.h>
+#include <upipe-modules/upipe_packet_source.h>
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+
+/** default size of a ring block */
+#define PKTSRC_DEFAULT_BLOCK_SIZE   (256 * 1024)
+/** default number of blocks in the ring */
+#define PKTSRC_DEFAULT_BLOCK_NR     64
+/** nominal frame size, only used to check the ring geometry */
+#define PKTSRC_FRAME_SIZE           2048
+/** time after which the kernel hands over a partially filled block, in ms */
+#define PKTSRC_BLOCK_TIMEOUT        1
+/** period of the checks for new blocks while the socket is not polled */
+#define PKTSRC_POLL_PERIOD          (UCLOCK_FREQ * PKTSRC_BLOCK_TIMEOUT / 1000)
+/** depth of the pool of ubuf structures */
+#define PKTSRC_UBUF_POOL_DEPTH      1024
+/** ubuf allocation signature (struct upipe_pktsrc_block *, size_t, size_t) */
+#define UBUF_PKTSRC_ALLOC_RING      UBASE_FOURCC('p','k','t','r')
+
+/** size of the IPv4 header without options */
+#define PKTSRC_IP_HEADER_SIZE       20
+/** size of the UDP header */
+#define PKTSRC_UDP_HEADER_SIZE      8
+
+/** @hidden */
+struct upipe_pktsrc_ring;
+
+/** @internal @This is the state of a block of the ring. */
+struct upipe_pktsrc_block {
+    /** ring containing the block */
+    struct upipe_pktsrc_ring *ring;
+    /** refcount held by the buffers pointing into the block */
+    struct urefcount urefcount;
+    /** true until the block is given back to the kernel */
+    uatomic_uint32_t held;
+    /** block descriptor in the ring */
+    struct tpacket_block_desc *desc;
+};
+
+UBASE_FROM_TO(upipe_pktsrc_block, urefcount, urefcount, urefcount)
+
+/** @internal @This is the mapped ring, which also acts as the ubuf manager
+ * of the buffers pointing into it. */
+struct upipe_pktsrc_ring {
+    /** refcount management structure */
+    struct urefcount urefcount;
+
+    /** mapped ring */
+    uint8_t *map;
+    /** size of the mapping */
+    size_t map_size;
+    /** number of blocks */
+    unsigned int block_nr;
+    /** state of the blocks */
+    struct upipe_pktsrc_block *blocks;
+    /** event signalled when a block is given back while the pipe waits */
+    struct ueventfd event;
+    /** true if the pipe waits for a block to be given back */
+    uatomic_uint32_t waiting;
+
+    /** ubuf pool */
+    struct upool ubuf_pool;
+    /** common management structure */
+    struct ubuf_mgr mgr;
+
+    /** extra space for upool */
+    uint8_t upool_extra[];
+};
+
+UBASE_FROM_TO(upipe_pktsrc_ring, urefcount, urefcount, urefcount)
+UBASE_FROM_TO(upipe_pktsrc_ring, ubuf_mgr, ubuf_mgr, mgr)
+UBASE_FROM_TO(upipe_pktsrc_ring, upool, ubuf_pool, ubuf_pool)
+
+/** @internal @This is a block ubuf pointing into the ring. */
+struct upipe_pktsrc_ubuf {
+    /** block of the ring containing the data */
+    struct upipe_pktsrc_block *block;
+
+    /** common block structure */
+    struct ubuf_block ubuf_block;
+};
+
+UBASE_FROM_TO(upipe_pktsrc_ubuf, ubuf, ubuf, ubuf_block.ubuf)
+
+/** @hidden */
+static int upipe_pktsrc_check(struct upipe *upipe, struct uref *flow_format);
+
+/** @internal @This is the private context of a packet source pipe. */
+struct upipe_pktsrc {
+    /** real refcount management structure */
+    struct urefcount urefcount_real;
+    /** refcount management structure exported to the public structure */
+    struct urefcount urefcount;
+
+    /** uref manager */
+    struct uref_mgr *uref_mgr;
+    /** uref manager request */
+    struct urequest uref_mgr_request;
+
+    /** uclock structure, if not NULL we are in live mode */
+    struct uclock *uclock;
+    /** uclock request */
+    struct urequest uclock_request;
+
+    /** upump manager */
+    struct upump_mgr *upump_mgr;
+    /** read watcher */
+    struct upump *upump;
+    /** watcher of the blocks given back while the socket is not polled */
+    struct upump *upump_wait;
+    /** timer checking for new blocks while the socket is not polled */
+    struct upump *upump_timer;
+    /** true if the socket is not polled until a block is given back */
+    bool waiting;
+
+    /** packet socket descriptor */
+    int fd;
+    /** socket used to join multicast groups */
+    int igmp_fd;
+    /** index of the interface */
+    unsigned int ifindex;
+    /** interface name */
+    char *uri;
+
+    /** configured size of a ring block */
+    unsigned int block_size;
+    /** configured number of blocks */
+    unsigned int block_nr;
+    /** mapped ring */
+    struct upipe_pktsrc_ring *ring;
+    /** index of the next block to read */
+    unsigned int block_idx;
+
+    /** list of output subpipes */
+    struct uchain outputs;
+    /** manager to create output subpipes */
+    struct upipe_mgr sub_mgr;
+
+    /** public upipe structure */
+    struct upipe upipe;
+};
+
+UPIPE_HELPER_UPIPE(upipe_pktsrc, upipe, UPIPE_PKTSRC_SIGNATURE)
+UPIPE_HELPER_UREFCOUNT(upipe_pktsrc, urefcount, upipe_pktsrc_no_input)
+UPIPE_HELPER_UREFCOUNT_REAL(upipe_pktsrc, urefcount_real, upipe_pktsrc_free)
+UPIPE_HELPER_VOID(upipe_pktsrc)
+UPIPE_HELPER_UREF_MGR(upipe_pktsrc, uref_mgr, uref_mgr_request,
+                      upipe_pktsrc_check, upipe_throw_provide_request, NULL)
+UPIPE_HELPER_UCLOCK(upipe_pktsrc, uclock, uclock_request, upipe_pktsrc_check,
+                    upipe_throw_provide_request, NULL)
+UPIPE_HELPER_UPUMP_MGR(upipe_pktsrc, upump_mgr)
+UPIPE_HELPER_UPUMP(upipe_pktsrc, upump, upump_mgr)
+UPIPE_HELPER_UPUMP(upipe_pktsrc, upump_wait, upump_mgr)
+UPIPE_HELPER_UPUMP(upipe_pktsrc, upump_timer, upump_mgr)
+
+/** @internal @This is the private context of an output of a packet source
+ * pipe. */
+struct upipe_pktsrc_output {
+    /** refcount management structure */
+    struct urefcount urefcount;
+    /** structure for double-linked lists */
+    struct uchain uchain;
+
+    /** pipe acting as output */
+    struct upipe *output;
+    /** flow definition packet */
+    struct uref *flow_def;
+    /** output state */
+    enum upipe_helper_output_state output_state;
+    /** list of output requests */
+    struct uchain request_list;
+
+    /** destination uri */
+    char *uri;
+    /** destination address */
+    struct in_addr addr;
+    /** destination port (0 for any port) */
+    uint16_t port;
+
+    /** public upipe structure */
+    struct upipe upipe;
+};
+
+UPIPE_HELPER_UPIPE(upipe_pktsrc_output, upipe, UPIPE_PKTSRC_OUTPUT_SIGNATURE)
+UPIPE_HELPER_UREFCOUNT(upipe_pktsrc_output, urefcount,
+                       upipe_pktsrc_output_free)
+UPIPE_HELPER_VOID(upipe_pktsrc_output)
+UPIPE_HELPER_OUTPUT(upipe_pktsrc_output, output, flow_def, output_state,
+                    request_list)
+
+UPIPE_HELPER_SUBPIPE(upipe_pktsrc, upipe_pktsrc_output, output, sub_mgr,
+                     outputs, uchain)
+
+/** @internal @This gives a block back to the kernel, once the last buffer
+ * pointing into it has been freed. It may run in any thread, so the pipe is
+ * woken up through an event.
+ *
+ * @param urefcount pointer to the urefcount of the block
+ */
+static void upipe_pktsrc_block_free(struct urefcount *urefcount)
+{
+    struct upipe_pktsrc_block *block =
+        upipe_pktsrc_block_from_urefcount(urefcount);
+    /* make sure all reads of the block are done before handing it over */
+    __sync_synchronize();
+    block->desc->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    uatomic_store(&block->held, 0);
+    if (uatomic_load(&block->ring->waiting))
+        ueventfd_write(&block->ring->event);
+}
+
+/** @internal @This allocates a ubuf pointing into a block of the ring.
+ *
+ * @param mgr common management structure
+ * @param signature signature of the allocator
+ * @param args block, offset from the start of the ring, and size
+ * @return pointer to ubuf or NULL in case of allocation error
+ */
+static struct ubuf *upipe_pktsrc_ubuf_alloc(struct ubuf_mgr *mgr,
+                                            uint32_t signature, va_list args)
+{
+    if (unlikely(signature != UBUF_PKTSRC_ALLOC_RING))
+        return NULL;
+
+    struct upipe_pktsrc_block *block =
+        va_arg(args, struct upipe_pktsrc_block *);
+    size_t offset = va_arg(args, size_t);
+    size_t size = va_arg(args, size_t);
+
+    struct upipe_pktsrc_ring *ring = upipe_pktsrc_ring_from_ubuf_mgr(mgr);
+    struct upipe_pktsrc_ubuf *pkt =
+        upool_alloc(&ring->ubuf_pool, struct upipe_pktsrc_ubuf *);
+    if (unlikely(pkt == NULL))
+        return NULL;
+
+    struct ubuf *ubuf = upipe_pktsrc_ubuf_to_ubuf(pkt);
+    ubuf_block_common_init(ubuf, false);
+    ubuf_block_common_set_buffer(ubuf, ring->map);
+    ubuf_block_common_set(ubuf, offset, size);
+    pkt->block = block;
+    urefcount_use(&block->urefcount);
+    return ubuf;
+}
+
+/** @internal @This allocates a new ubuf structure pointing into the same
+ * block as the given ubuf.
+ *
+ * @param ubuf pointer to ubuf
+ * @return pointer to the new ubuf, or NULL in case of allocation error
+ */
+static struct ubuf *upipe_pktsrc_ubuf_alloc_same(struct ubuf *ubuf)
+{
+    struct upipe_pktsrc_ring *ring =
+        upipe_pktsrc_ring_from_ubuf_mgr(ubuf->mgr);
+    struct upipe_pktsrc_ubuf *new_pkt =
+        upool_alloc(&ring->ubuf_pool, struct upipe_pktsrc_ubuf *);
+    if (unlikely(new_pkt == NULL))
+        return NULL;
+
+    struct upipe_pktsrc_ubuf *pkt = upipe_pktsrc_ubuf_from_ubuf(ubuf);
+    struct ubuf *new_ubuf = upipe_pktsrc_ubuf_to_ubuf(new_pkt);
+    ubuf_block_common_init(new_ubuf, false);
+    new_pkt->block = pkt->block;
+    urefcount_use(&new_pkt->block->urefcount);
+    return new_ubuf;
+}
+
+/** @internal @This handles control commands of ubufs pointing into the ring.
+ * The buffers are read-only, as they are shared with the kernel.
+ *
+ * @param ubuf pointer to ubuf
+ * @param command type of command to process
+ * @param args arguments of the command
+ * @return an error code
+ */
+static int upipe_pktsrc_ubuf_control(struct ubuf *ubuf,
+                                     int command, va_list args)
+{
+    switch (command) {
+        case UBUF_DUP: {
+            struct ubuf **new_ubuf_p = va_arg(args, struct ubuf **);
+            assert(new_ubuf_p != NULL);
+            struct ubuf *new_ubuf = upipe_pktsrc_ubuf_alloc_same(ubuf);
+            if (unlikely(new_ubuf == NULL))
+                return UBASE_ERR_ALLOC;
+            if (unlikely(!ubase_check(ubuf_block_common_dup(ubuf,
+                                                            new_ubuf)))) {
+                ubuf_free(new_ubuf);
+                return UBASE_ERR_INVALID;
+            }
+            *new_ubuf_p = new_ubuf;
+            return UBASE_ERR_NONE;
+        }
+        case UBUF_SINGLE:
+            return UBASE_ERR_BUSY;
+
+        case UBUF_SPLICE_BLOCK: {
+            struct ubuf **new_ubuf_p = va_arg(args, struct ubuf **);
+            int offset = va_arg(args, int);
+            int size = va_arg(args, int);
+            assert(new_ubuf_p != NULL);
+            struct ubuf *new_ubuf = upipe_pktsrc_ubuf_alloc_same(ubuf);
+            if (unlikely(new_ubuf == NULL))
+                return UBASE_ERR_ALLOC;
+            if (unlikely(!ubase_check(ubuf_block_common_splice(ubuf,
+                                            new_ubuf, offset, size)))) {
+                ubuf_free(new_ubuf);
+                return UBASE_ERR_INVALID;
+            }
+            *new_ubuf_p = new_ubuf;
+            return UBASE_ERR_NONE;
+        }
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** @internal @This frees a ubuf pointing into the ring.
+ *
+ * @param ubuf pointer to ubuf
+ */
+static void upipe_pktsrc_ubuf_free(struct ubuf *ubuf)
+{
+    struct upipe_pktsrc_ring *ring =
+        upipe_pktsrc_ring_from_ubuf_mgr(ubuf->mgr);
+    struct upipe_pktsrc_ubuf *pkt = upipe_pktsrc_ubuf_from_ubuf(ubuf);
+
+    ubuf_block_common_clean(ubuf);
+    urefcount_release(&pkt->block->urefcount);
+    upool_free(&ring->ubuf_pool, pkt);
+}
+
+/** @internal @This allocates the data structure.
+ *
+ * @param upool pointer to upool
+ * @return pointer to upipe_pktsrc_ubuf or NULL in case of allocation error
+ */
+static void *upipe_pktsrc_ubuf_alloc_inner(struct upool *upool)
+{
+    struct upipe_pktsrc_ring *ring = upipe_pktsrc_ring_from_ubuf_pool(upool);
+    struct upipe_pktsrc_ubuf *pkt = malloc(sizeof(struct upipe_pktsrc_ubuf));
+    if (unlikely(pkt == NULL))
+        return NULL;
+    struct ubuf *ubuf = upipe_pktsrc_ubuf_to_ubuf(pkt);
+    ubuf->mgr = upipe_pktsrc_ring_to_ubuf_mgr(ring);
+    return pkt;
+}
+
+/** @internal @This frees a upipe_pktsrc_ubuf.
+ *
+ * @param upool pointer to upool
+ * @param _pkt pointer to a upipe_pktsrc_ubuf structure to free
+ */
+static void upipe_pktsrc_ubuf_free_inner(struct upool *upool, void *_pkt)
+{
+    free(_pkt);
+}
+
+/** @internal @This unmaps the ring once the pipe and all buffers have
+ * released it.
+ *
+ * @param urefcount pointer to urefcount
+ */
+static void upipe_pktsrc_ring_free(struct urefcount *urefcount)
+{
+    struct upipe_pktsrc_ring *ring =
+        upipe_pktsrc_ring_from_urefcount(urefcount);
+    upool_clean(&ring->ubuf_pool);
+    for (unsigned int i = 0; i < ring->block_nr; i++) {
+        urefcount_clean(&ring->blocks[i].urefcount);
+        uatomic_clean(&ring->blocks[i].held);
+    }
+    uatomic_clean(&ring->waiting);
+    ueventfd_clean(&ring->event);
+    munmap(ring->map, ring->map_size);
+    free(ring->blocks);
+    urefcount_clean(urefcount);
+    free(ring);
+}
+
+/** @internal @This allocates the structure describing a mapped ring.
+ *
+ * @param map mapped ring
+ * @param block_size size of a block
+ * @param block_nr number of blocks
+ * @return pointer to the ring, or NULL in case of allocation error
+ */
+static struct upipe_pktsrc_ring *upipe_pktsrc_ring_alloc(uint8_t *map,
+        unsigned int block_size, unsigned int block_nr)
+{
+    struct upipe_pktsrc_ring *ring =
+        malloc(sizeof(struct upipe_pktsrc_ring) +
+               upool_sizeof(PKTSRC_UBUF_POOL_DEPTH));
+    if (unlikely(ring == NULL))
+        return NULL;
+    ring->blocks = calloc(block_nr, sizeof(struct upipe_pktsrc_block));
+    if (unlikely(ring->blocks == NULL)) {
+        free(ring);
+        return NULL;
+    }
+    if (unlikely(!ueventfd_init(&ring->event, false))) {
+        free(ring->blocks);
+        free(ring);
+        return NULL;
+    }
+    uatomic_init(&ring->waiting, 0);
+
+    ring->map = map;
+    ring->map_size = (size_t)block_size * block_nr;
+    ring->block_nr = block_nr;
+    for (unsigned int i = 0; i < block_nr; i++) {
+        struct upipe_pktsrc_block *block = &ring->blocks[i];
+        block->ring = ring;
+        urefcount_init(&block->urefcount, NULL);
+        uatomic_init(&block->held, 0);
+        block->desc =
+            (struct tpacket_block_desc *)(map + (size_t)i * block_size);
+    }
+
+    urefcount_init(upipe_pktsrc_ring_to_urefcount(ring),
+                   upipe_pktsrc_ring_free);
+    ring->mgr.refcount = upipe_pktsrc_ring_to_urefcount(ring);
+    ring->mgr.signature = UBUF_ALLOC_BLOCK;
+    ring->mgr.ubuf_alloc = upipe_pktsrc_ubuf_alloc;
+    ring->mgr.ubuf_control = upipe_pktsrc_ubuf_control;
+    ring->mgr.ubuf_free = upipe_pktsrc_ubuf_free;
+    ring->mgr.ubuf_mgr_control = NULL;
+    upool_init(&ring->ubuf_pool, ring->mgr.refcount, PKTSRC_UBUF_POOL_DEPTH,
+               ring->upool_extra, upipe_pktsrc_ubuf_alloc_inner,
+               upipe_pktsrc_ubuf_free_inner);
+    return ring;
+}
+
+/** @internal @This rebuilds the BPF filter of the socket so that only the
+ * UDP datagrams for the outputs are received.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_pktsrc_set_filter(struct upipe *upipe)
+{
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+    if (upipe_pktsrc->fd == -1)
+        return;
+
+    unsigned int nb_outputs = 0;
+    struct uchain *uchain;
+    ulist_foreach (&upipe_pktsrc->outputs, uchain)
+        nb_outputs++;
+
+    struct sock_filter *filter = malloc(sizeof(struct sock_filter) *
+                                        (8 + 5 * nb_outputs));
+    if (unlikely(filter == NULL)) {
+        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+        return;
+    }
+
+    /* offsets are relative to the IPv4 header, and the socket only gets
+     * IPv4 packets */
+    unsigned int len = 0;
+    filter[len++] = (struct sock_filter)
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9);
+    filter[len++] = (struct sock_filter)
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 1, 0);
+    filter[len++] = (struct sock_filter)
+        BPF_STMT(BPF_RET | BPF_K, 0);
+    /* fragments are not supported */
+    filter[len++] = (struct sock_filter)
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6);
+    filter[len++] = (struct sock_filter)
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x3fff, 0, 1);
+    filter[len++] = (struct sock_filter)
+        BPF_STMT(BPF_RET | BPF_K, 0);
+    filter[len++] = (struct sock_filter)
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0);
+
+    ulist_foreach (&upipe_pktsrc->outputs, uchain) {
+        struct upipe_pktsrc_output *output =
+            upipe_pktsrc_output_from_uchain(uchain);
+        if (output->uri == NULL)
+            continue;
+
+        filter[len++] = (struct sock_filter)
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 16);
+        filter[len++] = (struct sock_filter)
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(output->addr.s_addr),
+                     0, output->port ? 3 : 1);
+        if (output->port) {
+            filter[len++] = (struct sock_filter)
+                BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2);
+            filter[len++] = (struct sock_filter)
+                BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, output->port, 0, 1);
+        }
+        filter[len++] = (struct sock_filter)
+            BPF_STMT(BPF_RET | BPF_K, UINT32_MAX);
+    }
+    filter[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0);
+
+    struct sock_fprog fprog = { .len = len, .filter = filter };
+    if (unlikely(setsockopt(upipe_pktsrc->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                            &fprog, sizeof(fprog)) < 0)) {
+        /* let everything through, datagrams are checked anyway */
+        upipe_warn_va(upipe, "unable to set filter (%m)");
+        setsockopt(upipe_pktsrc->fd, SOL_SOCKET, SO_DETACH_FILTER, NULL, 0);
+    }
+    free(filter);
+}
+
+/** @internal @This joins a multicast group on the interface.
+ *
+ * @param upipe description structure of the pipe
+ * @param addr address of the group
+ */
+static void upipe_pktsrc_join(struct upipe *upipe, struct in_addr addr)
+{
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+    if (upipe_pktsrc->igmp_fd == -1 || !IN_MULTICAST(ntohl(addr.s_addr)))
+        return;
+
+    struct ip_mreqn mreqn;
+    memset(&mreqn, 0, sizeof(mreqn));
+    mreqn.imr_multiaddr = addr;
+    mreqn.imr_ifindex = upipe_pktsrc->ifindex;
+    if (setsockopt(upipe_pktsrc->igmp_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                   &mreqn, sizeof(mreqn)) < 0 && errno != EADDRINUSE)
+        upipe_warn_va(upipe, "unable to join group %s (%m)",
+                      inet_ntoa(addr));
+}
+
+/** @internal @This leaves a multicast group if no output uses it anymore.
+ *
+ * @param upipe description structure of the pipe
+ * @param addr address of the group
+ */
+static void upipe_pktsrc_leave(struct upipe *upipe, struct in_addr addr)
+{
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+    if (upipe_pktsrc->igmp_fd == -1 || !IN_MULTICAST(ntohl(addr.s_addr)))
+        return;
+
+    struct uchain *uchain;
+    ulist_foreach (&upipe_pktsrc->outputs, uchain) {
+        struct upipe_pktsrc_output *output =
+            upipe_pktsrc_output_from_uchain(uchain);
+        if (output->uri != NULL && output->addr.s_addr == addr.s_addr)
+            return;
+    }
+
+    struct ip_mreqn mreqn;
+    memset(&mreqn, 0, sizeof(mreqn));
+    mreqn.imr_multiaddr = addr;
+    mreqn.imr_ifindex = upipe_pktsrc->ifindex;
+    setsockopt(upipe_pktsrc->igmp_fd, IPPROTO_IP, IP_DROP_MEMBERSHIP,
+               &mreqn, sizeof(mreqn));
+}
+
+/** @internal @This allocates the flow definition of an output subpipe.
+ *
+ * @param upipe description structure of the subpipe
+ */
+static void upipe_pktsrc_output_check_flow_def(struct upipe *upipe)
+{
+    struct upipe_pktsrc_output *upipe_pktsrc_output =
+        upipe_pktsrc_output_from_upipe(upipe);
+    struct upipe_pktsrc *upipe_pktsrc =
+        upipe_pktsrc_from_sub_mgr(upipe->mgr);
+    if (upipe_pktsrc_output->flow_def != NULL ||
+        upipe_pktsrc->uref_mgr == NULL)
+        return;
+
+    struct uref *flow_def =
+        uref_block_flow_alloc_def(upipe_pktsrc->uref_mgr, NULL);
+    if (unlikely(flow_def == NULL)) {
+        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+        return;
+    }
+    upipe_pktsrc_output_store_flow_def(upipe, flow_def);
+}
+
+/** @internal @This allocates an output subpipe of a packet source pipe.
+ *
+ * @param mgr common management structure
+ * @param uprobe structure used to raise events
+ * @param signature signature of the pipe allocator
+ * @param args optional arguments
+ * @return pointer to upipe or NULL in case of allocation error
+ */
+static struct upipe *upipe_pktsrc_output_alloc(struct upipe_mgr *mgr,
+                                               struct uprobe *uprobe,
+                                               uint32_t signature,
+                                               va_list args)
+{
+    if (mgr->signature != UPIPE_PKTSRC_OUTPUT_SIGNATURE)
+        return NULL;
+
+    struct upipe *upipe =
+        upipe_pktsrc_output_alloc_void(mgr, uprobe, signature, args);
+    if (unlikely(upipe == NULL))
+        return NULL;
+
+    struct upipe_pktsrc_output *upipe_pktsrc_output =
+        upipe_pktsrc_output_from_upipe(upipe);
+    upipe_pktsrc_output_init_urefcount(upipe);
+    upipe_pktsrc_output_init_output(upipe);
+    upipe_pktsrc_output->uri = NULL;
+    upipe_pktsrc_output->addr.s_addr = INADDR_ANY;
+    upipe_pktsrc_output->port = 0;
+    upipe_pktsrc_output_init_sub(upipe);
+
+    upipe_throw_ready(upipe);
+    upipe_pktsrc_output_check_flow_def(upipe);
+    return upipe;
+}
+
+/** @internal @This returns the destination uri of an output subpipe.
+ *
+ * @param upipe description structure of the subpipe
+ * @param uri_p filled in with the uri
+ * @return an error code
+ */
+static int upipe_pktsrc_output_get_uri(struct upipe *upipe, const char **uri_p)
+{
+    struct upipe_pktsrc_output *upipe_pktsrc_output =
+        upipe_pktsrc_output_from_upipe(upipe);
+    assert(uri_p != NULL);
+    *uri_p = upipe_pktsrc_output->uri;
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This sets the destination of the datagrams of an output
+ * subpipe.
+ *
+ * @param upipe description structure of the subpipe
+ * @param uri destination, in the form [@]a.b.c.d[:port]
+ * @return an error code
+ */
+static int upipe_pktsrc_output_set_uri(struct upipe *upipe, const char *uri)
+{
+    struct upipe_pktsrc_output *upipe_pktsrc_output =
+        upipe_pktsrc_output_from_upipe(upipe);
+    struct upipe *super = upipe_pktsrc_to_upipe(
+            upipe_pktsrc_from_sub_mgr(upipe->mgr));
+
+    if (upipe_pktsrc_output->uri != NULL) {
+        ubase_clean_str(&upipe_pktsrc_output->uri);
+        upipe_pktsrc_leave(super, upipe_pktsrc_output->addr);
+        upipe_pktsrc_output->addr.s_addr = INADDR_ANY;
+        upipe_pktsrc_output->port = 0;
+    }
+
+    if (uri == NULL) {
+        upipe_pktsrc_set_filter(super);
+        return UBASE_ERR_NONE;
+    }
+
+    const char *host = uri[0] == '@' ? uri + 1 : uri;
+    const char *colon = strchr(host, ':');
+    size_t host_len = colon != NULL ? colon - host : strlen(host);
+    char addr_str[INET_ADDRSTRLEN];
+    struct in_addr addr;
+    unsigned long port = 0;
+    if (host_len >= sizeof(addr_str))
+        goto invalid;
+    memcpy(addr_str, host, host_len);
+    addr_str[host_len] = '\0';
+    if (inet_pton(AF_INET, addr_str, &addr) != 1)
+        goto invalid;
+    if (colon != NULL) {
+        char *end;
+        port = strtoul(colon + 1, &end, 10);
+        if (end == colon + 1 || *end != '\0' || port > UINT16_MAX)
+            goto invalid;
+    }
+
+    upipe_pktsrc_output->uri = strdup(uri);
+    if (unlikely(upipe_pktsrc_output->uri == NULL)) {
+        upipe_pktsrc_set_filter(super);
+        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+        return UBASE_ERR_ALLOC;
+    }
+    upipe_pktsrc_output->addr = addr;
+    upipe_pktsrc_output->port = port;
+    upipe_pktsrc_join(super, addr);
+    upipe_pktsrc_set_filter(super);
+    upipe_notice_va(upipe, "receiving %s", uri);
+    return UBASE_ERR_NONE;
+
+invalid:
+    upipe_pktsrc_set_filter(super);
+    upipe_err_va(upipe, "invalid uri %s", uri);
+    return UBASE_ERR_INVALID;
+}
+
+/** @internal @This processes control commands on an output subpipe of a
+ * packet source pipe.
+ *
+ * @param upipe description structure of the subpipe
+ * @param command type of command to process
+ * @param args arguments of the command
+ * @return an error code
+ */
+static int upipe_pktsrc_output_control(struct upipe *upipe,
+                                       int command, va_list args)
+{
+    UBASE_HANDLED_RETURN(
+        upipe_pktsrc_output_control_super(upipe, command, args));
+    switch (command) {
+        case UPIPE_GET_FLOW_DEF:
+        case UPIPE_GET_OUTPUT:
+        case UPIPE_SET_OUTPUT:
+            return upipe_pktsrc_output_control_output(upipe, command, args);
+
+        case UPIPE_GET_URI: {
+            const char **uri_p = va_arg(args, const char **);
+            return upipe_pktsrc_output_get_uri(upipe, uri_p);
+        }
+        case UPIPE_SET_URI: {
+            const char *uri = va_arg(args, const char *);
+            return upipe_pktsrc_output_set_uri(upipe, uri);
+        }
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** @This frees an output subpipe.
+ *
+ * @param upipe description structure of the subpipe
+ */
+static void upipe_pktsrc_output_free(struct upipe *upipe)
+{
+    struct upipe_pktsrc_output *upipe_pktsrc_output =
+        upipe_pktsrc_output_from_upipe(upipe);
+    struct upipe *super = upipe_pktsrc_to_upipe(
+            upipe_pktsrc_from_sub_mgr(upipe->mgr));
+
+    upipe_throw_dead(upipe);
+
+    bool had_uri = upipe_pktsrc_output->uri != NULL;
+    free(upipe_pktsrc_output->uri);
+    upipe_pktsrc_output->uri = NULL;
+    upipe_pktsrc_output_clean_sub(upipe);
+    if (had_uri) {
+        upipe_pktsrc_leave(super, upipe_pktsrc_output->addr);
+        upipe_pktsrc_set_filter(super);
+    }
+    upipe_pktsrc_output_clean_output(upipe);
+    upipe_pktsrc_output_clean_urefcount(upipe);
+    upipe_pktsrc_output_free_void(upipe);
+}
+
+/** @internal @This initializes the output manager for a packet source pipe.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_pktsrc_init_sub_mgr(struct upipe *upipe)
+{
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+    struct upipe_mgr *sub_mgr = &upipe_pktsrc->sub_mgr;
+    sub_mgr->refcount = upipe_pktsrc_to_urefcount_real(upipe_pktsrc);
+    sub_mgr->signature = UPIPE_PKTSRC_OUTPUT_SIGNATURE;
+    sub_mgr->upipe_alloc = upipe_pktsrc_output_alloc;
+    sub_mgr->upipe_input = NULL;
+    sub_mgr->upipe_control = upipe_pktsrc_output_control;
+    sub_mgr->upipe_mgr_control = NULL;
+}
+
+/** @internal @This allocates a packet source pipe.
+ *
+ * @param mgr common management structure
+ * @param uprobe structure used to raise events
+ * @param signature signature of the pipe allocator
+ * @param args optional arguments
+ * @return pointer to upipe or NULL in case of allocation error
+ */
+static struct upipe *upipe_pktsrc_alloc(struct upipe_mgr *mgr,
+                                        struct uprobe *uprobe,
+                                        uint32_t signature, va_list args)
+{
+    struct upipe *upipe = upipe_pktsrc_alloc_void(mgr, uprobe, signature, args);
+    if (unlikely(upipe == NULL))
+        return NULL;
+
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+    upipe_pktsrc_init_urefcount(upipe);
+    upipe_pktsrc_init_urefcount_real(upipe);
+    upipe_pktsrc_init_sub_mgr(upipe);
+    upipe_pktsrc_init_sub_outputs(upipe);
+    upipe_pktsrc_init_uref_mgr(upipe);
+    upipe_pktsrc_init_uclock(upipe);
+    upipe_pktsrc_init_upump_mgr(upipe);
+    upipe_pktsrc_init_upump(upipe);
+    upipe_pktsrc_init_upump_wait(upipe);
+    upipe_pktsrc_init_upump_timer(upipe);
+    upipe_pktsrc->waiting = false;
+    upipe_pktsrc->fd = -1;
+    upipe_pktsrc->igmp_fd = -1;
+    upipe_pktsrc->ifindex = 0;
+    upipe_pktsrc->uri = NULL;
+    upipe_pktsrc->block_size = PKTSRC_DEFAULT_BLOCK_SIZE;
+    upipe_pktsrc->block_nr = PKTSRC_DEFAULT_BLOCK_NR;
+    upipe_pktsrc->ring = NULL;
+    upipe_pktsrc->block_idx = 0;
+    upipe_throw_ready(upipe);
+    return upipe;
+}
+
+/** @internal @This outputs a datagram received in the ring, if it matches
+ * an output subpipe.
+ *
+ * @param upipe description structure of the pipe
+ * @param block block containing the packet
+ * @param hdr header of the packet
+ * @param now system time of the wakeup
+ */
+static void upipe_pktsrc_input_packet(struct upipe *upipe,
+                                      struct upipe_pktsrc_block *block,
+                                      struct tpacket3_hdr *hdr, uint64_t now)
+{
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+    struct upipe_pktsrc_ring *ring = upipe_pktsrc->ring;
+
+    const struct sockaddr_ll *sll = (const struct sockaddr_ll *)
+        ((uint8_t *)hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+    if (sll->sll_pkttype == PACKET_OUTGOING)
+        return;
+
+    const uint8_t *ip = (const uint8_t *)hdr + hdr->tp_net;
+    uint32_t len = hdr->tp_snaplen;
+    if (unlikely(len < PKTSRC_IP_HEADER_SIZE || (ip[0] >> 4) != 4))
+        return;
+    unsigned int ihl = (ip[0] & 0xf) * 4;
+    unsigned int ip_len = (ip[2] << 8) | ip[3];
+    if (unlikely(ihl < PKTSRC_IP_HEADER_SIZE || ip[9] != IPPROTO_UDP ||
+                 (((ip[6] << 8) | ip[7]) & 0x3fff) ||
+                 ip_len > len || ip_len < ihl + PKTSRC_UDP_HEADER_SIZE))
+        return;
+
+    const uint8_t *udp = ip + ihl;
+    unsigned int udp_len = (udp[4] << 8) | udp[5];
+    if (unlikely(udp_len < PKTSRC_UDP_HEADER_SIZE || udp_len > ip_len - ihl))
+        return;
+
+    uint32_t daddr;
+    memcpy(&daddr, ip + 16, sizeof(daddr));
+    uint16_t dport = (udp[2] << 8) | udp[3];
+
+    struct upipe_pktsrc_output *output = NULL;
+    struct uchain *uchain;
+    ulist_foreach (&upipe_pktsrc->outputs, uchain) {
+        struct upipe_pktsrc_output *candidate =
+            upipe_pktsrc_output_from_uchain(uchain);
+        if (candidate->uri != NULL && candidate->flow_def != NULL &&
+            candidate->addr.s_addr == daddr &&
+            (!candidate->port || candidate->port == dport)) {
+            output = candidate;
+            break;
+        }
+    }
+    if (output == NULL)
+        return;
+
+    struct uref *uref = uref_alloc(upipe_pktsrc->uref_mgr);
+    struct ubuf *ubuf = ubuf_alloc(&ring->mgr, UBUF_PKTSRC_ALLOC_RING, block,
+            (size_t)(udp + PKTSRC_UDP_HEADER_SIZE - ring->map),
+            (size_t)(udp_len - PKTSRC_UDP_HEADER_SIZE));
+    if (unlikely(uref == NULL || ubuf == NULL)) {
+        if (uref != NULL)
+            uref_free(uref);
+        ubuf_free(ubuf);
+        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+        return;
+    }
+    uref_attach_ubuf(uref, ubuf);
+
+    if (upipe_pktsrc->uclock != NULL) {
+        uint64_t real = hdr->tp_sec * UCLOCK_FREQ +
+            hdr->tp_nsec * UCLOCK_FREQ / UINT64_C(1000000000);
+        uint64_t systime = uclock_from_real(upipe_pktsrc->uclock, real);
+        /* the datagram cannot have been received in the future */
+        uref_clock_set_cr_sys(uref,
+                systime != UINT64_MAX && systime <= now ? systime : now);
+    }
+
+    upipe_pktsrc_output_output(upipe_pktsrc_output_to_upipe(output), uref,
+                               &upipe_pktsrc->upump);
+}
+
+/** @internal @This outputs the datagrams of a block handed over by the
+ * kernel.
+ *
+ * @param upipe description structure of the pipe
+ * @param block block to read
+ * @param now system time of the wakeup
+ */
+static void upipe_pktsrc_input_block(struct upipe *upipe,
+                                     struct upipe_pktsrc_block *block,
+                                     uint64_t now)
+{
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+    struct upipe_pktsrc_ring *ring = upipe_pktsrc->ring;
+    struct tpacket_block_desc *desc = block->desc;
+
+    if (unlikely(desc->hdr.bh1.block_status & TP_STATUS_LOSING)) {
+        struct tpacket_stats_v3 stats;
+        socklen_t stats_len = sizeof(stats);
+        if (getsockopt(upipe_pktsrc->fd, SOL_PACKET, PACKET_STATISTICS,
+                       &stats, &stats_len) == 0 && stats.tp_drops)
+            upipe_warn_va(upipe, "%u packets dropped by the kernel",
+                          stats.tp_drops);
+    }
+
+    uatomic_store(&block->held, 1);
+    urefcount_init(&block->urefcount, upipe_pktsrc_block_free);
+
+    struct tpacket3_hdr *hdr = (struct tpacket3_hdr *)
+        ((uint8_t *)desc + desc->hdr.bh1.offset_to_first_pkt);
+    uint32_t num_pkts = desc->hdr.bh1.num_pkts;
+    for (uint32_t i = 0; i < num_pkts; i++) {
+        upipe_pktsrc_input_packet(upipe, block, hdr, now);
+        /* the interface may have been closed during the output */
+        if (unlikely(upipe_pktsrc->ring != ring))
+            break;
+        hdr = (struct tpacket3_hdr *)((uint8_t *)hdr + hdr->tp_next_offset);
+    }
+
+    urefcount_release(&block->urefcount);
+}
+
+/** @hidden */
+static void upipe_pktsrc_worker(struct upump *upump);
+
+/** @internal @This stops polling the socket until a block used downstream
+ * is given back to the kernel.
+ *
+ * @param upipe description structure of the pipe
+ * @param block block used downstream
+ * @param poll true if new blocks may still be handed over by the kernel
+ * @return false if the block was given back in the meantime
+ */
+static bool upipe_pktsrc_wait(struct upipe *upipe,
+                              struct upipe_pktsrc_block *block, bool poll)
+{
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+    struct upipe_pktsrc_ring *ring = upipe_pktsrc->ring;
+
+    uatomic_store(&ring->waiting, 1);
+    /* the block may have been given back before waiting was set */
+    if (unlikely(!uatomic_load(&block->held)))
+        return false;
+
+    if (upipe_pktsrc->upump_wait == NULL) {
+        struct upump *upump_wait =
+            ueventfd_upump_alloc(&ring->event, upipe_pktsrc->upump_mgr,
+                                 upipe_pktsrc_worker, upipe,
+                                 upipe->refcount);
+        if (unlikely(upump_wait == NULL)) {
+            upipe_throw_fatal(upipe, UBASE_ERR_UPUMP);
+            return false;
+        }
+        upipe_pktsrc_set_upump_wait(upipe, upump_wait);
+    }
+    if (poll && upipe_pktsrc->upump_timer == NULL) {
+        struct upump *upump_timer =
+            upump_alloc_timer(upipe_pktsrc->upump_mgr, upipe_pktsrc_worker,
+                              upipe, upipe->refcount, PKTSRC_POLL_PERIOD,
+                              PKTSRC_POLL_PERIOD);
+        if (unlikely(upump_timer == NULL)) {
+            upipe_throw_fatal(upipe, UBASE_ERR_UPUMP);
+            return false;
+        }
+        upipe_pktsrc_set_upump_timer(upipe, upump_timer);
+    }
+
+    upump_start(upipe_pktsrc->upump_wait);
+    if (upipe_pktsrc->upump_timer != NULL) {
+        if (poll)
+            upump_start(upipe_pktsrc->upump_timer);
+        else
+            upump_stop(upipe_pktsrc->upump_timer);
+    }
+    upump_stop(upipe_pktsrc->upump);
+    upipe_pktsrc->waiting = true;
+    return true;
+}
+
+/** @internal @This polls the socket again after waiting.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_pktsrc_resume(struct upipe *upipe)
+{
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+    uatomic_store(&upipe_pktsrc->ring->waiting, 0);
+    if (!upipe_pktsrc->waiting)
+        return;
+
+    upump_stop(upipe_pktsrc->upump_wait);
+    if (upipe_pktsrc->upump_timer != NULL)
+        upump_stop(upipe_pktsrc->upump_timer);
+    upump_start(upipe_pktsrc->upump);
+    upipe_pktsrc->waiting = false;
+}
+
+/** @internal @This releases the watchers used while waiting.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_pktsrc_clean_wait(struct upipe *upipe)
+{
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+    upipe_pktsrc_set_upump_wait(upipe, NULL);
+    upipe_pktsrc_set_upump_timer(upipe, NULL);
+    upipe_pktsrc->waiting = false;
+}
+
+/** @internal @This reads the blocks handed over by the kernel. The socket is
+ * readable as long as the block retired last by the kernel is not given
+ * back, so it is not polled while that block is used downstream.
+ *
+ * @param upump description structure of the watcher
+ */
+static void upipe_pktsrc_worker(struct upump *upump)
+{
+    struct upipe *upipe = upump_get_opaque(upump, struct upipe *);
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+    struct upipe_pktsrc_ring *ring = upipe_pktsrc->ring;
+    uint64_t now = 0; /* to keep gcc quiet */
+    if (upipe_pktsrc->uclock != NULL)
+        now = uclock_now(upipe_pktsrc->uclock);
+    if (upump == upipe_pktsrc->upump_wait)
+        ueventfd_read(&ring->event);
+
+    /* keep the ring mapped if the interface is closed during the output */
+    urefcount_use(upipe_pktsrc_ring_to_urefcount(ring));
+    struct upipe_pktsrc_block *held = NULL;
+    bool poll = false;
+    for (unsigned int i = 0; i < ring->block_nr; i++) {
+        struct upipe_pktsrc_block *block =
+            &ring->blocks[upipe_pktsrc->block_idx];
+        if (unlikely(uatomic_load(&block->held))) {
+            /* the kernel cannot fill the ring past this block */
+            if (!upipe_pktsrc->waiting)
+                upipe_warn(upipe, "ring full, consider enlarging it");
+            held = block;
+            break;
+        }
+
+        if (!(block->desc->hdr.bh1.block_status & TP_STATUS_USER)) {
+            struct upipe_pktsrc_block *prev = &ring->blocks[
+                (upipe_pktsrc->block_idx + ring->block_nr - 1) %
+                ring->block_nr];
+            if (uatomic_load(&prev->held)) {
+                held = prev;
+                poll = true;
+            }
+            break;
+        }
+        __sync_synchronize();
+
+        upipe_pktsrc_input_block(upipe, block, now);
+        if (unlikely(upipe_pktsrc->ring != ring))
+            break;
+        upipe_pktsrc->block_idx = (upipe_pktsrc->block_idx + 1) %
+                                  ring->block_nr;
+    }
+
+    if (likely(upipe_pktsrc->ring == ring) &&
+        (held == NULL || !upipe_pktsrc_wait(upipe, held, poll)))
+        upipe_pktsrc_resume(upipe);
+    urefcount_release(upipe_pktsrc_ring_to_urefcount(ring));
+}
+
+/** @internal @This checks if the pump may be allocated.
+ *
+ * @param upipe description structure of the pipe
+ * @param flow_format amended flow format
+ * @return an error code
+ */
+static int upipe_pktsrc_check(struct upipe *upipe, struct uref *flow_format)
+{
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+    if (flow_format != NULL)
+        uref_free(flow_format);
+
+    upipe_pktsrc_check_upump_mgr(upipe);
+    if (upipe_pktsrc->upump_mgr == NULL)
+        return UBASE_ERR_NONE;
+
+    if (upipe_pktsrc->uref_mgr == NULL) {
+        upipe_pktsrc_require_uref_mgr(upipe);
+        return UBASE_ERR_NONE;
+    }
+
+    struct uchain *uchain;
+    ulist_foreach (&upipe_pktsrc->outputs, uchain) {
+        struct upipe_pktsrc_output *output =
+            upipe_pktsrc_output_from_uchain(uchain);
+        upipe_pktsrc_output_check_flow_def(
+                upipe_pktsrc_output_to_upipe(output));
+    }
+
+    if (upipe_pktsrc->uclock == NULL &&
+        urequest_get_opaque(&upipe_pktsrc->uclock_request, struct upipe *)
+            != NULL)
+        return UBASE_ERR_NONE;
+
+    if (upipe_pktsrc->fd != -1 && upipe_pktsrc->upump == NULL) {
+        struct upump *upump;
+        upump = upump_alloc_fd_read(upipe_pktsrc->upump_mgr,
+                                    upipe_pktsrc_worker, upipe,
+                                    upipe->refcount, upipe_pktsrc->fd);
+        if (unlikely(upump == NULL)) {
+            upipe_throw_fatal(upipe, UBASE_ERR_UPUMP);
+            return UBASE_ERR_UPUMP;
+        }
+        upipe_pktsrc_set_upump(upipe, upump);
+        upump_start(upump);
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This closes the interface. The ring is unmapped when all
+ * buffers pointing into it are released.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_pktsrc_close(struct upipe *upipe)
+{
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+
+    if (upipe_pktsrc->fd != -1) {
+        upipe_notice_va(upipe, "closing interface %s", upipe_pktsrc->uri);
+        ubase_clean_fd(&upipe_pktsrc->fd);
+    }
+    ubase_clean_fd(&upipe_pktsrc->igmp_fd);
+    ubase_clean_str(&upipe_pktsrc->uri);
+    upipe_pktsrc_set_upump(upipe, NULL);
+    upipe_pktsrc_clean_wait(upipe);
+    if (upipe_pktsrc->ring != NULL) {
+        urefcount_release(upipe_pktsrc_ring_to_urefcount(upipe_pktsrc->ring));
+        upipe_pktsrc->ring = NULL;
+    }
+}
+
+/** @internal @This returns the name of the opened interface.
+ *
+ * @param upipe description structure of the pipe
+ * @param uri_p filled in with the name of the interface
+ * @return an error code
+ */
+static int upipe_pktsrc_get_uri(struct upipe *upipe, const char **uri_p)
+{
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+    assert(uri_p != NULL);
+    *uri_p = upipe_pktsrc->uri;
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This opens the given interface and maps its capture ring.
+ *
+ * @param upipe description structure of the pipe
+ * @param uri name of the interface
+ * @return an error code
+ */
+static int upipe_pktsrc_set_uri(struct upipe *upipe, const char *uri)
+{
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+
+    upipe_pktsrc_close(upipe);
+    if (unlikely(uri == NULL))
+        return UBASE_ERR_NONE;
+
+    unsigned int ifindex = if_nametoindex(uri);
+    if (unlikely(ifindex == 0)) {
+        upipe_err_va(upipe, "unknown interface %s", uri);
+        return UBASE_ERR_INVALID;
+    }
+
+    /* no protocol until the socket is bound to the interface */
+    int fd = socket(AF_PACKET, SOCK_DGRAM, 0);
+    if (unlikely(fd == -1)) {
+        upipe_err_va(upipe, "can't open packet socket (%m)");
+        return UBASE_ERR_EXTERNAL;
+    }
+
+    int version = TPACKET_V3;
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = upipe_pktsrc->block_size;
+    req.tp_block_nr = upipe_pktsrc->block_nr;
+    req.tp_frame_size = PKTSRC_FRAME_SIZE;
+    req.tp_frame_nr = req.tp_block_size / req.tp_frame_size * req.tp_block_nr;
+    req.tp_retire_blk_tov = PKTSRC_BLOCK_TIMEOUT;
+    size_t map_size = (size_t)req.tp_block_size * req.tp_block_nr;
+    if (unlikely(setsockopt(fd, SOL_PACKET, PACKET_VERSION,
+                            &version, sizeof(version)) < 0 ||
+                 setsockopt(fd, SOL_PACKET, PACKET_RX_RING,
+                            &req, sizeof(req)) < 0)) {
+        upipe_err_va(upipe, "can't set up TPACKET_V3 ring (%m)");
+        close(fd);
+        return UBASE_ERR_EXTERNAL;
+    }
+
+    uint8_t *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        fd, 0);
+    if (unlikely(map == MAP_FAILED)) {
+        upipe_err_va(upipe, "can't map ring (%m)");
+        close(fd);
+        return UBASE_ERR_EXTERNAL;
+    }
+
+    upipe_pktsrc->ring = upipe_pktsrc_ring_alloc(map, req.tp_block_size,
+                                                 req.tp_block_nr);
+    upipe_pktsrc->uri = strdup(uri);
+    if (unlikely(upipe_pktsrc->ring == NULL || upipe_pktsrc->uri == NULL)) {
+        if (upipe_pktsrc->ring == NULL)
+            munmap(map, map_size);
+        upipe_pktsrc->fd = fd;
+        upipe_pktsrc_close(upipe);
+        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+        return UBASE_ERR_ALLOC;
+    }
+    upipe_pktsrc->fd = fd;
+    upipe_pktsrc->ifindex = ifindex;
+    upipe_pktsrc->block_idx = 0;
+
+#ifdef PACKET_IGNORE_OUTGOING
+    int ignore = 1;
+    setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING,
+               &ignore, sizeof(ignore));
+#endif
+    upipe_pktsrc_set_filter(upipe);
+
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_IP);
+    sll.sll_ifindex = ifindex;
+    if (unlikely(bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0)) {
+        upipe_err_va(upipe, "can't bind to interface %s (%m)", uri);
+        upipe_pktsrc_close(upipe);
+        return UBASE_ERR_EXTERNAL;
+    }
+
+    upipe_pktsrc->igmp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (unlikely(upipe_pktsrc->igmp_fd == -1))
+        upipe_warn_va(upipe, "can't open socket to join groups (%m)");
+    struct uchain *uchain;
+    ulist_foreach (&upipe_pktsrc->outputs, uchain) {
+        struct upipe_pktsrc_output *output =
+            upipe_pktsrc_output_from_uchain(uchain);
+        if (output->uri != NULL)
+            upipe_pktsrc_join(upipe, output->addr);
+    }
+
+    upipe_notice_va(upipe, "opening interface %s", upipe_pktsrc->uri);
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This sets the geometry of the capture ring.
+ *
+ * @param upipe description structure of the pipe
+ * @param block_size size of a ring block
+ * @param block_nr number of blocks
+ * @return an error code
+ */
+static int _upipe_pktsrc_set_ring(struct upipe *upipe,
+                                  unsigned int block_size,
+                                  unsigned int block_nr)
+{
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (unlikely(!block_nr || block_size < PKTSRC_FRAME_SIZE ||
+                 (page_size > 0 && block_size % page_size)))
+        return UBASE_ERR_INVALID;
+    upipe_pktsrc->block_size = block_size;
+    upipe_pktsrc->block_nr = block_nr;
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This processes control commands on a packet source pipe.
+ *
+ * @param upipe description structure of the pipe
+ * @param command type of command to process
+ * @param args arguments of the command
+ * @return an error code
+ */
+static int _upipe_pktsrc_control(struct upipe *upipe,
+                                 int command, va_list args)
+{
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+
+    UBASE_HANDLED_RETURN(upipe_pktsrc_control_outputs(upipe, command, args));
+    switch (command) {
+        case UPIPE_ATTACH_UPUMP_MGR:
+            upipe_pktsrc_set_upump(upipe, NULL);
+            upipe_pktsrc_clean_wait(upipe);
+            return upipe_pktsrc_attach_upump_mgr(upipe);
+        case UPIPE_ATTACH_UCLOCK:
+            upipe_pktsrc_set_upump(upipe, NULL);
+            upipe_pktsrc_clean_wait(upipe);
+            upipe_pktsrc_require_uclock(upipe);
+            return UBASE_ERR_NONE;
+
+        case UPIPE_GET_URI: {
+            const char **uri_p = va_arg(args, const char **);
+            return upipe_pktsrc_get_uri(upipe, uri_p);
+        }
+        case UPIPE_SET_URI: {
+            const char *uri = va_arg(args, const char *);
+            return upipe_pktsrc_set_uri(upipe, uri);
+        }
+        case UPIPE_PKTSRC_GET_RING: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_PKTSRC_SIGNATURE)
+            unsigned int *block_size_p = va_arg(args, unsigned int *);
+            unsigned int *block_nr_p = va_arg(args, unsigned int *);
+            *block_size_p = upipe_pktsrc->block_size;
+            *block_nr_p = upipe_pktsrc->block_nr;
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_PKTSRC_SET_RING: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_PKTSRC_SIGNATURE)
+            unsigned int block_size = va_arg(args, unsigned int);
+            unsigned int block_nr = va_arg(args, unsigned int);
+            return _upipe_pktsrc_set_ring(upipe, block_size, block_nr);
+        }
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** @internal @This processes control commands on a packet source pipe, and
+ * checks the status of the pipe afterwards.
+ *
+ * @param upipe description structure of the pipe
+ * @param command type of command to process
+ * @param args arguments of the command
+ * @return an error code
+ */
+static int upipe_pktsrc_control(struct upipe *upipe, int command, va_list args)
+{
+    UBASE_RETURN(_upipe_pktsrc_control(upipe, command, args));
+
+    return upipe_pktsrc_check(upipe, NULL);
+}
+
+/** @This frees a upipe.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_pktsrc_free(struct upipe *upipe)
+{
+    upipe_pktsrc_close(upipe);
+
+    upipe_throw_dead(upipe);
+
+    upipe_pktsrc_clean_upump_timer(upipe);
+    upipe_pktsrc_clean_upump_wait(upipe);
+    upipe_pktsrc_clean_upump(upipe);
+    upipe_pktsrc_clean_upump_mgr(upipe);
+    upipe_pktsrc_clean_uclock(upipe);
+    upipe_pktsrc_clean_uref_mgr(upipe);
+    upipe_pktsrc_clean_sub_outputs(upipe);
+    upipe_pktsrc_clean_urefcount_real(upipe);
+    upipe_pktsrc_clean_urefcount(upipe);
+    upipe_pktsrc_free_void(upipe);
+}
+
+/** @This is called when there is no external reference to the pipe anymore.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_pktsrc_no_input(struct upipe *upipe)
+{
+    struct upipe_pktsrc *upipe_pktsrc = upipe_pktsrc_from_upipe(upipe);
+    upipe_pktsrc_close(upipe);
+    upipe_pktsrc_throw_sub_outputs(upipe, UPROBE_SOURCE_END);
+    urefcount_release(upipe_pktsrc_to_urefcount_real(upipe_pktsrc));
+}
+
+/** module manager static descriptor */
+static struct upipe_mgr upipe_pktsrc_mgr = {
+    .refcount = NULL,
+    .signature = UPIPE_PKTSRC_SIGNATURE,
+
+    .upipe_alloc = upipe_pktsrc_alloc,
+    .upipe_input = NULL,
+    .upipe_control = upipe_pktsrc_control,
+
+    .upipe_mgr_control = NULL
+};
+
+/** @This returns the management structure for all packet sources.
+ *
+ * @return pointer to manager
+ */
+struct upipe_mgr *upipe_pktsrc_mgr_alloc(void)
+{
+    return &upipe_pktsrc_mgr;
+}
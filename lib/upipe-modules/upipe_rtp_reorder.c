@@ -63,6 +63,11 @@
 #include <math.h>
 #include <assert.h>
 
+/** initial number of slots of the reorder ring */
+#define UPIPE_RTPR_RING_MIN 1024
+/** maximum number of slots of the reorder ring */
+#define UPIPE_RTPR_RING_MAX 16384
+
 /** @hidden */
 static bool upipe_rtpr_sub_output(struct upipe *upipe, struct uref *uref,
                                   struct upump **upump_p);
@@ -95,14 +100,24 @@ struct upipe_rtpr {
 
     /** upump manager */
     struct upump_mgr *upump_mgr;
+    /** output timer */
     struct upump *upump;
-    /** reorder timer */
-    struct upump *upump2;
+    /** date of the output timer */
+    uint64_t deadline;
 
     /** manager to create subs */
     struct upipe_mgr sub_mgr;
 
-    struct uchain queue;
+    /** reorder ring, indexed by sequence number modulo its size */
+    struct uref **ring;
+    /** size of the ring minus one, the size being a power of two */
+    uint16_t ring_mask;
+    /** lowest sequence number in the ring */
+    uint16_t ring_first;
+    /** highest sequence number in the ring */
+    uint16_t ring_last;
+    /** number of urefs in the ring */
+    unsigned int ring_count;
 
     uint64_t last_sent_seqnum;
     uint64_t num_consecutive_late;
@@ -195,6 +210,8 @@ static int upipe_rtpr_sub_set_flow_def(struct upipe *upipe,
 
     flow_def = uref_dup(flow_def);
     UBASE_ALLOC_RETURN(flow_def)
+    if (upipe_rtpr_sub->flow_def != NULL)
+        uref_free(upipe_rtpr_sub->flow_def);
     upipe_rtpr_sub->flow_def = flow_def;
     if (!upipe_rtpr->flow_def) {
         flow_def = uref_dup(flow_def);
@@ -225,6 +242,7 @@ static struct upipe *upipe_rtpr_sub_alloc(struct upipe_mgr *mgr,
     struct upipe_rtpr_sub *upipe_rtpr_sub =
                             upipe_rtpr_sub_from_upipe(upipe);
 
+    upipe_rtpr_sub->flow_def = NULL;
     upipe_rtpr_sub_init_urefcount(upipe);
     upipe_rtpr_sub_init_input(upipe);
     upipe_rtpr_sub_init_sub(upipe);
@@ -263,38 +281,120 @@ static int upipe_rtpr_sub_control(struct upipe *upipe,
     }
 }
 
+/** @internal @This doubles the number of slots of the reorder ring.
+ *
+ * @param upipe description structure of the pipe
+ * @return an error code
+ */
+static int upipe_rtpr_ring_grow(struct upipe *upipe)
+{
+    struct upipe_rtpr *rtpr = upipe_rtpr_from_upipe(upipe);
+    unsigned int size = 2 * ((unsigned int)rtpr->ring_mask + 1);
+    if (size > UPIPE_RTPR_RING_MAX)
+        return UBASE_ERR_BUSY;
+    struct uref **ring = calloc(size, sizeof(struct uref *));
+    if (unlikely(ring == NULL))
+        return UBASE_ERR_ALLOC;
+
+    if (rtpr->ring_count) {
+        uint16_t seqnum = rtpr->ring_first;
+        for ( ; ; seqnum++) {
+            ring[seqnum & (size - 1)] = rtpr->ring[seqnum & rtpr->ring_mask];
+            if (seqnum == rtpr->ring_last)
+                break;
+        }
+    }
+    free(rtpr->ring);
+    rtpr->ring = ring;
+    rtpr->ring_mask = size - 1;
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This outputs the packet with the lowest sequence number.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_rtpr_send(struct upipe *upipe)
+{
+    struct upipe_rtpr *rtpr = upipe_rtpr_from_upipe(upipe);
+    uint16_t seqnum = rtpr->ring_first;
+    struct uref *uref = rtpr->ring[seqnum & rtpr->ring_mask];
+    rtpr->ring[seqnum & rtpr->ring_mask] = NULL;
+
+    if (--rtpr->ring_count) {
+        /* the slot of the highest sequence number is never empty */
+        do
+            rtpr->ring_first++;
+        while (rtpr->ring[rtpr->ring_first & rtpr->ring_mask] == NULL);
+    }
+
+    rtpr->last_sent_seqnum = seqnum;
+    upipe_rtpr_output(upipe, uref, NULL);
+}
+
+/** @hidden */
+static void upipe_rtpr_schedule(struct upipe *upipe);
+
+/** @internal @This outputs the packets whose date has come.
+ *
+ * @param upump description structure of the timer
+ */
 static void upipe_rtpr_timer(struct upump *upump)
 {
     struct upipe *upipe = upump_get_opaque(upump, struct upipe *);
     struct upipe_rtpr *rtpr = upipe_rtpr_from_upipe(upipe);
     uint64_t now = uclock_now(rtpr->uclock);
-    uint64_t date_sys;
-    int type;
-    struct uchain *uchain, *uchain_tmp;
-    struct uref *uref;
 
-    ulist_delete_foreach(&rtpr->queue, uchain, uchain_tmp) {
-        uref = uref_from_uchain(uchain);
-        uref_clock_get_date_sys(uref, &date_sys, &type);
-        uint64_t seqnum = 0;
-        uref_attr_get_priv(uref, &seqnum);
+    upipe_rtpr_set_upump(upipe, NULL);
 
-        if (now >= date_sys || date_sys == UINT64_MAX) {
-            ulist_delete(uchain);
-            upipe_rtpr_output(upipe, uref, NULL);
-            rtpr->last_sent_seqnum = seqnum;
-        }
-        else {
+    while (rtpr->ring_count) {
+        struct uref *uref = rtpr->ring[rtpr->ring_first & rtpr->ring_mask];
+        uint64_t date_sys = UINT64_MAX;
+        int type;
+        uref_clock_get_date_sys(uref, &date_sys, &type);
+        if (now < date_sys && date_sys != UINT64_MAX)
             break;
-        }
+        upipe_rtpr_send(upipe);
     }
+
+    upipe_rtpr_schedule(upipe);
+}
+
+/** @internal @This arms the timer for the date of the packet with the lowest
+ * sequence number, or right away if it has no date.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_rtpr_schedule(struct upipe *upipe)
+{
+    struct upipe_rtpr *rtpr = upipe_rtpr_from_upipe(upipe);
+    if (!rtpr->ring_count) {
+        upipe_rtpr_set_upump(upipe, NULL);
+        return;
+    }
+
+    struct uref *uref = rtpr->ring[rtpr->ring_first & rtpr->ring_mask];
+    uint64_t date_sys = UINT64_MAX;
+    int type;
+    uref_clock_get_date_sys(uref, &date_sys, &type);
+    if (date_sys == UINT64_MAX)
+        date_sys = 0;
+    if (rtpr->upump != NULL && rtpr->deadline <= date_sys)
+        return;
+
+    upipe_rtpr_check_upump_mgr(upipe);
+    if (rtpr->upump_mgr == NULL || rtpr->uclock == NULL)
+        return;
+
+    uint64_t now = uclock_now(rtpr->uclock);
+    rtpr->deadline = date_sys;
+    upipe_rtpr_wait_upump(upipe, date_sys > now ? date_sys - now : 0,
+                          upipe_rtpr_timer);
 }
 
 static void upipe_rtpr_list_add(struct upipe *upipe, struct uref *uref)
 {
     struct upipe_rtpr *rtpr = upipe_rtpr_from_upipe(upipe);
-    int dup = 0, ooo = 0;
-    struct uchain *uchain, *uchain_tmp;
 
     uint8_t rtp_buffer[RTP_HEADER_SIZE];
     const uint8_t *rtp_header = uref_block_peek(uref, 0, RTP_HEADER_SIZE,
@@ -306,7 +406,6 @@ static void upipe_rtpr_list_add(struct upipe *upipe, struct uref *uref)
         return;
     }
     uint16_t new_seqnum = rtp_get_seqnum(rtp_header);
-    uref_attr_set_priv(uref, new_seqnum);
     uref_block_peek_unmap(uref, 0, rtp_buffer, rtp_header);
 
     /* Drop late packets */
@@ -324,46 +423,50 @@ static void upipe_rtpr_list_add(struct upipe *upipe, struct uref *uref)
 
     rtpr->num_consecutive_late = 0;
 
-    /* Remove date_sys for any late packets */
-    ulist_delete_foreach_reverse(&rtpr->queue, uchain, uchain_tmp) {
-        struct uref *cur_uref = uref_from_uchain(uchain);
-        uint64_t seqnum = 0;
-        uref_attr_get_priv(cur_uref, &seqnum);
-
-        if (seq_num_lt(new_seqnum, seqnum)) {
-            if (ulist_is_first(&rtpr->queue, uchain)) {
-                uref_clock_delete_date_sys(uref);
-                ulist_insert(uchain->prev, uchain, uref_to_uchain(uref));
-                ooo = 1;
-                break;
-            }
-            else {
-                struct uref *prev_uref = uref_from_uchain(uchain->prev);
-                uint64_t prev_seqnum = 0;
-                uref_attr_get_priv(prev_uref, &prev_seqnum);
-                if (!seq_num_lt(new_seqnum, prev_seqnum) && !(new_seqnum == prev_seqnum)) {
-                    uref_clock_delete_date_sys(uref);
-                    ulist_insert(uchain->prev, uchain, uref_to_uchain(uref));
-                    ooo = 1;
-                    break;
-                }
+    if (unlikely(rtpr->ring == NULL)) {
+        rtpr->ring = calloc(UPIPE_RTPR_RING_MIN, sizeof(struct uref *));
+        if (unlikely(rtpr->ring == NULL)) {
+            uref_free(uref);
+            upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+            return;
+        }
+        rtpr->ring_mask = UPIPE_RTPR_RING_MIN - 1;
+    }
+
+    /* Make room for packets too far ahead */
+    while (rtpr->ring_count && seq_num_lt(rtpr->ring_last, new_seqnum) &&
+           (uint16_t)(new_seqnum - rtpr->ring_first) > rtpr->ring_mask) {
+        if (!ubase_check(upipe_rtpr_ring_grow(upipe)))
+            upipe_rtpr_send(upipe);
+    }
+
+    if (!rtpr->ring_count) {
+        rtpr->ring_first = rtpr->ring_last = new_seqnum;
+    } else if (seq_num_lt(rtpr->ring_last, new_seqnum)) {
+        rtpr->ring_last = new_seqnum;
+    } else {
+        if (seq_num_lt(new_seqnum, rtpr->ring_first)) {
+            if ((uint16_t)(rtpr->ring_last - new_seqnum) > rtpr->ring_mask) {
+                uref_free(uref);
+                return;
             }
+            rtpr->ring_first = new_seqnum;
         }
         /* Duplicate packet */
-        else if (new_seqnum == seqnum) {
-            dup = 1;
+        else if (rtpr->ring[new_seqnum & rtpr->ring_mask] != NULL) {
             uref_free(uref);
-            break;
+            return;
         }
-        else
-            break;
+
+        /* Remove date_sys for any late packets */
+        uref_clock_delete_date_sys(uref);
     }
 
+    rtpr->ring[new_seqnum & rtpr->ring_mask] = uref;
+    rtpr->ring_count++;
 
-    /* Add to end if normal packet */
-    if (!dup && !ooo) {
-        ulist_add(&rtpr->queue, uref_to_uchain(uref));
-    }
+    if (new_seqnum == rtpr->ring_first)
+        upipe_rtpr_schedule(upipe);
 }
 
 /** @internal @This receives data.
@@ -418,9 +521,12 @@ static void upipe_rtpr_sub_free(struct upipe *upipe)
 
     upipe_throw_dead(upipe);
 
+    if (upipe_rtpr_sub->flow_def != NULL)
+        uref_free(upipe_rtpr_sub->flow_def);
     upipe_rtpr_sub_clean_input(upipe);
     upipe_rtpr_sub_clean_sub(upipe);
     upipe_rtpr_sub_clean_urefcount(upipe);
+    upipe_rtpr_sub_free_void(upipe);
 }
 
 /** @internal @This initializes the output manager for an rtpr sub pipe.
@@ -443,14 +549,15 @@ static void upipe_rtpr_init_sub_mgr(struct upipe *upipe)
 static void upipe_rtpr_clean_queue(struct upipe *upipe)
 {
     struct upipe_rtpr *rtpr = upipe_rtpr_from_upipe(upipe);
-    struct uchain *uchain, *uchain_tmp;
-    struct uref *uref;
 
-    ulist_delete_foreach(&rtpr->queue, uchain, uchain_tmp) {
-        uref = uref_from_uchain(uchain);
-        ulist_delete(uchain);
-        uref_free(uref);
+    if (rtpr->ring != NULL) {
+        for (unsigned int i = 0; i <= rtpr->ring_mask; i++)
+            if (rtpr->ring[i] != NULL)
+                uref_free(rtpr->ring[i]);
+        free(rtpr->ring);
     }
+    rtpr->ring = NULL;
+    rtpr->ring_count = 0;
 }
 
 /** @internal @This allocates a rtpr pipe.
@@ -484,7 +591,10 @@ static struct upipe *upipe_rtpr_alloc(struct upipe_mgr *mgr,
 
     upipe_rtpr->flow_def_input = NULL;
 
-    ulist_init(&upipe_rtpr->queue);
+    upipe_rtpr->ring = NULL;
+    upipe_rtpr->ring_mask = 0;
+    upipe_rtpr->ring_count = 0;
+    upipe_rtpr->deadline = UINT64_MAX;
 
     upipe_rtpr->last_sent_seqnum = UINT64_MAX;
     upipe_rtpr->num_consecutive_late = 0;
@@ -492,12 +602,6 @@ static struct upipe *upipe_rtpr_alloc(struct upipe_mgr *mgr,
 
     upipe_rtpr_check_upump_mgr(upipe);
 
-    upipe_rtpr->upump2 = upump_alloc_timer(upipe_rtpr->upump_mgr,
-                                            upipe_rtpr_timer, upipe, upipe->refcount,
-                                            UCLOCK_FREQ/300, UCLOCK_FREQ/300);
-
-    upump_start(upipe_rtpr->upump2);
-
     upipe_throw_ready(upipe);
     return upipe;
 }
@@ -563,11 +667,14 @@ static int upipe_rtpr_control(struct upipe *upipe, int command, va_list args)
     switch (command) {
         case UPIPE_ATTACH_UPUMP_MGR: {
             upipe_rtpr_set_upump(upipe, NULL);
-            return upipe_rtpr_attach_upump_mgr(upipe);
+            UBASE_RETURN(upipe_rtpr_attach_upump_mgr(upipe))
+            upipe_rtpr_schedule(upipe);
+            return UBASE_ERR_NONE;
         }
         case UPIPE_ATTACH_UCLOCK: {
             upipe_rtpr_set_upump(upipe, NULL);
             upipe_rtpr_require_uclock(upipe);
+            upipe_rtpr_schedule(upipe);
             return UBASE_ERR_NONE;
         }
         case UPIPE_SET_FLOW_DEF: {
@@ -613,14 +720,10 @@ static void upipe_rtpr_free(struct urefcount *urefcount_real)
     upipe_dbg_va(upipe, "releasing pipe %p", upipe);
     upipe_throw_dead(upipe);
 
-    upump_stop(upipe_rtpr->upump2);
-    upump_free(upipe_rtpr->upump2);
     upipe_rtpr_clean_queue(upipe);
 
     upipe_rtpr_clean_uclock(upipe);
     upipe_rtpr_clean_sub_inputs(upipe);
-    if (upipe_rtpr->flow_def != NULL)
-        uref_free(upipe_rtpr->flow_def);
     urefcount_clean(urefcount_real);
 
     upipe_rtpr_clean_upump(upipe);
@@ -28,6 +28,8 @@
  * @short Upipe sink module for udp
  */
 
+#define _GNU_SOURCE
+
 #include <upipe/ubase.h>
 #include <upipe/ulist.h>
 #include <upipe/uprobe.h>
@@ -59,6 +61,8 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 #include <errno.h>
 #include <assert.h>
 
@@ -72,6 +76,11 @@
 #define UDP_DEFAULT_TTL 0
 #define UDP_DEFAULT_PORT 1234
 
+/** maximum number of datagrams sent in a single system call */
+#define UDPSINK_MAX_BATCH 64
+/** maximum payload of a segmentation offload send */
+#define UDPSINK_MAX_GSO 65507
+
 /** @hidden */
 static void upipe_udpsink_watcher(struct upump *upump);
 /** @hidden */
@@ -118,6 +127,13 @@ struct upipe_udpsink {
     /** destination for not-connected socket (size) */
     socklen_t addrlen;
 
+    /** window in which held packets are sent together, or 0 */
+    uint64_t batch_window;
+    /** true if UDP segmentation offload may be used */
+    bool gso;
+    /** batching counters */
+    struct upipe_udpsink_stats stats;
+
     /** public upipe structure */
     struct upipe upipe;
 };
@@ -158,6 +174,9 @@ static struct upipe *upipe_udpsink_alloc(struct upipe_mgr *mgr,
     upipe_udpsink->uri = NULL;
     upipe_udpsink->raw = false;
     upipe_udpsink->addrlen = 0;
+    upipe_udpsink->batch_window = 0;
+    upipe_udpsink->gso = true;
+    memset(&upipe_udpsink->stats, 0, sizeof(upipe_udpsink->stats));
     upipe_throw_ready(upipe);
     return upipe;
 }
@@ -185,6 +204,263 @@ static void upipe_udpsink_poll(struct upipe *upipe)
     }
 }
 
+#ifdef UPIPE_HAVE_SENDMMSG
+/** @internal @This accounts for a send system call.
+ *
+ * @param upipe description structure of the pipe
+ * @param datagrams number of datagrams sent by the call
+ */
+static void upipe_udpsink_count_batch(struct upipe *upipe,
+                                      unsigned int datagrams)
+{
+    struct upipe_udpsink *upipe_udpsink = upipe_udpsink_from_upipe(upipe);
+    unsigned int bucket = 0;
+    while (bucket < UPIPE_UDPSINK_BATCH_BUCKETS - 1 &&
+           datagrams >> (bucket + 1))
+        bucket++;
+    upipe_udpsink->stats.syscalls++;
+    upipe_udpsink->stats.datagrams += datagrams;
+    upipe_udpsink->stats.batch_sizes[bucket]++;
+}
+
+/** @internal @This tries to send a batch of datagrams of the same size with
+ * a single UDP segmentation offload send.
+ *
+ * @param upipe description structure of the pipe
+ * @param msgs message headers of the datagrams
+ * @param nb number of datagrams
+ * @return 1 if the batch was sent or dropped, 0 if it must be sent with
+ * sendmmsg, and -1 if the socket is not writable
+ */
+static int upipe_udpsink_send_gso(struct upipe *upipe, struct mmsghdr *msgs,
+                                  unsigned int nb)
+{
+#ifdef UDP_SEGMENT
+    struct upipe_udpsink *upipe_udpsink = upipe_udpsink_from_upipe(upipe);
+    if (!upipe_udpsink->gso || upipe_udpsink->raw || nb < 2)
+        return 0;
+
+    size_t sizes[nb];
+    size_t total = 0;
+    unsigned int iovlen = 0;
+    for (unsigned int i = 0; i < nb; i++) {
+        sizes[i] = 0;
+        for (unsigned int j = 0; j < msgs[i].msg_hdr.msg_iovlen; j++)
+            sizes[i] += msgs[i].msg_hdr.msg_iov[j].iov_len;
+        /* only the last segment may be shorter */
+        if ((i < nb - 1 && sizes[i] != sizes[0]) || sizes[i] > sizes[0])
+            return 0;
+        total += sizes[i];
+        iovlen += msgs[i].msg_hdr.msg_iovlen;
+    }
+    if (total > UDPSINK_MAX_GSO)
+        return 0;
+
+    /* the iovecs of all datagrams are contiguous */
+    uint8_t control[CMSG_SPACE(sizeof(uint16_t))];
+    memset(control, 0, sizeof(control));
+    struct msghdr msghdr = {
+        .msg_name = upipe_udpsink->addrlen ? &upipe_udpsink->addr : NULL,
+        .msg_namelen = upipe_udpsink->addrlen,
+
+        .msg_iov = msgs[0].msg_hdr.msg_iov,
+        .msg_iovlen = iovlen,
+
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+        .msg_flags = 0,
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msghdr);
+    cmsg->cmsg_level = IPPROTO_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t gso_size = sizes[0];
+    memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+
+    for ( ; ; ) {
+        if (sendmsg(upipe_udpsink->fd, &msghdr, 0) != -1) {
+            upipe_udpsink_count_batch(upipe, nb);
+            upipe_udpsink->stats.gso++;
+            return 1;
+        }
+
+        switch (errno) {
+            case EINTR:
+                continue;
+            case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+            case EWOULDBLOCK:
+#endif
+                return -1;
+            case EIO:
+            case EINVAL:
+            case EOPNOTSUPP:
+            case ENOPROTOOPT:
+                /* the socket or the device does not support it */
+                upipe_notice_va(upipe, "disabling segmentation offload (%m)");
+                upipe_udpsink->gso = false;
+                return 0;
+            default:
+                break;
+        }
+        /* Errors at this point come from ICMP messages such as
+         * "port unreachable", and we do not want to kill the application
+         * with transient errors; the batch is dropped. */
+        return 1;
+    }
+#else
+    return 0;
+#endif
+}
+
+/** @internal @This sends a packet together with the held packets whose
+ * deadline falls within the batching window.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref uref structure of the first packet
+ * @param now current system time, or UINT64_MAX in non-live mode
+ * @return true if the uref was processed
+ */
+static bool upipe_udpsink_output_batch(struct upipe *upipe, struct uref *uref,
+                                       uint64_t now)
+{
+    struct upipe_udpsink *upipe_udpsink = upipe_udpsink_from_upipe(upipe);
+    struct uref *urefs[UDPSINK_MAX_BATCH];
+    unsigned int nb = 0;
+    urefs[nb++] = uref;
+
+    while (nb < UDPSINK_MAX_BATCH && !upipe_udpsink_check_input(upipe)) {
+        struct uref *next =
+            uref_from_uchain(ulist_peek(&upipe_udpsink->urefs));
+        const char *def;
+        if (ubase_check(uref_flow_get_def(next, &def)))
+            break;
+        if (now != UINT64_MAX) {
+            uint64_t systime;
+            if (!ubase_check(uref_clock_get_cr_sys(next, &systime)))
+                break;
+            systime += upipe_udpsink->latency;
+            /* late packets are handled one by one */
+            if (systime > now + upipe_udpsink->batch_window ||
+                now > systime + SYSTIME_PRINT)
+                break;
+        }
+        urefs[nb++] = upipe_udpsink_pop_input(upipe);
+    }
+
+    int iovec_counts[nb];
+    int total = 0;
+    unsigned int valid = 0;
+    for (unsigned int i = 0; i < nb; i++) {
+        int iovec_count = uref_block_iovec_count(urefs[i], 0, -1);
+        if (unlikely(iovec_count <= 0)) {
+            if (iovec_count == -1)
+                upipe_warn(upipe, "cannot read ubuf buffer");
+            uref_free(urefs[i]);
+            continue;
+        }
+        urefs[valid] = urefs[i];
+        iovec_counts[valid++] = iovec_count;
+        total += iovec_count + (upipe_udpsink->raw ? 1 : 0);
+    }
+    nb = valid;
+    if (unlikely(nb == 0))
+        return true;
+
+    struct iovec iovecs[total];
+    uint8_t raw_headers[upipe_udpsink->raw ? nb : 1][RAW_HEADER_SIZE];
+    struct mmsghdr msgs[nb];
+    struct iovec *iovec = iovecs;
+    valid = 0;
+    for (unsigned int i = 0; i < nb; i++) {
+        struct iovec *msg_iovecs = iovec;
+        if (upipe_udpsink->raw) {
+            size_t payload_len = 0;
+            uref_block_size(urefs[i], &payload_len);
+            memcpy(raw_headers[valid], upipe_udpsink->raw_header,
+                   RAW_HEADER_SIZE);
+            udp_raw_set_len(raw_headers[valid], payload_len);
+            iovec->iov_base = raw_headers[valid];
+            iovec->iov_len = RAW_HEADER_SIZE;
+            iovec++;
+        }
+        if (unlikely(!ubase_check(uref_block_iovec_read(urefs[i], 0, -1,
+                                                        iovec)))) {
+            upipe_warn(upipe, "cannot read ubuf buffer");
+            uref_free(urefs[i]);
+            iovec = msg_iovecs;
+            continue;
+        }
+
+        struct msghdr *msghdr = &msgs[valid].msg_hdr;
+        msghdr->msg_name = upipe_udpsink->addrlen ? &upipe_udpsink->addr : NULL;
+        msghdr->msg_namelen = upipe_udpsink->addrlen;
+        msghdr->msg_iov = msg_iovecs;
+        msghdr->msg_iovlen = iovec_counts[i] + (upipe_udpsink->raw ? 1 : 0);
+        msghdr->msg_control = NULL;
+        msghdr->msg_controllen = 0;
+        msghdr->msg_flags = 0;
+        msgs[valid].msg_len = 0;
+        urefs[valid++] = urefs[i];
+        iovec += iovec_counts[i];
+    }
+    nb = valid;
+
+    unsigned int done = 0;
+    int ret = nb ? upipe_udpsink_send_gso(upipe, msgs, nb) : 1;
+    if (ret > 0)
+        done = nb;
+    else if (ret == 0) {
+        while (done < nb) {
+            ret = sendmmsg(upipe_udpsink->fd, msgs + done, nb - done, 0);
+            if (likely(ret > 0)) {
+                upipe_udpsink_count_batch(upipe, ret);
+                done += ret;
+                continue;
+            }
+            if (ret == 0)
+                break;
+
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN
+#if EAGAIN != EWOULDBLOCK
+                || errno == EWOULDBLOCK
+#endif
+               )
+                break;
+            /* Errors at this point come from ICMP messages such as
+             * "port unreachable", and we do not want to kill the application
+             * with transient errors. */
+            done++;
+        }
+    }
+
+    for (unsigned int i = 0; i < nb; i++) {
+        struct iovec *iovec = msgs[i].msg_hdr.msg_iov;
+        if (upipe_udpsink->raw)
+            iovec++;
+        uref_block_iovec_unmap(urefs[i], 0, -1, iovec);
+        if (i < done)
+            uref_free(urefs[i]);
+    }
+
+    if (likely(done == nb))
+        return true;
+
+    /* hold the packets that could not be sent, in order; the caller holds
+     * the first packet if it was not sent */
+    bool held = !done && urefs[0] == uref;
+    for (unsigned int i = nb; i > done + (held ? 1 : 0); i--)
+        upipe_udpsink_unshift_input(upipe, urefs[i - 1]);
+    if (!held)
+        /* the next attempt will find the socket blocked */
+        return true;
+    upipe_udpsink_poll(upipe);
+    return false;
+}
+#endif
+
 /** @internal @This outputs data to the udp sink.
  *
  * @param upipe description structure of the pipe
@@ -246,6 +522,13 @@ static bool upipe_udpsink_output(struct upipe *upipe, struct uref *uref,
                       upipe_udpsink->latency / (UCLOCK_FREQ / 1000));
 
 write_buffer:
+#ifdef UPIPE_HAVE_SENDMMSG
+    if (upipe_udpsink->batch_window)
+        return upipe_udpsink_output_batch(upipe, uref,
+                upipe_udpsink->uclock != NULL ?
+                uclock_now(upipe_udpsink->uclock) : UINT64_MAX);
+#endif
+
     for ( ; ; ) {
         size_t payload_len = 0;
         if (unlikely(!ubase_check(uref_block_size(uref, &payload_len)))) {
@@ -347,14 +630,15 @@ static void upipe_udpsink_watcher(struct upump *upump)
     }
 }
 
-/** @internal @This receives data.
+/** @internal @This receives a datagram.
  *
  * @param upipe description structure of the pipe
  * @param uref uref structure
  * @param upump_p reference to pump that generated the buffer
  */
-static void upipe_udpsink_input(struct upipe *upipe, struct uref *uref,
-                                struct upump **upump_p)
+static void upipe_udpsink_input_datagram(struct upipe *upipe,
+                                         struct uref *uref,
+                                         struct upump **upump_p)
 {
     if (!upipe_udpsink_check_input(upipe)) {
         upipe_udpsink_hold_input(upipe, uref);
@@ -368,6 +652,65 @@ static void upipe_udpsink_input(struct upipe *upipe, struct uref *uref,
     }
 }
 
+/** @internal @This receives data. Bulk blocks are cut into their chunks,
+ * which are sent as individual datagrams at their own date.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref uref structure
+ * @param upump_p reference to pump that generated the buffer
+ */
+static void upipe_udpsink_input(struct upipe *upipe, struct uref *uref,
+                                struct upump **upump_p)
+{
+    uint64_t chunk_size;
+    unsigned int nb_chunks;
+    if (likely(!ubase_check(uref_block_get_chunk_size(uref, &chunk_size)) ||
+               !ubase_check(uref_block_get_chunks(uref, &nb_chunks)) ||
+               !chunk_size || !nb_chunks)) {
+        upipe_udpsink_input_datagram(upipe, uref, upump_p);
+        return;
+    }
+
+    uint64_t *delays = malloc(nb_chunks * sizeof(uint64_t));
+    if (unlikely(delays == NULL)) {
+        uref_free(uref);
+        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+        return;
+    }
+    for (unsigned int i = 0; i < nb_chunks; i++)
+        uref_block_get_chunk_delay(uref, i, &delays[i]);
+    /* do not duplicate the side table in every chunk */
+    uref_block_delete_chunk_size(uref);
+    uref_block_delete_chunk_delays(uref);
+
+    uint64_t cr_sys = UINT64_MAX;
+    uref_clock_get_cr_sys(uref, &cr_sys);
+    for (unsigned int i = 0; i < nb_chunks; i++) {
+        struct uref *chunk;
+        if (i < nb_chunks - 1) {
+            chunk = uref_block_splice(uref, i * chunk_size, chunk_size);
+            if (unlikely(chunk == NULL)) {
+                free(delays);
+                uref_free(uref);
+                upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+                return;
+            }
+        } else {
+            chunk = uref;
+            if (unlikely(!ubase_check(uref_block_resize(chunk,
+                                i * chunk_size, -1)))) {
+                upipe_warn(upipe, "unable to resize last chunk, dropping");
+                uref_free(chunk);
+                break;
+            }
+        }
+        if (cr_sys != UINT64_MAX)
+            uref_clock_set_cr_sys(chunk, cr_sys + delays[i]);
+        upipe_udpsink_input_datagram(upipe, chunk, upump_p);
+    }
+    free(delays);
+}
+
 /** @internal @This sets the input flow definition.
  *
  * @param upipe description structure of the pipe
@@ -467,6 +810,27 @@ static int upipe_udpsink_flush(struct upipe *upipe)
     return UBASE_ERR_NONE;
 }
 
+/** @internal @This sets the batching window.
+ *
+ * @param upipe description structure of the pipe
+ * @param window window in 27 MHz ticks, or 0 to disable batching
+ * @return an error code
+ */
+static int _upipe_udpsink_set_batch_window(struct upipe *upipe,
+                                           uint64_t window)
+{
+#ifdef UPIPE_HAVE_SENDMMSG
+    struct upipe_udpsink *upipe_udpsink = upipe_udpsink_from_upipe(upipe);
+    upipe_udpsink->batch_window = window;
+    return UBASE_ERR_NONE;
+#else
+    if (!window)
+        return UBASE_ERR_NONE;
+    upipe_warn(upipe, "batched output is not supported on this platform");
+    return UBASE_ERR_UNHANDLED;
+#endif
+}
+
 /** @internal @This processes control commands on a udp sink pipe.
  *
  * @param upipe description structure of the pipe
@@ -533,6 +897,24 @@ static int _upipe_udpsink_control(struct upipe *upipe,
             memcpy(&upipe_udpsink->addr, s, upipe_udpsink->addrlen);
             return UBASE_ERR_NONE;
         }
+        case UPIPE_UDPSINK_GET_BATCH_WINDOW: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_UDPSINK_SIGNATURE)
+            uint64_t *window_p = va_arg(args, uint64_t *);
+            *window_p = upipe_udpsink->batch_window;
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_UDPSINK_SET_BATCH_WINDOW: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_UDPSINK_SIGNATURE)
+            uint64_t window = va_arg(args, uint64_t);
+            return _upipe_udpsink_set_batch_window(upipe, window);
+        }
+        case UPIPE_UDPSINK_GET_STATS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_UDPSINK_SIGNATURE)
+            struct upipe_udpsink_stats *stats_p =
+                va_arg(args, struct upipe_udpsink_stats *);
+            *stats_p = upipe_udpsink->stats;
+            return UBASE_ERR_NONE;
+        }
         case UPIPE_FLUSH:
             return upipe_udpsink_flush(upipe);
         default:
@@ -28,6 +28,8 @@
  * @short Upipe source module for udp sockets
  */
 
+#define _GNU_SOURCE
+
 #include <upipe/ubase.h>
 #include <upipe/uprobe.h>
 #include <upipe/uclock.h>
@@ -63,10 +65,14 @@
 #include <sys/ioctl.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 /** default size of buffers when unspecified */
 #define UBUF_DEFAULT_SIZE       4096
+/** maximum number of datagrams read per wakeup */
+#define UDPSRC_MAX_BATCH        1024
 
 #define UDP_DEFAULT_TTL 0
 #define UDP_DEFAULT_PORT 1234
@@ -74,6 +80,20 @@
 /** @hidden */
 static int upipe_udpsrc_check(struct upipe *upipe, struct uref *flow_format);
 
+#ifdef UPIPE_HAVE_RECVMMSG
+/** @internal @This is the reception context of a datagram in batched mode. */
+struct upipe_udpsrc_slot {
+    /** pre-allocated uref, or NULL */
+    struct uref *uref;
+    /** mapped buffer of the uref */
+    struct iovec iov;
+    /** source address */
+    struct sockaddr_storage addr;
+    /** ancillary data (reception timestamp) */
+    uint8_t control[CMSG_SPACE(sizeof(struct timespec))];
+};
+#endif
+
 /** @internal @This is the private context of a udp socket source pipe. */
 struct upipe_udpsrc {
     /** refcount management structure */
@@ -122,6 +142,17 @@ struct upipe_udpsrc {
     /** source address (size) */
     socklen_t addrlen;
 
+    /** maximum number of datagrams read per wakeup */
+    unsigned int batch;
+#ifdef UPIPE_HAVE_RECVMMSG
+    /** message headers for recvmmsg */
+    struct mmsghdr *msgs;
+    /** reception contexts for recvmmsg */
+    struct upipe_udpsrc_slot *slots;
+    /** incremented whenever the reception contexts are flushed */
+    unsigned int slots_gen;
+#endif
+
     /** public upipe structure */
     struct upipe upipe;
 };
@@ -172,10 +203,240 @@ static struct upipe *upipe_udpsrc_alloc(struct upipe_mgr *mgr,
     upipe_udpsrc->fd = -1;
     upipe_udpsrc->uri = NULL;
     upipe_udpsrc->addrlen = 0;
+    upipe_udpsrc->batch = 1;
+#ifdef UPIPE_HAVE_RECVMMSG
+    upipe_udpsrc->msgs = NULL;
+    upipe_udpsrc->slots = NULL;
+    upipe_udpsrc->slots_gen = 0;
+#endif
     upipe_throw_ready(upipe);
     return upipe;
 }
 
+/** @internal @This throws an event if the remote address changed.
+ *
+ * @param upipe description structure of the pipe
+ * @param addr address of the sender
+ * @param addrlen size of the address
+ */
+static void upipe_udpsrc_check_peer(struct upipe *upipe,
+                                    struct sockaddr_storage *addr,
+                                    socklen_t addrlen)
+{
+    struct upipe_udpsrc *upipe_udpsrc = upipe_udpsrc_from_upipe(upipe);
+    if (likely(addrlen == upipe_udpsrc->addrlen &&
+               !memcmp(addr, &upipe_udpsrc->addr, addrlen)))
+        return;
+
+    upipe_throw(upipe, UPROBE_UDPSRC_NEW_PEER, UPIPE_UDPSRC_SIGNATURE,
+            addr, &addrlen);
+    upipe_udpsrc->addrlen = addrlen;
+    memcpy(&upipe_udpsrc->addr, addr, addrlen);
+}
+
+/** @internal @This handles a read error on the socket.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_udpsrc_read_error(struct upipe *upipe)
+{
+    struct upipe_udpsrc *upipe_udpsrc = upipe_udpsrc_from_upipe(upipe);
+    switch (errno) {
+        case EINTR:
+        case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+        case EWOULDBLOCK:
+#endif
+            /* not an issue, try again later */
+            return;
+        case EBADF:
+        case EINVAL:
+        case EIO:
+        default:
+            break;
+    }
+    upipe_err_va(upipe, "read error from %s (%m)", upipe_udpsrc->uri);
+    upipe_udpsrc_set_upump(upipe, NULL);
+    upipe_throw_source_end(upipe);
+}
+
+#ifdef UPIPE_HAVE_RECVMMSG
+/** @internal @This frees the urefs pre-allocated for batched reception.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_udpsrc_flush_batch(struct upipe *upipe)
+{
+    struct upipe_udpsrc *upipe_udpsrc = upipe_udpsrc_from_upipe(upipe);
+    upipe_udpsrc->slots_gen++;
+    if (upipe_udpsrc->slots == NULL)
+        return;
+
+    for (unsigned int i = 0; i < upipe_udpsrc->batch; i++) {
+        struct upipe_udpsrc_slot *slot = &upipe_udpsrc->slots[i];
+        if (slot->uref != NULL) {
+            uref_free(slot->uref);
+            slot->uref = NULL;
+        }
+    }
+}
+
+/** @internal @This releases the batched reception contexts.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_udpsrc_clean_batch(struct upipe *upipe)
+{
+    struct upipe_udpsrc *upipe_udpsrc = upipe_udpsrc_from_upipe(upipe);
+    upipe_udpsrc_flush_batch(upipe);
+    free(upipe_udpsrc->slots);
+    free(upipe_udpsrc->msgs);
+    upipe_udpsrc->slots = NULL;
+    upipe_udpsrc->msgs = NULL;
+}
+
+/** @internal @This returns the system time at which a datagram was received
+ * by the kernel.
+ *
+ * @param upipe description structure of the pipe
+ * @param msg message header filled in by recvmmsg
+ * @param now system time of the wakeup, used as a fallback
+ * @return system time of the datagram
+ */
+static uint64_t upipe_udpsrc_batch_systime(struct upipe *upipe,
+                                           struct msghdr *msg, uint64_t now)
+{
+#ifdef SO_TIMESTAMPNS
+    struct upipe_udpsrc *upipe_udpsrc = upipe_udpsrc_from_upipe(upipe);
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET ||
+            cmsg->cmsg_type != SCM_TIMESTAMPNS)
+            continue;
+
+        struct timespec ts;
+        memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+        uint64_t real = ts.tv_sec * UCLOCK_FREQ +
+                        ts.tv_nsec * UCLOCK_FREQ / UINT64_C(1000000000);
+        uint64_t systime = uclock_from_real(upipe_udpsrc->uclock, real);
+        /* the datagram cannot have been received in the future */
+        if (systime != UINT64_MAX && systime <= now)
+            return systime;
+        break;
+    }
+#endif
+    return now;
+}
+
+/** @internal @This reads up to batch datagrams from the source in a single
+ * system call, and outputs them.
+ *
+ * @param upump description structure of the read watcher
+ */
+static void upipe_udpsrc_worker_batch(struct upump *upump)
+{
+    struct upipe *upipe = upump_get_opaque(upump, struct upipe *);
+    struct upipe_udpsrc *upipe_udpsrc = upipe_udpsrc_from_upipe(upipe);
+    unsigned int batch = upipe_udpsrc->batch;
+    struct mmsghdr *msgs = upipe_udpsrc->msgs;
+    struct upipe_udpsrc_slot *slots = upipe_udpsrc->slots;
+    unsigned int slots_gen = upipe_udpsrc->slots_gen;
+
+    for (unsigned int i = 0; i < batch; i++) {
+        struct upipe_udpsrc_slot *slot = &slots[i];
+        if (slot->uref == NULL) {
+            slot->uref = uref_block_alloc(upipe_udpsrc->uref_mgr,
+                                          upipe_udpsrc->ubuf_mgr,
+                                          upipe_udpsrc->output_size);
+            if (unlikely(slot->uref == NULL)) {
+                upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+                return;
+            }
+        }
+
+        uint8_t *buffer;
+        int output_size = -1;
+        if (unlikely(!ubase_check(uref_block_write(slot->uref, 0,
+                                                   &output_size, &buffer)))) {
+            for (unsigned int j = 0; j < i; j++)
+                uref_block_unmap(slots[j].uref, 0);
+            upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+            return;
+        }
+        assert(output_size == upipe_udpsrc->output_size);
+
+        slot->iov.iov_base = buffer;
+        slot->iov.iov_len = output_size;
+        struct msghdr *msg = &msgs[i].msg_hdr;
+        msg->msg_name = &slot->addr;
+        msg->msg_namelen = sizeof(slot->addr);
+        msg->msg_iov = &slot->iov;
+        msg->msg_iovlen = 1;
+        msg->msg_control = slot->control;
+        msg->msg_controllen = sizeof(slot->control);
+        msg->msg_flags = 0;
+        msgs[i].msg_len = 0;
+    }
+
+    int ret = recvmmsg(upipe_udpsrc->fd, msgs, batch, MSG_DONTWAIT, NULL);
+    for (unsigned int i = 0; i < batch; i++)
+        uref_block_unmap(slots[i].uref, 0);
+
+    if (unlikely(ret == -1)) {
+        upipe_udpsrc_read_error(upipe);
+        return;
+    }
+
+    uint64_t now = 0; /* to keep gcc quiet */
+    if (unlikely(upipe_udpsrc->uclock != NULL))
+        now = uclock_now(upipe_udpsrc->uclock);
+
+    int i;
+    for (i = 0; i < ret; i++) {
+        struct upipe_udpsrc_slot *slot = &slots[i];
+        struct msghdr *msg = &msgs[i].msg_hdr;
+        struct uref *uref = slot->uref;
+        slot->uref = NULL;
+        upipe_udpsrc_check_peer(upipe, &slot->addr, msg->msg_namelen);
+
+        if (unlikely(msgs[i].msg_len == 0)) {
+            uref_free(uref);
+            if (likely(upipe_udpsrc->uclock == NULL)) {
+                upipe_notice_va(upipe, "end of udp socket %s",
+                                upipe_udpsrc->uri);
+                upipe_udpsrc_set_upump(upipe, NULL);
+                upipe_throw_source_end(upipe);
+                break;
+            }
+            continue;
+        }
+
+        if (unlikely(upipe_udpsrc->uclock != NULL))
+            uref_clock_set_cr_sys(uref,
+                    upipe_udpsrc_batch_systime(upipe, msg, now));
+        if (unlikely(msgs[i].msg_len != upipe_udpsrc->output_size))
+            uref_block_resize(uref, 0, msgs[i].msg_len);
+        upipe_udpsrc_output(upipe, uref, &upipe_udpsrc->upump);
+
+        /* the socket or the reception contexts may have been closed or
+         * changed by the output */
+        if (unlikely(upipe_udpsrc->upump != upump ||
+                     upipe_udpsrc->slots_gen != slots_gen))
+            break;
+    }
+
+    /* drop datagrams that can no longer be output */
+    if (upipe_udpsrc->slots_gen == slots_gen) {
+        for (i++; i < ret; i++) {
+            if (slots[i].uref != NULL) {
+                uref_free(slots[i].uref);
+                slots[i].uref = NULL;
+            }
+        }
+    }
+}
+#endif
+
 /** @internal @This reads data from the source and outputs it.
  * It is called either when the idler triggers (permanent storage mode) or
  * when data is available on the udp socket descriptor (live stream mode).
@@ -217,31 +478,10 @@ static void upipe_udpsrc_worker(struct upump *upump)
 
     if (unlikely(ret == -1)) {
         uref_free(uref);
-        switch (errno) {
-            case EINTR:
-            case EAGAIN:
-#if EAGAIN != EWOULDBLOCK
-            case EWOULDBLOCK:
-#endif
-                /* not an issue, try again later */
-                return;
-            case EBADF:
-            case EINVAL:
-            case EIO:
-            default:
-                break;
-        }
-        upipe_err_va(upipe, "read error from %s (%m)", upipe_udpsrc->uri);
-        upipe_udpsrc_set_upump(upipe, NULL);
-        upipe_throw_source_end(upipe);
+        upipe_udpsrc_read_error(upipe);
         return;
-    } else if (addrlen != upipe_udpsrc->addrlen ||
-        memcmp(&addr, &upipe_udpsrc->addr, addrlen)) {
-        upipe_throw(upipe, UPROBE_UDPSRC_NEW_PEER, UPIPE_UDPSRC_SIGNATURE,
-                &addr, &addrlen);
-        upipe_udpsrc->addrlen = addrlen;
-        memcpy(&upipe_udpsrc->addr, &addr, addrlen);
     }
+    upipe_udpsrc_check_peer(upipe, &addr, addrlen);
 
     if (unlikely(ret == 0)) {
         uref_free(uref);
@@ -268,8 +508,12 @@ static void upipe_udpsrc_worker(struct upump *upump)
 static int upipe_udpsrc_check(struct upipe *upipe, struct uref *flow_format)
 {
     struct upipe_udpsrc *upipe_udpsrc = upipe_udpsrc_from_upipe(upipe);
-    if (flow_format != NULL)
+    if (flow_format != NULL) {
         upipe_udpsrc_store_flow_def(upipe, flow_format);
+#ifdef UPIPE_HAVE_RECVMMSG
+        upipe_udpsrc_flush_batch(upipe);
+#endif
+    }
 
     upipe_udpsrc_check_upump_mgr(upipe);
     if (upipe_udpsrc->upump_mgr == NULL)
@@ -298,9 +542,23 @@ static int upipe_udpsrc_check(struct upipe *upipe, struct uref *flow_format)
         return UBASE_ERR_NONE;
 
     if (upipe_udpsrc->fd != -1 && upipe_udpsrc->upump == NULL) {
+        upump_cb worker = upipe_udpsrc_worker;
+#ifdef UPIPE_HAVE_RECVMMSG
+        if (upipe_udpsrc->batch > 1) {
+            worker = upipe_udpsrc_worker_batch;
+#ifdef SO_TIMESTAMPNS
+            int enable = 1;
+            if (upipe_udpsrc->uclock != NULL &&
+                setsockopt(upipe_udpsrc->fd, SOL_SOCKET, SO_TIMESTAMPNS,
+                           &enable, sizeof(enable)) < 0)
+                upipe_warn_va(upipe, "unable to get kernel timestamps (%m)");
+#endif
+        }
+#endif
+
         struct upump *upump;
         upump = upump_alloc_fd_read(upipe_udpsrc->upump_mgr,
-                                    upipe_udpsrc_worker, upipe, upipe->refcount,
+                                    worker, upipe, upipe->refcount,
                                     upipe_udpsrc->fd);
         if (unlikely(upump == NULL)) {
             upipe_throw_fatal(upipe, UBASE_ERR_UPUMP);
@@ -366,6 +624,41 @@ static int upipe_udpsrc_set_uri(struct upipe *upipe, const char *uri)
     return UBASE_ERR_NONE;
 }
 
+/** @internal @This sets the maximum number of datagrams read per wakeup.
+ *
+ * @param upipe description structure of the pipe
+ * @param batch batch depth
+ * @return an error code
+ */
+static int _upipe_udpsrc_set_batch(struct upipe *upipe, unsigned int batch)
+{
+    struct upipe_udpsrc *upipe_udpsrc = upipe_udpsrc_from_upipe(upipe);
+    if (unlikely(batch == 0 || batch > UDPSRC_MAX_BATCH))
+        return UBASE_ERR_INVALID;
+    if (batch == upipe_udpsrc->batch)
+        return UBASE_ERR_NONE;
+
+#ifdef UPIPE_HAVE_RECVMMSG
+    upipe_udpsrc_set_upump(upipe, NULL);
+    upipe_udpsrc_clean_batch(upipe);
+    upipe_udpsrc->batch = 1;
+    if (batch == 1)
+        return UBASE_ERR_NONE;
+
+    upipe_udpsrc->msgs = calloc(batch, sizeof(struct mmsghdr));
+    upipe_udpsrc->slots = calloc(batch, sizeof(struct upipe_udpsrc_slot));
+    if (unlikely(upipe_udpsrc->msgs == NULL || upipe_udpsrc->slots == NULL)) {
+        upipe_udpsrc_clean_batch(upipe);
+        return UBASE_ERR_ALLOC;
+    }
+    upipe_udpsrc->batch = batch;
+    return UBASE_ERR_NONE;
+#else
+    upipe_warn(upipe, "batched reception is not supported on this platform");
+    return UBASE_ERR_UNHANDLED;
+#endif
+}
+
 /** @internal @This processes control commands on a udp socket source pipe.
  *
  * @param upipe description structure of the pipe
@@ -393,7 +686,11 @@ static int _upipe_udpsrc_control(struct upipe *upipe,
             return upipe_udpsrc_control_output(upipe, command, args);
 
         case UPIPE_GET_OUTPUT_SIZE:
+            return upipe_udpsrc_control_output_size(upipe, command, args);
         case UPIPE_SET_OUTPUT_SIZE:
+#ifdef UPIPE_HAVE_RECVMMSG
+            upipe_udpsrc_flush_batch(upipe);
+#endif
             return upipe_udpsrc_control_output_size(upipe, command, args);
 
         case UPIPE_GET_URI: {
@@ -416,6 +713,17 @@ static int _upipe_udpsrc_control(struct upipe *upipe,
             upipe_udpsrc->fd = va_arg(args, int );
             return UBASE_ERR_NONE;
         }
+        case UPIPE_UDPSRC_GET_BATCH: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_UDPSRC_SIGNATURE)
+            unsigned int *batch_p = va_arg(args, unsigned int *);
+            *batch_p = upipe_udpsrc->batch;
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_UDPSRC_SET_BATCH: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_UDPSRC_SIGNATURE)
+            unsigned int batch = va_arg(args, unsigned int);
+            return _upipe_udpsrc_set_batch(upipe, batch);
+        }
         default:
             return UBASE_ERR_UNHANDLED;
     }
@@ -453,6 +761,9 @@ static void upipe_udpsrc_free(struct upipe *upipe)
     upipe_throw_dead(upipe);
 
     free(upipe_udpsrc->uri);
+#ifdef UPIPE_HAVE_RECVMMSG
+    upipe_udpsrc_clean_batch(upipe);
+#endif
     upipe_udpsrc_clean_output_size(upipe);
     upipe_udpsrc_clean_uclock(upipe);
     upipe_udpsrc_clean_upump(upipe);
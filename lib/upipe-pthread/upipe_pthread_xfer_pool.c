@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short pool of POSIX threads running event loops, to which pipelines are
+ * transferred
+ */
+
+#define _GNU_SOURCE
+
+#include <upipe/ubase.h>
+#include <upipe/urefcount.h>
+#include <upipe/umutex.h>
+#include <upipe/uprobe.h>
+#include <upipe/upump.h>
+#include <upipe/upipe.h>
+#include <upipe-pthread/umutex_pthread.h>
+#include <upipe-pthread/upipe_pthread_transfer.h>
+#include <upipe-pthread/upipe_pthread_xfer_pool.h>
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+/** minimum period between two measures of the load, in ns */
+#define UPIPE_PTHREAD_XFER_POOL_PERIOD UINT64_C(100000000)
+
+/** @internal @This describes a thread of the pool. */
+struct upipe_pthread_xfer_pool_thread {
+    /** xfer manager of the thread */
+    struct upipe_mgr *xfer_mgr;
+    /** thread ID */
+    pthread_t pthread_id;
+    /** true if the CPU clock of the thread is available */
+    bool has_clock;
+#ifdef UPIPE_HAVE_PTHREAD_GETCPUCLOCKID
+    /** CPU clock of the thread */
+    clockid_t clockid;
+#endif
+    /** CPU time of the thread at the last measure, in ns */
+    uint64_t cpu_time;
+    /** CPU usage during the last measure, in per mille */
+    unsigned int load;
+    /** number of pipelines handed out since the last measure */
+    unsigned int recent;
+    /** number of pipelines handed out */
+    unsigned int assigned;
+};
+
+/** @internal @This is the private context of a pool. */
+struct upipe_pthread_xfer_pool_ctx {
+    /** refcount management structure */
+    struct urefcount urefcount;
+    /** date of the last measure, in ns */
+    uint64_t date;
+    /** number of threads */
+    unsigned int nb_threads;
+
+    /** public structure */
+    struct upipe_pthread_xfer_pool pool;
+
+    /** threads */
+    struct upipe_pthread_xfer_pool_thread threads[];
+};
+
+UBASE_FROM_TO(upipe_pthread_xfer_pool_ctx, upipe_pthread_xfer_pool, pool, pool)
+UBASE_FROM_TO(upipe_pthread_xfer_pool_ctx, urefcount, urefcount, urefcount)
+
+/** @internal @This returns the current monotonic date.
+ *
+ * @return date in ns
+ */
+static uint64_t upipe_pthread_xfer_pool_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+/** @internal @This returns the CPU time consumed by a thread.
+ *
+ * @param thread description structure of the thread
+ * @return CPU time in ns, or 0 if unavailable
+ */
+static uint64_t
+    upipe_pthread_xfer_pool_cpu(struct upipe_pthread_xfer_pool_thread *thread)
+{
+#ifdef UPIPE_HAVE_PTHREAD_GETCPUCLOCKID
+    struct timespec ts;
+    if (thread->has_clock && clock_gettime(thread->clockid, &ts) == 0)
+        return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+#endif
+    return 0;
+}
+
+/** @internal @This measures the load of the threads, if the last measure
+ * is old enough.
+ *
+ * @param ctx private context of the pool
+ */
+static void upipe_pthread_xfer_pool_measure(
+        struct upipe_pthread_xfer_pool_ctx *ctx)
+{
+    uint64_t now = upipe_pthread_xfer_pool_now();
+    uint64_t period = now - ctx->date;
+    if (period < UPIPE_PTHREAD_XFER_POOL_PERIOD)
+        return;
+
+    for (unsigned int i = 0; i < ctx->nb_threads; i++) {
+        struct upipe_pthread_xfer_pool_thread *thread = &ctx->threads[i];
+        uint64_t cpu_time = upipe_pthread_xfer_pool_cpu(thread);
+        thread->load = cpu_time > thread->cpu_time ?
+                       (cpu_time - thread->cpu_time) * 1000 / period : 0;
+        thread->cpu_time = cpu_time;
+        thread->recent = 0;
+    }
+    ctx->date = now;
+}
+
+/** @This returns the transfer manager of the least loaded thread of the
+ * pool. The load of a thread is its CPU usage, plus an estimate for the
+ * pipelines handed to it since the last measure. This must always be called
+ * from the same thread.
+ *
+ * @param pool pointer to pool
+ * @return pointer to xfer manager (to be released by the caller)
+ */
+struct upipe_mgr *
+    upipe_pthread_xfer_pool_get_mgr(struct upipe_pthread_xfer_pool *pool)
+{
+    struct upipe_pthread_xfer_pool_ctx *ctx =
+        upipe_pthread_xfer_pool_ctx_from_pool(pool);
+    upipe_pthread_xfer_pool_measure(ctx);
+
+    /* average load of a pipeline */
+    uint64_t load = 0, assigned = 0;
+    for (unsigned int i = 0; i < ctx->nb_threads; i++) {
+        load += ctx->threads[i].load;
+        assigned += ctx->threads[i].assigned;
+    }
+    uint64_t unit = assigned ? load / assigned : 0;
+
+    struct upipe_pthread_xfer_pool_thread *best = NULL;
+    uint64_t best_load = UINT64_MAX;
+    for (unsigned int i = 0; i < ctx->nb_threads; i++) {
+        struct upipe_pthread_xfer_pool_thread *thread = &ctx->threads[i];
+        uint64_t thread_load = thread->load + thread->recent * unit;
+        if (thread_load < best_load ||
+            (thread_load == best_load &&
+             (thread->recent < best->recent ||
+              (thread->recent == best->recent &&
+               thread->assigned < best->assigned)))) {
+            best = thread;
+            best_load = thread_load;
+        }
+    }
+
+    best->recent++;
+    best->assigned++;
+    return upipe_mgr_use(best->xfer_mgr);
+}
+
+/** @This returns the load of a thread of the pool.
+ *
+ * @param pool pointer to pool
+ * @param index index of the thread
+ * @param load_p filled in with the CPU usage of the thread during the last
+ * measure, in per mille (may be NULL)
+ * @param assigned_p filled in with the number of transfer managers handed
+ * out for this thread (may be NULL)
+ * @return an error code
+ */
+int upipe_pthread_xfer_pool_get_load(struct upipe_pthread_xfer_pool *pool,
+                                     unsigned int index,
+                                     unsigned int *load_p,
+                                     unsigned int *assigned_p)
+{
+    struct upipe_pthread_xfer_pool_ctx *ctx =
+        upipe_pthread_xfer_pool_ctx_from_pool(pool);
+    if (index >= ctx->nb_threads)
+        return UBASE_ERR_INVALID;
+
+    if (load_p != NULL)
+        *load_p = ctx->threads[index].load;
+    if (assigned_p != NULL)
+        *assigned_p = ctx->threads[index].assigned;
+    return UBASE_ERR_NONE;
+}
+
+/** @This frees a pool.
+ *
+ * @param urefcount pointer to urefcount
+ */
+static void upipe_pthread_xfer_pool_free(struct urefcount *urefcount)
+{
+    struct upipe_pthread_xfer_pool_ctx *ctx =
+        upipe_pthread_xfer_pool_ctx_from_urefcount(urefcount);
+    for (unsigned int i = 0; i < ctx->nb_threads; i++)
+        upipe_mgr_release(ctx->threads[i].xfer_mgr);
+    urefcount_clean(urefcount);
+    free(ctx);
+}
+
+/** @This allocates a pool of threads, each running an event loop.
+ *
+ * @param nb_threads number of threads (0 for the number of online CPUs)
+ * @param pin true to pin each thread to a CPU
+ * @param lock true to protect each event loop with a mutex, so that it
+ * may be frozen (see @ref upipe_xfer_mgr_freeze)
+ * @param queue_length maximum length of the internal queue of commands
+ * @param msg_pool_depth maximum number of messages in the pool
+ * @param uprobe_pthread_upump_mgr pointer to optional probe, that will be set
+ * with the created upump_mgr
+ * @param upump_mgr_alloc alloc function provided by the upump manager
+ * @param upump_pool_depth maximum number of upump structures in the pool
+ * @param upump_blocker_pool_depth maximum number of upump_blocker structures in
+ * the pool
+ * @return pointer to pool, or NULL in case of error
+ */
+struct upipe_pthread_xfer_pool *upipe_pthread_xfer_pool_alloc(
+        unsigned int nb_threads, bool pin, bool lock,
+        uint8_t queue_length, uint16_t msg_pool_depth,
+        struct uprobe *uprobe_pthread_upump_mgr,
+        upump_mgr_alloc upump_mgr_alloc, uint16_t upump_pool_depth,
+        uint16_t upump_blocker_pool_depth)
+{
+    if (!nb_threads) {
+        long nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nb_threads = nb_cpus > 0 ? nb_cpus : 1;
+    }
+
+    struct upipe_pthread_xfer_pool_ctx *ctx =
+        malloc(sizeof(struct upipe_pthread_xfer_pool_ctx) +
+               nb_threads * sizeof(struct upipe_pthread_xfer_pool_thread));
+    if (unlikely(ctx == NULL)) {
+        uprobe_release(uprobe_pthread_upump_mgr);
+        return NULL;
+    }
+    urefcount_init(upipe_pthread_xfer_pool_ctx_to_urefcount(ctx),
+                   upipe_pthread_xfer_pool_free);
+    ctx->pool.refcount = upipe_pthread_xfer_pool_ctx_to_urefcount(ctx);
+    ctx->nb_threads = 0;
+
+#ifdef UPIPE_HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+    /* CPUs the process is allowed to run on */
+    cpu_set_t allowed;
+    unsigned int cpus[CPU_SETSIZE];
+    unsigned int nb_cpus = 0;
+    if (pin && sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+        for (unsigned int i = 0; i < CPU_SETSIZE; i++)
+            if (CPU_ISSET(i, &allowed))
+                cpus[nb_cpus++] = i;
+    if (pin && !nb_cpus)
+        uprobe_warn(uprobe_pthread_upump_mgr, NULL,
+                    "unable to get CPU affinity, not pinning threads");
+#else
+    if (pin)
+        uprobe_warn(uprobe_pthread_upump_mgr, NULL,
+                    "CPU affinity is not supported, not pinning threads");
+#endif
+
+    for (unsigned int i = 0; i < nb_threads; i++) {
+        struct upipe_pthread_xfer_pool_thread *thread = &ctx->threads[i];
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+#ifdef UPIPE_HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+        if (pin && nb_cpus) {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(cpus[i % nb_cpus], &cpu_set);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpu_set), &cpu_set);
+        }
+#endif
+
+        struct umutex *mutex = NULL;
+        if (lock) {
+            mutex = umutex_pthread_alloc(NULL);
+            if (unlikely(mutex == NULL)) {
+                pthread_attr_destroy(&attr);
+                goto upipe_pthread_xfer_pool_alloc_err;
+            }
+        }
+
+        thread->xfer_mgr = upipe_pthread_xfer_mgr_alloc(queue_length,
+                msg_pool_depth, uprobe_use(uprobe_pthread_upump_mgr),
+                upump_mgr_alloc, upump_pool_depth, upump_blocker_pool_depth,
+                mutex, &thread->pthread_id, &attr);
+        umutex_release(mutex);
+        pthread_attr_destroy(&attr);
+        if (unlikely(thread->xfer_mgr == NULL))
+            goto upipe_pthread_xfer_pool_alloc_err;
+
+        thread->has_clock = false;
+#ifdef UPIPE_HAVE_PTHREAD_GETCPUCLOCKID
+        thread->has_clock =
+            pthread_getcpuclockid(thread->pthread_id, &thread->clockid) == 0;
+#endif
+        thread->cpu_time = upipe_pthread_xfer_pool_cpu(thread);
+        thread->load = 0;
+        thread->recent = 0;
+        thread->assigned = 0;
+        ctx->nb_threads++;
+    }
+
+    ctx->date = upipe_pthread_xfer_pool_now();
+    uprobe_release(uprobe_pthread_upump_mgr);
+    return upipe_pthread_xfer_pool_ctx_to_pool(ctx);
+
+upipe_pthread_xfer_pool_alloc_err:
+    uprobe_err(uprobe_pthread_upump_mgr, NULL, "unable to start thread");
+    uprobe_release(uprobe_pthread_upump_mgr);
+    urefcount_release(upipe_pthread_xfer_pool_ctx_to_urefcount(ctx));
+    return NULL;
+}
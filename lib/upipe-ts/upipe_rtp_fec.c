@@ -62,8 +62,36 @@
 #include <bitstream/mpeg/ts.h>
 #include <bitstream/smpte/2022_1_fec.h>
 
+#include "upipe_rtp_fec_xor.h"
+
+#ifdef UPIPE_HAVE_X86_SIMD
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define UPIPE_FEC_JITTER UCLOCK_FREQ/25
 #define FEC_MAX 255
+/** minimum number of slots of the rings, sized to hold the jitter */
+#define UPIPE_RTP_FEC_RING_MIN 1024
+/** maximum number of slots of the rings, within sequence number comparison */
+#define UPIPE_RTP_FEC_RING_MAX 32768
+/** flag set in uref->priv of recovered packets */
+#define UPIPE_RTP_FEC_RECOVERED (UINT64_C(1) << 16)
+
+/** @internal @This is a ring of urefs indexed by sequence number. */
+struct upipe_rtp_fec_ring {
+    /** urefs, at the index of their sequence number modulo the size */
+    struct uref **urefs;
+    /** size of the ring minus one, the size being a power of two */
+    uint16_t mask;
+    /** lowest sequence number in the ring */
+    uint16_t first;
+    /** highest sequence number in the ring */
+    uint16_t last;
+    /** number of urefs in the ring */
+    unsigned int count;
+};
 
 /** upipe_rtp_fec structure with rtp-fec parameters */
 struct upipe_rtp_fec {
@@ -110,9 +138,15 @@ struct upipe_rtp_fec {
     /** row subpipe */
     struct upipe row_subpipe;
 
-    struct uchain main_queue;
-    struct uchain col_queue;
-    struct uchain row_queue;
+    /** main packets, indexed by sequence number */
+    struct upipe_rtp_fec_ring main_ring;
+    /** column FEC packets, indexed by SNBase */
+    struct upipe_rtp_fec_ring col_ring;
+    /** row FEC packets, indexed by SNBase */
+    struct upipe_rtp_fec_ring row_ring;
+
+    /** XORs a buffer into another */
+    void (*fec_xor)(uint8_t *, const uint8_t *, size_t);
 
     /* number of packets not recovered */
     uint64_t lost;
@@ -120,6 +154,15 @@ struct upipe_rtp_fec {
     /* number of packets recovered */
     uint64_t recovered;
 
+    /** base sequence number of the matrix being output */
+    uint32_t out_matrix_snbase;
+    /** number of packets recovered in the matrix being output */
+    unsigned int matrix_recovered;
+    /** number of packets lost in the matrix being output */
+    unsigned int matrix_lost;
+    /** per-matrix statistics */
+    struct upipe_rtp_fec_stats stats;
+
     /** output pipe */
     struct upipe *output;
     /** flow_definition packet */
@@ -193,74 +236,421 @@ static void upipe_rtp_fec_extract_parameters(struct uref *fec_uref,
     uref_block_peek_unmap(fec_uref, RTP_HEADER_SIZE, fec_header, peek);
 }
 
-/* Delete main packets older than the reference point */
-static void clear_main_list(struct uchain *main_list, uint16_t snbase)
+/** @This XORs a buffer into another (portable version).
+ *
+ * @param dst buffer to XOR into
+ * @param src buffer to XOR
+ * @param size number of octets
+ */
+void upipe_rtp_fec_xor_c(uint8_t *dst, const uint8_t *src, size_t size)
 {
-    struct uchain *uchain, *uchain_tmp;
+    size_t i = 0;
+#if defined(__SSE2__)
+    for ( ; i + 16 <= size; i += 16)
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(
+                    _mm_loadu_si128((const __m128i *)(dst + i)),
+                    _mm_loadu_si128((const __m128i *)(src + i))));
+#endif
+    for ( ; i + 8 <= size; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, dst + i, 8);
+        memcpy(&b, src + i, 8);
+        a ^= b;
+        memcpy(dst + i, &a, 8);
+    }
+    for ( ; i < size; i++)
+        dst[i] ^= src[i];
+}
 
-    ulist_delete_foreach (main_list, uchain, uchain_tmp) {
-        struct uref *uref = uref_from_uchain(uchain);
-        if (!seq_num_lt(uref->priv, snbase))
-            break;
+#ifdef UPIPE_HAVE_X86_SIMD
+/** @This XORs a buffer into another with AVX2, 128 octets at a time. The
+ * CPU must support the avx2 feature.
+ *
+ * @param dst buffer to XOR into
+ * @param src buffer to XOR
+ * @param size number of octets
+ */
+__attribute__((target("avx2")))
+void upipe_rtp_fec_xor_avx2(uint8_t *dst, const uint8_t *src, size_t size)
+{
+    size_t i = 0;
+    for ( ; i + 128 <= size; i += 128) {
+        __m256i a0 = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i a1 = _mm256_loadu_si256((const __m256i *)(dst + i + 32));
+        __m256i a2 = _mm256_loadu_si256((const __m256i *)(dst + i + 64));
+        __m256i a3 = _mm256_loadu_si256((const __m256i *)(dst + i + 96));
+        a0 = _mm256_xor_si256(a0,
+                _mm256_loadu_si256((const __m256i *)(src + i)));
+        a1 = _mm256_xor_si256(a1,
+                _mm256_loadu_si256((const __m256i *)(src + i + 32)));
+        a2 = _mm256_xor_si256(a2,
+                _mm256_loadu_si256((const __m256i *)(src + i + 64)));
+        a3 = _mm256_xor_si256(a3,
+                _mm256_loadu_si256((const __m256i *)(src + i + 96)));
+        _mm256_storeu_si256((__m256i *)(dst + i), a0);
+        _mm256_storeu_si256((__m256i *)(dst + i + 32), a1);
+        _mm256_storeu_si256((__m256i *)(dst + i + 64), a2);
+        _mm256_storeu_si256((__m256i *)(dst + i + 96), a3);
+    }
+    for ( ; i + 32 <= size; i += 32)
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(
+                    _mm256_loadu_si256((const __m256i *)(dst + i)),
+                    _mm256_loadu_si256((const __m256i *)(src + i))));
+    upipe_rtp_fec_xor_c(dst + i, src + i, size - i);
+}
+#endif
 
-        ulist_delete(uchain);
-        uref_free(uref);
+/** @internal @This allocates the slots of a ring.
+ *
+ * @param ring pointer to the ring
+ * @param size number of slots, a power of two
+ * @return an error code
+ */
+static int upipe_rtp_fec_ring_init(struct upipe_rtp_fec_ring *ring,
+                                   unsigned int size)
+{
+    ring->urefs = calloc(size, sizeof(struct uref *));
+    if (unlikely(ring->urefs == NULL))
+        return UBASE_ERR_ALLOC;
+    ring->mask = size - 1;
+    ring->first = ring->last = 0;
+    ring->count = 0;
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This frees the urefs and the slots of a ring.
+ *
+ * @param ring pointer to the ring
+ */
+static void upipe_rtp_fec_ring_clean(struct upipe_rtp_fec_ring *ring)
+{
+    if (ring->urefs != NULL) {
+        for (unsigned int i = 0; i <= ring->mask; i++)
+            if (ring->urefs[i] != NULL)
+                uref_free(ring->urefs[i]);
+        free(ring->urefs);
     }
+    ring->urefs = NULL;
+    ring->mask = 0;
+    ring->count = 0;
 }
 
-// TODO : merge with above, cache seqnum
-/* Delete FEC packets older than the reference point */
-static void clear_fec_list(struct uchain *fec_list, uint16_t last_fec_snbase)
+/** @internal @This doubles the number of slots of a ring.
+ *
+ * @param ring pointer to the ring
+ * @return an error code
+ */
+static int upipe_rtp_fec_ring_grow(struct upipe_rtp_fec_ring *ring)
 {
-    struct uchain *uchain, *uchain_tmp;
-    ulist_delete_foreach (fec_list, uchain, uchain_tmp) {
-        struct uref *fec_uref = uref_from_uchain(uchain);
-        uint16_t snbase_low = fec_uref->priv >> 32;
+    unsigned int size = 2 * ((unsigned int)ring->mask + 1);
+    if (size > UPIPE_RTP_FEC_RING_MAX)
+        return UBASE_ERR_BUSY;
+    struct uref **urefs = calloc(size, sizeof(struct uref *));
+    if (unlikely(urefs == NULL))
+        return UBASE_ERR_ALLOC;
 
-        if (!seq_num_lt(snbase_low, last_fec_snbase))
-            break;
+    if (ring->count) {
+        uint16_t seqnum = ring->first;
+        for ( ; ; seqnum++) {
+            urefs[seqnum & (size - 1)] = ring->urefs[seqnum & ring->mask];
+            if (seqnum == ring->last)
+                break;
+        }
+    }
+    free(ring->urefs);
+    ring->urefs = urefs;
+    ring->mask = size - 1;
+    return UBASE_ERR_NONE;
+}
 
-        ulist_delete(uchain);
-        uref_free(fec_uref);
+/** @internal @This checks if a sequence number is too far ahead of the
+ * lowest sequence number of a ring to be inserted.
+ *
+ * @param ring pointer to the ring
+ * @param seqnum sequence number
+ * @return true if the ring has no slot for the sequence number
+ */
+static bool upipe_rtp_fec_ring_overflows(struct upipe_rtp_fec_ring *ring,
+                                         uint16_t seqnum)
+{
+    return ring->count && seq_num_lt(ring->last, seqnum) &&
+           (uint16_t)(seqnum - ring->first) > ring->mask;
+}
+
+/** @internal @This inserts a uref into a ring. The caller must make room for
+ * it beforehand.
+ *
+ * @param ring pointer to the ring
+ * @param seqnum sequence number of the uref
+ * @param uref uref to insert
+ * @return false if the uref is a duplicate or too old, in which case the
+ * caller keeps ownership of it
+ */
+static bool upipe_rtp_fec_ring_insert(struct upipe_rtp_fec_ring *ring,
+                                      uint16_t seqnum, struct uref *uref)
+{
+    if (unlikely(ring->urefs == NULL))
+        return false;
+
+    if (!ring->count) {
+        ring->first = ring->last = seqnum;
+    } else if (seq_num_lt(seqnum, ring->first)) {
+        if ((uint16_t)(ring->last - seqnum) > ring->mask)
+            return false;
+        ring->first = seqnum;
+    } else if (seq_num_lt(ring->last, seqnum)) {
+        assert((uint16_t)(seqnum - ring->first) <= ring->mask);
+        ring->last = seqnum;
+    } else if (ring->urefs[seqnum & ring->mask] != NULL) {
+        return false;
     }
+
+    ring->urefs[seqnum & ring->mask] = uref;
+    ring->count++;
+    return true;
 }
 
-static void insert_ordered_uref(struct uchain *queue, struct uref *uref)
+/** @internal @This returns the uref with the given sequence number.
+ *
+ * @param ring pointer to the ring
+ * @param seqnum sequence number
+ * @return pointer to the uref, or NULL if it is not in the ring
+ */
+static struct uref *upipe_rtp_fec_ring_get(struct upipe_rtp_fec_ring *ring,
+                                           uint16_t seqnum)
 {
-    uint16_t new_seqnum = uref->priv;
+    if (!ring->count || seq_num_lt(seqnum, ring->first) ||
+        seq_num_lt(ring->last, seqnum))
+        return NULL;
+    return ring->urefs[seqnum & ring->mask];
+}
 
-    struct uchain *uchain, *uchain_tmp;
-    ulist_delete_foreach_reverse(queue, uchain, uchain_tmp) {
-        struct uref *cur_uref = uref_from_uchain(uchain);
-        uint16_t seqnum = cur_uref->priv;
+/** @internal @This returns the uref with the lowest sequence number.
+ *
+ * @param ring pointer to the ring
+ * @return pointer to the uref, or NULL if the ring is empty
+ */
+static struct uref *upipe_rtp_fec_ring_peek(struct upipe_rtp_fec_ring *ring)
+{
+    if (!ring->count)
+        return NULL;
+    return ring->urefs[ring->first & ring->mask];
+}
 
-        /* Duplicate packet */
-        if (new_seqnum == seqnum) {
-            uref_free(uref);
+/** @internal @This removes the uref with the lowest sequence number.
+ *
+ * @param ring pointer to the ring
+ * @return pointer to the uref, or NULL if the ring is empty
+ */
+static struct uref *upipe_rtp_fec_ring_pop(struct upipe_rtp_fec_ring *ring)
+{
+    if (!ring->count)
+        return NULL;
+    struct uref *uref = ring->urefs[ring->first & ring->mask];
+    ring->urefs[ring->first & ring->mask] = NULL;
+    if (--ring->count) {
+        /* the slot of the highest sequence number is never empty */
+        do
+            ring->first++;
+        while (ring->urefs[ring->first & ring->mask] == NULL);
+    }
+    return uref;
+}
+
+/* Delete packets older than the reference point */
+static void upipe_rtp_fec_ring_clear(struct upipe_rtp_fec_ring *ring,
+                                     uint16_t snbase)
+{
+    while (ring->count && seq_num_lt(ring->first, snbase))
+        uref_free(upipe_rtp_fec_ring_pop(ring));
+}
+
+/** @internal @This closes the statistics of the matrix being output.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_rtp_fec_close_matrix(struct upipe *upipe)
+{
+    struct upipe_rtp_fec *upipe_rtp_fec = upipe_rtp_fec_from_upipe(upipe);
+    struct upipe_rtp_fec_stats *stats = &upipe_rtp_fec->stats;
+
+    stats->matrices++;
+    if (upipe_rtp_fec->matrix_recovered)
+        stats->matrices_recovered++;
+    if (upipe_rtp_fec->matrix_lost) {
+        stats->matrices_lost++;
+        upipe_dbg_va(upipe, "matrix %"PRIu32": %u packets recovered, %u lost",
+                     upipe_rtp_fec->out_matrix_snbase,
+                     upipe_rtp_fec->matrix_recovered,
+                     upipe_rtp_fec->matrix_lost);
+    }
+    if (stats->max_recovered < upipe_rtp_fec->matrix_recovered)
+        stats->max_recovered = upipe_rtp_fec->matrix_recovered;
+    if (stats->max_lost < upipe_rtp_fec->matrix_lost)
+        stats->max_lost = upipe_rtp_fec->matrix_lost;
+
+    upipe_rtp_fec->matrix_recovered = 0;
+    upipe_rtp_fec->matrix_lost = 0;
+}
+
+/** @internal @This accounts an output packet, and the packets lost before
+ * it, in the statistics of their matrices. Matrices are aligned on the first
+ * column FEC packet.
+ *
+ * @param upipe description structure of the pipe
+ * @param expected sequence number expected after the previous packet
+ * @param seqnum sequence number of the packet
+ * @param recovered true if the packet was recovered
+ */
+static void upipe_rtp_fec_account(struct upipe *upipe, uint16_t expected,
+                                  uint16_t seqnum, bool recovered)
+{
+    struct upipe_rtp_fec *upipe_rtp_fec = upipe_rtp_fec_from_upipe(upipe);
+    uint16_t matrix_size = upipe_rtp_fec->cols * upipe_rtp_fec->rows;
+    if (!matrix_size)
+        return;
+
+    if (upipe_rtp_fec->out_matrix_snbase == UINT32_MAX) {
+        if (upipe_rtp_fec->cur_matrix_snbase == UINT32_MAX ||
+            seq_num_lt(seqnum, upipe_rtp_fec->cur_matrix_snbase))
             return;
-        }
+        upipe_rtp_fec->out_matrix_snbase = upipe_rtp_fec->cur_matrix_snbase;
+        if (seq_num_lt(expected, upipe_rtp_fec->out_matrix_snbase))
+            expected = upipe_rtp_fec->out_matrix_snbase;
+    }
+    if (seq_num_lt(seqnum, expected))
+        expected = seqnum;
 
-        if (!seq_num_lt(new_seqnum, seqnum))
+    for ( ; ; ) {
+        uint16_t end = upipe_rtp_fec->out_matrix_snbase + matrix_size;
+        if (seq_num_lt(seqnum, end))
             break;
+        if (seq_num_lt(expected, end)) {
+            upipe_rtp_fec->matrix_lost += (uint16_t)(end - expected);
+            expected = end;
+        }
+        upipe_rtp_fec_close_matrix(upipe);
+        upipe_rtp_fec->out_matrix_snbase = end;
+    }
+
+    upipe_rtp_fec->matrix_lost += (uint16_t)(seqnum - expected);
+    if (recovered)
+        upipe_rtp_fec->matrix_recovered++;
+}
+
+/** @internal @This outputs a main packet and accounts it.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref uref structure
+ */
+static void upipe_rtp_fec_send(struct upipe *upipe, struct uref *uref)
+{
+    struct upipe_rtp_fec *upipe_rtp_fec = upipe_rtp_fec_from_upipe(upipe);
+    uint16_t seqnum = uref->priv;
+    bool recovered = uref->priv & UPIPE_RTP_FEC_RECOVERED;
 
-        /* Check previous packet if any */
-        struct uref *prev_uref = uref_from_uchain(uchain->prev);
-        if (prev_uref) {
-            uint16_t prev_seqnum = prev_uref->priv;
-            if (prev_seqnum == new_seqnum)
-                continue;
+    upipe_rtp_fec_output(upipe, uref, NULL);
 
-            if (seq_num_lt(new_seqnum, prev_uref->priv))
-                continue;
+    uint16_t expected = seqnum;
+    if (upipe_rtp_fec->last_send_seqnum != UINT32_MAX) {
+        expected = upipe_rtp_fec->last_send_seqnum + 1;
+        if (expected != seqnum) {
+            upipe_warn_va(upipe, "FEC output LOST, expected seqnum %hu got %hu",
+                    expected, seqnum);
+            upipe_rtp_fec->lost += (uint16_t)(seqnum - expected);
         }
+    }
+    upipe_rtp_fec_account(upipe, expected, seqnum, recovered);
 
-        uref_clock_delete_date_sys(uref);
-        ulist_insert(uchain->prev, uchain, uref_to_uchain(uref));
+    upipe_rtp_fec->last_send_seqnum = seqnum;
+}
+
+/** @internal @This inserts a main packet in the ring.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref uref structure
+ */
+static void upipe_rtp_fec_insert_main(struct upipe *upipe, struct uref *uref)
+{
+    struct upipe_rtp_fec *upipe_rtp_fec = upipe_rtp_fec_from_upipe(upipe);
+    struct upipe_rtp_fec_ring *ring = &upipe_rtp_fec->main_ring;
+    uint16_t seqnum = uref->priv;
+
+    /* Packet arriving after its successors were output */
+    if (upipe_rtp_fec->last_send_seqnum != UINT32_MAX &&
+        !seq_num_lt(upipe_rtp_fec->last_send_seqnum, seqnum)) {
+        upipe_verbose_va(upipe, "late packet %hu", seqnum);
+        uref_free(uref);
         return;
     }
 
-    /* Add to end of queue */
-    ulist_add(queue, uref_to_uchain(uref));
+    while (upipe_rtp_fec_ring_overflows(ring, seqnum)) {
+        if (ubase_check(upipe_rtp_fec_ring_grow(ring)))
+            continue;
+        /* Output the oldest packet early to make room */
+        struct uref *first_uref = upipe_rtp_fec_ring_pop(ring);
+        uint64_t date_sys = UINT64_MAX;
+        int type;
+        uref_clock_get_date_sys(first_uref, &date_sys, &type);
+        if (date_sys != UINT64_MAX)
+            uref_clock_set_date_sys(first_uref,
+                                    date_sys + upipe_rtp_fec->latency, type);
+        upipe_rtp_fec_send(upipe, first_uref);
+    }
+
+    /* The date of reordered packets is not usable */
+    if (ring->count && seq_num_lt(seqnum, ring->last))
+        uref_clock_delete_date_sys(uref);
+
+    if (!upipe_rtp_fec_ring_insert(ring, seqnum, uref))
+        uref_free(uref);
+}
+
+/** @internal @This inserts a FEC packet in a ring, indexed by its SNBase.
+ *
+ * @param ring pointer to the ring
+ * @param uref uref structure
+ */
+static void upipe_rtp_fec_insert_fec(struct upipe_rtp_fec_ring *ring,
+                                     struct uref *uref)
+{
+    uint16_t snbase_low = uref->priv >> 32;
+
+    while (upipe_rtp_fec_ring_overflows(ring, snbase_low))
+        if (!ubase_check(upipe_rtp_fec_ring_grow(ring)))
+            uref_free(upipe_rtp_fec_ring_pop(ring));
+
+    if (!upipe_rtp_fec_ring_insert(ring, snbase_low, uref))
+        uref_free(uref);
+}
+
+/** @internal @This XORs the payload of a packet into a buffer.
+ *
+ * @param upipe description structure of the pipe
+ * @param dst buffer to XOR into
+ * @param uref packet
+ * @param size number of octets of payload to XOR
+ */
+static void upipe_rtp_fec_xor_payload(struct upipe *upipe, uint8_t *dst,
+                                      struct uref *uref, int size)
+{
+    struct upipe_rtp_fec *upipe_rtp_fec = upipe_rtp_fec_from_upipe(upipe);
+    int offset = RTP_HEADER_SIZE;
+
+    while (size > 0) {
+        int read_size = size;
+        const uint8_t *src;
+        if (unlikely(!ubase_check(uref_block_read(uref, offset, &read_size,
+                                                  &src)))) {
+            upipe_warn(upipe, "invalid buffer");
+            return;
+        }
+        upipe_rtp_fec->fec_xor(dst, src, read_size);
+        uref_block_unmap(uref, offset);
+        dst += read_size;
+        offset += read_size;
+        size -= read_size;
+    }
 }
 
 /* apply the correction from that fec packet */
@@ -269,28 +659,24 @@ static void upipe_rtp_fec_correct_packets(struct upipe *upipe,
 {
     struct upipe_rtp_fec *upipe_rtp_fec = upipe_rtp_fec_from_upipe(upipe);
 
-    bool found_seqnum[FEC_MAX] = {0};
+    struct uref *urefs[FEC_MAX];
+    uint16_t missing_seqnum = 0;
 
     /* Search to see if any packets are lost */
     int processed = 0;
-    struct uchain *uchain, *uchain_tmp;
-    ulist_foreach (&upipe_rtp_fec->main_queue, uchain) {
-        struct uref *uref = uref_from_uchain(uchain);
-        uint16_t seqnum = uref->priv;
-
-        for (int i = 0; i < items; i++) {
-            if (seqnum_list[i] == seqnum) {
-                processed++;
-                found_seqnum[i] = true;
-                break;
-            }
-        }
+    for (int i = 0; i < items; i++) {
+        urefs[i] = upipe_rtp_fec_ring_get(&upipe_rtp_fec->main_ring,
+                                          seqnum_list[i]);
+        if (urefs[i] != NULL)
+            processed++;
+        else
+            missing_seqnum = seqnum_list[i];
+    }
 
-        if (processed == items) {
-            upipe_verbose_va(upipe, "no packets lost");
-            uref_free(fec_uref);
-            return;
-        }
+    if (processed == items) {
+        upipe_verbose_va(upipe, "no packets lost");
+        uref_free(fec_uref);
+        return;
     }
 
     if (processed != items - 1) {
@@ -300,39 +686,45 @@ static void upipe_rtp_fec_correct_packets(struct upipe *upipe,
         return;
     }
 
+    if (upipe_rtp_fec->last_send_seqnum != UINT32_MAX &&
+        !seq_num_lt(upipe_rtp_fec->last_send_seqnum, missing_seqnum)) {
+        upipe_dbg_va(upipe, "Too late to correct packet %hu", missing_seqnum);
+        uref_free(fec_uref);
+        return;
+    }
+
     /* Extract parameters from FEC packet */
     uint16_t length_rec;
     uint32_t ts_rec;
     upipe_rtp_fec_extract_parameters(fec_uref, &ts_rec, &length_rec);
 
-    /* Recoverable packet */
-    ulist_foreach (&upipe_rtp_fec->main_queue, uchain) {
-        struct uref *uref = uref_from_uchain(uchain);
-
-        // TODO: only if in list?
+    /* Recover length and timestamp of missing packet */
+    struct uref *header_uref = NULL;
+    for (int i = 0; i < items; i++) {
+        struct uref *uref = urefs[i];
+        if (uref == NULL)
+            continue;
 
         uint8_t rtp_buffer[RTP_HEADER_SIZE];
         const uint8_t *rtp_header = uref_block_peek(uref, 0, RTP_HEADER_SIZE,
                 rtp_buffer);
         if (unlikely(rtp_header == NULL)) {
             upipe_warn(upipe, "invalid buffer");
+            urefs[i] = NULL;
             continue;
         }
 
         uint32_t timestamp = rtp_get_timestamp(rtp_header);
         uref_block_peek_unmap(uref, 0, rtp_buffer, rtp_header);
 
-        /* Recover length and timestamp of missing packet */
-        for (int i = 0; i < items; i++) {
-            if (seqnum_list[i] == uref->priv) {
-                size_t uref_len = 0;
-                uref_block_size(uref, &uref_len);
-                uref_len -= RTP_HEADER_SIZE;
+        size_t uref_len = 0;
+        uref_block_size(uref, &uref_len);
+        uref_len -= RTP_HEADER_SIZE;
 
-                length_rec ^= uref_len;
-                ts_rec ^= timestamp;
-            }
-        }
+        length_rec ^= uref_len;
+        ts_rec ^= timestamp;
+        if (header_uref == NULL)
+            header_uref = uref;
     }
 
     if (length_rec != 7 * TS_SIZE)
@@ -342,58 +734,44 @@ static void upipe_rtp_fec_correct_packets(struct upipe *upipe,
     uref_block_resize(fec_uref, SMPTE_2022_FEC_HEADER_SIZE, -1);
     uint8_t *dst;
     int size = length_rec + RTP_HEADER_SIZE;
-    uref_block_write(fec_uref, 0, &size, &dst);
-
-    bool copy_header = true;
-
-    processed = 0;
-    ulist_foreach (&upipe_rtp_fec->main_queue, uchain) {
-        struct uref *uref = uref_from_uchain(uchain);
-        for (int i = 0; i < items; i++) {
-            if (seqnum_list[i] == uref->priv) {
-                size_t size = 0;
-                uref_block_size(uref, &size);
-                uint8_t payload_buf[TS_SIZE * 7 + RTP_HEADER_SIZE];
-
-                if(size < sizeof(payload_buf))
-                    continue;
-
-                // TODO: uref_block_read in a loop
-                const uint8_t *peek = uref_block_peek(uref, 0, size,
-                        payload_buf);
-                if (copy_header) {
-                    memcpy(dst, peek, RTP_HEADER_SIZE);
-                    copy_header = false;
-                }
-                for (int i = 0; i < size - RTP_HEADER_SIZE; i++)
-                    dst[RTP_HEADER_SIZE + i] ^= peek[RTP_HEADER_SIZE + i];
-                uref_block_peek_unmap(uref, RTP_HEADER_SIZE, payload_buf, peek);
-                processed++;
-                break;
-            }
-        }
-
-        if (processed == items-1)
-            break;
+    if (unlikely(header_uref == NULL ||
+                 !ubase_check(uref_block_write(fec_uref, 0, &size, &dst)))) {
+        upipe_warn(upipe, "invalid FEC buffer");
+        uref_free(fec_uref);
+        return;
+    }
+    if (unlikely(size != length_rec + RTP_HEADER_SIZE)) {
+        upipe_warn(upipe, "invalid FEC buffer");
+        uref_block_unmap(fec_uref, 0);
+        uref_free(fec_uref);
+        return;
     }
 
-    /* Maybe possible to merge with above */
-    uint16_t missing_seqnum = 0;
-    for (int i = 0; i < items; i++)
-        if (!found_seqnum[i]) {
-            missing_seqnum = seqnum_list[i];
-            break;
-        }
+    uref_block_extract(header_uref, 0, RTP_HEADER_SIZE, dst);
+
+    /* XOR the payloads, shorter packets being padded with zeros */
+    for (int i = 0; i < items; i++) {
+        if (urefs[i] == NULL)
+            continue;
+
+        size_t uref_size = 0;
+        uref_block_size(urefs[i], &uref_size);
+        uref_size -= RTP_HEADER_SIZE;
+        if (uref_size > length_rec)
+            uref_size = length_rec;
+        upipe_rtp_fec_xor_payload(upipe, dst + RTP_HEADER_SIZE, urefs[i],
+                                  uref_size);
+    }
 
     upipe_dbg_va(&upipe_rtp_fec->upipe, "Corrected packet. Sequence number: %u", missing_seqnum);
     upipe_rtp_fec->recovered++;
-    fec_uref->priv = missing_seqnum;
+    fec_uref->priv = missing_seqnum | UPIPE_RTP_FEC_RECOVERED;
     rtp_set_seqnum(dst, missing_seqnum);
     rtp_set_timestamp(dst, ts_rec);
     uref_block_unmap(fec_uref, 0);
     uref_block_resize(fec_uref, 0, size);
 
-    insert_ordered_uref(&upipe_rtp_fec->main_queue, fec_uref);
+    upipe_rtp_fec_insert_main(upipe, fec_uref);
 }
 
 static void upipe_rtp_fec_apply_col_fec(struct upipe *upipe)
@@ -402,11 +780,11 @@ static void upipe_rtp_fec_apply_col_fec(struct upipe *upipe)
     uint16_t seqnum_list[FEC_MAX];
 
     for (;;) {
-        struct uchain *fec_uchain = ulist_peek(&upipe_rtp_fec->col_queue);
-        if (!fec_uchain)
+        struct uref *fec_uref =
+            upipe_rtp_fec_ring_peek(&upipe_rtp_fec->col_ring);
+        if (!fec_uref)
             break;
 
-        struct uref *fec_uref = uref_from_uchain(fec_uchain);
         uint16_t snbase_low = fec_uref->priv >> 32;
         uint16_t col_delta = upipe_rtp_fec->last_seqnum - snbase_low - 1;
 
@@ -414,7 +792,7 @@ static void upipe_rtp_fec_apply_col_fec(struct upipe *upipe)
         if (col_delta <= (upipe_rtp_fec->cols + 1) * upipe_rtp_fec->rows)
             break;
 
-        ulist_pop(&upipe_rtp_fec->col_queue);
+        upipe_rtp_fec_ring_pop(&upipe_rtp_fec->col_ring);
 
         /* If no current matrix is being processed and we have enough packets
          * set existing matrix to the snbase value */
@@ -441,14 +819,13 @@ static void upipe_rtp_fec_apply_row_fec(struct upipe *upipe,
     uint16_t seqnum_list[FEC_MAX];
 
     /* get rid of old row FEC packets */
-    clear_fec_list(&upipe_rtp_fec->row_queue, cur_row_fec_snbase);
+    upipe_rtp_fec_ring_clear(&upipe_rtp_fec->row_ring, cur_row_fec_snbase);
 
     /* Row FEC packets are optional so may not actually exist */
-    struct uchain *fec_uchain = ulist_pop(&upipe_rtp_fec->row_queue);
-    if (!fec_uchain)
+    struct uref *fec_uref = upipe_rtp_fec_ring_pop(&upipe_rtp_fec->row_ring);
+    if (!fec_uref)
         return;
 
-    struct uref *fec_uref = uref_from_uchain(fec_uchain);
     uint16_t snbase_low = fec_uref->priv >> 32;
 
     upipe_rtp_fec->cur_row_fec_snbase = snbase_low;
@@ -461,21 +838,11 @@ static void upipe_rtp_fec_apply_row_fec(struct upipe *upipe,
             upipe_rtp_fec->cols);
 }
 
-static void upipe_rtp_fec_clear_queue(struct uchain *queue)
-{
-    struct uchain *uchain, *uchain_tmp;
-    ulist_delete_foreach (queue, uchain, uchain_tmp) {
-        struct uref *uref = uref_from_uchain(uchain);
-        ulist_delete(uchain);
-        uref_free(uref);
-    }
-}
-
 static void upipe_rtp_fec_clear(struct upipe_rtp_fec *upipe_rtp_fec)
 {
-    upipe_rtp_fec_clear_queue(&upipe_rtp_fec->main_queue);
-    upipe_rtp_fec_clear_queue(&upipe_rtp_fec->col_queue);
-    upipe_rtp_fec_clear_queue(&upipe_rtp_fec->row_queue);
+    upipe_rtp_fec_ring_clean(&upipe_rtp_fec->main_ring);
+    upipe_rtp_fec_ring_clean(&upipe_rtp_fec->col_ring);
+    upipe_rtp_fec_ring_clean(&upipe_rtp_fec->row_ring);
 }
 
 // TODO: wait_upump?
@@ -485,13 +852,11 @@ static void upipe_rtp_fec_timer(struct upump *upump)
     struct upipe_rtp_fec *upipe_rtp_fec = upipe_rtp_fec_from_upipe(upipe);
     uint64_t now = uclock_now(upipe_rtp_fec->uclock);
 
-    struct uchain *uchain, *uchain_tmp;
-    ulist_delete_foreach (&upipe_rtp_fec->main_queue, uchain, uchain_tmp) {
-        struct uref *uref = uref_from_uchain(uchain);
+    struct uref *uref;
+    while ((uref = upipe_rtp_fec_ring_peek(&upipe_rtp_fec->main_ring))) {
         uint64_t date_sys = UINT64_MAX;
         int type;
         uref_clock_get_date_sys(uref, &date_sys, &type);
-        uint64_t seqnum = uref->priv & UINT32_MAX;
 
         if (date_sys != UINT64_MAX) {
             // TODO: replace by output latency
@@ -503,21 +868,8 @@ static void upipe_rtp_fec_timer(struct upump *upump)
             uref_clock_set_date_sys(uref, date_sys, type);
         }
 
-        ulist_delete(uchain);
-        upipe_rtp_fec_output(upipe, uref, NULL);
-
-        if (upipe_rtp_fec->last_send_seqnum != UINT32_MAX) {
-            uint16_t expected = upipe_rtp_fec->last_send_seqnum + 1;
-            if (expected != seqnum) {
-                upipe_warn_va(upipe, "FEC output LOST, expected seqnum %hu got %" PRIu64,
-                        expected, seqnum);
-                upipe_rtp_fec->lost +=
-                    (seqnum + UINT16_MAX + 1 - expected) & UINT16_MAX;
-
-            }
-        }
-
-        upipe_rtp_fec->last_send_seqnum = seqnum;
+        upipe_rtp_fec_ring_pop(&upipe_rtp_fec->main_ring);
+        upipe_rtp_fec_send(upipe, uref);
     }
 }
 
@@ -551,9 +903,31 @@ static void clear_fec(struct upipe *upipe)
     upipe_rtp_fec->first_seqnum = UINT32_MAX;
     upipe_rtp_fec->last_seqnum = UINT32_MAX;
     upipe_rtp_fec->latency = 0;
+    upipe_rtp_fec->out_matrix_snbase = UINT32_MAX;
+    upipe_rtp_fec->matrix_recovered = 0;
+    upipe_rtp_fec->matrix_lost = 0;
 
     memset(upipe_rtp_fec->recent, 0xff, 2 * upipe_rtp_fec->rows *
             upipe_rtp_fec->cols * sizeof(*upipe_rtp_fec->recent));
+
+    if (upipe_rtp_fec->rows && upipe_rtp_fec->cols) {
+        /* Room for two matrices, the late FEC packets and the jitter */
+        unsigned int size = UPIPE_RTP_FEC_RING_MIN;
+        while (size < 4 * upipe_rtp_fec->rows * upipe_rtp_fec->cols &&
+               size < UPIPE_RTP_FEC_RING_MAX)
+            size *= 2;
+        if (unlikely(!ubase_check(upipe_rtp_fec_ring_init(
+                            &upipe_rtp_fec->main_ring, size)) ||
+                     !ubase_check(upipe_rtp_fec_ring_init(
+                            &upipe_rtp_fec->col_ring, size)) ||
+                     !ubase_check(upipe_rtp_fec_ring_init(
+                            &upipe_rtp_fec->row_ring, size)))) {
+            upipe_rtp_fec_clear(upipe_rtp_fec);
+            upipe_rtp_fec->rows = 0;
+            upipe_rtp_fec->cols = 0;
+            upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+        }
+    }
 }
 
 static void upipe_rtp_fec_start_timer(struct upipe *upipe, uint16_t seqnum)
@@ -561,13 +935,14 @@ static void upipe_rtp_fec_start_timer(struct upipe *upipe, uint16_t seqnum)
     struct upipe_rtp_fec *upipe_rtp_fec = upipe_rtp_fec_from_sub_mgr(upipe->mgr);
 
     /* Clear any old non-FEC packets */
-    clear_main_list(&upipe_rtp_fec->main_queue, upipe_rtp_fec->cur_matrix_snbase);
+    upipe_rtp_fec_ring_clear(&upipe_rtp_fec->main_ring,
+                             upipe_rtp_fec->cur_matrix_snbase);
 
-    struct uchain *first_uchain = ulist_peek(&upipe_rtp_fec->main_queue);
-    if (!first_uchain)
+    struct uref *first_uref =
+        upipe_rtp_fec_ring_peek(&upipe_rtp_fec->main_ring);
+    if (!first_uref)
         return;
 
-    struct uref *first_uref = uref_from_uchain(first_uchain);
     upipe_rtp_fec->first_seqnum = first_uref->priv;
 
     /* Make sure we have at least two matrices of data as per the spec */
@@ -584,13 +959,10 @@ static void upipe_rtp_fec_start_timer(struct upipe *upipe, uint16_t seqnum)
 
     if (date_sys == UINT64_MAX) {
         /* First packet having an unusable date_sys is not useful */
-        ulist_delete(first_uchain);
-        uref_free(first_uref);
-        first_uchain = ulist_peek(&upipe_rtp_fec->main_queue);
-        if (first_uchain) {
-            struct uref *uref = uref_from_uchain(first_uchain);
-            upipe_rtp_fec->first_seqnum = uref->priv;
-        }
+        uref_free(upipe_rtp_fec_ring_pop(&upipe_rtp_fec->main_ring));
+        first_uref = upipe_rtp_fec_ring_peek(&upipe_rtp_fec->main_ring);
+        if (first_uref)
+            upipe_rtp_fec->first_seqnum = (uint16_t)first_uref->priv;
         return;
     }
 
@@ -664,7 +1036,7 @@ static void upipe_rtp_fec_main_input(struct upipe *upipe, struct uref *uref)
         uint64_t date_sys = 0;
         uref_clock_get_date_sys(uref, &date_sys, &type);
 
-        insert_ordered_uref(&upipe_rtp_fec->main_queue, uref);
+        upipe_rtp_fec_insert_main(super_pipe, uref);
 
         /* Owing to clock drift the latency of 2x the FEC matrix may increase
          * Build a continually updating duration and correct the latency if necessary.
@@ -734,8 +1106,8 @@ static void upipe_rtp_fec_colrow_input(struct upipe *upipe, struct uref *uref)
     uref_block_peek_unmap(uref, RTP_HEADER_SIZE, fec_buffer, fec_header);
 
     bool col = (upipe == upipe_rtp_fec_to_col_subpipe(upipe_rtp_fec));
-    struct uchain *queue = col ? &upipe_rtp_fec->col_queue :
-        &upipe_rtp_fec->row_queue;
+    struct upipe_rtp_fec_ring *ring = col ? &upipe_rtp_fec->col_ring :
+        &upipe_rtp_fec->row_ring;
 
     if (col) {
         if (d) {
@@ -764,7 +1136,7 @@ static void upipe_rtp_fec_colrow_input(struct upipe *upipe, struct uref *uref)
         }
     }
 
-    insert_ordered_uref(queue, uref);
+    upipe_rtp_fec_insert_fec(ring, uref);
     upipe_rtp_fec->pkts_since_last_fec = 0;
     return;
 
@@ -872,7 +1244,9 @@ static void upipe_rtp_fec_init_sub_mgr(struct upipe *upipe)
     struct upipe_rtp_fec *upipe_rtp_fec = upipe_rtp_fec_from_upipe(upipe);
     struct upipe_mgr *sub_mgr = &upipe_rtp_fec->sub_mgr;
 
-    sub_mgr->refcount = upipe_rtp_fec_to_urefcount(upipe_rtp_fec);
+    /* the subpipes are static and share the refcount of the pipe, so they
+     * must not hold it through their manager */
+    sub_mgr->refcount = NULL;
     sub_mgr->signature = UPIPE_RTP_FEC_INPUT_SIGNATURE;
     sub_mgr->upipe_alloc = NULL;
     sub_mgr->upipe_input = upipe_rtp_fec_sub_input;
@@ -916,6 +1290,12 @@ static struct upipe *_upipe_rtp_fec_alloc(struct upipe_mgr *mgr,
     upipe_rtp_fec->lost = 0;
     upipe_rtp_fec->prev_date_sys = UINT64_MAX;
     upipe_rtp_fec->recovered = 0;
+    upipe_rtp_fec->out_matrix_snbase = UINT32_MAX;
+    upipe_rtp_fec->fec_xor = upipe_rtp_fec_xor_c;
+#ifdef UPIPE_HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2"))
+        upipe_rtp_fec->fec_xor = upipe_rtp_fec_xor_avx2;
+#endif
 
     struct upipe *upipe = upipe_rtp_fec_to_upipe(upipe_rtp_fec);
     upipe_init(upipe, mgr, uprobe);
@@ -935,10 +1315,6 @@ static struct upipe *_upipe_rtp_fec_alloc(struct upipe_mgr *mgr,
     upipe_rtp_fec_sub_init(upipe_rtp_fec_to_row_subpipe(upipe_rtp_fec),
                             &upipe_rtp_fec->sub_mgr, uprobe_row);
 
-    ulist_init(&upipe_rtp_fec->main_queue);
-    ulist_init(&upipe_rtp_fec->col_queue);
-    ulist_init(&upipe_rtp_fec->row_queue);
-
     upipe_rtp_fec_check_upump_mgr(upipe);
 
     upipe_throw_ready(upipe);
@@ -1030,6 +1406,14 @@ static int upipe_rtp_fec_control(struct upipe *upipe, int command, va_list args)
         *columns = upipe_rtp_fec->cols;
         return UBASE_ERR_NONE;
     }
+    case UPIPE_RTP_FEC_GET_STATS: {
+        UBASE_SIGNATURE_CHECK(args, UPIPE_RTP_FEC_SIGNATURE)
+        struct upipe_rtp_fec_stats *stats =
+            va_arg(args, struct upipe_rtp_fec_stats *);
+        *stats = upipe_rtp_fec->stats;
+        memset(&upipe_rtp_fec->stats, 0, sizeof(upipe_rtp_fec->stats));
+        return UBASE_ERR_NONE;
+    }
     default:
         return UBASE_ERR_UNHANDLED;
     }
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2015-2017 Open Broadcast Systems Ltd
+ *
+ * Authors: Kieran Kunhya
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ */
+
+/** @file
+ * @short Upipe internal XOR functions of the RTP FEC module
+ */
+
+#ifndef _UPIPE_TS_UPIPE_RTP_FEC_XOR_H_
+/** @hidden */
+#define _UPIPE_TS_UPIPE_RTP_FEC_XOR_H_
+
+#include <upipe/config.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** @This XORs a buffer into another (portable version).
+ *
+ * @param dst buffer to XOR into
+ * @param src buffer to XOR
+ * @param size number of octets
+ */
+void upipe_rtp_fec_xor_c(uint8_t *dst, const uint8_t *src, size_t size);
+
+#ifdef UPIPE_HAVE_X86_SIMD
+/** @This XORs a buffer into another with AVX2. The CPU must support the avx2
+ * feature.
+ *
+ * @param dst buffer to XOR into
+ * @param src buffer to XOR
+ * @param size number of octets
+ */
+void upipe_rtp_fec_xor_avx2(uint8_t *dst, const uint8_t *src, size_t size);
+#endif
+
+#endif
@@ -67,6 +67,7 @@
 #include <upipe-modules/upipe_setrap.h>
 #include <upipe-modules/upipe_idem.h>
 #include <upipe-modules/upipe_setflowdef.h>
+#include <upipe-modules/upipe_worker_linear.h>
 #include <upipe-ts/uref_ts_flow.h>
 #include <upipe-ts/uref_ts_event.h>
 #include <upipe-ts/upipe_ts_demux.h>
@@ -114,6 +115,8 @@
 #define MAX_DELAY UCLOCK_FREQ
 /** number of EITs table IDs */
 #define EITS_TABLEIDS 16
+/** length of the queues to and from worker threads, in PES */
+#define WORKER_QUEUE_LENGTH 255
 
 /** @internal @This is the private context of a ts_demux manager. */
 struct upipe_ts_demux_mgr {
@@ -165,6 +168,14 @@ struct upipe_ts_demux_mgr {
     /** pointer to autof manager */
     struct upipe_mgr *autof_mgr;
 
+    /* workers */
+    /** array of pointers to wlin managers running outputs */
+    struct upipe_mgr **worker_mgrs;
+    /** number of wlin managers */
+    unsigned int nb_workers;
+    /** probe hierarchy for pipes running in worker threads */
+    struct uprobe *worker_uprobe;
+
     /** public upipe_mgr structure */
     struct upipe_mgr mgr;
 };
@@ -250,6 +261,8 @@ struct upipe_ts_demux {
     bool auto_conformance;
     /** current conformance */
     enum upipe_ts_conformance conformance;
+    /** index of the worker assigned to the next program */
+    unsigned int next_worker;
 
     /** probe to get new flow events from inner pipes created by psi_pid
      * objects */
@@ -350,6 +363,8 @@ struct upipe_ts_demux_program {
     uint16_t pcr_pid;
     /** PCR ts_split output inner pipe */
     struct upipe *pcr_split_output;
+    /** wlin manager running the framers of the outputs, or NULL */
+    struct upipe_mgr *worker_mgr;
 
     /** offset between MPEG timestamps and Upipe timestamps */
     int64_t timestamp_offset;
@@ -737,6 +752,9 @@ static int upipe_ts_demux_output_plumber(struct upipe *upipe,
                                     UPROBE_LOG_VERBOSE, "pesd"));
         if (unlikely(output == NULL))
             return UBASE_ERR_ALLOC;
+        if (program->worker_mgr != NULL && ts_demux_mgr->autof_mgr != NULL)
+            /* hand whole PES to the worker thread */
+            upipe_ts_pesd_set_assemble(output, true);
         upipe_release(output);
         return UBASE_ERR_NONE;
     }
@@ -759,6 +777,37 @@ static int upipe_ts_demux_output_plumber(struct upipe *upipe,
         return UBASE_ERR_NONE;
     }
 
+    if (ts_demux_mgr->autof_mgr != NULL && program->worker_mgr != NULL) {
+        /* allocate autof in a worker thread */
+        struct upipe *remote =
+            upipe_void_alloc(ts_demux_mgr->autof_mgr,
+                uprobe_pfx_alloc_va(
+                    uprobe_use(ts_demux_mgr->worker_uprobe),
+                    UPROBE_LOG_VERBOSE, "autof %"PRIu64, program->program));
+        if (unlikely(remote == NULL))
+            return UBASE_ERR_ALLOC;
+
+        struct upipe *output =
+            upipe_wlin_alloc(program->worker_mgr,
+                uprobe_pfx_alloc(
+                    uprobe_use(&upipe_ts_demux_output->last_inner_probe),
+                    UPROBE_LOG_VERBOSE, "wlin"),
+                remote,
+                uprobe_pfx_alloc_va(
+                    uprobe_use(ts_demux_mgr->worker_uprobe),
+                    UPROBE_LOG_VERBOSE, "wlin %"PRIu64, program->program),
+                WORKER_QUEUE_LENGTH, WORKER_QUEUE_LENGTH);
+        if (unlikely(output == NULL))
+            return UBASE_ERR_ALLOC;
+        int err = upipe_set_output(inner, output);
+        if (unlikely(!ubase_check(err))) {
+            upipe_release(output);
+            return err;
+        }
+        upipe_ts_demux_output_store_bin_output(upipe, output);
+        return UBASE_ERR_NONE;
+    }
+
     if (ts_demux_mgr->autof_mgr != NULL) {
         /* allocate autof inner */
         struct upipe *output =
@@ -1648,6 +1697,7 @@ static struct upipe *upipe_ts_demux_program_alloc(struct upipe_mgr *mgr,
     upipe_ts_demux_program->pmt_rap = 0;
     upipe_ts_demux_program->pcr_pid = 0;
     upipe_ts_demux_program->pcr_split_output = NULL;
+    upipe_ts_demux_program->worker_mgr = NULL;
     upipe_ts_demux_program->psi_pid_pmt =
         upipe_ts_demux_program->psi_pid_eit = NULL;
     upipe_ts_demux_program->psi_split_output_pmt =
@@ -1683,6 +1733,16 @@ static struct upipe *upipe_ts_demux_program_alloc(struct upipe_mgr *mgr,
     upipe_throw_ready(upipe);
 
     struct upipe_ts_demux *demux = upipe_ts_demux_from_program_mgr(upipe->mgr);
+    struct upipe_ts_demux_mgr *ts_demux_mgr =
+        upipe_ts_demux_mgr_from_upipe_mgr(upipe_ts_demux_to_upipe(demux)->mgr);
+    if (ts_demux_mgr->nb_workers) {
+        /* distribute programs on workers */
+        upipe_ts_demux_program->worker_mgr = upipe_mgr_use(
+            ts_demux_mgr->worker_mgrs[demux->next_worker]);
+        demux->next_worker = (demux->next_worker + 1) %
+                             ts_demux_mgr->nb_workers;
+    }
+
     const uint8_t *filter, *mask;
     size_t size;
     const char *def;
@@ -1741,8 +1801,6 @@ static struct upipe *upipe_ts_demux_program_alloc(struct upipe_mgr *mgr,
         return upipe;
     }
 
-    struct upipe_ts_demux_mgr *ts_demux_mgr =
-        upipe_ts_demux_mgr_from_upipe_mgr(upipe_ts_demux_to_upipe(demux)->mgr);
     upipe_ts_demux_program->pmtd =
         upipe_void_alloc_output(upipe_ts_demux_program->setflowdef,
                 ts_demux_mgr->ts_pmtd_mgr,
@@ -1829,6 +1887,7 @@ static void upipe_ts_demux_program_free(struct urefcount *urefcount_real)
     uprobe_clean(&upipe_ts_demux_program->proxy_probe);
     urefcount_clean(urefcount_real);
     upipe_ts_demux_program_clean_sub_outputs(upipe);
+    upipe_mgr_release(upipe_ts_demux_program->worker_mgr);
     if (upipe_ts_demux_program->flow_def_input != NULL)
         uref_free(upipe_ts_demux_program->flow_def_input);
     upipe_ts_demux_program_clean_urefcount(upipe);
@@ -2690,6 +2749,7 @@ static struct upipe *upipe_ts_demux_alloc(struct upipe_mgr *mgr,
     upipe_ts_demux->conformance = UPIPE_TS_CONFORMANCE_DVB_NO_TABLES;
     upipe_ts_demux->auto_conformance = true;
     upipe_ts_demux->nit_pid = 0;
+    upipe_ts_demux->next_worker = 0;
     upipe_ts_demux->flow_def_input = NULL;
 
     uprobe_init(&upipe_ts_demux->psi_pid_plumber,
@@ -3094,6 +3154,10 @@ static void upipe_ts_demux_mgr_free(struct urefcount *urefcount)
     upipe_mgr_release(ts_demux_mgr->ts_pesd_mgr);
     upipe_mgr_release(ts_demux_mgr->ts_scte35d_mgr);
     upipe_mgr_release(ts_demux_mgr->autof_mgr);
+    for (unsigned int i = 0; i < ts_demux_mgr->nb_workers; i++)
+        upipe_mgr_release(ts_demux_mgr->worker_mgrs[i]);
+    free(ts_demux_mgr->worker_mgrs);
+    uprobe_release(ts_demux_mgr->worker_uprobe);
 
     urefcount_clean(urefcount);
     free(ts_demux_mgr);
@@ -3152,6 +3216,43 @@ static int upipe_ts_demux_mgr_control(struct upipe_mgr *mgr,
         GET_SET_MGR(autof, AUTOF)
 #undef GET_SET_MGR
 
+        case UPIPE_TS_DEMUX_MGR_GET_WORKERS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_TS_DEMUX_SIGNATURE)
+            unsigned int *p = va_arg(args, unsigned int *);
+            *p = ts_demux_mgr->nb_workers;
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_TS_DEMUX_MGR_SET_WORKERS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_TS_DEMUX_SIGNATURE)
+            if (!urefcount_single(&ts_demux_mgr->urefcount))
+                return UBASE_ERR_BUSY;
+            struct upipe_mgr **worker_mgrs =
+                va_arg(args, struct upipe_mgr **);
+            unsigned int nb_workers = va_arg(args, unsigned int);
+            struct uprobe *uprobe_remote = va_arg(args, struct uprobe *);
+            if (nb_workers && (worker_mgrs == NULL || uprobe_remote == NULL))
+                return UBASE_ERR_INVALID;
+
+            struct upipe_mgr **mgrs = NULL;
+            if (nb_workers) {
+                mgrs = malloc(nb_workers * sizeof(struct upipe_mgr *));
+                if (unlikely(mgrs == NULL))
+                    return UBASE_ERR_ALLOC;
+                for (unsigned int i = 0; i < nb_workers; i++)
+                    mgrs[i] = upipe_mgr_use(worker_mgrs[i]);
+            }
+
+            for (unsigned int i = 0; i < ts_demux_mgr->nb_workers; i++)
+                upipe_mgr_release(ts_demux_mgr->worker_mgrs[i]);
+            free(ts_demux_mgr->worker_mgrs);
+            uprobe_release(ts_demux_mgr->worker_uprobe);
+            ts_demux_mgr->worker_mgrs = mgrs;
+            ts_demux_mgr->nb_workers = nb_workers;
+            ts_demux_mgr->worker_uprobe =
+                nb_workers ? uprobe_use(uprobe_remote) : NULL;
+            return UBASE_ERR_NONE;
+        }
+
         default:
             return UBASE_ERR_UNHANDLED;
     }
@@ -3190,6 +3291,10 @@ struct upipe_mgr *upipe_ts_demux_mgr_alloc(void)
 
     ts_demux_mgr->autof_mgr = NULL;
 
+    ts_demux_mgr->worker_mgrs = NULL;
+    ts_demux_mgr->nb_workers = 0;
+    ts_demux_mgr->worker_uprobe = NULL;
+
     urefcount_init(upipe_ts_demux_mgr_to_urefcount(ts_demux_mgr),
                    upipe_ts_demux_mgr_free);
     ts_demux_mgr->mgr.refcount = upipe_ts_demux_mgr_to_urefcount(ts_demux_mgr);
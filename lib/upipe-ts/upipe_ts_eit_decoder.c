@@ -65,6 +65,21 @@
 /** @hidden */
 static int upipe_ts_eitd_check(struct upipe *upipe, struct uref *flow_format);
 
+/** @internal @This describes an event of the current EIT, so that it may be
+ * recognized in the next version of the table. */
+struct upipe_ts_eitd_event {
+    /** event ID */
+    uint16_t id;
+    /** number of the section carrying the event */
+    uint8_t section;
+    /** offset of the event in the section */
+    uint16_t offset;
+    /** size of the event, including descriptors */
+    uint16_t size;
+    /** event number in the flow definition attributes */
+    uint64_t index;
+};
+
 /** @internal @This is the private context of a ts_eitd pipe. */
 struct upipe_ts_eitd {
     /** refcount management structure */
@@ -94,6 +109,12 @@ struct upipe_ts_eitd {
     UPIPE_TS_PSID_TABLE_DECLARE(eit);
     /** EIT table being gathered */
     UPIPE_TS_PSID_TABLE_DECLARE(next_eit);
+    /** events of the currently in effect EIT, sorted by event ID */
+    struct upipe_ts_eitd_event *events;
+    /** number of events of the currently in effect EIT */
+    unsigned int nb_events;
+    /** maximum number of events exported, or 0 */
+    unsigned int max_events;
 
     /** encoding of the following iconv handle */
     const char *current_encoding;
@@ -140,6 +161,9 @@ static struct upipe *upipe_ts_eitd_alloc(struct upipe_mgr *mgr,
     upipe_ts_eitd_init_iconv(upipe);
     upipe_ts_psid_table_init(upipe_ts_eitd->eit);
     upipe_ts_psid_table_init(upipe_ts_eitd->next_eit);
+    upipe_ts_eitd->events = NULL;
+    upipe_ts_eitd->nb_events = 0;
+    upipe_ts_eitd->max_events = 0;
     upipe_throw_ready(upipe);
     return upipe;
 }
@@ -319,6 +343,69 @@ static void upipe_ts_eitd_parse_descs(struct upipe *upipe,
     }
 }
 
+/** @internal @This parses an event of the EIT and imports it into the flow
+ * definition.
+ *
+ * @param upipe description structure of the pipe
+ * @param flow_def flow definition packet to fill in
+ * @param event event number
+ * @param eit_event pointer to the event in the EIT section
+ */
+static void upipe_ts_eitd_parse_event(struct upipe *upipe,
+                                      struct uref *flow_def, uint64_t event,
+                                      const uint8_t *eit_event)
+{
+    UBASE_FATAL(upipe, uref_event_set_id(flow_def,
+                eitn_get_event_id(eit_event), event))
+    time_t start = dvb_time_decode_UTC(eitn_get_start_time(eit_event));
+    UBASE_FATAL(upipe, uref_event_set_start(flow_def,
+                start * UCLOCK_FREQ, event))
+    int duration, hour, min, sec;
+    dvb_time_decode_bcd(eitn_get_duration_bcd(eit_event), &duration,
+                        &hour, &min, &sec);
+    UBASE_FATAL(upipe, uref_event_set_duration(flow_def,
+                duration * UCLOCK_FREQ, event))
+    UBASE_FATAL(upipe, uref_ts_event_set_running_status(flow_def,
+                eitn_get_running(eit_event), event))
+    if (eitn_get_ca(eit_event)) {
+        UBASE_FATAL(upipe, uref_ts_event_set_scrambled(flow_def, event))
+    }
+    upipe_ts_eitd_parse_descs(upipe, flow_def, event,
+            descs_get_desc(eitn_get_descs((uint8_t *)eit_event), 0),
+            eitn_get_desclength(eit_event));
+}
+
+/** @internal @This compares two events by event ID.
+ *
+ * @param p1 pointer to the first event
+ * @param p2 pointer to the second event
+ * @return an integer less than, equal to, or greater than zero
+ */
+static int upipe_ts_eitd_event_cmp(const void *p1, const void *p2)
+{
+    const struct upipe_ts_eitd_event *event1 = p1;
+    const struct upipe_ts_eitd_event *event2 = p2;
+    return (int)event1->id - (int)event2->id;
+}
+
+/** @internal @This finds an event of the currently in effect EIT.
+ *
+ * @param upipe description structure of the pipe
+ * @param id event ID
+ * @return pointer to the event, or NULL
+ */
+static const struct upipe_ts_eitd_event *
+    upipe_ts_eitd_find_event(struct upipe *upipe, uint16_t id)
+{
+    struct upipe_ts_eitd *upipe_ts_eitd = upipe_ts_eitd_from_upipe(upipe);
+    if (upipe_ts_eitd->flow_def_attr == NULL)
+        return NULL;
+    struct upipe_ts_eitd_event key = { .id = id };
+    return bsearch(&key, upipe_ts_eitd->events, upipe_ts_eitd->nb_events,
+                   sizeof(struct upipe_ts_eitd_event),
+                   upipe_ts_eitd_event_cmp);
+}
+
 /** @internal @This parses a new PSI section.
  *
  * @param upipe description structure of the pipe
@@ -331,6 +418,13 @@ static void upipe_ts_eitd_input(struct upipe *upipe, struct uref *uref,
     struct upipe_ts_eitd *upipe_ts_eitd = upipe_ts_eitd_from_upipe(upipe);
     assert(upipe_ts_eitd->flow_def_input != NULL);
 
+    if (upipe_ts_psid_table_cached(upipe_ts_eitd->eit,
+                                   upipe_ts_eitd->next_eit, uref)) {
+        /* Identical section. */
+        uref_free(uref);
+        return;
+    }
+
     if (!upipe_ts_eitd_table_section(upipe_ts_eitd->next_eit, uref))
         return;
 
@@ -359,6 +453,19 @@ static void upipe_ts_eitd_input(struct upipe *upipe, struct uref *uref,
         return;
     }
 
+    /* map the sections of the current EIT to recognize unchanged events */
+    const uint8_t *sections[PSI_TABLE_MAX_SECTIONS];
+    for (int i = 0; i < PSI_TABLE_MAX_SECTIONS; i++) {
+        int size = -1;
+        if (upipe_ts_eitd->nb_events == 0 || upipe_ts_eitd->eit[i] == NULL ||
+            !ubase_check(uref_block_read(upipe_ts_eitd->eit[i], 0, &size,
+                                         &sections[i])))
+            sections[i] = NULL;
+    }
+
+    struct upipe_ts_eitd_event *events = NULL;
+    unsigned int nb_events = 0, nb_alloc = 0;
+    unsigned int unchanged = 0, modified = 0, added = 0;
     bool first = true;
     uint64_t event = 0;
     upipe_ts_psid_table_foreach (upipe_ts_eitd->next_eit, section_uref) {
@@ -389,25 +496,50 @@ static void upipe_ts_eitd_input(struct upipe *upipe, struct uref *uref,
         int j = 0;
         while ((eit_event = eit_get_event((uint8_t *)section, j)) != NULL) {
             j++;
+            if (upipe_ts_eitd->max_events &&
+                event >= upipe_ts_eitd->max_events)
+                break;
 
-            UBASE_FATAL(upipe, uref_event_set_id(flow_def,
-                        eitn_get_event_id(eit_event), event))
-            time_t start = dvb_time_decode_UTC(eitn_get_start_time(eit_event));
-            UBASE_FATAL(upipe, uref_event_set_start(flow_def,
-                        start * UCLOCK_FREQ, event))
-            int duration, hour, min, sec;
-            dvb_time_decode_bcd(eitn_get_duration_bcd(eit_event), &duration,
-                                &hour, &min, &sec);
-            UBASE_FATAL(upipe, uref_event_set_duration(flow_def,
-                        duration * UCLOCK_FREQ, event))
-            UBASE_FATAL(upipe, uref_ts_event_set_running_status(flow_def,
-                        eitn_get_running(eit_event), event))
-            if (eitn_get_ca(eit_event)) {
-                UBASE_FATAL(upipe, uref_ts_event_set_scrambled(flow_def, event))
+            uint16_t id = eitn_get_event_id(eit_event);
+            uint16_t event_size = EIT_EVENT_SIZE +
+                                  eitn_get_desclength(eit_event);
+            const struct upipe_ts_eitd_event *old_event =
+                upipe_ts_eitd_find_event(upipe, id);
+            if (old_event != NULL && sections[old_event->section] != NULL &&
+                old_event->size == event_size &&
+                !memcmp(sections[old_event->section] + old_event->offset,
+                        eit_event, event_size)) {
+                /* unchanged event, reuse the decoded attributes */
+                uref_ts_event_copy(flow_def, event,
+                                   upipe_ts_eitd->flow_def_attr,
+                                   old_event->index);
+                unchanged++;
+            } else {
+                upipe_ts_eitd_parse_event(upipe, flow_def, event, eit_event);
+                if (old_event != NULL)
+                    modified++;
+                else
+                    added++;
+            }
+
+            if (nb_events >= nb_alloc) {
+                /* events are only remembered to speed up the next version */
+                unsigned int alloc = nb_alloc ? nb_alloc * 2 : 64;
+                struct upipe_ts_eitd_event *tmp =
+                    realloc(events, alloc * sizeof(*events));
+                if (tmp != NULL) {
+                    events = tmp;
+                    nb_alloc = alloc;
+                }
+            }
+            if (nb_events < nb_alloc) {
+                events[nb_events].id = id;
+                events[nb_events].section = psi_get_section(section);
+                events[nb_events].offset = eit_event - section;
+                events[nb_events].size = event_size;
+                events[nb_events].index = event;
+                nb_events++;
             }
-            upipe_ts_eitd_parse_descs(upipe, flow_def, event,
-                    descs_get_desc(eitn_get_descs((uint8_t *)eit_event), 0),
-                    eitn_get_desclength(eit_event));
 
             event++;
         }
@@ -415,6 +547,27 @@ static void upipe_ts_eitd_input(struct upipe *upipe, struct uref *uref,
         uref_block_unmap(section_uref, 0);
     }
 
+    for (int i = 0; i < PSI_TABLE_MAX_SECTIONS; i++)
+        if (sections[i] != NULL)
+            uref_block_unmap(upipe_ts_eitd->eit[i], 0);
+
+    qsort(events, nb_events, sizeof(*events), upipe_ts_eitd_event_cmp);
+    /* exported events of the previous version which are no longer */
+    unsigned int removed = 0, k = 0;
+    for (unsigned int i = 0; i < upipe_ts_eitd->nb_events; i++) {
+        uint16_t id = upipe_ts_eitd->events[i].id;
+        while (k < nb_events && events[k].id < id)
+            k++;
+        if (k == nb_events || events[k].id != id)
+            removed++;
+    }
+    upipe_verbose_va(upipe, "new EIT: %u events added, %u modified, "
+                     "%u unchanged, %u removed",
+                     added, modified, unchanged, removed);
+    free(upipe_ts_eitd->events);
+    upipe_ts_eitd->events = events;
+    upipe_ts_eitd->nb_events = nb_events;
+
     UBASE_FATAL(upipe, uref_event_set_events(flow_def, event))
 
     /* Switch tables. */
@@ -490,6 +643,21 @@ static int upipe_ts_eitd_control(struct upipe *upipe, int command, va_list args)
             struct uref *flow_def = va_arg(args, struct uref *);
             return upipe_ts_eitd_set_flow_def(upipe, flow_def);
         }
+        case UPIPE_TS_EITD_GET_MAX_EVENTS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_TS_EITD_SIGNATURE)
+            struct upipe_ts_eitd *upipe_ts_eitd =
+                upipe_ts_eitd_from_upipe(upipe);
+            unsigned int *max_events_p = va_arg(args, unsigned int *);
+            *max_events_p = upipe_ts_eitd->max_events;
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_TS_EITD_SET_MAX_EVENTS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_TS_EITD_SIGNATURE)
+            struct upipe_ts_eitd *upipe_ts_eitd =
+                upipe_ts_eitd_from_upipe(upipe);
+            upipe_ts_eitd->max_events = va_arg(args, unsigned int);
+            return UBASE_ERR_NONE;
+        }
 
         default:
             return UBASE_ERR_UNHANDLED;
@@ -507,6 +675,7 @@ static void upipe_ts_eitd_free(struct upipe *upipe)
     struct upipe_ts_eitd *upipe_ts_eitd = upipe_ts_eitd_from_upipe(upipe);
     upipe_ts_psid_table_clean(upipe_ts_eitd->eit);
     upipe_ts_psid_table_clean(upipe_ts_eitd->next_eit);
+    free(upipe_ts_eitd->events);
     upipe_ts_eitd_clean_output(upipe);
     upipe_ts_eitd_clean_ubuf_mgr(upipe);
     upipe_ts_eitd_clean_flow_def(upipe);
@@ -67,6 +67,8 @@
 #define PADDING_PID 8191
 /** TB buffer size in octets (T-STD model) */
 #define TB_SIZE 512
+/** max number of PSI sections whose packets are cached */
+#define PSI_CACHE_SIZE 32
 /** define to get header verbosity */
 #undef VERBOSE_HEADERS
 /** define to get timing verbosity */
@@ -75,6 +77,19 @@
 /** @hidden */
 static int upipe_ts_encaps_check(struct upipe *upipe, struct uref *flow_format);
 
+/** @internal @This is a PSI section along with its TS packets, cached so
+ * that repetitions of the section don't have to be packetized again. */
+struct upipe_ts_encaps_psi {
+    /** structure for double-linked lists */
+    struct uchain uchain;
+    /** PSI section */
+    struct ubuf *section;
+    /** TS packets carrying the section, with a null continuity counter */
+    struct ubuf *packets;
+};
+
+UBASE_FROM_TO(upipe_ts_encaps_psi, uchain, uchain, uchain)
+
 /** @internal @This is the private context of a ts_encaps pipe. */
 struct upipe_ts_encaps {
     /** refcount management structure */
@@ -144,6 +159,14 @@ struct upipe_ts_encaps {
 
     /** a padding packet for PSI streams */
     struct ubuf *padding;
+    /** cache of packetized PSI sections, most recently used first */
+    struct uchain psi_cache;
+    /** number of sections in the cache */
+    unsigned int psi_cache_size;
+    /** cached TS packets of the current PSI section, or NULL */
+    struct ubuf *psi_packets;
+    /** offset of the next cached TS packet to output */
+    size_t psi_offset;
     /** last continuity counter for this PID */
     uint8_t last_cc;
     /** last time prepare was called */
@@ -230,6 +253,10 @@ static struct upipe *upipe_ts_encaps_alloc(struct upipe_mgr *mgr,
     upipe_ts_encaps->pes_min_duration = 0;
     upipe_ts_encaps->pes_alignment = true;
     upipe_ts_encaps->padding = NULL;
+    ulist_init(&upipe_ts_encaps->psi_cache);
+    upipe_ts_encaps->psi_cache_size = 0;
+    upipe_ts_encaps->psi_packets = NULL;
+    upipe_ts_encaps->psi_offset = 0;
     upipe_ts_encaps->last_cc = 0;
     upipe_ts_encaps->last_splice = 0;
     upipe_ts_encaps->last_pcr = 0;
@@ -409,6 +436,25 @@ static void upipe_ts_encaps_check_status(struct upipe *upipe)
         upipe_ts_encaps_update_status(upipe);
 }
 
+/** @internal @This empties the cache of packetized PSI sections.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_ts_encaps_flush_psi(struct upipe *upipe)
+{
+    struct upipe_ts_encaps *encaps = upipe_ts_encaps_from_upipe(upipe);
+    struct uchain *uchain, *uchain_tmp;
+    ulist_delete_foreach (&encaps->psi_cache, uchain, uchain_tmp) {
+        struct upipe_ts_encaps_psi *psi =
+            upipe_ts_encaps_psi_from_uchain(uchain);
+        ulist_delete(uchain);
+        ubuf_free(psi->section);
+        ubuf_free(psi->packets);
+        free(psi);
+    }
+    encaps->psi_cache_size = 0;
+}
+
 /** @This promotes a uref to the temporary buffer, checking for flow def
  * changes.
  *
@@ -432,6 +478,7 @@ static void upipe_ts_encaps_promote_uref(struct upipe *upipe)
         uint64_t cr_prog = 0, cr_sys;
         size_t uref_size;
         if (unlikely(ubase_check(uref_flow_get_def(uref, &def)))) {
+            upipe_ts_encaps_flush_psi(upipe);
             encaps->psi = !ubase_ncmp(def, "block.mpegts.mpegtspsi.");
             uref_flow_set_def(uref, "void.");
             uref_block_flow_get_octetrate(uref, &encaps->octetrate);
@@ -503,6 +550,8 @@ static void upipe_ts_encaps_consume_uref(struct upipe *upipe)
     struct upipe_ts_encaps *upipe_ts_encaps = upipe_ts_encaps_from_upipe(upipe);
     uref_free(upipe_ts_encaps->uref);
     upipe_ts_encaps->uref = NULL;
+    ubuf_free(upipe_ts_encaps->psi_packets);
+    upipe_ts_encaps->psi_packets = NULL;
     upipe_ts_encaps_promote_uref(upipe);
 }
 
@@ -1240,6 +1289,233 @@ static int upipe_ts_encaps_complete(struct upipe *upipe, struct ubuf **ubuf_p,
     return UBASE_ERR_NONE;
 }
 
+/** @internal @This packetizes a PSI section into TS packets, with a null
+ * continuity counter. The packets are made of the same segments as on the
+ * uncached path, and share the memory of the section.
+ *
+ * @param upipe description structure of the pipe
+ * @param section PSI section
+ * @param section_size size of the PSI section
+ * @return ubuf containing the TS packets, or NULL
+ */
+static struct ubuf *upipe_ts_encaps_packetize_psi(struct upipe *upipe,
+                                                  struct ubuf *section,
+                                                  size_t section_size)
+{
+    struct upipe_ts_encaps *encaps = upipe_ts_encaps_from_upipe(upipe);
+    /* pointer_field */
+    struct ubuf *payload = ubuf_block_alloc(encaps->ubuf_mgr, 1);
+    struct ubuf *dup = ubuf_dup(section);
+    uint8_t *buffer;
+    int size = -1;
+    if (unlikely(payload == NULL || dup == NULL ||
+                 !ubase_check(ubuf_block_write(payload, 0, &size, &buffer)))) {
+        ubuf_free(payload);
+        ubuf_free(dup);
+        return NULL;
+    }
+    assert(size == 1);
+    buffer[0] = 0;
+    ubuf_block_unmap(payload, 0);
+    if (unlikely(!ubase_check(ubuf_block_append(payload, dup)))) {
+        ubuf_free(payload);
+        ubuf_free(dup);
+        return NULL;
+    }
+
+    size_t payload_size = section_size + 1;
+    struct ubuf *packets = NULL;
+    while (payload != NULL) {
+        struct ubuf *next = NULL;
+        if (payload_size > TS_SIZE - TS_HEADER_SIZE) {
+            next = ubuf_block_split(payload, TS_SIZE - TS_HEADER_SIZE);
+            if (unlikely(next == NULL))
+                goto upipe_ts_encaps_packetize_psi_err;
+            payload_size -= TS_SIZE - TS_HEADER_SIZE;
+        } else if (payload_size < TS_SIZE - TS_HEADER_SIZE) {
+            /* pad with 0xff */
+            struct ubuf *padding = ubuf_dup(encaps->padding);
+            if (unlikely(padding == NULL ||
+                         !ubase_check(ubuf_block_resize(padding, 0,
+                                 TS_SIZE - TS_HEADER_SIZE - payload_size)) ||
+                         !ubase_check(ubuf_block_append(payload, padding)))) {
+                ubuf_free(padding);
+                goto upipe_ts_encaps_packetize_psi_err;
+            }
+        }
+
+        struct ubuf *ts = ubuf_block_alloc(encaps->ubuf_mgr, TS_HEADER_SIZE);
+        size = -1;
+        if (unlikely(ts == NULL ||
+                     !ubase_check(ubuf_block_write(ts, 0, &size, &buffer)))) {
+            ubuf_free(ts);
+            ubuf_free(next);
+            goto upipe_ts_encaps_packetize_psi_err;
+        }
+        ts_init(buffer);
+        ts_set_pid(buffer, encaps->pid);
+        ts_set_payload(buffer);
+        if (packets == NULL)
+            ts_set_unitstart(buffer);
+        ubuf_block_unmap(ts, 0);
+
+        if (unlikely(!ubase_check(ubuf_block_append(ts, payload)))) {
+            ubuf_free(ts);
+            ubuf_free(next);
+            goto upipe_ts_encaps_packetize_psi_err;
+        }
+        payload = next;
+        if (packets == NULL)
+            packets = ts;
+        else if (unlikely(!ubase_check(ubuf_block_append(packets, ts)))) {
+            ubuf_free(ts);
+            ubuf_free(payload);
+            ubuf_free(packets);
+            return NULL;
+        }
+    }
+    return packets;
+
+upipe_ts_encaps_packetize_psi_err:
+    ubuf_free(payload);
+    ubuf_free(packets);
+    return NULL;
+}
+
+/** @internal @This looks up the current PSI section in the cache, and
+ * packetizes it if it is not found.
+ *
+ * @param upipe description structure of the pipe
+ * @return an error code
+ */
+static int upipe_ts_encaps_promote_psi(struct upipe *upipe)
+{
+    struct upipe_ts_encaps *encaps = upipe_ts_encaps_from_upipe(upipe);
+    struct ubuf *section = encaps->uref->ubuf;
+    assert(section != NULL);
+
+    struct upipe_ts_encaps_psi *psi = NULL;
+    struct uchain *uchain;
+    ulist_foreach (&encaps->psi_cache, uchain) {
+        struct upipe_ts_encaps_psi *entry =
+            upipe_ts_encaps_psi_from_uchain(uchain);
+        if (ubase_check(ubuf_block_equal(entry->section, section))) {
+            psi = entry;
+            ulist_delete(uchain);
+            break;
+        }
+    }
+
+    if (psi == NULL) {
+        /* new or modified section */
+#ifdef VERBOSE_HEADERS
+        upipe_verbose_va(upipe, "packetizing PSI section");
+#endif
+        psi = malloc(sizeof(struct upipe_ts_encaps_psi));
+        UBASE_ALLOC_RETURN(psi);
+        psi->section = ubuf_dup(section);
+        psi->packets = upipe_ts_encaps_packetize_psi(upipe, section,
+                                                     encaps->uref_size);
+        if (unlikely(psi->section == NULL || psi->packets == NULL)) {
+            ubuf_free(psi->section);
+            ubuf_free(psi->packets);
+            free(psi);
+            return UBASE_ERR_ALLOC;
+        }
+        uchain_init(&psi->uchain);
+
+        if (encaps->psi_cache_size >= PSI_CACHE_SIZE) {
+            struct upipe_ts_encaps_psi *last =
+                upipe_ts_encaps_psi_from_uchain(encaps->psi_cache.prev);
+            ulist_delete(&last->uchain);
+            ubuf_free(last->section);
+            ubuf_free(last->packets);
+            free(last);
+        } else
+            encaps->psi_cache_size++;
+    }
+    ulist_unshift(&encaps->psi_cache, &psi->uchain);
+
+    encaps->psi_packets = ubuf_dup(psi->packets);
+    UBASE_ALLOC_RETURN(encaps->psi_packets);
+    encaps->psi_offset = 0;
+    /* pointer_field */
+    encaps->uref_size++;
+    encaps->au_size = encaps->uref_size;
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This outputs the next cached TS packet of the current PSI
+ * section, with the continuity counter patched.
+ *
+ * @param upipe description structure of the pipe
+ * @param ubuf_p filled in with a pointer to the TS packet
+ * @param dts_sys_p filled in with the dts_sys, or UINT64_MAX
+ * @return an error code
+ */
+static int upipe_ts_encaps_splice_psi(struct upipe *upipe,
+                                      struct ubuf **ubuf_p,
+                                      uint64_t *dts_sys_p)
+{
+    struct upipe_ts_encaps *encaps = upipe_ts_encaps_from_upipe(upipe);
+    encaps->need_status = true;
+    *dts_sys_p = UINT64_MAX;
+
+    if (encaps->psi_packets == NULL) {
+        UBASE_RETURN(upipe_ts_encaps_promote_psi(upipe));
+        uref_block_delete_start(encaps->uref);
+    }
+
+    size_t uref_size = encaps->uref_size;
+    /* pointer_field */
+    size_t header_size = encaps->psi_offset ? 0 : 1;
+    uint64_t dts_sys = UINT64_MAX;
+    uref_clock_get_dts_sys(encaps->uref, &dts_sys);
+    if (dts_sys != UINT64_MAX)
+        *dts_sys_p = dts_sys - (uint64_t)(uref_size - header_size) *
+                               UCLOCK_FREQ / encaps->tb_rate;
+
+    /* only the header is copied, to patch the continuity counter */
+    struct ubuf *ubuf = ubuf_block_copy(encaps->ubuf_mgr, encaps->psi_packets,
+                                        encaps->psi_offset, TS_HEADER_SIZE);
+    struct ubuf *payload = ubuf_dup(encaps->psi_packets);
+    uint8_t *buffer;
+    int size = -1;
+    if (unlikely(ubuf == NULL || payload == NULL ||
+                 !ubase_check(ubuf_block_resize(payload,
+                         encaps->psi_offset + TS_HEADER_SIZE,
+                         TS_SIZE - TS_HEADER_SIZE)) ||
+                 !ubase_check(ubuf_block_write(ubuf, 0, &size, &buffer)))) {
+        ubuf_free(ubuf);
+        ubuf_free(payload);
+        return UBASE_ERR_ALLOC;
+    }
+    encaps->last_cc++;
+    encaps->last_cc &= 0xf;
+    ts_set_cc(buffer, encaps->last_cc);
+    ubuf_block_unmap(ubuf, 0);
+    if (unlikely(!ubase_check(ubuf_block_append(ubuf, payload)))) {
+        ubuf_free(ubuf);
+        ubuf_free(payload);
+        return UBASE_ERR_ALLOC;
+    }
+    encaps->psi_offset += TS_SIZE;
+
+    size_t payload_size = TS_SIZE - TS_HEADER_SIZE;
+    if (payload_size > uref_size)
+        payload_size = uref_size;
+    encaps->uref_size -= payload_size;
+    encaps->au_size -= payload_size;
+    encaps->tb_buffer -= payload_size;
+    if (!encaps->uref_size) {
+        assert(!encaps->au_size);
+        upipe_ts_encaps_consume_uref(upipe);
+    }
+
+    *ubuf_p = ubuf;
+    return UBASE_ERR_NONE;
+}
+
 /** @This returns a ubuf containing a TS packet, and the dts_sys of the packet.
  *
  * @param upipe description structure of the pipe
@@ -1315,6 +1591,16 @@ static int _upipe_ts_encaps_splice(struct upipe *upipe, uint64_t cr_sys_min,
     }
 
     bool start = ubase_check(uref_block_get_start(encaps->uref));
+    if (encaps->psi && !encaps->pcr_interval &&
+        (encaps->psi_packets != NULL ||
+         (start && !ubase_check(uref_flow_get_random(encaps->uref)) &&
+          !ubase_check(uref_flow_get_discontinuity(encaps->uref))))) {
+        /* repeated PSI sections are only packetized once */
+        UBASE_RETURN(upipe_ts_encaps_splice_psi(upipe, ubuf_p, dts_sys_p));
+        upipe_ts_encaps_check_status(upipe);
+        return UBASE_ERR_NONE;
+    }
+
     if (start) {
         UBASE_RETURN(upipe_ts_encaps_promote_au(upipe));
     }
@@ -1448,6 +1734,8 @@ static void upipe_ts_encaps_free(struct upipe *upipe)
 
     uref_free(upipe_ts_encaps->uref);
     ubuf_free(upipe_ts_encaps->padding);
+    ubuf_free(upipe_ts_encaps->psi_packets);
+    upipe_ts_encaps_flush_psi(upipe);
     upipe_ts_encaps_clean_input(upipe);
     upipe_ts_encaps_clean_output(upipe);
     upipe_ts_encaps_clean_ubuf_mgr(upipe);
@@ -171,6 +171,11 @@
 #define DEFAULT_AAC_ENCAPS UREF_MPGA_ENCAPS_ADTS
 /** default encoding */
 #define DEFAULT_ENCODING "UTF-8"
+/** alignment and size granularity of output blocks in bulk mode */
+#define BULK_ALIGN 4096
+/** max number of chunks in an output block in bulk mode (the side table
+ * is stored in an opaque attribute) */
+#define BULK_MAX_CHUNKS (UINT16_MAX / 4)
 /** default TSID */
 #define DEFAULT_TSID 1
 /** default first automatic SID */
@@ -280,7 +285,8 @@ struct upipe_ts_mux {
     /** psi_pid structure for TDT */
     struct upipe_ts_mux_psi_pid *psi_pid_tdt;
 
-    /** one TS packet of padding */
+    /** one output block (mtu) of TS padding packets, shared by all
+     * padding segments */
     struct ubuf *padding;
 
     /** input flow definition */
@@ -339,6 +345,14 @@ struct upipe_ts_mux {
     enum upipe_ts_mux_mode mode;
     /** MTU */
     size_t mtu;
+    /** requested size of output blocks in bulk mode, or 0 */
+    size_t bulk_size;
+    /** output block being filled in bulk mode */
+    struct uref *bulk;
+    /** number of chunks in the output block */
+    unsigned int bulk_chunks;
+    /** side table of the delays of the chunks of the output block */
+    uint8_t *bulk_delays;
     /** size of the TB buffer */
     size_t tb_size;
 
@@ -406,6 +420,9 @@ static void upipe_ts_mux_build_flow_def(struct upipe *upipe);
 /** @hidden */
 static void upipe_ts_mux_work(struct upipe *upipe, struct upump **upump_p);
 /** @hidden */
+static void upipe_ts_mux_flush_bulk(struct upipe *upipe,
+                                    struct upump **upump_p);
+/** @hidden */
 static void upipe_ts_mux_update(struct upipe *upipe);
 /** @hidden */
 static bool upipe_ts_mux_find_sid(struct upipe *upipe, uint16_t sid);
@@ -1534,6 +1551,8 @@ static int upipe_ts_mux_input_control(struct upipe *upipe,
             struct upipe_ts_mux *upipe_ts_mux = upipe_ts_mux_from_program_mgr(
                         upipe_ts_mux_program_to_upipe(program)->mgr);
             upipe_ts_mux_work(upipe_ts_mux_to_upipe(upipe_ts_mux), NULL);
+            /* do not keep a partial block of flushed packets */
+            upipe_ts_mux_flush_bulk(upipe_ts_mux_to_upipe(upipe_ts_mux), NULL);
             return UBASE_ERR_NONE;
         }
         case UPIPE_BIN_GET_LAST_INNER: {
@@ -1618,6 +1637,8 @@ static void upipe_ts_mux_input_no_input(struct upipe *upipe)
     urefcount_release(upipe_ts_mux_input_to_urefcount_real(upipe_ts_mux_input));
 
     upipe_ts_mux_work(upipe_ts_mux_to_upipe(mux), NULL);
+    /* output the last packets of the stream even if the block is not full */
+    upipe_ts_mux_flush_bulk(upipe_ts_mux_to_upipe(mux), NULL);
     upipe_release(upipe_ts_mux_to_upipe(mux));
 }
 
@@ -2489,6 +2510,10 @@ static struct upipe *upipe_ts_mux_alloc(struct upipe_mgr *mgr,
     upipe_ts_mux->mode = UPIPE_TS_MUX_MODE_CBR;
     upipe_ts_mux->tb_size = T_STD_TS_BUFFER;
     upipe_ts_mux->mtu = TS_SIZE;
+    upipe_ts_mux->bulk_size = 0;
+    upipe_ts_mux->bulk = NULL;
+    upipe_ts_mux->bulk_chunks = 0;
+    upipe_ts_mux->bulk_delays = NULL;
     upipe_ts_mux->latency = 0;
     upipe_ts_mux->cr_sys = UINT64_MAX;
     upipe_ts_mux->cr_sys_remainder = 0;
@@ -2715,14 +2740,15 @@ upipe_ts_mux_splice_done:
     }
 }
 
-/** @internal @This appends a uref to our buffer.
+/** @internal @This appends a block of TS packets to our buffer.
  *
  * @param upipe description structure of the pipe
  * @param ubuf ubuf to append
+ * @param size size of the ubuf, in octets (multiple of TS_SIZE)
  * @param dts_sys dts_sys associated with the ubuf
  */
-static void upipe_ts_mux_append(struct upipe *upipe, struct ubuf *ubuf,
-                                uint64_t dts_sys)
+static void upipe_ts_mux_append_block(struct upipe *upipe, struct ubuf *ubuf,
+                                      size_t size, uint64_t dts_sys)
 {
     struct upipe_ts_mux *mux = upipe_ts_mux_from_upipe(upipe);
     if (mux->uref == NULL) {
@@ -2747,7 +2773,162 @@ static void upipe_ts_mux_append(struct upipe *upipe, struct ubuf *ubuf,
                     dts_sys - (mux->cr_sys - mux->latency));
         uref_block_append(mux->uref, ubuf);
     }
-    mux->uref_size += TS_SIZE;
+    mux->uref_size += size;
+}
+
+/** @internal @This appends a TS packet to our buffer.
+ *
+ * @param upipe description structure of the pipe
+ * @param ubuf ubuf to append
+ * @param dts_sys dts_sys associated with the ubuf
+ */
+static void upipe_ts_mux_append(struct upipe *upipe, struct ubuf *ubuf,
+                                uint64_t dts_sys)
+{
+    upipe_ts_mux_append_block(upipe, ubuf, TS_SIZE, dts_sys);
+}
+
+/** @internal @This fills our buffer up to the mtu with padding packets, as
+ * a single segment referencing the shared padding block.
+ *
+ * @param upipe description structure of the pipe
+ * @return number of padding packets appended
+ */
+static unsigned int upipe_ts_mux_pad(struct upipe *upipe)
+{
+    struct upipe_ts_mux *mux = upipe_ts_mux_from_upipe(upipe);
+    if (mux->uref_size >= mux->mtu)
+        return 0;
+
+    size_t size = mux->mtu - mux->uref_size;
+    struct ubuf *ubuf = ubuf_dup(mux->padding);
+    if (unlikely(ubuf == NULL ||
+                 !ubase_check(ubuf_block_resize(ubuf, 0, size)))) {
+        ubuf_free(ubuf);
+        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+        return 0;
+    }
+    upipe_ts_mux_append_block(upipe, ubuf, size, UINT64_MAX);
+    return size / TS_SIZE;
+}
+
+/** @internal @This returns the number of chunks of output blocks in bulk
+ * mode, so that the blocks are a multiple of both the mtu and BULK_ALIGN.
+ *
+ * @param upipe description structure of the pipe
+ * @return number of chunks
+ */
+static unsigned int upipe_ts_mux_bulk_chunks(struct upipe *upipe)
+{
+    struct upipe_ts_mux *mux = upipe_ts_mux_from_upipe(upipe);
+    size_t a = mux->mtu, b = BULK_ALIGN;
+    while (b) {
+        size_t r = a % b;
+        a = b;
+        b = r;
+    }
+    /* a is now the GCD of mtu and BULK_ALIGN */
+    size_t unit = BULK_ALIGN / a;
+    size_t nb_chunks = (mux->bulk_size + mux->mtu - 1) / mux->mtu;
+    nb_chunks = (nb_chunks + unit - 1) / unit * unit;
+    if (nb_chunks > BULK_MAX_CHUNKS) {
+        nb_chunks = BULK_MAX_CHUNKS / unit * unit;
+        if (!nb_chunks)
+            nb_chunks = BULK_MAX_CHUNKS;
+    }
+    return nb_chunks;
+}
+
+/** @internal @This outputs the current output block in bulk mode.
+ *
+ * @param upipe description structure of the pipe
+ * @param upump_p reference to pump that generated the buffer
+ */
+static void upipe_ts_mux_flush_bulk(struct upipe *upipe,
+                                    struct upump **upump_p)
+{
+    struct upipe_ts_mux *mux = upipe_ts_mux_from_upipe(upipe);
+    struct uref *uref = mux->bulk;
+    if (uref == NULL)
+        return;
+    mux->bulk = NULL;
+
+    if (unlikely(!ubase_check(uref_block_resize(uref, 0,
+                        mux->bulk_chunks * mux->mtu)) ||
+                 !ubase_check(uref_block_set_chunk_size(uref, mux->mtu)) ||
+                 !ubase_check(uref_block_set_chunk_delays(uref,
+                        mux->bulk_delays, mux->bulk_chunks * 4)))) {
+        uref_free(uref);
+        mux->bulk_chunks = 0;
+        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+        return;
+    }
+    mux->bulk_chunks = 0;
+    upipe_ts_mux_output(upipe, uref, upump_p);
+}
+
+/** @internal @This copies an output packet to the current output block in
+ * bulk mode, and outputs the block when it is full.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref output packet
+ * @param upump_p reference to pump that generated the buffer
+ */
+static void upipe_ts_mux_bulk(struct upipe *upipe, struct uref *uref,
+                              struct upump **upump_p)
+{
+    struct upipe_ts_mux *mux = upipe_ts_mux_from_upipe(upipe);
+    uint64_t cr_sys = 0, bulk_cr_sys = 0;
+    uref_clock_get_cr_sys(uref, &cr_sys);
+    if (mux->bulk != NULL) {
+        uref_clock_get_cr_sys(mux->bulk, &bulk_cr_sys);
+        if (unlikely(cr_sys < bulk_cr_sys ||
+                     cr_sys - bulk_cr_sys > UINT32_MAX))
+            /* the delay doesn't fit in the side table */
+            upipe_ts_mux_flush_bulk(upipe, upump_p);
+    }
+
+    unsigned int nb_chunks = upipe_ts_mux_bulk_chunks(upipe);
+    if (mux->bulk == NULL) {
+        uint8_t *delays = realloc(mux->bulk_delays, nb_chunks * 4);
+        if (delays != NULL)
+            mux->bulk_delays = delays;
+        struct ubuf *ubuf = ubuf_block_alloc(mux->ubuf_mgr,
+                                             nb_chunks * mux->mtu);
+        if (unlikely(delays == NULL || ubuf == NULL ||
+                     (mux->bulk = uref_dup_inner(uref)) == NULL)) {
+            ubuf_free(ubuf);
+            uref_free(uref);
+            upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+            return;
+        }
+        uref_attach_ubuf(mux->bulk, ubuf);
+        bulk_cr_sys = cr_sys;
+    }
+
+    uint8_t *buffer;
+    int size = mux->mtu;
+    if (unlikely(!ubase_check(uref_block_write(mux->bulk,
+                        mux->bulk_chunks * mux->mtu, &size, &buffer)))) {
+        uref_free(uref);
+        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+        return;
+    }
+    assert(size == mux->mtu);
+    uref_block_extract(uref, 0, size, buffer);
+    uref_block_unmap(mux->bulk, mux->bulk_chunks * mux->mtu);
+
+    uint64_t dts_sys, bulk_dts_sys;
+    if (ubase_check(uref_clock_get_dts_sys(uref, &dts_sys)) &&
+        (!ubase_check(uref_clock_get_dts_sys(mux->bulk, &bulk_dts_sys)) ||
+         dts_sys < bulk_dts_sys))
+        uref_clock_set_cr_dts_delay(mux->bulk, dts_sys - bulk_cr_sys);
+    uref_free(uref);
+
+    uref_block_set_chunk_delay(mux->bulk_delays, mux->bulk_chunks,
+                               cr_sys - bulk_cr_sys);
+    if (++mux->bulk_chunks >= nb_chunks)
+        upipe_ts_mux_flush_bulk(upipe, upump_p);
 }
 
 /** @internal @This completes a uref and outputs it.
@@ -2761,7 +2942,10 @@ static void upipe_ts_mux_complete(struct upipe *upipe, struct upump **upump_p)
     struct uref *uref = mux->uref;
     mux->uref = NULL;
     mux->uref_size = 0;
-    upipe_ts_mux_output(upipe, uref, upump_p);
+    if (mux->bulk_size && uref != NULL && mux->ubuf_mgr != NULL)
+        upipe_ts_mux_bulk(upipe, uref, upump_p);
+    else
+        upipe_ts_mux_output(upipe, uref, upump_p);
 }
 
 /** @internal @This runs when the pump expires (live mode only).
@@ -2795,13 +2979,7 @@ static void _upipe_ts_mux_watcher(struct upipe *upipe)
             (mux->uref != NULL &&
              ubase_check(uref_clock_get_dts_sys(mux->uref, &dts_sys)) &&
              dts_sys + mux->latency < upipe_ts_mux_show_increment(upipe))) {
-            while (mux->uref_size < mux->mtu) {
-                nb_packets++;
-                struct ubuf *ubuf = ubuf_dup(mux->padding);
-                if (ubuf == NULL)
-                    break;
-                upipe_ts_mux_append(upipe, ubuf, UINT64_MAX);
-            }
+            nb_packets += upipe_ts_mux_pad(upipe);
         }
 
         if (mux->uref_size >= mux->mtu)
@@ -2929,13 +3107,7 @@ static void upipe_ts_mux_work_file(struct upipe *upipe, struct upump **upump_p)
             continue;
         }
 
-        while (mux->uref_size < mux->mtu) {
-            struct ubuf *ubuf = ubuf_dup(mux->padding);
-            if (ubuf == NULL)
-                break;
-            upipe_ts_mux_append(upipe, ubuf, UINT64_MAX);
-        }
-
+        upipe_ts_mux_pad(upipe);
         upipe_ts_mux_complete(upipe, upump_p);
         upipe_ts_mux_increment(upipe);
     }
@@ -3058,7 +3230,11 @@ static int upipe_ts_mux_check(struct upipe *upipe, struct uref *flow_format)
     if (mux->ubuf_mgr == NULL) {
         struct uref *flow_def_dup =
             uref_block_flow_alloc_def(mux->uref_mgr, "mpegts.");
-        if (unlikely(flow_def_dup == NULL)) {
+        if (unlikely(flow_def_dup == NULL ||
+                     (mux->bulk_size &&
+                      !ubase_check(uref_block_flow_set_align(flow_def_dup,
+                                                             BULK_ALIGN))))) {
+            uref_free(flow_def_dup);
             upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
             return UBASE_ERR_ALLOC;
         }
@@ -3067,7 +3243,7 @@ static int upipe_ts_mux_check(struct upipe *upipe, struct uref *flow_format)
     }
 
     if (mux->padding == NULL) {
-        mux->padding = ubuf_block_alloc(mux->ubuf_mgr, TS_SIZE);
+        mux->padding = ubuf_block_alloc(mux->ubuf_mgr, mux->mtu);
         if (unlikely(mux->padding == NULL)) {
             upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
             return UBASE_ERR_ALLOC;
@@ -3081,8 +3257,9 @@ static int upipe_ts_mux_check(struct upipe *upipe, struct uref *flow_format)
             mux->padding = NULL;
             return UBASE_ERR_ALLOC;
         }
-        assert(size == TS_SIZE);
-        ts_pad(buffer);
+        assert(size == mux->mtu);
+        for (int offset = 0; offset < size; offset += TS_SIZE)
+            ts_pad(buffer + offset);
         ubuf_block_unmap(mux->padding, 0);
     }
 
@@ -3565,6 +3742,12 @@ static int upipe_ts_mux_set_output_size(struct upipe *upipe, unsigned int mtu)
     if (unlikely(mtu < TS_SIZE))
         return UBASE_ERR_INVALID;
     mtu -= mtu % TS_SIZE;
+    if (upipe_ts_mux->mtu != mtu) {
+        upipe_ts_mux_flush_bulk(upipe, NULL);
+        /* the padding block is rebuilt by upipe_ts_mux_check */
+        ubuf_free(upipe_ts_mux->padding);
+        upipe_ts_mux->padding = NULL;
+    }
     upipe_ts_mux->mtu = mtu;
     if (upipe_ts_mux->total_octetrate)
         upipe_ts_mux->interval = (upipe_ts_mux->mtu * UCLOCK_FREQ +
@@ -4124,6 +4307,45 @@ static int _upipe_ts_mux_set_mode(struct upipe *upipe,
     return UBASE_ERR_NONE;
 }
 
+/** @internal @This returns the current bulk output size.
+ *
+ * @param upipe description structure of the pipe
+ * @param bulk_size_p filled in with the size of output blocks, or 0
+ * @return an error code
+ */
+static int _upipe_ts_mux_get_bulk_size(struct upipe *upipe,
+                                       unsigned int *bulk_size_p)
+{
+    struct upipe_ts_mux *upipe_ts_mux = upipe_ts_mux_from_upipe(upipe);
+    assert(bulk_size_p != NULL);
+    *bulk_size_p = upipe_ts_mux->bulk_size ?
+        upipe_ts_mux_bulk_chunks(upipe) * upipe_ts_mux->mtu : 0;
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This sets the bulk output size.
+ *
+ * @param upipe description structure of the pipe
+ * @param bulk_size size of output blocks, or 0 to disable bulk mode
+ * @return an error code
+ */
+static int _upipe_ts_mux_set_bulk_size(struct upipe *upipe,
+                                       unsigned int bulk_size)
+{
+    struct upipe_ts_mux *upipe_ts_mux = upipe_ts_mux_from_upipe(upipe);
+    upipe_ts_mux_flush_bulk(upipe, NULL);
+    if (!bulk_size != !upipe_ts_mux->bulk_size &&
+        upipe_ts_mux->ubuf_mgr != NULL) {
+        /* the alignment of buffers changes, get a new ubuf manager */
+        ubuf_mgr_release(upipe_ts_mux->ubuf_mgr);
+        upipe_ts_mux->ubuf_mgr = NULL;
+        ubuf_free(upipe_ts_mux->padding);
+        upipe_ts_mux->padding = NULL;
+    }
+    upipe_ts_mux->bulk_size = bulk_size;
+    return UBASE_ERR_NONE;
+}
+
 /** @internal @This returns the current encapsulation for AAC streams.
  *
  * @param upipe description structure of the pipe
@@ -4396,6 +4618,16 @@ static int _upipe_ts_mux_control(struct upipe *upipe, int command, va_list args)
             int *encaps_p = va_arg(args, int *);
             return _upipe_ts_mux_get_aac_encaps(upipe, encaps_p);
         }
+        case UPIPE_TS_MUX_GET_BULK_SIZE: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_TS_MUX_SIGNATURE)
+            unsigned int *bulk_size_p = va_arg(args, unsigned int *);
+            return _upipe_ts_mux_get_bulk_size(upipe, bulk_size_p);
+        }
+        case UPIPE_TS_MUX_SET_BULK_SIZE: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_TS_MUX_SIGNATURE)
+            unsigned int bulk_size = va_arg(args, unsigned int);
+            return _upipe_ts_mux_set_bulk_size(upipe, bulk_size);
+        }
         case UPIPE_TS_MUX_SET_AAC_ENCAPS: {
             UBASE_SIGNATURE_CHECK(args, UPIPE_TS_MUX_SIGNATURE)
             int encaps = va_arg(args, int);
@@ -4460,17 +4692,12 @@ static void upipe_ts_mux_free(struct urefcount *urefcount_real)
     struct upipe *upipe = upipe_ts_mux_to_upipe(mux);
 
     if (mux->uref != NULL) {
-        size_t uref_size;
-        while ((ubase_check(uref_block_size(mux->uref, &uref_size)) &&
-                uref_size < mux->mtu)) {
-            struct ubuf *ubuf = ubuf_dup(mux->padding);
-            if (ubuf == NULL)
-                break;
-            upipe_ts_mux_append(upipe, ubuf, UINT64_MAX);
-        }
-
+        if (mux->padding != NULL)
+            upipe_ts_mux_pad(upipe);
         upipe_ts_mux_complete(upipe, NULL);
     }
+    upipe_ts_mux_flush_bulk(upipe, NULL);
+    free(mux->bulk_delays);
 
     upipe_throw_dead(upipe);
 
@@ -4624,6 +4851,8 @@ const char *upipe_ts_mux_command_str(int cmd)
         UBASE_CASE_TO_STR(UPIPE_TS_MUX_SET_ENCODING);
         UBASE_CASE_TO_STR(UPIPE_TS_MUX_FREEZE_PSI);
         UBASE_CASE_TO_STR(UPIPE_TS_MUX_PREPARE);
+        UBASE_CASE_TO_STR(UPIPE_TS_MUX_GET_BULK_SIZE);
+        UBASE_CASE_TO_STR(UPIPE_TS_MUX_SET_BULK_SIZE);
         default: break;
     }
     return NULL;
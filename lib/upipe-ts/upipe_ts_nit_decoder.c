@@ -195,7 +195,7 @@ static bool upipe_ts_nitd_table_validate(struct upipe *upipe)
                                                   &section))))
             return false;
 
-        if (!nit_validate(section) || !psi_check_crc(section)) {
+        if (!nit_validate(section) || !upipe_ts_psid_check_crc(section)) {
             uref_block_unmap(section_uref, 0);
             return false;
         }
@@ -314,6 +314,13 @@ static void upipe_ts_nitd_input(struct upipe *upipe, struct uref *uref,
     struct upipe_ts_nitd *upipe_ts_nitd = upipe_ts_nitd_from_upipe(upipe);
     assert(upipe_ts_nitd->flow_def_input != NULL);
 
+    if (upipe_ts_psid_table_cached(upipe_ts_nitd->nit,
+                                   upipe_ts_nitd->next_nit, uref)) {
+        /* Identical section. */
+        uref_free(uref);
+        return;
+    }
+
     if (!upipe_ts_psid_table_section(upipe_ts_nitd->next_nit, uref))
         return;
 
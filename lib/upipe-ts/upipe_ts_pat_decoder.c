@@ -204,7 +204,7 @@ static bool upipe_ts_patd_table_validate(struct upipe *upipe)
                                                   &section))))
             return false;
 
-        if (!pat_validate(section) || !psi_check_crc(section)) {
+        if (!pat_validate(section) || !upipe_ts_psid_check_crc(section)) {
             uref_block_unmap(section_uref, 0);
             return false;
         }
@@ -345,6 +345,20 @@ static void upipe_ts_patd_input(struct upipe *upipe, struct uref *uref,
     assert(upipe_ts_patd->flow_def_input != NULL);
     assert(upipe_ts_patd->ubuf_mgr != NULL);
 
+    if (upipe_ts_psid_table_validate(upipe_ts_patd->pat) &&
+        !upipe_ts_psid_table_get_lastsection(upipe_ts_patd->pat) &&
+        upipe_ts_psid_table_cached(upipe_ts_patd->pat,
+                                   upipe_ts_patd->next_pat, uref)) {
+        /* Identical single-section PAT. */
+        uint64_t cr_sys;
+        if (ubase_check(uref_clock_get_cr_sys(uref, &cr_sys))) {
+            uref_clock_set_rap_sys(uref, cr_sys);
+            upipe_throw_new_rap(upipe, uref);
+        }
+        uref_free(uref);
+        return;
+    }
+
     if (!upipe_ts_psid_table_section(upipe_ts_patd->next_pat, uref))
         return;
 
@@ -79,6 +79,10 @@ struct upipe_ts_pesd {
     bool acquired;
     /** true if subsequent (non-start) packets have to be dropped */
     bool drop;
+    /** true if PES are assembled before being output */
+    bool assemble;
+    /** PES being assembled, without header */
+    struct uref *pes_uref;
 
     /** public upipe structure */
     struct upipe upipe;
@@ -112,6 +116,8 @@ static struct upipe *upipe_ts_pesd_alloc(struct upipe_mgr *mgr,
     upipe_ts_pesd_init_sync(upipe);
     upipe_ts_pesd_init_output(upipe);
     upipe_ts_pesd->drop = true;
+    upipe_ts_pesd->assemble = false;
+    upipe_ts_pesd->pes_uref = NULL;
     upipe_ts_pesd->next_uref = NULL;
     upipe_ts_pesd->next_uref_size = 0;
     upipe_throw_ready(upipe);
@@ -131,12 +137,34 @@ static void upipe_ts_pesd_flush(struct upipe *upipe, bool lost)
         upipe_ts_pesd->next_uref = NULL;
         upipe_ts_pesd->next_uref_size = 0;
     }
+    if (upipe_ts_pesd->pes_uref != NULL) {
+        upipe_warn(upipe, "dropping incomplete PES");
+        uref_free(upipe_ts_pesd->pes_uref);
+        upipe_ts_pesd->pes_uref = NULL;
+    }
     if (lost)
         upipe_ts_pesd_sync_lost(upipe);
     upipe_ts_pesd->drop = true;
 }
 
+/** @internal @This outputs the assembled PES, if any.
+ *
+ * @param upipe description structure of the pipe
+ * @param upump_p reference to pump that generated the buffer
+ */
+static void upipe_ts_pesd_output_pes(struct upipe *upipe,
+                                     struct upump **upump_p)
+{
+    struct upipe_ts_pesd *upipe_ts_pesd = upipe_ts_pesd_from_upipe(upipe);
+    struct uref *uref = upipe_ts_pesd->pes_uref;
+    if (uref != NULL) {
+        upipe_ts_pesd->pes_uref = NULL;
+        upipe_ts_pesd_output(upipe, uref, upump_p);
+    }
+}
+
 /** @internal @This outputs a PES chunk, and checks if it is the end of the PES.
+ * If PES are assembled, the chunk is chained to the PES instead.
  *
  * @param upipe description structure of the pipe
  * @param upump_p reference to pump that generated the buffer
@@ -147,12 +175,34 @@ static void upipe_ts_pesd_check_output(struct upipe *upipe,
     struct upipe_ts_pesd *upipe_ts_pesd = upipe_ts_pesd_from_upipe(upipe);
     upipe_ts_pesd_sync_acquired(upipe);
     upipe_ts_pesd->drop = false;
-    if (upipe_ts_pesd->next_uref_size == upipe_ts_pesd->next_pes_size) {
-        uref_block_set_end(upipe_ts_pesd->next_uref);
+    struct uref *uref = upipe_ts_pesd->next_uref;
+    upipe_ts_pesd->next_uref = NULL;
+
+    if (upipe_ts_pesd->assemble && upipe_ts_pesd->pes_uref != NULL) {
+        struct ubuf *ubuf = uref_detach_ubuf(uref);
+        uref_free(uref);
+        if (unlikely(!ubase_check(uref_block_append(upipe_ts_pesd->pes_uref,
+                                                    ubuf)))) {
+            ubuf_free(ubuf);
+            upipe_ts_pesd_flush(upipe, false);
+            upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+            return;
+        }
+        uref = upipe_ts_pesd->pes_uref;
+    }
+
+    bool end = upipe_ts_pesd->next_uref_size == upipe_ts_pesd->next_pes_size;
+    if (end) {
+        uref_block_set_end(uref);
         upipe_ts_pesd->next_uref_size = upipe_ts_pesd->next_pes_size = 0;
     }
-    upipe_ts_pesd_output(upipe, upipe_ts_pesd->next_uref, upump_p);
-    upipe_ts_pesd->next_uref = NULL;
+
+    if (upipe_ts_pesd->assemble) {
+        upipe_ts_pesd->pes_uref = uref;
+        if (end)
+            upipe_ts_pesd_output_pes(upipe, upump_p);
+    } else
+        upipe_ts_pesd_output(upipe, uref, upump_p);
 }
 
 /** @internal @This parses and removes the PES header of a packet.
@@ -316,6 +366,8 @@ static void upipe_ts_pesd_input(struct upipe *upipe, struct uref *uref,
     }
 
     if (ubase_check(uref_block_get_start(uref))) {
+        /* PES of unbounded length end with the next PES */
+        upipe_ts_pesd_output_pes(upipe, upump_p);
         if (unlikely(upipe_ts_pesd->next_uref != NULL)) {
             upipe_warn(upipe, "truncated PES header");
             uref_free(upipe_ts_pesd->next_uref);
@@ -371,6 +423,21 @@ static int upipe_ts_pesd_set_flow_def(struct upipe *upipe,
     return UBASE_ERR_NONE;
 }
 
+/** @internal @This sets whether PES are assembled before being output.
+ *
+ * @param upipe description structure of the pipe
+ * @param assemble true if PES are to be assembled
+ * @return an error code
+ */
+static int _upipe_ts_pesd_set_assemble(struct upipe *upipe, bool assemble)
+{
+    struct upipe_ts_pesd *upipe_ts_pesd = upipe_ts_pesd_from_upipe(upipe);
+    if (!assemble)
+        upipe_ts_pesd_output_pes(upipe, NULL);
+    upipe_ts_pesd->assemble = assemble;
+    return UBASE_ERR_NONE;
+}
+
 /** @internal @This processes control commands on a ts pesd pipe.
  *
  * @param upipe description structure of the pipe
@@ -386,6 +453,17 @@ static int upipe_ts_pesd_control(struct upipe *upipe, int command, va_list args)
             struct uref *flow_def = va_arg(args, struct uref *);
             return upipe_ts_pesd_set_flow_def(upipe, flow_def);
         }
+        case UPIPE_TS_PESD_GET_ASSEMBLE: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_TS_PESD_SIGNATURE)
+            int *assemble_p = va_arg(args, int *);
+            *assemble_p = upipe_ts_pesd_from_upipe(upipe)->assemble ? 1 : 0;
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_TS_PESD_SET_ASSEMBLE: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_TS_PESD_SIGNATURE)
+            bool assemble = !!va_arg(args, int);
+            return _upipe_ts_pesd_set_assemble(upipe, assemble);
+        }
         default:
             return UBASE_ERR_UNHANDLED;
     }
@@ -398,6 +476,8 @@ static int upipe_ts_pesd_control(struct upipe *upipe, int command, va_list args)
 static void upipe_ts_pesd_free(struct upipe *upipe)
 {
     struct upipe_ts_pesd *upipe_ts_pesd = upipe_ts_pesd_from_upipe(upipe);
+    /* PES of unbounded length only end with the next PES */
+    upipe_ts_pesd_output_pes(upipe, NULL);
     upipe_throw_dead(upipe);
 
     upipe_ts_pesd_clean_output(upipe);
@@ -28,11 +28,29 @@
 #include <upipe/uref.h>
 #include <upipe/uref_block.h>
 
+#include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <assert.h>
 
 #include <bitstream/mpeg/psi.h>
 
+/** @This computes the MPEG-2 CRC32 of a buffer, eight octets at a time.
+ *
+ * @param buffer pointer to the buffer
+ * @param size size of the buffer, in octets
+ * @return CRC32 of the buffer
+ */
+uint32_t upipe_ts_psid_crc32(const uint8_t *buffer, size_t size);
+
+/** @This checks the CRC32 of a PSI section. It is equivalent to
+ * psi_check_crc, but faster.
+ *
+ * @param section PSI section, whose length has already been checked
+ * @return false if the CRC is invalid
+ */
+bool upipe_ts_psid_check_crc(const uint8_t *section);
+
 /** @This compares two PSI sections.
  *
  * @param section1 PSI section 1
@@ -194,6 +212,44 @@ static inline bool upipe_ts_psid_table_section(struct uref **sections,
     return true;
 }
 
+/** @This checks if a section is already known, that is to say if it is
+ * identical to the section with the same number in the current table, while
+ * no new table is being collected. Since the current table was validated,
+ * such a section may be dropped without checking its CRC nor parsing it
+ * again. This is the case of most sections, as tables are repeated several
+ * times per second but rarely change.
+ *
+ * @param sections current PSI table
+ * @param next_sections PSI table being collected
+ * @param uref new section
+ * @return true if the section is known
+ */
+static inline bool upipe_ts_psid_table_cached(struct uref **sections,
+                                              struct uref **next_sections,
+                                              struct uref *uref)
+{
+    if (sections[0] == NULL)
+        return false;
+    for (int i = 0; i < PSI_TABLE_MAX_SECTIONS; i++)
+        if (next_sections[i] != NULL)
+            return false;
+
+    uint8_t buffer[PSI_HEADER_SIZE_SYNTAX1];
+    const uint8_t *section_header = uref_block_peek(uref, 0,
+                                                    PSI_HEADER_SIZE_SYNTAX1,
+                                                    buffer);
+    if (unlikely(section_header == NULL))
+        return false;
+    uint8_t section = psi_get_section(section_header);
+    int err = uref_block_peek_unmap(uref, 0, buffer, section_header);
+    ubase_assert(err);
+
+    /* table id, extension, version and section number are part of the
+     * comparison */
+    return sections[section] != NULL &&
+           ubase_check(uref_block_equal(sections[section], uref));
+}
+
 /** @This returns a section from a PSI table.
  *
  * @param sections PSI table
@@ -20,6 +20,12 @@
 
 /** @file
  * @short Upipe module splitting PIDs of a transport stream
+ *
+ * The input may either be single TS packets (block.mpegts.) or runs of
+ * aligned TS packets (block.mpegtsaligned.). In the latter case, the runs
+ * are sliced without copying; outputs whose flow definition is
+ * block.mpegtsaligned. receive consecutive packets of their PID in a single
+ * buffer, other outputs receive one buffer per packet.
  */
 
 #include <upipe/ubase.h>
@@ -46,8 +52,12 @@
 
 #include <bitstream/mpeg/ts.h>
 
-/** we only accept blocks containing exactly one TS packet */
+/** we accept blocks containing exactly one TS packet */
 #define EXPECTED_FLOW_DEF "block.mpegts."
+/** or blocks containing a run of aligned TS packets */
+#define EXPECTED_FLOW_DEF_ALIGNED "block.mpegtsaligned."
+/** number of PIDs read in one pass over a run of TS packets */
+#define PIDS_BATCH 64
 /** maximum number of PIDs */
 #define MAX_PIDS 8192
 
@@ -69,6 +79,8 @@ struct upipe_ts_split {
     /** list of output subpipes */
     struct uchain subs;
 
+    /** true if the input blocks carry runs of aligned TS packets */
+    bool aligned;
     /** PIDs array */
     struct upipe_ts_split_pid pids[MAX_PIDS];
 
@@ -105,6 +117,8 @@ struct upipe_ts_split_sub {
     enum upipe_helper_output_state output_state;
     /** list of output requests */
     struct uchain request_list;
+    /** true if the output accepts runs of aligned TS packets */
+    bool aligned;
 
     /** public upipe structure */
     struct upipe upipe;
@@ -151,6 +165,8 @@ static struct upipe *upipe_ts_split_sub_alloc(struct upipe_mgr *mgr,
     uchain_init(&upipe_ts_split_sub->uchain_pid);
     upipe_ts_split_sub_init_output(upipe);
     upipe_ts_split_sub_init_sub(upipe);
+    upipe_ts_split_sub->aligned =
+        ubase_check(uref_flow_match_def(flow_def, EXPECTED_FLOW_DEF_ALIGNED));
     upipe_ts_split_sub_store_flow_def(upipe, flow_def);
 
     struct upipe_ts_split *upipe_ts_split =
@@ -255,6 +271,7 @@ static struct upipe *upipe_ts_split_alloc(struct upipe_mgr *mgr,
                    upipe_ts_split_free);
     upipe_ts_split_init_sub_mgr(upipe);
     upipe_ts_split_init_sub_subs(upipe);
+    upipe_ts_split->aligned = false;
 
     int i;
     for (i = 0; i < MAX_PIDS; i++) {
@@ -334,8 +351,8 @@ static void upipe_ts_split_pid_unset(struct upipe *upipe, uint16_t pid,
  * @param uref uref structure
  * @param upump_p reference to pump that generated the buffer
  */
-static void upipe_ts_split_input(struct upipe *upipe, struct uref *uref,
-                                 struct upump **upump_p)
+static void upipe_ts_split_input_packet(struct upipe *upipe, struct uref *uref,
+                                        struct upump **upump_p)
 {
     struct upipe_ts_split *upipe_ts_split = upipe_ts_split_from_upipe(upipe);
     uint8_t buffer[TS_HEADER_SIZE];
@@ -374,6 +391,146 @@ static void upipe_ts_split_input(struct upipe *upipe, struct uref *uref,
         uref_free(uref);
 }
 
+/** @internal @This reads the PIDs of a run of aligned TS packets, in one pass
+ * over each segment of the block.
+ *
+ * @param uref uref structure
+ * @param offset offset of the first TS packet in the block
+ * @param nb number of TS packets to read
+ * @param pids filled in with the PIDs of the TS packets
+ * @return an error code
+ */
+static int upipe_ts_split_read_pids(struct uref *uref, int offset,
+                                    unsigned int nb, uint16_t *pids)
+{
+    unsigned int i = 0;
+    while (i < nb) {
+        const uint8_t *buffer;
+        int size = -1;
+        UBASE_RETURN(uref_block_read(uref, offset, &size, &buffer))
+
+        /* packets whose PID lies entirely in this segment */
+        unsigned int n = size >= 3 ? (size - 3) / TS_SIZE + 1 : 0;
+        if (n > nb - i)
+            n = nb - i;
+        for (unsigned int j = 0; j < n; j++)
+            pids[i + j] = ts_get_pid(buffer + j * TS_SIZE);
+        uref_block_unmap(uref, offset);
+
+        if (unlikely(!n)) {
+            /* the header spans several segments */
+            uint8_t header[TS_HEADER_SIZE];
+            UBASE_RETURN(uref_block_extract(uref, offset, TS_HEADER_SIZE,
+                                            header))
+            pids[i] = ts_get_pid(header);
+            n = 1;
+        }
+        i += n;
+        offset += n * TS_SIZE;
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This outputs consecutive TS packets of the same PID to the
+ * appropriate output(s), without copying them. Outputs accepting aligned
+ * TS packets receive the whole run in a single buffer.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref uref structure carrying the run
+ * @param offset offset of the first TS packet in the block
+ * @param nb number of TS packets
+ * @param pid PID of the TS packets
+ * @param upump_p reference to pump that generated the buffer
+ * @return an error code
+ */
+static int upipe_ts_split_output_run(struct upipe *upipe, struct uref *uref,
+                                     int offset, unsigned int nb, uint16_t pid,
+                                     struct upump **upump_p)
+{
+    struct upipe_ts_split *upipe_ts_split = upipe_ts_split_from_upipe(upipe);
+    struct uchain *uchain;
+    ulist_foreach (&upipe_ts_split->pids[pid].subs, uchain) {
+        struct upipe_ts_split_sub *output =
+                upipe_ts_split_sub_from_uchain_pid(uchain);
+        unsigned int nb_slices = output->aligned ? 1 : nb;
+        int slice_size = output->aligned ? nb * TS_SIZE : TS_SIZE;
+        for (unsigned int i = 0; i < nb_slices; i++) {
+            struct uref *slice = uref_block_splice(uref,
+                    offset + i * slice_size, slice_size);
+            if (unlikely(slice == NULL))
+                return UBASE_ERR_ALLOC;
+            upipe_ts_split_sub_output(upipe_ts_split_sub_to_upipe(output),
+                                      slice, upump_p);
+        }
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This demuxes a run of aligned TS packets to the appropriate
+ * output(s).
+ *
+ * @param upipe description structure of the pipe
+ * @param uref uref structure
+ * @param size size of the block
+ * @param upump_p reference to pump that generated the buffer
+ */
+static void upipe_ts_split_input_run(struct upipe *upipe, struct uref *uref,
+                                     size_t size, struct upump **upump_p)
+{
+    if (unlikely(size % TS_SIZE))
+        upipe_warn_va(upipe, "discarding %zu trailing octets",
+                      size % TS_SIZE);
+
+    unsigned int nb = size / TS_SIZE;
+    for (unsigned int first = 0; first < nb; first += PIDS_BATCH) {
+        uint16_t pids[PIDS_BATCH];
+        unsigned int count = nb - first < PIDS_BATCH ? nb - first : PIDS_BATCH;
+        int err = upipe_ts_split_read_pids(uref, first * TS_SIZE, count, pids);
+        if (unlikely(!ubase_check(err))) {
+            uref_free(uref);
+            upipe_throw_fatal(upipe, err);
+            return;
+        }
+
+        unsigned int i = 0;
+        while (i < count) {
+            unsigned int j = i + 1;
+            while (j < count && pids[j] == pids[i])
+                j++;
+            err = upipe_ts_split_output_run(upipe, uref,
+                                            (first + i) * TS_SIZE, j - i,
+                                            pids[i], upump_p);
+            if (unlikely(!ubase_check(err))) {
+                uref_free(uref);
+                upipe_throw_fatal(upipe, err);
+                return;
+            }
+            i = j;
+        }
+    }
+    uref_free(uref);
+}
+
+/** @internal @This demuxes TS packets to the appropriate output(s).
+ *
+ * @param upipe description structure of the pipe
+ * @param uref uref structure
+ * @param upump_p reference to pump that generated the buffer
+ */
+static void upipe_ts_split_input(struct upipe *upipe, struct uref *uref,
+                                 struct upump **upump_p)
+{
+    struct upipe_ts_split *upipe_ts_split = upipe_ts_split_from_upipe(upipe);
+    size_t size;
+    if (upipe_ts_split->aligned &&
+        likely(ubase_check(uref_block_size(uref, &size))) &&
+        size > TS_SIZE) {
+        upipe_ts_split_input_run(upipe, uref, size, upump_p);
+        return;
+    }
+    upipe_ts_split_input_packet(upipe, uref, upump_p);
+}
+
 /** @internal @This sets the input flow definition.
  *
  * @param upipe description structure of the pipe
@@ -385,7 +542,14 @@ static int upipe_ts_split_set_flow_def(struct upipe *upipe,
 {
     if (flow_def == NULL)
         return UBASE_ERR_INVALID;
-    return uref_flow_match_def(flow_def, EXPECTED_FLOW_DEF);
+    struct upipe_ts_split *upipe_ts_split = upipe_ts_split_from_upipe(upipe);
+    if (ubase_check(uref_flow_match_def(flow_def, EXPECTED_FLOW_DEF_ALIGNED)))
+        upipe_ts_split->aligned = true;
+    else {
+        UBASE_RETURN(uref_flow_match_def(flow_def, EXPECTED_FLOW_DEF))
+        upipe_ts_split->aligned = false;
+    }
+    return UBASE_ERR_NONE;
 }
 
 /** @internal @This processes control commands.
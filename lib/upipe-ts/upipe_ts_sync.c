@@ -29,6 +29,10 @@
  * @item 196 @item TS packet followed by an 8-octet timestamp or checksum
  * @item 204 @item TS packet followed by a 16-octet checksum
  * @end table
+ *
+ * With standard TS size, the pipe may be configured with
+ * @ref upipe_ts_sync_set_batch to output runs of consecutive TS packets in a
+ * single buffer (block.mpegtsaligned.), instead of one buffer per packet.
  */
 
 #include <upipe/ubase.h>
@@ -51,16 +55,23 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <string.h>
+#include <limits.h>
 #include <assert.h>
 
 #include <bitstream/mpeg/ts.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /** default number of packets to sync with */
 #define DEFAULT_TS_SYNC 2
 /** we only accept blocks */
 #define EXPECTED_FLOW_DEF "block."
 /** when configured with standard TS size, we output TS packets */
 #define OUTPUT_FLOW_DEF "block.mpegts."
+/** when configured to output several TS packets per buffer */
+#define BATCH_OUTPUT_FLOW_DEF "block.mpegtsaligned."
 /** otherwise there is a suffix to decaps */
 #define SUFFIX_OUTPUT_FLOW_DEF "block.mpegtssuffix."
 /** TS synchronization word */
@@ -84,6 +95,8 @@ struct upipe_ts_sync {
     size_t output_size;
     /** number of packets to sync with */
     unsigned int ts_sync;
+    /** maximum number of packets per output buffer */
+    unsigned int batch;
     /** next uref to be processed */
     struct uref *next_uref;
     /** original size of the next uref */
@@ -129,14 +142,99 @@ static struct upipe *upipe_ts_sync_alloc(struct upipe_mgr *mgr,
     upipe_ts_sync_init_output(upipe);
     upipe_ts_sync_init_output_size(upipe, TS_SIZE);
     upipe_ts_sync->ts_sync = DEFAULT_TS_SYNC;
+    upipe_ts_sync->batch = 1;
     upipe_ts_sync->next_uref = NULL;
     ulist_init(&upipe_ts_sync->urefs);
     upipe_throw_ready(upipe);
     return upipe;
 }
 
+/** @internal @This finds the first position in a linear buffer followed by
+ * the given number of sync words, at the given stride. All the sync words of
+ * the tested positions must lie in the buffer.
+ *
+ * @param buffer linear buffer
+ * @param size number of positions to test
+ * @param stride distance between sync words
+ * @param nb number of sync words to test
+ * @return position of the first match, or size if none was found
+ */
+static size_t upipe_ts_sync_find(const uint8_t *buffer, size_t size,
+                                 size_t stride, unsigned int nb)
+{
+    size_t p = 0;
+#ifdef __SSE2__
+    /* test 16 positions at once */
+    const __m128i sync = _mm_set1_epi8(TS_SYNC);
+    for ( ; p + 16 <= size; p += 16) {
+        __m128i match = _mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i *)(buffer + p)), sync);
+        for (unsigned int k = 1; k < nb && _mm_movemask_epi8(match); k++)
+            match = _mm_and_si128(match, _mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i *)(buffer + p + k * stride)),
+                sync));
+        int mask = _mm_movemask_epi8(match);
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+#endif
+
+    while (p < size) {
+        const uint8_t *match = memchr(buffer + p, TS_SYNC, size - p);
+        if (match == NULL)
+            break;
+        p = match - buffer;
+        unsigned int k;
+        for (k = 1; k < nb && buffer[p + k * stride] == TS_SYNC; k++);
+        if (k == nb)
+            return p;
+        p++;
+    }
+    return size;
+}
+
+/** @internal @This counts the consecutive sync words at the packet stride,
+ * starting at the given offset in the working buffer.
+ *
+ * @param upipe description structure of the pipe
+ * @param offset offset of the first sync word
+ * @param max maximum number of sync words to count
+ * @param end_p filled in with true if the end of the working buffer was
+ * reached
+ * @return number of consecutive sync words
+ */
+static unsigned int upipe_ts_sync_count_words(struct upipe *upipe,
+                                              size_t offset, unsigned int max,
+                                              bool *end_p)
+{
+    struct upipe_ts_sync *upipe_ts_sync = upipe_ts_sync_from_upipe(upipe);
+    unsigned int nb = 0;
+    *end_p = false;
+    while (nb < max) {
+        const uint8_t *buffer;
+        int size = -1;
+        if (unlikely(!ubase_check(uref_block_read(upipe_ts_sync->next_uref,
+                                                  offset, &size, &buffer)))) {
+            *end_p = true;
+            break;
+        }
+        int i = 0;
+        while (nb < max && i < size && buffer[i] == TS_SYNC) {
+            nb++;
+            i += upipe_ts_sync->output_size;
+        }
+        uref_block_unmap(upipe_ts_sync->next_uref, offset);
+        if (nb < max && i < size)
+            break;
+        offset += i;
+    }
+    return nb;
+}
+
 /** @internal @This checks the presence of the required number of sync words
- * in the working buffer.
+ * in the working buffer. Each linear segment is scanned once, and only
+ * candidates whose sync words span several segments are tested across
+ * segments.
  *
  * @param upipe description structure of the pipe
  * @param offset_p written with the offset of the potential first TS packet in
@@ -146,35 +244,78 @@ static struct upipe *upipe_ts_sync_alloc(struct upipe_mgr *mgr,
 static bool upipe_ts_sync_check(struct upipe *upipe, size_t *offset_p)
 {
     struct upipe_ts_sync *upipe_ts_sync = upipe_ts_sync_from_upipe(upipe);
+    size_t span = (upipe_ts_sync->ts_sync - 1) * upipe_ts_sync->output_size;
     for ( ; ; ) {
-        if (unlikely(!ubase_check(uref_block_scan(upipe_ts_sync->next_uref,
-                                                  offset_p, TS_SYNC))))
+        const uint8_t *buffer;
+        int size = -1;
+        if (unlikely(!ubase_check(uref_block_read(upipe_ts_sync->next_uref,
+                                                  *offset_p, &size, &buffer))))
             return false;
 
-        /* first octet at *offset_p is a sync word */
-        int ts_sync = upipe_ts_sync->ts_sync - 1;
-        for (int offset = *offset_p + upipe_ts_sync->output_size; ts_sync;
-             ts_sync--, offset += upipe_ts_sync->output_size) {
-            const uint8_t *buffer;
-            int size = 1;
-            uint8_t word;
-            if (unlikely(!ubase_check(uref_block_read(upipe_ts_sync->next_uref,
-                                          offset, &size, &buffer))))
-                /* not enough sync words could be tested */
-                return false;
-            assert(size == 1);
-            word = *buffer;
-            uref_block_unmap(upipe_ts_sync->next_uref, offset);
-            if (word != TS_SYNC) {
-                *offset_p += 1;
-                break;
-            }
+        /* candidates whose sync words all lie in this segment */
+        size_t limit = size > span ? size - span : 0;
+        size_t found = upipe_ts_sync_find(buffer, limit,
+                                          upipe_ts_sync->output_size,
+                                          upipe_ts_sync->ts_sync);
+        if (found < limit) {
+            uref_block_unmap(upipe_ts_sync->next_uref, *offset_p);
+            *offset_p += found;
+            return true;
         }
-        if (!ts_sync)
-            break;
+
+        /* other candidates span several segments */
+        const uint8_t *match = memchr(buffer + limit, TS_SYNC, size - limit);
+        uref_block_unmap(upipe_ts_sync->next_uref, *offset_p);
+        if (match == NULL) {
+            *offset_p += size;
+            continue;
+        }
+
+        /* first octet at *offset_p is a sync word */
+        *offset_p += match - buffer;
+        bool end;
+        if (upipe_ts_sync_count_words(upipe, *offset_p,
+                                      upipe_ts_sync->ts_sync, &end) ==
+                upipe_ts_sync->ts_sync)
+            return true;
+        if (end)
+            /* not enough sync words could be tested */
+            return false;
+        *offset_p += 1;
     }
+}
+
+/** @internal @This returns true if several TS packets may be output in a
+ * single buffer.
+ *
+ * @param upipe description structure of the pipe
+ * @return true if output buffers carry runs of TS packets
+ */
+static inline bool upipe_ts_sync_batched(struct upipe *upipe)
+{
+    struct upipe_ts_sync *upipe_ts_sync = upipe_ts_sync_from_upipe(upipe);
+    return upipe_ts_sync->batch > 1 && upipe_ts_sync->output_size == TS_SIZE;
+}
 
-    return true;
+/** @internal @This counts the TS packets which may be output in a single
+ * buffer, after @ref upipe_ts_sync_check found a TS packet at the beginning
+ * of the working buffer. Each packet must be followed by the same number of
+ * sync words as in @ref upipe_ts_sync_check.
+ *
+ * @param upipe description structure of the pipe
+ * @return number of TS packets to output
+ */
+static unsigned int upipe_ts_sync_count(struct upipe *upipe)
+{
+    struct upipe_ts_sync *upipe_ts_sync = upipe_ts_sync_from_upipe(upipe);
+    if (!upipe_ts_sync_batched(upipe))
+        return 1;
+
+    /* upipe_ts_sync_check already tested ts_sync sync words */
+    bool end;
+    return 1 + upipe_ts_sync_count_words(upipe,
+            upipe_ts_sync->ts_sync * upipe_ts_sync->output_size,
+            upipe_ts_sync->batch - 1, &end);
 }
 
 /** @internal @This flushes all input buffers.
@@ -235,8 +376,9 @@ static void upipe_ts_sync_input(struct upipe *upipe, struct uref *uref,
 
         /* upipe_ts_sync_check said there is at least one TS packet there. */
         upipe_ts_sync_sync_acquired(upipe);
+        unsigned int nb = upipe_ts_sync_count(upipe);
         struct uref *output = upipe_ts_sync_extract_uref_stream(upipe,
-                                                    upipe_ts_sync->output_size);
+                                            nb * upipe_ts_sync->output_size);
         if (unlikely(output == NULL)) {
             upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
             continue;
@@ -245,6 +387,33 @@ static void upipe_ts_sync_input(struct upipe *upipe, struct uref *uref,
     }
 }
 
+/** @internal @This builds and stores the output flow definition.
+ *
+ * @param upipe description structure of the pipe
+ * @param flow_def output flow definition packet, to modify
+ * @return an error code
+ */
+static int upipe_ts_sync_build_flow_def(struct upipe *upipe,
+                                        struct uref *flow_def)
+{
+    struct upipe_ts_sync *upipe_ts_sync = upipe_ts_sync_from_upipe(upipe);
+    int err;
+    if (upipe_ts_sync_batched(upipe)) {
+        uref_block_flow_delete_size(flow_def);
+        err = uref_flow_set_def(flow_def, BATCH_OUTPUT_FLOW_DEF);
+    } else {
+        err = uref_block_flow_set_size(flow_def, upipe_ts_sync->output_size);
+        if (ubase_check(err))
+            err = uref_flow_set_def(flow_def, OUTPUT_FLOW_DEF);
+    }
+    if (unlikely(!ubase_check(err))) {
+        uref_free(flow_def);
+        return err;
+    }
+    upipe_ts_sync_store_flow_def(upipe, flow_def);
+    return UBASE_ERR_NONE;
+}
+
 /** @internal @This sets the input flow definition.
  *
  * @param upipe description structure of the pipe
@@ -262,12 +431,7 @@ static int upipe_ts_sync_set_flow_def(struct upipe *upipe,
         upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
         return UBASE_ERR_ALLOC;
     }
-    struct upipe_ts_sync *upipe_ts_sync = upipe_ts_sync_from_upipe(upipe);
-    UBASE_RETURN(uref_block_flow_set_size(flow_def_dup,
-                                          upipe_ts_sync->output_size))
-    UBASE_RETURN(uref_flow_set_def(flow_def_dup, OUTPUT_FLOW_DEF))
-    upipe_ts_sync_store_flow_def(upipe, flow_def_dup);
-    return UBASE_ERR_NONE;
+    return upipe_ts_sync_build_flow_def(upipe, flow_def_dup);
 }
 
 /** @internal @This returns the configured number of packets to synchronize
@@ -302,6 +466,44 @@ static int _upipe_ts_sync_set_sync(struct upipe *upipe, int sync)
     return UBASE_ERR_NONE;
 }
 
+/** @internal @This returns the maximum number of TS packets per output
+ * buffer.
+ *
+ * @param upipe description structure of the pipe
+ * @param batch_p filled in with number of packets
+ * @return an error code
+ */
+static int _upipe_ts_sync_get_batch(struct upipe *upipe,
+                                    unsigned int *batch_p)
+{
+    struct upipe_ts_sync *upipe_ts_sync = upipe_ts_sync_from_upipe(upipe);
+    assert(batch_p != NULL);
+    *batch_p = upipe_ts_sync->batch;
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This sets the maximum number of TS packets per output buffer.
+ *
+ * @param upipe description structure of the pipe
+ * @param batch number of packets
+ * @return an error code
+ */
+static int _upipe_ts_sync_set_batch(struct upipe *upipe, unsigned int batch)
+{
+    struct upipe_ts_sync *upipe_ts_sync = upipe_ts_sync_from_upipe(upipe);
+    if (!batch || batch > INT_MAX / TS_SIZE)
+        return UBASE_ERR_INVALID;
+    bool batched = upipe_ts_sync_batched(upipe);
+    upipe_ts_sync->batch = batch;
+    if (upipe_ts_sync->flow_def == NULL ||
+        batched == upipe_ts_sync_batched(upipe))
+        return UBASE_ERR_NONE;
+
+    struct uref *flow_def = uref_dup(upipe_ts_sync->flow_def);
+    UBASE_ALLOC_RETURN(flow_def)
+    return upipe_ts_sync_build_flow_def(upipe, flow_def);
+}
+
 /** @internal @This processes control commands on a ts sync pipe.
  *
  * @param upipe description structure of the pipe
@@ -333,6 +535,16 @@ static int upipe_ts_sync_control(struct upipe *upipe,
             int sync = va_arg(args, int);
             return _upipe_ts_sync_set_sync(upipe, sync);
         }
+        case UPIPE_TS_SYNC_GET_BATCH: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_TS_SYNC_SIGNATURE)
+            unsigned int *batch_p = va_arg(args, unsigned int *);
+            return _upipe_ts_sync_get_batch(upipe, batch_p);
+        }
+        case UPIPE_TS_SYNC_SET_BATCH: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_TS_SYNC_SIGNATURE)
+            unsigned int batch = va_arg(args, unsigned int);
+            return _upipe_ts_sync_set_batch(upipe, batch);
+        }
         default:
             return UBASE_ERR_UNHANDLED;
     }
@@ -32,6 +32,7 @@
 
 #include <upipe/ubase.h>
 #include <upipe/urefcount.h>
+#include <upipe/uatomic.h>
 #include <upipe/upool.h>
 #include <upipe/umem.h>
 #include <upipe/udict.h>
@@ -47,6 +48,12 @@
 #define UDICT_MIN_SIZE 128
 /** default extra space added on udict expansion */
 #define UDICT_EXTRA_SIZE 64
+/** number of slots in the index of attributes (power of 2) */
+#define UDICT_INDEX_SIZE 64
+/** maximum number of attributes in the index */
+#define UDICT_INDEX_MAX 48
+/** too many attributes to be indexed */
+#define UDICT_INDEX_OVERFLOW -2
 
 /** @internal @This represents a shorthand attribute type. */
 struct inline_shorthand {
@@ -120,6 +127,8 @@ struct udict_inline_mgr {
 
     /** udict pool */
     struct upool udict_pool;
+    /** shared attribute space pool */
+    struct upool shared_pool;
     /** umem allocator */
     struct umem_mgr *umem_mgr;
 
@@ -134,20 +143,82 @@ struct udict_inline_mgr {
 UBASE_FROM_TO(udict_inline_mgr, udict_mgr, udict_mgr, mgr)
 UBASE_FROM_TO(udict_inline_mgr, urefcount, urefcount, urefcount)
 UBASE_FROM_TO(udict_inline_mgr, upool, udict_pool, udict_pool)
+UBASE_FROM_TO(udict_inline_mgr, upool, shared_pool, shared_pool)
+
+/** @internal @This is a slot in the index of attributes. */
+struct udict_inline_index {
+    /** hash of the name and type of the attribute */
+    uint32_t hash;
+    /** offset of the attribute in the buffer plus one, or 0 if unused */
+    uint32_t offset;
+};
 
-/** super-set of the udict structure with additional local members */
-struct udict_inline {
+/** @internal @This is the attribute space, shared between duplicated
+ * udicts until one of them is written to. */
+struct udict_inline_shared {
+    /** number of udicts pointing to the attribute space */
+    uatomic_uint32_t refcount;
     /** umem structure pointing to buffer */
     struct umem umem;
     /** used size */
     size_t size;
 
+    /** number of indexed attributes, or UDICT_INDEX_OVERFLOW */
+    int index_nb;
+    /** open addressing hash table of attributes */
+    struct udict_inline_index index[UDICT_INDEX_SIZE];
+};
+
+/** super-set of the udict structure with additional local members */
+struct udict_inline {
+    /** pointer to attribute space */
+    struct udict_inline_shared *shared;
+
     /** common structure */
     struct udict udict;
 };
 
 UBASE_FROM_TO(udict_inline, udict, udict, udict)
 
+/** @internal @This allocates an attribute space.
+ *
+ * @param inline_mgr pointer to the udict_inline manager
+ * @param size initial size of the attribute space
+ * @return pointer to the attribute space or NULL in case of allocation error
+ */
+static struct udict_inline_shared *
+    udict_inline_shared_alloc(struct udict_inline_mgr *inline_mgr, size_t size)
+{
+    struct udict_inline_shared *shared =
+        upool_alloc(&inline_mgr->shared_pool, struct udict_inline_shared *);
+    if (unlikely(shared == NULL))
+        return NULL;
+
+    if (size < inline_mgr->min_size)
+        size = inline_mgr->min_size;
+    if (unlikely(!umem_alloc(inline_mgr->umem_mgr, &shared->umem, size))) {
+        upool_free(&inline_mgr->shared_pool, shared);
+        return NULL;
+    }
+    uatomic_store(&shared->refcount, 1);
+    return shared;
+}
+
+/** @internal @This releases an attribute space, and frees it if it is no
+ * longer used.
+ *
+ * @param inline_mgr pointer to the udict_inline manager
+ * @param shared pointer to the attribute space
+ */
+static void udict_inline_shared_release(struct udict_inline_mgr *inline_mgr,
+                                        struct udict_inline_shared *shared)
+{
+    if (uatomic_fetch_sub(&shared->refcount, 1) == 1) {
+        umem_free(&shared->umem);
+        upool_free(&inline_mgr->shared_pool, shared);
+    }
+}
+
 /** @This allocates a udict with attributes space.
  *
  * @param mgr common management structure
@@ -159,23 +230,29 @@ static struct udict *udict_inline_alloc(struct udict_mgr *mgr, size_t size)
     struct udict_inline_mgr *inline_mgr = udict_inline_mgr_from_udict_mgr(mgr);
     struct udict_inline *inl = upool_alloc(&inline_mgr->udict_pool,
                                            struct udict_inline *);
+    if (unlikely(inl == NULL))
+        return NULL;
     struct udict *udict = udict_inline_to_udict(inl);
 
-    if (size < inline_mgr->min_size)
-        size = inline_mgr->min_size;
-    if (unlikely(!umem_alloc(inline_mgr->umem_mgr, &inl->umem, size))) {
+    inl->shared = udict_inline_shared_alloc(inline_mgr, size);
+    if (unlikely(inl->shared == NULL)) {
         upool_free(&inline_mgr->udict_pool, inl);
         return NULL;
     }
 
-    uint8_t *buffer = umem_buffer(&inl->umem);
+    uint8_t *buffer = umem_buffer(&inl->shared->umem);
     buffer[0] = UDICT_TYPE_END;
-    inl->size = 1;
+    inl->shared->size = 1;
+    /* the index is maintained from the start, so that lookups never write
+     * to an attribute space shared with duplicates */
+    memset(inl->shared->index, 0, sizeof(inl->shared->index));
+    inl->shared->index_nb = 0;
 
     return udict;
 }
 
-/** @This duplicates a given udict.
+/** @This duplicates a given udict. The attribute space is shared until
+ * one of the udicts is modified.
  *
  * @param udict pointer to udict
  * @param new_udict_p reference written with a pointer to the newly allocated
@@ -185,16 +262,50 @@ static struct udict *udict_inline_alloc(struct udict_mgr *mgr, size_t size)
 static int udict_inline_dup(struct udict *udict, struct udict **new_udict_p)
 {
     assert(new_udict_p != NULL);
+    struct udict_inline_mgr *inline_mgr =
+        udict_inline_mgr_from_udict_mgr(udict->mgr);
     struct udict_inline *inl = udict_inline_from_udict(udict);
-    struct udict *new_udict = udict_inline_alloc(udict->mgr, inl->size);
-    if (unlikely(new_udict == NULL))
+    struct udict_inline *new_inl = upool_alloc(&inline_mgr->udict_pool,
+                                               struct udict_inline *);
+    if (unlikely(new_inl == NULL))
         return UBASE_ERR_ALLOC;
 
-    *new_udict_p = new_udict;
+    uatomic_fetch_add(&inl->shared->refcount, 1);
+    new_inl->shared = inl->shared;
+    *new_udict_p = udict_inline_to_udict(new_inl);
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This makes sure the attribute space of a udict is not shared
+ * before it is modified.
+ *
+ * @param udict pointer to udict
+ * @return an error code
+ */
+static int udict_inline_unshare(struct udict *udict)
+{
+    struct udict_inline *inl = udict_inline_from_udict(udict);
+    struct udict_inline_shared *shared = inl->shared;
+    if (likely(uatomic_load(&shared->refcount) == 1))
+        return UBASE_ERR_NONE;
 
-    struct udict_inline *new_inl = udict_inline_from_udict(new_udict);
-    memcpy(umem_buffer(&new_inl->umem), umem_buffer(&inl->umem), inl->size);
-    new_inl->size = inl->size;
+    struct udict_inline_mgr *inline_mgr =
+        udict_inline_mgr_from_udict_mgr(udict->mgr);
+    struct udict_inline_shared *new_shared =
+        udict_inline_shared_alloc(inline_mgr, shared->size);
+    if (unlikely(new_shared == NULL))
+        return UBASE_ERR_ALLOC;
+
+    memcpy(umem_buffer(&new_shared->umem), umem_buffer(&shared->umem),
+           shared->size);
+    new_shared->size = shared->size;
+    /* offsets are identical in the copy */
+    new_shared->index_nb = shared->index_nb;
+    if (shared->index_nb >= 0)
+        memcpy(new_shared->index, shared->index, sizeof(shared->index));
+
+    inl->shared = new_shared;
+    udict_inline_shared_release(inline_mgr, shared);
     return UBASE_ERR_NONE;
 }
 
@@ -236,29 +347,123 @@ static uint8_t *udict_inline_next(uint8_t *attr)
     return attr + 3 + size;
 }
 
-/** @internal @This finds an attribute (shorthand or not) of the given name
- * and type and returns a pointer to its beginning.
+/** @internal @This computes the hash of an attribute, used to index it.
  *
- * @param udict pointer to the udict
+ * @param name name of the attribute (ignored for shorthands)
+ * @param type type of the attribute
+ * @return hash of the attribute
+ */
+static inline uint32_t udict_inline_hash(const char *name,
+                                         enum udict_type type)
+{
+    /* FNV-1a */
+    uint32_t hash = (UINT32_C(2166136261) ^ type) * UINT32_C(16777619);
+    if (type <= UDICT_TYPE_SHORTHAND && name != NULL)
+        while (*name)
+            hash = (hash ^ (uint8_t)*name++) * UINT32_C(16777619);
+    return hash;
+}
+
+/** @internal @This adds an attribute to the index.
+ *
+ * @param shared pointer to the shared attribute space
+ * @param hash hash of the attribute
+ * @param offset offset of the attribute in the buffer
+ */
+static void udict_inline_index_add(struct udict_inline_shared *shared, uint32_t hash,
+                                   size_t offset)
+{
+    if (shared->index_nb < 0)
+        return;
+    if (unlikely(shared->index_nb >= UDICT_INDEX_MAX || offset >= UINT32_MAX)) {
+        shared->index_nb = UDICT_INDEX_OVERFLOW;
+        return;
+    }
+
+    unsigned int i = hash & (UDICT_INDEX_SIZE - 1);
+    while (shared->index[i].offset)
+        i = (i + 1) & (UDICT_INDEX_SIZE - 1);
+    shared->index[i].hash = hash;
+    shared->index[i].offset = offset + 1;
+    shared->index_nb++;
+}
+
+/** @internal @This removes an attribute from the index, and shifts the
+ * offsets of the following attributes.
+ *
+ * @param shared pointer to the shared attribute space
+ * @param hash hash of the attribute
+ * @param offset offset of the attribute in the buffer
+ * @param size size of the removed attribute
+ */
+static void udict_inline_index_del(struct udict_inline_shared *shared, uint32_t hash,
+                                   size_t offset, size_t size)
+{
+    if (shared->index_nb < 0)
+        return;
+
+    unsigned int i = hash & (UDICT_INDEX_SIZE - 1);
+    while (shared->index[i].offset != offset + 1) {
+        assert(shared->index[i].offset);
+        i = (i + 1) & (UDICT_INDEX_SIZE - 1);
+    }
+
+    /* move back the following entries of the cluster */
+    unsigned int j = i;
+    for ( ; ; ) {
+        j = (j + 1) & (UDICT_INDEX_SIZE - 1);
+        if (!shared->index[j].offset)
+            break;
+        unsigned int k = shared->index[j].hash & (UDICT_INDEX_SIZE - 1);
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        shared->index[i] = shared->index[j];
+        i = j;
+    }
+    shared->index[i].offset = 0;
+    shared->index_nb--;
+
+    for (i = 0; i < UDICT_INDEX_SIZE; i++)
+        if (shared->index[i].offset > offset + 1)
+            shared->index[i].offset -= size;
+}
+
+/** @internal @This finds an attribute (shorthand or not) of the given name,
+ * type and hash and returns a pointer to its beginning.
+ *
+ * @param shared pointer to the shared attribute space
  * @param name name of the attribute
  * @param type type of the attribute (excluding inline_shorthands)
+ * @param hash hash of the attribute
  * @return pointer to the attribute, or NULL
  */
-static uint8_t *udict_inline_find(struct udict *udict, const char *name,
-                                  enum udict_type type)
+static uint8_t *udict_inline_lookup(struct udict_inline_shared *shared,
+                                    const char *name, enum udict_type type,
+                                    uint32_t hash)
 {
-    struct udict_inline *inl = udict_inline_from_udict(udict);
-#ifdef STATS
-    if (type > UDICT_TYPE_SHORTHAND) {
-        struct udict_inline_mgr *inline_mgr =
-            udict_inline_mgr_from_udict_mgr(udict->mgr);
-        inline_mgr->stats[type - UDICT_TYPE_SHORTHAND - 1]++;
+    uint8_t *buffer = umem_buffer(&shared->umem);
+    if (unlikely(type == UDICT_TYPE_END))
+        return buffer + shared->size - 1;
+
+    if (likely(shared->index_nb >= 0)) {
+        unsigned int i = hash & (UDICT_INDEX_SIZE - 1);
+        while (shared->index[i].offset) {
+            if (shared->index[i].hash == hash) {
+                uint8_t *attr = buffer + shared->index[i].offset - 1;
+                if (*attr == type &&
+                    (type > UDICT_TYPE_SHORTHAND ||
+                     !strcmp((const char *)(attr + 3), name)))
+                    return attr;
+            }
+            i = (i + 1) & (UDICT_INDEX_SIZE - 1);
+        }
+        return NULL;
     }
-#endif
-    uint8_t *attr = umem_buffer(&inl->umem);
+
+    uint8_t *attr = buffer;
     while (attr != NULL) {
         if (*attr == type &&
-             (type > UDICT_TYPE_SHORTHAND || type == UDICT_TYPE_END ||
+             (type > UDICT_TYPE_SHORTHAND ||
               !strcmp((const char *)(attr + 3), name)))
             return attr;
         attr = udict_inline_next(attr);
@@ -266,6 +471,41 @@ static uint8_t *udict_inline_find(struct udict *udict, const char *name,
     return NULL;
 }
 
+#ifdef STATS
+/** @internal @This counts the accesses to a shorthand attribute.
+ *
+ * @param udict pointer to the udict
+ * @param type type of the attribute
+ */
+static void udict_inline_stats(struct udict *udict, enum udict_type type)
+{
+    if (type > UDICT_TYPE_SHORTHAND) {
+        struct udict_inline_mgr *inline_mgr =
+            udict_inline_mgr_from_udict_mgr(udict->mgr);
+        inline_mgr->stats[type - UDICT_TYPE_SHORTHAND - 1]++;
+    }
+}
+#else
+#define udict_inline_stats(udict, type)
+#endif
+
+/** @internal @This finds an attribute (shorthand or not) of the given name
+ * and type and returns a pointer to its beginning.
+ *
+ * @param udict pointer to the udict
+ * @param name name of the attribute
+ * @param type type of the attribute (excluding inline_shorthands)
+ * @return pointer to the attribute, or NULL
+ */
+static uint8_t *udict_inline_find(struct udict *udict, const char *name,
+                                  enum udict_type type)
+{
+    struct udict_inline *inl = udict_inline_from_udict(udict);
+    udict_inline_stats(udict, type);
+    return udict_inline_lookup(inl->shared, name, type,
+                               udict_inline_hash(name, type));
+}
+
 /** @internal @This finds an attribute (shorthand or not) of the given name
  * and type and returns the name and type of the next attribute.
  *
@@ -288,7 +528,7 @@ static void udict_inline_iterate(struct udict *udict, const char **name_p,
         if (likely(attr != NULL))
             attr = udict_inline_next(attr);
     } else
-        attr = umem_buffer(&inl->umem);
+        attr = umem_buffer(&inl->shared->umem);
     if (unlikely(attr == NULL || *attr == UDICT_TYPE_END)) {
         *type_p = UDICT_TYPE_END;
         return;
@@ -298,22 +538,18 @@ static void udict_inline_iterate(struct udict *udict, const char **name_p,
     *name_p = *attr > UDICT_TYPE_SHORTHAND ? NULL : (const char *)(attr + 3);
 }
 
-/** @internal @This finds an attribute (shorthand or not) of the given name
- * and type and returns a pointer to the beginning of its value.
+/** @internal @This returns a pointer to the beginning of the value of an
+ * attribute.
  *
- * @param udict pointer to the udict
+ * @param attr pointer to the attribute
  * @param name name of the attribute
  * @param type type of the attribute (excluding inline_shorthands)
  * @param size_p size of the value, written on execution (can be NULL)
- * @return pointer to the value of the found attribute, or NULL
+ * @return pointer to the value of the attribute, or NULL
  */
-static uint8_t *_udict_inline_get(struct udict *udict, const char *name,
-                                  enum udict_type type, size_t *size_p)
+static uint8_t *udict_inline_value(uint8_t *attr, const char *name,
+                                   enum udict_type type, size_t *size_p)
 {
-    uint8_t *attr = udict_inline_find(udict, name, type);
-    if (unlikely(attr == NULL))
-        return NULL;
-
     if (likely(type > UDICT_TYPE_SHORTHAND)) {
         const struct inline_shorthand *shorthand =
             udict_inline_shorthand(*attr);
@@ -342,6 +578,24 @@ static uint8_t *_udict_inline_get(struct udict *udict, const char *name,
     return attr;
 }
 
+/** @internal @This finds an attribute (shorthand or not) of the given name
+ * and type and returns a pointer to the beginning of its value.
+ *
+ * @param udict pointer to the udict
+ * @param name name of the attribute
+ * @param type type of the attribute (excluding inline_shorthands)
+ * @param size_p size of the value, written on execution (can be NULL)
+ * @return pointer to the value of the found attribute, or NULL
+ */
+static uint8_t *_udict_inline_get(struct udict *udict, const char *name,
+                                  enum udict_type type, size_t *size_p)
+{
+    uint8_t *attr = udict_inline_find(udict, name, type);
+    if (unlikely(attr == NULL))
+        return NULL;
+    return udict_inline_value(attr, name, type, size_p);
+}
+
 /** @internal @This finds an attribute (shorthand or not) of the given name
  * and type and returns a pointer to the beginning of its value (const version).
  *
@@ -365,6 +619,22 @@ static int udict_inline_get(struct udict *udict, const char *name,
     return UBASE_ERR_NONE;
 }
 
+/** @internal @This removes an attribute from the buffer.
+ *
+ * @param shared pointer to the shared attribute space
+ * @param attr pointer to the attribute
+ * @param hash hash of the attribute
+ */
+static void udict_inline_remove(struct udict_inline_shared *shared, uint8_t *attr,
+                                uint32_t hash)
+{
+    uint8_t *buffer = umem_buffer(&shared->umem);
+    uint8_t *end = udict_inline_next(attr);
+    memmove(attr, end, buffer + shared->size - end);
+    shared->size -= end - attr;
+    udict_inline_index_del(shared, hash, attr - buffer, end - attr);
+}
+
 /** @internal @This deletes an attribute.
  *
  * @param udict pointer to the udict
@@ -377,13 +647,16 @@ static int udict_inline_delete(struct udict *udict, const char *name,
 {
     assert(type != UDICT_TYPE_END);
     struct udict_inline *inl = udict_inline_from_udict(udict);
-    uint8_t *attr = udict_inline_find(udict, name, type);
+    udict_inline_stats(udict, type);
+    uint32_t hash = udict_inline_hash(name, type);
+    uint8_t *attr = udict_inline_lookup(inl->shared, name, type, hash);
     if (unlikely(attr == NULL))
         return UBASE_ERR_INVALID;
 
-    uint8_t *end = udict_inline_next(attr);
-    memmove(attr, end, umem_buffer(&inl->umem) + inl->size - end);
-    inl->size -= end - attr;
+    size_t offset = attr - umem_buffer(&inl->shared->umem);
+    UBASE_RETURN(udict_inline_unshare(udict))
+    udict_inline_remove(inl->shared, umem_buffer(&inl->shared->umem) + offset,
+                        hash);
     return UBASE_ERR_NONE;
 }
 
@@ -410,26 +683,34 @@ static int udict_inline_set(struct udict *udict, const char *name,
         base_type = shorthand->base_type;
     }
 
+    UBASE_RETURN(udict_inline_unshare(udict))
+    struct udict_inline_shared *shared = inl->shared;
+    udict_inline_stats(udict, type);
+
     /* check if it already exists */
-    size_t current_size;
-    uint8_t *attr = _udict_inline_get(udict, name, type, &current_size);
+    uint32_t hash = udict_inline_hash(name, type);
+    uint8_t *attr = udict_inline_lookup(shared, name, type, hash);
     if (unlikely(attr != NULL)) {
+        size_t current_size;
+        uint8_t *value = udict_inline_value(attr, name, type, &current_size);
+        if (unlikely(value == NULL))
+            return UBASE_ERR_INVALID;
         if ((base_type != UDICT_TYPE_OPAQUE &&
              base_type != UDICT_TYPE_STRING) ||
             current_size == attr_size) {
             if (attr_p != NULL)
-                *attr_p = attr;
+                *attr_p = value;
             return UBASE_ERR_NONE;
         }
         if (likely(base_type == UDICT_TYPE_STRING &&
                    current_size > attr_size)) {
             /* Just zero out superfluous bytes */
-            memset(attr + attr_size, 0, current_size - attr_size);
+            memset(value + attr_size, 0, current_size - attr_size);
             if (attr_p != NULL)
-                *attr_p = attr;
+                *attr_p = value;
             return UBASE_ERR_NONE;
         }
-        udict_inline_delete(udict, name, type);
+        udict_inline_remove(shared, attr, hash);
     }
 
     /* calculate header size */
@@ -444,19 +725,20 @@ static int udict_inline_set(struct udict *udict, const char *name,
     }
 
     /* check total attributes size */
-    attr = umem_buffer(&inl->umem) + inl->size - 1;
-    size_t total_size = (attr - umem_buffer(&inl->umem)) + header_size +
+    attr = umem_buffer(&shared->umem) + shared->size - 1;
+    size_t total_size = (attr - umem_buffer(&shared->umem)) + header_size +
                         attr_size + 1;
-    if (unlikely(total_size >= umem_size(&inl->umem))) {
+    if (unlikely(total_size >= umem_size(&shared->umem))) {
         struct udict_inline_mgr *inline_mgr =
             udict_inline_mgr_from_udict_mgr(udict->mgr);
-        if (unlikely(!umem_realloc(&inl->umem, total_size +
+        if (unlikely(!umem_realloc(&shared->umem, total_size +
                                                inline_mgr->extra_size)))
             return UBASE_ERR_ALLOC;
 
-        attr = umem_buffer(&inl->umem) + inl->size - 1;
+        attr = umem_buffer(&shared->umem) + shared->size - 1;
     }
     assert(*attr == UDICT_TYPE_END);
+    udict_inline_index_add(shared, hash, shared->size - 1);
 
     /* write attribute header */
     if (unlikely(shorthand == NULL)) {
@@ -480,7 +762,7 @@ static int udict_inline_set(struct udict *udict, const char *name,
     attr[attr_size] = UDICT_TYPE_END;
     if (attr_p != NULL)
         *attr_p = attr;
-    inl->size += header_size + attr_size;
+    shared->size += header_size + attr_size;
     return UBASE_ERR_NONE;
 }
 
@@ -566,7 +848,7 @@ static void udict_inline_free(struct udict *udict)
         udict_inline_mgr_from_udict_mgr(udict->mgr);
     struct udict_inline *inl = udict_inline_from_udict(udict);
 
-    umem_free(&inl->umem);
+    udict_inline_shared_release(inline_mgr, inl->shared);
     upool_free(&inline_mgr->udict_pool, inl);
 }
 
@@ -597,6 +879,33 @@ static void udict_inline_free_inner(struct upool *upool, void *inl)
     free(inl);
 }
 
+/** @internal @This allocates the data structure of an attribute space.
+ *
+ * @param upool pointer to upool
+ * @return pointer to udict_inline_shared or NULL in case of allocation error
+ */
+static void *udict_inline_shared_alloc_inner(struct upool *upool)
+{
+    struct udict_inline_shared *shared =
+        malloc(sizeof(struct udict_inline_shared));
+    if (unlikely(shared == NULL))
+        return NULL;
+    uatomic_init(&shared->refcount, 0);
+    return shared;
+}
+
+/** @internal @This frees a udict_inline_shared.
+ *
+ * @param upool pointer to upool
+ * @param _shared pointer to a udict_inline_shared structure to free
+ */
+static void udict_inline_shared_free_inner(struct upool *upool, void *_shared)
+{
+    struct udict_inline_shared *shared = _shared;
+    uatomic_clean(&shared->refcount);
+    free(shared);
+}
+
 /** @internal @This instructs an existing udict manager to release all
  * structures currently kept in pools. It is intended as a debug tool only.
  *
@@ -606,6 +915,7 @@ static void udict_inline_mgr_vacuum(struct udict_mgr *mgr)
 {
     struct udict_inline_mgr *inline_mgr = udict_inline_mgr_from_udict_mgr(mgr);
     upool_vacuum(&inline_mgr->udict_pool);
+    upool_vacuum(&inline_mgr->shared_pool);
 }
 
 /** @This processes control commands on a udict_std_mgr.
@@ -647,6 +957,7 @@ static void udict_inline_mgr_free(struct urefcount *urefcount)
 #endif
 
     upool_clean(&inline_mgr->udict_pool);
+    upool_clean(&inline_mgr->shared_pool);
     umem_mgr_release(inline_mgr->umem_mgr);
 
     urefcount_clean(urefcount);
@@ -669,7 +980,7 @@ struct udict_mgr *udict_inline_mgr_alloc(unsigned int udict_pool_depth,
 {
     struct udict_inline_mgr *inline_mgr =
         malloc(sizeof(struct udict_inline_mgr) +
-               upool_sizeof(udict_pool_depth));
+               2 * upool_sizeof(udict_pool_depth));
     if (unlikely(inline_mgr == NULL))
         return NULL;
 
@@ -685,6 +996,13 @@ struct udict_mgr *udict_inline_mgr_alloc(unsigned int udict_pool_depth,
                udict_pool_depth,
                (void *)inline_mgr + sizeof(struct udict_inline_mgr),
                udict_inline_alloc_inner, udict_inline_free_inner);
+    upool_init(&inline_mgr->shared_pool, inline_mgr->mgr.refcount,
+               udict_pool_depth,
+               (void *)inline_mgr + sizeof(struct udict_inline_mgr) +
+               upool_sizeof(udict_pool_depth),
+               udict_inline_shared_alloc_inner, udict_inline_shared_free_inner);
+    upool_cache_init(&inline_mgr->udict_pool);
+    upool_cache_init(&inline_mgr->shared_pool);
     inline_mgr->umem_mgr = umem_mgr;
     umem_mgr_use(umem_mgr);
 
@@ -0,0 +1,459 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short Upipe memory allocator using huge-page arenas
+ */
+
+#include <upipe/ubase.h>
+#include <upipe/urefcount.h>
+#include <upipe/uatomic.h>
+#include <upipe/ulifo.h>
+#include <upipe/umem.h>
+#include <upipe/umem_hugepage.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef UPIPE_HAVE_LINUX_MEMPOLICY_H
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+/** size of a huge page */
+#define UMEM_HUGEPAGE_SIZE (UINT64_C(2) << 20)
+/** unit of allocation in the arena (log2) */
+#define UMEM_HUGEPAGE_UNIT_SHIFT 12
+/** size of the smallest buffer allocated from the arena */
+#define UMEM_HUGEPAGE_POOL0_SIZE (1 << UMEM_HUGEPAGE_UNIT_SHIFT)
+/** maximum number of buffer pools (up to 64 MiB) */
+#define UMEM_HUGEPAGE_MAX_POOLS 15
+/** maximum number of NUMA nodes */
+#define UMEM_HUGEPAGE_MAX_NODES 1024
+
+/** @This defines the private data structures of the huge-page manager. */
+struct umem_hugepage_mgr {
+    /** refcount management structure */
+    struct urefcount urefcount;
+
+    /** common management structure */
+    struct umem_mgr mgr;
+
+    /** arena */
+    uint8_t *arena;
+    /** size of the arena */
+    size_t arena_size;
+    /** true if the arena is backed by explicit huge pages */
+    bool hugetlb;
+    /** NUMA node the arena is bound to, or -1 */
+    int node;
+
+    /** number of units in the arena */
+    uint32_t nb_units;
+    /** first unit of the arena not carved yet */
+    uatomic_uint32_t next_unit;
+    /** number of units in buffers currently allocated */
+    uatomic_uint32_t busy_units;
+    /** number of allocations served by malloc() */
+    uatomic_uint32_t fallbacks;
+
+    /** number of pools of buffers */
+    unsigned int nb_pools;
+    /** number of buffers carved for each pool */
+    uatomic_uint32_t carved[UMEM_HUGEPAGE_MAX_POOLS];
+    /** maximum number of buffers carved for each pool */
+    uint32_t depths[UMEM_HUGEPAGE_MAX_POOLS];
+    /** buffer pools */
+    struct ulifo pools[UMEM_HUGEPAGE_MAX_POOLS];
+};
+
+UBASE_FROM_TO(umem_hugepage_mgr, umem_mgr, umem_mgr, mgr)
+UBASE_FROM_TO(umem_hugepage_mgr, urefcount, urefcount, urefcount)
+
+/** @internal @This returns the nearest bigger size to allocate for a umem of
+ * the given size to fit into and returns the index of the appropriate pool.
+ *
+ * @param hugepage_mgr description structure of the umem mgr
+ * @param wanted desired size of the umem
+ * @param real_p reference written with the actual size of the future buffer
+ * @return index of the pool in which to find appropriate buffers, or
+ * nb_pools if the buffer is not allocated from the arena
+ */
+static unsigned int umem_hugepage_find(struct umem_hugepage_mgr *hugepage_mgr,
+                                       size_t wanted, size_t *real_p)
+{
+    unsigned int pool = hugepage_mgr->nb_pools;
+    if (wanted >= UMEM_HUGEPAGE_POOL0_SIZE / 2)
+        for (pool = 0; pool < hugepage_mgr->nb_pools; pool++)
+            if (wanted <= ((size_t)UMEM_HUGEPAGE_POOL0_SIZE << pool))
+                break;
+    if (likely(real_p != NULL))
+        *real_p = pool < hugepage_mgr->nb_pools ?
+                  (size_t)UMEM_HUGEPAGE_POOL0_SIZE << pool : wanted;
+    return pool;
+}
+
+/** @internal @This carves a new buffer out of the arena.
+ *
+ * @param hugepage_mgr description structure of the umem mgr
+ * @param pool index of the pool of the buffer
+ * @return pointer to the buffer, or NULL if the arena is exhausted
+ */
+static uint8_t *umem_hugepage_carve(struct umem_hugepage_mgr *hugepage_mgr,
+                                    unsigned int pool)
+{
+    /* the pool must be able to hold all the carved buffers */
+    if (uatomic_fetch_add(&hugepage_mgr->carved[pool], 1) >=
+            hugepage_mgr->depths[pool]) {
+        uatomic_fetch_sub(&hugepage_mgr->carved[pool], 1);
+        return NULL;
+    }
+
+    uint32_t units = UINT32_C(1) << pool;
+    uint32_t next = uatomic_load(&hugepage_mgr->next_unit);
+    do {
+        if (next + units > hugepage_mgr->nb_units) {
+            uatomic_fetch_sub(&hugepage_mgr->carved[pool], 1);
+            return NULL;
+        }
+    } while (!uatomic_compare_exchange(&hugepage_mgr->next_unit, &next,
+                                       next + units));
+    return hugepage_mgr->arena + ((size_t)next << UMEM_HUGEPAGE_UNIT_SHIFT);
+}
+
+/** @internal @This checks if a buffer belongs to the arena.
+ *
+ * @param hugepage_mgr description structure of the umem mgr
+ * @param buffer pointer to buffer
+ * @return true if the buffer was carved out of the arena
+ */
+static inline bool umem_hugepage_in_arena(
+        struct umem_hugepage_mgr *hugepage_mgr, uint8_t *buffer)
+{
+    return buffer >= hugepage_mgr->arena &&
+           buffer < hugepage_mgr->arena + hugepage_mgr->arena_size;
+}
+
+/** @This allocates a new umem buffer space.
+ *
+ * @param mgr management structure
+ * @param umem caller-allocated structure, filled in with the required pointer
+ * and size (previous content is discarded)
+ * @param size requested size of the umem
+ * @return false if the memory couldn't be allocated (umem left untouched)
+ */
+static bool umem_hugepage_alloc(struct umem_mgr *mgr, struct umem *umem,
+                                size_t size)
+{
+    struct umem_hugepage_mgr *hugepage_mgr =
+        umem_hugepage_mgr_from_umem_mgr(mgr);
+    size_t real_size;
+    unsigned int pool = umem_hugepage_find(hugepage_mgr, size, &real_size);
+    uint8_t *buffer = NULL;
+
+    if (likely(pool < hugepage_mgr->nb_pools)) {
+        buffer = ulifo_pop(&hugepage_mgr->pools[pool], uint8_t *);
+        if (buffer == NULL)
+            buffer = umem_hugepage_carve(hugepage_mgr, pool);
+        if (likely(buffer != NULL))
+            uatomic_fetch_add(&hugepage_mgr->busy_units, UINT32_C(1) << pool);
+    }
+    if (unlikely(buffer == NULL)) {
+        buffer = malloc(real_size);
+        if (unlikely(buffer == NULL))
+            return false;
+        uatomic_fetch_add(&hugepage_mgr->fallbacks, 1);
+    }
+
+    umem->buffer = buffer;
+    umem->size = size;
+    umem->real_size = real_size;
+    umem->mgr = mgr;
+    return true;
+}
+
+/** @This frees a umem.
+ *
+ * @param umem caller-allocated structure, previously successfully passed to
+ * @ref umem_alloc
+ */
+static void umem_hugepage_free(struct umem *umem)
+{
+    struct umem_hugepage_mgr *hugepage_mgr =
+        umem_hugepage_mgr_from_umem_mgr(umem->mgr);
+
+    if (umem_hugepage_in_arena(hugepage_mgr, umem->buffer)) {
+        unsigned int pool = umem_hugepage_find(hugepage_mgr, umem->real_size,
+                                               NULL);
+        assert(pool < hugepage_mgr->nb_pools);
+        uatomic_fetch_sub(&hugepage_mgr->busy_units, UINT32_C(1) << pool);
+        /* cannot fail as the pool may hold all the carved buffers */
+        ulifo_push(&hugepage_mgr->pools[pool], umem->buffer);
+    } else
+        free(umem->buffer);
+    umem->buffer = NULL;
+    umem->mgr = NULL;
+}
+
+/** @This resizes a umem. We do not realloc() the buffer because it would
+ * move buffers out of the arena.
+ *
+ * @param umem caller-allocated structure, previously successfully passed to
+ * @ref umem_alloc, and filled in with the new pointer and size
+ * @param new_size new requested size of the umem
+ * @return false if the memory couldn't be allocated (umem left untouched)
+ */
+static bool umem_hugepage_realloc(struct umem *umem, size_t new_size)
+{
+    if (likely(new_size <= umem->real_size)) {
+        umem->size = new_size;
+        return true;
+    }
+
+    struct umem new_umem;
+    if (!umem_hugepage_alloc(umem->mgr, &new_umem, new_size))
+        return false;
+    memcpy(new_umem.buffer, umem->buffer, umem->size);
+    umem_hugepage_free(umem);
+    *umem = new_umem;
+    return true;
+}
+
+/** @internal @This returns the usage of the arena.
+ *
+ * @param mgr pointer to umem manager
+ * @param usage_p filled in with the usage of the arena
+ * @return an error code
+ */
+static int umem_hugepage_mgr_get_usage_internal(struct umem_mgr *mgr,
+        struct umem_hugepage_usage *usage_p)
+{
+    struct umem_hugepage_mgr *hugepage_mgr =
+        umem_hugepage_mgr_from_umem_mgr(mgr);
+    usage_p->arena_size = hugepage_mgr->arena_size;
+    usage_p->arena_used = (size_t)uatomic_load(&hugepage_mgr->next_unit) <<
+                          UMEM_HUGEPAGE_UNIT_SHIFT;
+    usage_p->arena_busy = (size_t)uatomic_load(&hugepage_mgr->busy_units) <<
+                          UMEM_HUGEPAGE_UNIT_SHIFT;
+    usage_p->fallbacks = uatomic_load(&hugepage_mgr->fallbacks);
+    usage_p->hugetlb = hugepage_mgr->hugetlb;
+    usage_p->node = hugepage_mgr->node;
+    return UBASE_ERR_NONE;
+}
+
+/** @This processes control commands on a umem_hugepage_mgr.
+ *
+ * @param mgr pointer to umem manager
+ * @param command type of command to process
+ * @param args arguments of the command
+ * @return an error code
+ */
+static int umem_hugepage_mgr_control(struct umem_mgr *mgr,
+                                     int command, va_list args)
+{
+    switch (command) {
+        case UMEM_HUGEPAGE_MGR_GET_USAGE: {
+            UBASE_SIGNATURE_CHECK(args, UMEM_HUGEPAGE_SIGNATURE)
+            struct umem_hugepage_usage *usage_p =
+                va_arg(args, struct umem_hugepage_usage *);
+            return umem_hugepage_mgr_get_usage_internal(mgr, usage_p);
+        }
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** @This frees a umem manager.
+ *
+ * @param urefcount pointer to urefcount
+ */
+static void umem_hugepage_mgr_free(struct urefcount *urefcount)
+{
+    struct umem_hugepage_mgr *hugepage_mgr =
+        umem_hugepage_mgr_from_urefcount(urefcount);
+
+    for (unsigned int i = 0; i < hugepage_mgr->nb_pools; i++) {
+        /* buffers of the arena are released with the arena */
+        while (ulifo_pop(&hugepage_mgr->pools[i], uint8_t *) != NULL);
+        ulifo_clean(&hugepage_mgr->pools[i]);
+        uatomic_clean(&hugepage_mgr->carved[i]);
+    }
+    munmap(hugepage_mgr->arena, hugepage_mgr->arena_size);
+
+    uatomic_clean(&hugepage_mgr->next_unit);
+    uatomic_clean(&hugepage_mgr->busy_units);
+    uatomic_clean(&hugepage_mgr->fallbacks);
+    urefcount_clean(urefcount);
+    free(hugepage_mgr);
+}
+
+/** @internal @This maps the arena, with huge pages if possible.
+ *
+ * @param size size of the arena, multiple of the huge page size
+ * @param hugetlb_p filled in with true if explicit huge pages are used
+ * @return pointer to the arena, or NULL in case of error
+ */
+static uint8_t *umem_hugepage_map(size_t size, bool *hugetlb_p)
+{
+    void *arena;
+#ifdef MAP_HUGETLB
+    arena = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (arena != MAP_FAILED) {
+        *hugetlb_p = true;
+        return arena;
+    }
+#endif
+    *hugetlb_p = false;
+
+    /* align on a huge page so that transparent huge pages may be used */
+    arena = mmap(NULL, size + UMEM_HUGEPAGE_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (unlikely(arena == MAP_FAILED))
+        return NULL;
+    uintptr_t start = (uintptr_t)arena;
+    uintptr_t aligned = (start + UMEM_HUGEPAGE_SIZE - 1) &
+                        ~(uintptr_t)(UMEM_HUGEPAGE_SIZE - 1);
+    if (aligned > start)
+        munmap(arena, aligned - start);
+    munmap((uint8_t *)aligned + size, start + UMEM_HUGEPAGE_SIZE - aligned);
+#ifdef MADV_HUGEPAGE
+    madvise((void *)aligned, size, MADV_HUGEPAGE);
+#endif
+    return (uint8_t *)aligned;
+}
+
+/** @internal @This binds the arena to a NUMA node.
+ *
+ * @param arena pointer to the arena
+ * @param size size of the arena
+ * @param node_p NUMA node to bind to, or -1 for the node of the calling
+ * thread, overwritten with the actual node or -1 if the arena is not bound
+ */
+static void umem_hugepage_bind(uint8_t *arena, size_t size, int *node_p)
+{
+#if defined(UPIPE_HAVE_LINUX_MEMPOLICY_H) && defined(SYS_mbind)
+    if (*node_p < 0) {
+#ifdef SYS_getcpu
+        unsigned int cpu, node;
+        if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+            *node_p = node;
+#endif
+    }
+
+    if (*node_p >= 0 && *node_p < UMEM_HUGEPAGE_MAX_NODES) {
+        unsigned long nodemask[UMEM_HUGEPAGE_MAX_NODES /
+                               (8 * sizeof(unsigned long))];
+        memset(nodemask, 0, sizeof(nodemask));
+        nodemask[*node_p / (8 * sizeof(unsigned long))] |=
+            1UL << (*node_p % (8 * sizeof(unsigned long)));
+        /* only prefer the node, as explicit huge pages are not reserved per
+         * node */
+        if (syscall(SYS_mbind, arena, size, MPOL_PREFERRED, nodemask,
+                    UMEM_HUGEPAGE_MAX_NODES, 0) == 0)
+            return;
+    }
+#endif
+    *node_p = -1;
+}
+
+/** @This allocates a new instance of the huge-page umem manager. If huge
+ * pages are not available, the arena is allocated with regular pages.
+ *
+ * @param arena_size size of the arena to reserve, rounded up to a multiple of
+ * 2 MB
+ * @param node NUMA node to bind the arena to, or -1 for the node of the
+ * calling thread
+ * @return pointer to manager, or NULL in case of error
+ */
+struct umem_mgr *umem_hugepage_mgr_alloc(size_t arena_size, int node)
+{
+    arena_size = (arena_size + UMEM_HUGEPAGE_SIZE - 1) &
+                 ~(size_t)(UMEM_HUGEPAGE_SIZE - 1);
+    if (unlikely(!arena_size ||
+                 (arena_size >> UMEM_HUGEPAGE_UNIT_SHIFT) > UINT32_MAX))
+        return NULL;
+    uint32_t nb_units = arena_size >> UMEM_HUGEPAGE_UNIT_SHIFT;
+
+    unsigned int nb_pools = 0;
+    uint32_t depths[UMEM_HUGEPAGE_MAX_POOLS];
+    size_t alloc_size = sizeof(struct umem_hugepage_mgr);
+    while (nb_pools < UMEM_HUGEPAGE_MAX_POOLS && (nb_units >> nb_pools)) {
+        depths[nb_pools] = nb_units >> nb_pools;
+        if (depths[nb_pools] > UINT16_MAX)
+            depths[nb_pools] = UINT16_MAX;
+        alloc_size += ulifo_sizeof(depths[nb_pools]);
+        nb_pools++;
+    }
+
+    struct umem_hugepage_mgr *hugepage_mgr = malloc(alloc_size);
+    if (unlikely(hugepage_mgr == NULL))
+        return NULL;
+
+    hugepage_mgr->arena = umem_hugepage_map(arena_size, &hugepage_mgr->hugetlb);
+    if (unlikely(hugepage_mgr->arena == NULL)) {
+        free(hugepage_mgr);
+        return NULL;
+    }
+    hugepage_mgr->arena_size = arena_size;
+    hugepage_mgr->node = node;
+    umem_hugepage_bind(hugepage_mgr->arena, arena_size, &hugepage_mgr->node);
+
+    /* fault the arena in now, on the selected node */
+    long page_size = hugepage_mgr->hugetlb ? UMEM_HUGEPAGE_SIZE :
+                     sysconf(_SC_PAGESIZE);
+    if (page_size <= 0)
+        page_size = UMEM_HUGEPAGE_POOL0_SIZE;
+    for (size_t offset = 0; offset < arena_size; offset += page_size)
+        hugepage_mgr->arena[offset] = 0;
+
+    hugepage_mgr->nb_units = nb_units;
+    uatomic_init(&hugepage_mgr->next_unit, 0);
+    uatomic_init(&hugepage_mgr->busy_units, 0);
+    uatomic_init(&hugepage_mgr->fallbacks, 0);
+    hugepage_mgr->nb_pools = nb_pools;
+
+    void *extra = (void *)hugepage_mgr + sizeof(struct umem_hugepage_mgr);
+    for (unsigned int i = 0; i < nb_pools; i++) {
+        hugepage_mgr->depths[i] = depths[i];
+        uatomic_init(&hugepage_mgr->carved[i], 0);
+        ulifo_init(&hugepage_mgr->pools[i], depths[i], extra);
+        extra += ulifo_sizeof(depths[i]);
+    }
+
+    urefcount_init(umem_hugepage_mgr_to_urefcount(hugepage_mgr),
+                   umem_hugepage_mgr_free);
+    hugepage_mgr->mgr.refcount = umem_hugepage_mgr_to_urefcount(hugepage_mgr);
+    hugepage_mgr->mgr.umem_alloc = umem_hugepage_alloc;
+    hugepage_mgr->mgr.umem_realloc = umem_hugepage_realloc;
+    hugepage_mgr->mgr.umem_free = umem_hugepage_free;
+    hugepage_mgr->mgr.umem_mgr_vacuum = NULL;
+    hugepage_mgr->mgr.umem_mgr_control = umem_hugepage_mgr_control;
+
+    return umem_hugepage_mgr_to_umem_mgr(hugepage_mgr);
+}
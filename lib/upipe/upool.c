@@ -0,0 +1,538 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short Upipe per-thread caches of upool elements
+ *
+ * Each thread keeps two magazines of free elements per pool: allocations and
+ * releases are served locally while possible, and full or empty magazines
+ * are exchanged with the depot of the pool otherwise.
+ */
+
+#include <upipe/ubase.h>
+#include <upipe/uatomic.h>
+#include <upipe/ulifo.h>
+#include <upipe/upool.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/** number of entries of the per-thread table of recently used caches */
+#define UPOOL_CACHE_HINTS 64
+
+/** @internal @This is a magazine of free elements. */
+struct upool_magazine {
+    /** number of elements in the magazine */
+    unsigned int count;
+    /** elements */
+    void *objs[UPOOL_MAGAZINE_SIZE];
+};
+
+/** @internal @This is the cache of a thread for a pool. */
+struct upool_cache {
+    /** next cache of the pool */
+    struct upool_cache *next;
+    /** next cache of the thread */
+    struct upool_cache *thread_next;
+    /** identifier of the depot of the cache */
+    uint32_t id;
+    /** depot of the cache, or NULL once the pool is cleaned (protected by
+     * upool_lock) */
+    struct upool_depot *depot;
+    /** true if the thread exited (protected by upool_lock) */
+    bool orphan;
+    /** magazine in use */
+    struct upool_magazine *loaded;
+    /** previously used magazine, either full or empty */
+    struct upool_magazine *previous;
+    /** counters */
+    struct upool_stats stats;
+};
+
+/** @internal @This is the depot of magazines of a pool. */
+struct upool_depot {
+    /** pointer to the pool */
+    struct upool *upool;
+    /** unique identifier of the depot */
+    uint32_t id;
+    /** list of caches of all threads */
+    uatomic_ptr_t caches;
+    /** full magazines */
+    struct ulifo full;
+    /** empty magazines */
+    struct ulifo empty;
+};
+
+/** @internal @This is an entry of the per-thread table of caches. */
+struct upool_tls {
+    /** identifier of the depot of the cache, or 0 */
+    uint32_t id;
+    /** cache of the thread */
+    struct upool_cache *cache;
+};
+
+/** last allocated depot identifier */
+static uatomic_uint32_t upool_last_id;
+/** per-thread table of recently used caches, indexed by depot identifier */
+static __thread struct upool_tls upool_tls[UPOOL_CACHE_HINTS];
+/** per-thread list of caches */
+static __thread struct upool_cache *upool_thread_caches;
+/** key used to release the caches of a thread when it exits */
+static pthread_key_t upool_key;
+/** makes sure upool_key is created once */
+static pthread_once_t upool_key_once = PTHREAD_ONCE_INIT;
+/** serializes the exit of threads, the creation of caches and the cleaning
+ * of pools */
+static pthread_mutex_t upool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void upool_thread_exit(void *caches);
+
+/** @internal @This creates the key releasing the caches of exiting threads.
+ */
+static void upool_key_init(void)
+{
+    pthread_key_create(&upool_key, upool_thread_exit);
+}
+
+/** @This enables per-thread caches on a upool. It must be called after
+ * @ref upool_init and before any allocation. Besides the elements kept in
+ * the shared LIFO and in the depot, each thread using the pool may keep up
+ * to 2 * @ref UPOOL_MAGAZINE_SIZE unused elements, which are handed back
+ * to the depot when the thread exits, and released by @ref upool_clean.
+ *
+ * @param upool pointer to a upool structure
+ * @return an error code (the pool keeps working without caches in case of
+ * error)
+ */
+int upool_cache_init(struct upool *upool)
+{
+    if (unlikely(upool->depot != NULL))
+        return UBASE_ERR_BUSY;
+
+    /* the depot holds at most as many elements as the pool */
+    unsigned int nb_magazines = upool->lifo.uring.length / UPOOL_MAGAZINE_SIZE;
+    if (nb_magazines < 2)
+        return UBASE_ERR_INVALID;
+
+    if (unlikely(pthread_once(&upool_key_once, upool_key_init)))
+        return UBASE_ERR_EXTERNAL;
+
+    struct upool_depot *depot = malloc(sizeof(struct upool_depot) +
+                                       2 * ulifo_sizeof(nb_magazines));
+    if (unlikely(depot == NULL))
+        return UBASE_ERR_ALLOC;
+
+    depot->upool = upool;
+    do
+        depot->id = uatomic_fetch_add(&upool_last_id, 1) + 1;
+    while (unlikely(depot->id == 0));
+    uatomic_ptr_init(&depot->caches, NULL);
+    ulifo_init(&depot->full, nb_magazines, (uint8_t *)(depot + 1));
+    ulifo_init(&depot->empty, nb_magazines,
+               (uint8_t *)(depot + 1) + ulifo_sizeof(nb_magazines));
+    upool->depot = depot;
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This allocates an empty magazine.
+ *
+ * @param depot pointer to depot
+ * @return pointer to magazine, or NULL in case of allocation error
+ */
+static struct upool_magazine *upool_magazine_alloc(struct upool_depot *depot)
+{
+    struct upool_magazine *magazine =
+        ulifo_pop(&depot->empty, struct upool_magazine *);
+    if (magazine == NULL) {
+        magazine = malloc(sizeof(struct upool_magazine));
+        if (unlikely(magazine == NULL))
+            return NULL;
+        magazine->count = 0;
+    }
+    return magazine;
+}
+
+/** @internal @This releases an empty magazine.
+ *
+ * @param depot pointer to depot
+ * @param magazine pointer to magazine
+ */
+static void upool_magazine_free(struct upool_depot *depot,
+                                struct upool_magazine *magazine)
+{
+    if (!ulifo_push(&depot->empty, magazine))
+        free(magazine);
+}
+
+/** @internal @This frees all the elements of a magazine.
+ *
+ * @param upool pointer to a upool structure
+ * @param magazine pointer to magazine
+ */
+static void upool_magazine_vacuum(struct upool *upool,
+                                  struct upool_magazine *magazine)
+{
+    for (unsigned int i = 0; i < magazine->count; i++)
+        upool->free_cb(upool, magazine->objs[i]);
+    magazine->count = 0;
+}
+
+/** @internal @This returns the cache of the current thread for a depot,
+ * without creating it.
+ *
+ * @param id identifier of the depot
+ * @return pointer to cache, or NULL if the thread has no cache yet
+ */
+static struct upool_cache *upool_cache_find(uint32_t id)
+{
+    struct upool_tls *tls = &upool_tls[id % UPOOL_CACHE_HINTS];
+    if (likely(tls->id == id))
+        return tls->cache;
+
+    struct upool_cache *cache;
+    for (cache = upool_thread_caches; cache != NULL;
+         cache = cache->thread_next)
+        if (cache->id == id) {
+            tls->id = id;
+            tls->cache = cache;
+            break;
+        }
+    return cache;
+}
+
+/** @internal @This removes a cache from the list of the current thread.
+ * upool_lock must be held.
+ *
+ * @param cache pointer to cache
+ */
+static void upool_cache_unlink(struct upool_cache *cache)
+{
+    struct upool_cache **cache_p = &upool_thread_caches;
+    while (*cache_p != cache)
+        cache_p = &(*cache_p)->thread_next;
+    *cache_p = cache->thread_next;
+
+    struct upool_tls *tls = &upool_tls[cache->id % UPOOL_CACHE_HINTS];
+    if (tls->id == cache->id)
+        tls->id = 0;
+}
+
+/** @internal @This frees the caches of the current thread whose pool was
+ * cleaned. upool_lock must be held.
+ */
+static void upool_cache_prune(void)
+{
+    struct upool_cache *cache = upool_thread_caches;
+    while (cache != NULL) {
+        struct upool_cache *next = cache->thread_next;
+        if (cache->depot == NULL) {
+            upool_cache_unlink(cache);
+            free(cache);
+        }
+        cache = next;
+    }
+}
+
+/** @internal @This returns the cache of the current thread, and creates it
+ * if needed. The cache of an exited thread is reused if possible, so that
+ * the number of caches of a pool is bounded by the number of threads
+ * running at the same time.
+ *
+ * @param depot pointer to depot
+ * @return pointer to cache, or NULL in case of allocation error
+ */
+static struct upool_cache *upool_cache_get(struct upool_depot *depot)
+{
+    struct upool_cache *cache = upool_cache_find(depot->id);
+    if (likely(cache != NULL))
+        return cache;
+
+    struct upool_magazine *loaded = upool_magazine_alloc(depot);
+    struct upool_magazine *previous = upool_magazine_alloc(depot);
+    if (unlikely(loaded == NULL || previous == NULL)) {
+        free(loaded);
+        free(previous);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&upool_lock);
+    /* the key only needs to be non-NULL for upool_thread_exit to be called */
+    if (unlikely(pthread_setspecific(upool_key, &upool_thread_caches)))
+        goto upool_cache_get_err;
+
+    upool_cache_prune();
+    for (cache = uatomic_ptr_load(&depot->caches); cache != NULL;
+         cache = cache->next)
+        if (cache->orphan)
+            break;
+
+    if (cache == NULL) {
+        cache = malloc(sizeof(struct upool_cache));
+        if (unlikely(cache == NULL))
+            goto upool_cache_get_err;
+        cache->id = depot->id;
+        cache->depot = depot;
+        memset(&cache->stats, 0, sizeof(cache->stats));
+
+        void *head = uatomic_ptr_load(&depot->caches);
+        do
+            cache->next = head;
+        while (unlikely(!uatomic_ptr_compare_exchange(&depot->caches, &head,
+                                                      cache)));
+    }
+
+    cache->orphan = false;
+    cache->loaded = loaded;
+    cache->previous = previous;
+    cache->thread_next = upool_thread_caches;
+    upool_thread_caches = cache;
+    pthread_mutex_unlock(&upool_lock);
+
+    struct upool_tls *tls = &upool_tls[depot->id % UPOOL_CACHE_HINTS];
+    tls->id = depot->id;
+    tls->cache = cache;
+    return cache;
+
+upool_cache_get_err:
+    pthread_mutex_unlock(&upool_lock);
+    free(loaded);
+    free(previous);
+    return NULL;
+}
+
+/** @internal @This hands a magazine of an exiting thread back to the depot.
+ *
+ * @param depot pointer to depot
+ * @param magazine pointer to magazine
+ */
+static void upool_magazine_return(struct upool_depot *depot,
+                                  struct upool_magazine *magazine)
+{
+    if (!magazine->count) {
+        upool_magazine_free(depot, magazine);
+        return;
+    }
+    if (likely(ulifo_push(&depot->full, magazine)))
+        return;
+
+    struct upool *upool = depot->upool;
+    for (unsigned int i = 0; i < magazine->count; i++) {
+        void *spilled = magazine->objs[i];
+        if (unlikely(!ulifo_push(&upool->lifo, spilled)))
+            upool->free_cb(upool, spilled);
+    }
+    magazine->count = 0;
+    upool_magazine_free(depot, magazine);
+}
+
+/** @internal @This is called when a thread using caches exits, and hands
+ * its magazines back to the depots, or frees the caches of cleaned pools.
+ *
+ * @param unused value of upool_key
+ */
+static void upool_thread_exit(void *unused)
+{
+    pthread_mutex_lock(&upool_lock);
+    struct upool_cache *cache = upool_thread_caches;
+    while (cache != NULL) {
+        struct upool_cache *next = cache->thread_next;
+        if (cache->depot != NULL) {
+            upool_magazine_return(cache->depot, cache->loaded);
+            upool_magazine_return(cache->depot, cache->previous);
+            cache->loaded = cache->previous = NULL;
+            cache->orphan = true;
+        } else
+            free(cache);
+        cache = next;
+    }
+    upool_thread_caches = NULL;
+    pthread_mutex_unlock(&upool_lock);
+}
+
+/** @internal @This allocates an element from the cache of the current
+ * thread.
+ *
+ * @param upool pointer to a upool structure
+ * @return allocated element, or NULL if the cache and depot are empty
+ */
+void *upool_cache_pop(struct upool *upool)
+{
+    struct upool_depot *depot = upool->depot;
+    struct upool_cache *cache = upool_cache_get(depot);
+    if (unlikely(cache == NULL))
+        return NULL;
+
+    if (unlikely(!cache->loaded->count)) {
+        struct upool_magazine *magazine = cache->previous;
+        if (!magazine->count) {
+            /* both magazines are empty */
+            magazine = ulifo_pop(&depot->full, struct upool_magazine *);
+            if (magazine == NULL)
+                return NULL;
+            cache->stats.depot_allocs += magazine->count;
+            upool_magazine_free(depot, cache->previous);
+        } else
+            cache->stats.local_hits++;
+        cache->previous = cache->loaded;
+        cache->loaded = magazine;
+    } else
+        cache->stats.local_hits++;
+
+    return cache->loaded->objs[--cache->loaded->count];
+}
+
+/** @internal @This returns an element to the cache of the current thread.
+ *
+ * @param upool pointer to a upool structure
+ * @param obj element to free
+ * @return false if the element couldn't be cached
+ */
+bool upool_cache_push(struct upool *upool, void *obj)
+{
+    struct upool_depot *depot = upool->depot;
+    struct upool_cache *cache = upool_cache_get(depot);
+    if (unlikely(cache == NULL))
+        return false;
+
+    if (unlikely(cache->loaded->count >= UPOOL_MAGAZINE_SIZE)) {
+        struct upool_magazine *magazine = cache->previous;
+        if (magazine->count) {
+            /* both magazines are full */
+            magazine = upool_magazine_alloc(depot);
+            if (unlikely(magazine == NULL))
+                return false;
+            unsigned int count = cache->previous->count;
+            if (likely(ulifo_push(&depot->full, cache->previous)))
+                cache->stats.remote_frees += count;
+            else {
+                for (unsigned int i = 0; i < count; i++) {
+                    void *spilled = cache->previous->objs[i];
+                    if (unlikely(!ulifo_push(&upool->lifo, spilled)))
+                        upool->free_cb(upool, spilled);
+                }
+                cache->previous->count = 0;
+                cache->stats.spills += count;
+                upool_magazine_free(depot, cache->previous);
+            }
+        }
+        cache->previous = cache->loaded;
+        cache->loaded = magazine;
+    }
+
+    cache->stats.local_hits++;
+    cache->loaded->objs[cache->loaded->count++] = obj;
+    return true;
+}
+
+/** @internal @This releases all the elements kept in the depot and in the
+ * cache of the current thread.
+ *
+ * @param upool pointer to a upool structure
+ */
+void upool_cache_vacuum(struct upool *upool)
+{
+    struct upool_depot *depot = upool->depot;
+    struct upool_magazine *magazine;
+    while ((magazine = ulifo_pop(&depot->full,
+                                 struct upool_magazine *)) != NULL) {
+        upool_magazine_vacuum(upool, magazine);
+        free(magazine);
+    }
+    while ((magazine = ulifo_pop(&depot->empty,
+                                 struct upool_magazine *)) != NULL)
+        free(magazine);
+
+    struct upool_cache *cache = upool_cache_find(depot->id);
+    if (cache != NULL) {
+        upool_magazine_vacuum(upool, cache->loaded);
+        upool_magazine_vacuum(upool, cache->previous);
+    }
+}
+
+/** @internal @This releases all the elements kept in the caches of all
+ * threads, and frees the depot. No other thread may use the pool.
+ *
+ * @param upool pointer to a upool structure
+ */
+void upool_cache_clean(struct upool *upool)
+{
+    struct upool_depot *depot = upool->depot;
+
+    pthread_mutex_lock(&upool_lock);
+    struct upool_cache *own = upool_cache_find(depot->id);
+    if (own != NULL)
+        upool_cache_unlink(own);
+
+    struct upool_cache *cache = uatomic_ptr_load(&depot->caches);
+    while (cache != NULL) {
+        struct upool_cache *next = cache->next;
+        if (cache->loaded != NULL) {
+            upool_magazine_vacuum(upool, cache->loaded);
+            upool_magazine_vacuum(upool, cache->previous);
+            free(cache->loaded);
+            free(cache->previous);
+        }
+        if (cache == own || cache->orphan)
+            free(cache);
+        else
+            /* freed by its thread */
+            cache->depot = NULL;
+        cache = next;
+    }
+    pthread_mutex_unlock(&upool_lock);
+
+    upool_cache_vacuum(upool);
+    ulifo_clean(&depot->full);
+    ulifo_clean(&depot->empty);
+    uatomic_ptr_clean(&depot->caches);
+    free(depot);
+    upool->depot = NULL;
+}
+
+/** @This returns the counters of the per-thread caches of a upool. The
+ * counters of other threads are read without synchronization, so they may
+ * be slightly outdated.
+ *
+ * @param upool pointer to a upool structure
+ * @param stats filled in with the counters
+ * @return an error code
+ */
+int upool_get_stats(struct upool *upool, struct upool_stats *stats)
+{
+    if (upool->depot == NULL)
+        return UBASE_ERR_INVALID;
+
+    memset(stats, 0, sizeof(*stats));
+    struct upool_cache *cache = uatomic_ptr_load(&upool->depot->caches);
+    while (cache != NULL) {
+        stats->local_hits += cache->stats.local_hits;
+        stats->depot_allocs += cache->stats.depot_allocs;
+        stats->remote_frees += cache->stats.remote_frees;
+        stats->spills += cache->stats.spills;
+        cache = cache->next;
+    }
+    return UBASE_ERR_NONE;
+}
@@ -30,11 +30,22 @@
 #include <upipe/ubase.h>
 #include <upipe/ulist.h>
 #include <upipe/upool.h>
+#include <upipe/uclock.h>
+#include <upipe/uclock_std.h>
 #include <upipe/upump_common.h>
 #include <upipe/upump_blocker.h>
 
 #include <stdlib.h>
 
+/** number of bits of the tick handled by each level of the timer wheel */
+#define UPUMP_WHEEL_BITS 6
+/** number of slots per level of the timer wheel */
+#define UPUMP_WHEEL_SIZE (1 << UPUMP_WHEEL_BITS)
+/** mask of the slot index */
+#define UPUMP_WHEEL_MASK (UPUMP_WHEEL_SIZE - 1)
+/** number of levels of the timer wheel */
+#define UPUMP_WHEEL_LEVELS 4
+
 /** @This stores extra opaque structures for blockers.
  */
 struct upump_blocker_common {
@@ -48,6 +59,351 @@ struct upump_blocker_common {
 UBASE_FROM_TO(upump_blocker_common, upump_blocker, upump_blocker, blocker)
 UBASE_FROM_TO(upump_blocker_common, uchain, uchain, uchain)
 
+/** @This stores a hierarchical timer wheel. Timers are sorted in slots of
+ * @ref UPUMP_WHEEL_SIZE ticks per level, each level covering
+ * @ref UPUMP_WHEEL_SIZE times the range of the level below, and are moved
+ * down a level when the wheel reaches the slot they are in. The wheel is
+ * driven by a single one-shot timer of the event loop, armed for the next
+ * occupied slot, so that idle ticks do not wake up the loop.
+ */
+struct upump_common_wheel {
+    /** pointer to the manager */
+    struct upump_common_mgr *common_mgr;
+    /** clock used to date timers */
+    struct uclock *uclock;
+    /** resolution of the wheel, in 27 MHz ticks */
+    uint64_t tick;
+    /** true if new timers are handled by the wheel */
+    bool enabled;
+
+    /** current tick of the wheel */
+    uint64_t now;
+    /** number of armed timers */
+    unsigned int count;
+    /** number of armed blocking timers */
+    unsigned int blocking;
+    /** true while the wheel is dispatching expired timers */
+    bool dispatching;
+
+    /** timer of the event loop driving the wheel */
+    struct upump *upump;
+    /** true if the timer of the event loop is blocking */
+    bool upump_status;
+    /** tick at which the timer of the event loop triggers, or UINT64_MAX */
+    uint64_t deadline;
+
+    /** timers beyond the range of the highest level */
+    struct uchain overflow;
+    /** slots of timers */
+    struct uchain slots[UPUMP_WHEEL_LEVELS][UPUMP_WHEEL_SIZE];
+};
+
+UBASE_FROM_TO(upump_common, uchain, wheel_uchain, wheel_uchain)
+
+/** @internal @This returns the current tick of the clock of the wheel.
+ *
+ * @param wheel pointer to the timer wheel
+ * @return current tick
+ */
+static uint64_t upump_common_wheel_clock(struct upump_common_wheel *wheel)
+{
+    uint64_t now = uclock_now(wheel->uclock) / wheel->tick;
+    return now > wheel->now ? now : wheel->now;
+}
+
+/** @internal @This inserts an armed timer into the slot matching its
+ * expiry.
+ *
+ * @param wheel pointer to the timer wheel
+ * @param common pointer to the common structure of the timer
+ */
+static void upump_common_wheel_insert(struct upump_common_wheel *wheel,
+                                      struct upump_common *common)
+{
+    uint64_t expiry = common->wheel_expiry;
+    unsigned int level = 0;
+    /* the timer goes in the lowest level where all higher digits of its
+     * expiry are those of the current tick */
+    while (level < UPUMP_WHEEL_LEVELS &&
+           (expiry >> (UPUMP_WHEEL_BITS * (level + 1))) !=
+           (wheel->now >> (UPUMP_WHEEL_BITS * (level + 1))))
+        level++;
+
+    struct uchain *list;
+    if (level == UPUMP_WHEEL_LEVELS)
+        list = &wheel->overflow;
+    else
+        list = &wheel->slots[level][(expiry >> (UPUMP_WHEEL_BITS * level)) &
+                                    UPUMP_WHEEL_MASK];
+    ulist_add(list, upump_common_to_wheel_uchain(common));
+}
+
+/** @internal @This moves down all timers of a slot.
+ *
+ * @param wheel pointer to the timer wheel
+ * @param list slot to empty
+ */
+static void upump_common_wheel_cascade(struct upump_common_wheel *wheel,
+                                       struct uchain *list)
+{
+    struct uchain tmp;
+    struct uchain *uchain;
+    ulist_init(&tmp);
+    while ((uchain = ulist_pop(list)) != NULL)
+        ulist_add(&tmp, uchain);
+    while ((uchain = ulist_pop(&tmp)) != NULL)
+        upump_common_wheel_insert(wheel,
+                                  upump_common_from_wheel_uchain(uchain));
+}
+
+/** @internal @This returns the next tick at which the wheel has work to
+ * do, either timers expiring or a slot to move down.
+ *
+ * @param wheel pointer to the timer wheel
+ * @return next tick, or UINT64_MAX if no timer is armed
+ */
+static uint64_t upump_common_wheel_next(struct upump_common_wheel *wheel)
+{
+    uint64_t now = wheel->now;
+    for (unsigned int level = 0; level < UPUMP_WHEEL_LEVELS; level++) {
+        unsigned int shift = UPUMP_WHEEL_BITS * level;
+        /* slots at or before the current one were moved down */
+        for (unsigned int i = ((now >> shift) & UPUMP_WHEEL_MASK) + 1;
+             i < UPUMP_WHEEL_SIZE; i++)
+            if (!ulist_empty(&wheel->slots[level][i]))
+                return ((now >> (shift + UPUMP_WHEEL_BITS)) <<
+                        (shift + UPUMP_WHEEL_BITS)) | ((uint64_t)i << shift);
+    }
+    if (!ulist_empty(&wheel->overflow))
+        return ((now >> (UPUMP_WHEEL_BITS * UPUMP_WHEEL_LEVELS)) + 1) <<
+               (UPUMP_WHEEL_BITS * UPUMP_WHEEL_LEVELS);
+    return UINT64_MAX;
+}
+
+/** @hidden */
+static void upump_common_wheel_update(struct upump_common_wheel *wheel);
+
+/** @internal @This frees the timer of the event loop driving the wheel. The
+ * timer does not hold a reference to the manager, so one is taken for the
+ * release done by the pump.
+ *
+ * @param wheel pointer to the timer wheel
+ */
+static void upump_common_wheel_free_upump(struct upump_common_wheel *wheel)
+{
+    if (wheel->upump == NULL)
+        return;
+    upump_mgr_use(upump_common_mgr_to_upump_mgr(wheel->common_mgr));
+    upump_free(wheel->upump);
+    wheel->upump = NULL;
+}
+
+/** @internal @This advances the wheel by one tick, and dispatches the
+ * timers expiring at this tick.
+ *
+ * @param wheel pointer to the timer wheel
+ */
+static void upump_common_wheel_advance(struct upump_common_wheel *wheel)
+{
+    uint64_t now = ++wheel->now;
+    unsigned int level;
+    for (level = 1; level < UPUMP_WHEEL_LEVELS; level++) {
+        if (now & ((UINT64_C(1) << (UPUMP_WHEEL_BITS * level)) - 1))
+            break;
+        upump_common_wheel_cascade(wheel,
+                &wheel->slots[level][(now >> (UPUMP_WHEEL_BITS * level)) &
+                                     UPUMP_WHEEL_MASK]);
+    }
+    if (level == UPUMP_WHEEL_LEVELS &&
+        !(now & ((UINT64_C(1) << (UPUMP_WHEEL_BITS * level)) - 1)))
+        upump_common_wheel_cascade(wheel, &wheel->overflow);
+
+    struct uchain *list = &wheel->slots[0][now & UPUMP_WHEEL_MASK];
+    struct uchain *uchain;
+    while ((uchain = ulist_pop(list)) != NULL) {
+        struct upump_common *common = upump_common_from_wheel_uchain(uchain);
+        if (common->wheel_repeat) {
+            uint64_t repeat = (common->wheel_repeat + wheel->tick - 1) /
+                              wheel->tick;
+            common->wheel_expiry += repeat;
+            upump_common_wheel_insert(wheel, common);
+        } else {
+            common->wheel_armed = false;
+            wheel->count--;
+            if (common->wheel_status)
+                wheel->blocking--;
+        }
+        upump_common_dispatch(upump_common_to_upump(common));
+    }
+}
+
+/** @internal @This is called by the timer of the event loop driving the
+ * wheel.
+ *
+ * @param upump description structure of the timer of the event loop
+ */
+static void upump_common_wheel_cb(struct upump *upump)
+{
+    struct upump_common_wheel *wheel = upump->opaque;
+    uint64_t now = upump_common_wheel_clock(wheel);
+    wheel->deadline = UINT64_MAX;
+
+    wheel->dispatching = true;
+    uint64_t next;
+    /* the ticks in between have nothing to expire or move down */
+    while (wheel->count && (next = upump_common_wheel_next(wheel)) <= now) {
+        wheel->now = next - 1;
+        upump_common_wheel_advance(wheel);
+    }
+    /* a timer started during the dispatch may have read the clock later */
+    if (now > wheel->now)
+        wheel->now = now;
+    wheel->dispatching = false;
+    upump_common_wheel_update(wheel);
+}
+
+/** @internal @This arms or stops the timer of the event loop depending on
+ * the armed timers. A timer triggering later than necessary, because timers
+ * were stopped, is kept and simply re-armed when it triggers.
+ *
+ * @param wheel pointer to the timer wheel
+ */
+static void upump_common_wheel_update(struct upump_common_wheel *wheel)
+{
+    if (wheel->dispatching)
+        return;
+
+    struct upump_mgr *mgr = upump_common_mgr_to_upump_mgr(wheel->common_mgr);
+    uint64_t next = wheel->count ? upump_common_wheel_next(wheel) :
+                    UINT64_MAX;
+    if (next == UINT64_MAX) {
+        upump_common_wheel_free_upump(wheel);
+        wheel->deadline = UINT64_MAX;
+        return;
+    }
+
+    bool status = wheel->blocking > 0;
+    if (wheel->upump == NULL || next < wheel->deadline) {
+        upump_common_wheel_free_upump(wheel);
+
+        uint64_t date = next <= UINT64_MAX / wheel->tick ?
+                        next * wheel->tick : UINT64_MAX;
+        uint64_t now = uclock_now(wheel->uclock);
+        /* the timer must not go through the wheel */
+        bool enabled = wheel->enabled;
+        wheel->enabled = false;
+        wheel->upump = upump_alloc_timer(mgr, upump_common_wheel_cb, wheel,
+                                         NULL, date > now ? date - now : 0, 0);
+        wheel->enabled = enabled;
+        if (unlikely(wheel->upump == NULL)) {
+            wheel->deadline = UINT64_MAX;
+            return;
+        }
+        /* the timer must not keep the manager alive */
+        upump_mgr_release(mgr);
+        wheel->upump_status = true;
+        wheel->deadline = next;
+        if (status != wheel->upump_status) {
+            upump_set_status(wheel->upump, status);
+            wheel->upump_status = status;
+        }
+        upump_start(wheel->upump);
+    } else if (status != wheel->upump_status) {
+        upump_set_status(wheel->upump, status);
+        wheel->upump_status = status;
+    }
+}
+
+/** @internal @This arms a timer in the wheel.
+ *
+ * @param upump description structure of the pump
+ * @param status blocking status of the pump
+ */
+static void upump_common_wheel_start(struct upump *upump, bool status)
+{
+    struct upump_common *common = upump_common_from_upump(upump);
+    struct upump_common_mgr *common_mgr =
+        upump_common_mgr_from_upump_mgr(upump->mgr);
+    struct upump_common_wheel *wheel = common_mgr->wheel;
+    if (common->wheel_armed)
+        return;
+
+    if (!wheel->count)
+        /* all slots are empty */
+        wheel->now = upump_common_wheel_clock(wheel);
+    uint64_t date = uclock_now(wheel->uclock);
+    date = common->wheel_after <= UINT64_MAX - wheel->tick - date ?
+           date + common->wheel_after + wheel->tick - 1 : UINT64_MAX;
+    uint64_t expiry = date / wheel->tick;
+    common->wheel_expiry = expiry > wheel->now ? expiry : wheel->now + 1;
+    upump_common_wheel_insert(wheel, common);
+
+    common->wheel_armed = true;
+    common->wheel_status = status;
+    wheel->count++;
+    if (status)
+        wheel->blocking++;
+    upump_common_wheel_update(wheel);
+}
+
+/** @internal @This disarms a timer in the wheel.
+ *
+ * @param upump description structure of the pump
+ * @param status blocking status of the pump
+ */
+static void upump_common_wheel_stop(struct upump *upump, bool status)
+{
+    struct upump_common *common = upump_common_from_upump(upump);
+    struct upump_common_mgr *common_mgr =
+        upump_common_mgr_from_upump_mgr(upump->mgr);
+    struct upump_common_wheel *wheel = common_mgr->wheel;
+    if (!common->wheel_armed)
+        return;
+
+    ulist_delete(upump_common_to_wheel_uchain(common));
+    common->wheel_armed = false;
+    wheel->count--;
+    if (common->wheel_status)
+        wheel->blocking--;
+    upump_common_wheel_update(wheel);
+}
+
+/** @internal @This really starts a pump, either in the event loop or in the
+ * timer wheel.
+ *
+ * @param upump description structure of the pump
+ * @param status blocking status of the pump
+ */
+static void upump_common_real_start(struct upump *upump, bool status)
+{
+    struct upump_common *common = upump_common_from_upump(upump);
+    if (common->wheel)
+        upump_common_wheel_start(upump, status);
+    else {
+        struct upump_common_mgr *common_mgr =
+            upump_common_mgr_from_upump_mgr(upump->mgr);
+        common_mgr->upump_real_start(upump, status);
+    }
+}
+
+/** @internal @This really stops a pump, either in the event loop or in the
+ * timer wheel.
+ *
+ * @param upump description structure of the pump
+ * @param status blocking status of the pump
+ */
+static void upump_common_real_stop(struct upump *upump, bool status)
+{
+    struct upump_common *common = upump_common_from_upump(upump);
+    if (common->wheel)
+        upump_common_wheel_stop(upump, status);
+    else {
+        struct upump_common_mgr *common_mgr =
+            upump_common_mgr_from_upump_mgr(upump->mgr);
+        common_mgr->upump_real_stop(upump, status);
+    }
+}
+
 /** @This allocates and initializes a blocker.
  *
  * @param upump description structure of the pump
@@ -71,11 +427,8 @@ struct upump_blocker *upump_common_blocker_alloc(struct upump *upump)
     bool was_blocked = !ulist_empty(&common->blockers);
     ulist_add(&common->blockers,
               upump_blocker_common_to_uchain(blocker_common));
-    if (common->started && !was_blocked) {
-        struct upump_common_mgr *common_mgr =
-            upump_common_mgr_from_upump_mgr(upump->mgr);
-        common_mgr->upump_real_stop(upump, common->status);
-    }
+    if (common->started && !was_blocked)
+        upump_common_real_stop(upump, common->status);
     return blocker;
 }
 
@@ -92,11 +445,8 @@ void upump_common_blocker_free(struct upump_blocker *blocker)
     struct upump_common *common = upump_common_from_upump(blocker->upump);
 
     ulist_delete(upump_blocker_common_to_uchain(blocker_common));
-    if (common->started && ulist_empty(&common->blockers)) {
-        struct upump_common_mgr *common_mgr =
-            upump_common_mgr_from_upump_mgr(blocker->upump->mgr);
-        common_mgr->upump_real_start(blocker->upump, common->status);
-    }
+    if (common->started && ulist_empty(&common->blockers))
+        upump_common_real_start(blocker->upump, common->status);
 
     upool_free(&common_mgr->upump_blocker_pool, blocker_common);
 }
@@ -132,6 +482,31 @@ void upump_common_init(struct upump *upump)
     common->started = false;
     common->status = true;
     ulist_init(&common->blockers);
+    common->wheel = false;
+    common->wheel_armed = false;
+}
+
+/** @This initializes the common part of a timer pump, and hands it over to
+ * the timer wheel if it is enabled. This must be called after
+ * @ref upump_common_init.
+ *
+ * @param upump description structure of the pump
+ * @param after time after which it triggers, in 27 MHz ticks
+ * @param repeat repeat period, in 27 MHz ticks (0 to disable)
+ * @return true if the timer is handled by the wheel, in which case the
+ * manager must not set up a timer of the event loop
+ */
+bool upump_common_init_timer(struct upump *upump,
+                             uint64_t after, uint64_t repeat)
+{
+    struct upump_common *common = upump_common_from_upump(upump);
+    struct upump_common_mgr *common_mgr =
+        upump_common_mgr_from_upump_mgr(upump->mgr);
+    common->wheel = common_mgr->wheel != NULL && common_mgr->wheel->enabled;
+    common->wheel_after = after;
+    common->wheel_repeat = repeat;
+    uchain_init(upump_common_to_wheel_uchain(common));
+    return common->wheel;
 }
 
 /** @This dispatches a pump.
@@ -153,11 +528,8 @@ void upump_common_start(struct upump *upump)
 {
     struct upump_common *common = upump_common_from_upump(upump);
     common->started = true;
-    if (ulist_empty(&common->blockers)) {
-        struct upump_common_mgr *common_mgr =
-            upump_common_mgr_from_upump_mgr(upump->mgr);
-        common_mgr->upump_real_start(upump, common->status);
-    }
+    if (ulist_empty(&common->blockers))
+        upump_common_real_start(upump, common->status);
 }
 
 /** @This stops a pump if needed.
@@ -168,11 +540,8 @@ void upump_common_stop(struct upump *upump)
 {
     struct upump_common *common = upump_common_from_upump(upump);
     common->started = false;
-    if (ulist_empty(&common->blockers)) {
-        struct upump_common_mgr *common_mgr =
-            upump_common_mgr_from_upump_mgr(upump->mgr);
-        common_mgr->upump_real_stop(upump, common->status);
-    }
+    if (ulist_empty(&common->blockers))
+        upump_common_real_stop(upump, common->status);
 }
 
 /** @This gets the blocking status of a pump.
@@ -221,6 +590,59 @@ void upump_common_clean(struct upump *upump)
     urefcount_release(refcount);
 }
 
+/** @This sets the resolution of the timer wheel. Only timers allocated
+ * afterwards are affected.
+ *
+ * @param mgr pointer to a upump_mgr structure wrapped into a
+ * upump_common_mgr structure
+ * @param tick resolution of the wheel, in 27 MHz ticks (0 to disable)
+ * @return an error code
+ */
+int upump_common_mgr_set_timer_tick(struct upump_mgr *mgr, uint64_t tick)
+{
+    struct upump_common_mgr *common_mgr = upump_common_mgr_from_upump_mgr(mgr);
+    struct upump_common_wheel *wheel = common_mgr->wheel;
+    if (!tick) {
+        if (wheel != NULL)
+            wheel->enabled = false;
+        return UBASE_ERR_NONE;
+    }
+
+    if (wheel == NULL) {
+        wheel = malloc(sizeof(struct upump_common_wheel));
+        UBASE_ALLOC_RETURN(wheel);
+        wheel->uclock = uclock_std_alloc(0);
+        if (unlikely(wheel->uclock == NULL)) {
+            free(wheel);
+            return UBASE_ERR_ALLOC;
+        }
+        wheel->common_mgr = common_mgr;
+        wheel->now = 0;
+        wheel->count = wheel->blocking = 0;
+        wheel->dispatching = false;
+        wheel->upump = NULL;
+        wheel->upump_status = true;
+        wheel->deadline = UINT64_MAX;
+        ulist_init(&wheel->overflow);
+        for (unsigned int i = 0; i < UPUMP_WHEEL_LEVELS; i++)
+            for (unsigned int j = 0; j < UPUMP_WHEEL_SIZE; j++)
+                ulist_init(&wheel->slots[i][j]);
+        common_mgr->wheel = wheel;
+    } else if (wheel->count && tick != wheel->tick)
+        return UBASE_ERR_BUSY;
+
+    if (wheel->upump != NULL && tick != wheel->tick) {
+        /* the timer of the event loop is stopped as no timer is armed */
+        upump_common_wheel_free_upump(wheel);
+        wheel->deadline = UINT64_MAX;
+    }
+    /* the slots are empty, the current tick is counted in the new unit */
+    wheel->now = uclock_now(wheel->uclock) / tick;
+    wheel->tick = tick;
+    wheel->enabled = true;
+    return UBASE_ERR_NONE;
+}
+
 /** @This returns the extra buffer space needed for pools.
  *
  * @param upump_pool_depth maximum number of upump structures in the pool
@@ -256,6 +678,12 @@ void upump_common_mgr_vacuum(struct upump_mgr *mgr)
 void upump_common_mgr_clean(struct upump_mgr *mgr)
 {
     struct upump_common_mgr *common_mgr = upump_common_mgr_from_upump_mgr(mgr);
+    struct upump_common_wheel *wheel = common_mgr->wheel;
+    if (wheel != NULL) {
+        upump_common_wheel_free_upump(wheel);
+        uclock_release(wheel->uclock);
+        free(wheel);
+    }
     upool_clean(&common_mgr->upump_pool);
     upool_clean(&common_mgr->upump_blocker_pool);
 }
@@ -287,6 +715,7 @@ void upump_common_mgr_init(struct upump_mgr *mgr,
     struct upump_common_mgr *common_mgr = upump_common_mgr_from_upump_mgr(mgr);
     common_mgr->upump_real_start = upump_real_start;
     common_mgr->upump_real_stop = upump_real_stop;
+    common_mgr->wheel = NULL;
 
     upool_init(&common_mgr->upump_pool, mgr->refcount, upump_pool_depth,
                pool_extra, upump_alloc_inner, upump_free_inner);
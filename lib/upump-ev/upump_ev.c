@@ -155,6 +155,7 @@ static struct upump *upump_ev_alloc(struct upump_mgr *mgr,
     if (unlikely(upump_ev == NULL))
         return NULL;
     struct upump *upump = upump_ev_to_upump(upump_ev);
+    upump_common_init(upump);
 
     switch (event) {
         case UPUMP_TYPE_IDLER:
@@ -163,6 +164,8 @@ static struct upump *upump_ev_alloc(struct upump_mgr *mgr,
         case UPUMP_TYPE_TIMER: {
             uint64_t after = va_arg(args, uint64_t);
             uint64_t repeat = va_arg(args, uint64_t);
+            if (upump_common_init_timer(upump, after, repeat))
+                break;
             ev_timer_init(&upump_ev->ev_timer, upump_ev_dispatch_timer,
                           (ev_tstamp)after / UCLOCK_FREQ,
                           (ev_tstamp)repeat / UCLOCK_FREQ);
@@ -190,8 +193,6 @@ static struct upump *upump_ev_alloc(struct upump_mgr *mgr,
     }
     upump_ev->event = event;
 
-    upump_common_init(upump);
-
     return upump;
 }
 
@@ -415,6 +416,10 @@ static int upump_ev_mgr_control(struct upump_mgr *mgr,
         case UPUMP_MGR_VACUUM:
             upump_common_mgr_vacuum(mgr);
             return UBASE_ERR_NONE;
+        case UPUMP_MGR_SET_TIMER_TICK: {
+            uint64_t tick = va_arg(args, uint64_t);
+            return upump_common_mgr_set_timer_tick(mgr, tick);
+        }
         default:
             return UBASE_ERR_UNHANDLED;
     }
@@ -0,0 +1,1034 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short implementation of a Upipe event loop using Linux io_uring
+ *
+ * Each started pump has at most one operation in flight in the ring: a
+ * one-shot poll for file descriptors and signals, an absolute timeout for
+ * timers, and a read for read pumps. The operation is armed again before
+ * the pump is dispatched, and cancelled when the pump is stopped. Idlers
+ * are run in turn whenever no completion is pending.
+ */
+
+#define _GNU_SOURCE
+
+#include <upipe/ubase.h>
+#include <upipe/ulist.h>
+#include <upipe/urefcount.h>
+#include <upipe/uclock.h>
+#include <upipe/umutex.h>
+#include <upipe/upump.h>
+#include <upipe/upump_common.h>
+#include <upump-uring/upump_uring.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/signalfd.h>
+
+#include <linux/io_uring.h>
+
+/** number of entries of the submission queue */
+#define UPUMP_URING_ENTRIES 256
+
+/** @This stores management parameters and local structures.
+ */
+struct upump_uring_mgr {
+    /** refcount management structure */
+    struct urefcount urefcount;
+
+    /** io_uring file descriptor */
+    int ring_fd;
+    /** mapping of the submission queue ring */
+    void *sq_ring;
+    /** size of the mapping of the submission queue ring */
+    size_t sq_ring_size;
+    /** mapping of the completion queue ring (may be sq_ring) */
+    void *cq_ring;
+    /** size of the mapping of the completion queue ring */
+    size_t cq_ring_size;
+    /** mapping of the submission queue entries */
+    struct io_uring_sqe *sqes;
+    /** size of the mapping of the submission queue entries */
+    size_t sqes_size;
+
+    /** kernel head of the submission queue */
+    unsigned *sq_khead;
+    /** kernel tail of the submission queue */
+    unsigned *sq_ktail;
+    /** mask of the submission queue */
+    unsigned sq_mask;
+    /** number of entries of the submission queue */
+    unsigned sq_entries;
+    /** index array of the submission queue */
+    unsigned *sq_array;
+    /** local tail of the submission queue */
+    unsigned sq_tail;
+    /** number of entries not yet submitted */
+    unsigned sq_pending;
+
+    /** kernel head of the completion queue */
+    unsigned *cq_khead;
+    /** kernel tail of the completion queue */
+    unsigned *cq_ktail;
+    /** mask of the completion queue */
+    unsigned cq_mask;
+    /** completion queue entries */
+    struct io_uring_cqe *cqes;
+
+    /** list of started idlers */
+    struct uchain idlers;
+    /** list of completed pumps waiting to be dispatched */
+    struct uchain ready;
+    /** list of pumps waiting for room in the submission queue */
+    struct uchain deferred;
+    /** number of started blocking pumps */
+    unsigned int active;
+    /** number of started pumps per signal */
+    unsigned int signals[_NSIG];
+
+    /** common structure */
+    struct upump_common_mgr common_mgr;
+
+    /** extra space for upool */
+    uint8_t upool_extra[];
+};
+
+UBASE_FROM_TO(upump_uring_mgr, upump_mgr, upump_mgr, common_mgr.mgr)
+UBASE_FROM_TO(upump_uring_mgr, urefcount, urefcount, urefcount)
+
+/** @This stores local structures.
+ */
+struct upump_uring {
+    /** type of event to watch */
+    int event;
+    /** file descriptor to poll or to read from (signalfd for signals) */
+    int fd;
+    /** signal to watch */
+    int signal;
+    /** timer delay before the first trigger, in 27 MHz ticks */
+    uint64_t after;
+    /** timer repeat period, in 27 MHz ticks */
+    uint64_t repeat;
+    /** absolute date of the next timer trigger (CLOCK_MONOTONIC) */
+    struct __kernel_timespec ts;
+    /** buffer of the next read */
+    void *buffer;
+    /** size of the buffer of the next read */
+    size_t size;
+    /** result of the last completed read */
+    ssize_t result;
+
+    /** true if the pump was really started */
+    bool real;
+    /** true if the pump was really started as blocking */
+    bool blocking;
+    /** true if the pump is accounted for in the active count */
+    bool counted;
+    /** true if a one-shot timer has triggered */
+    bool expired;
+    /** true if an operation is in flight */
+    bool armed;
+    /** true if the operation in flight is being cancelled */
+    bool cancelling;
+    /** true if a read completed while the pump was stopped */
+    bool completed;
+    /** true if the operation must be armed once the queue has room */
+    bool defer_arm;
+    /** true if the operation must be cancelled once the queue has room */
+    bool defer_cancel;
+    /** result of the last completion */
+    int32_t res;
+    /** structure for the idlers or ready list */
+    struct uchain uchain;
+    /** structure for the deferred list */
+    struct uchain deferred;
+
+    /** common structure */
+    struct upump_common common;
+};
+
+UBASE_FROM_TO(upump_uring, upump, upump, common.upump)
+UBASE_FROM_TO(upump_uring, uchain, uchain, uchain)
+UBASE_FROM_TO(upump_uring, uchain, deferred, deferred)
+
+/** @internal @This enters the ring to submit pending entries, and optionally
+ * wait for completions.
+ *
+ * @param uring_mgr pointer to upump_uring_mgr structure
+ * @param min_complete number of completions to wait for
+ * @return the return value of io_uring_enter(2)
+ */
+static int upump_uring_mgr_enter(struct upump_uring_mgr *uring_mgr,
+                                 unsigned min_complete)
+{
+    if (!uring_mgr->sq_pending && !min_complete)
+        return 0;
+
+    int ret = syscall(__NR_io_uring_enter, uring_mgr->ring_fd,
+                      uring_mgr->sq_pending, min_complete,
+                      min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (ret > 0)
+        uring_mgr->sq_pending -= ret > uring_mgr->sq_pending ?
+                                 uring_mgr->sq_pending : ret;
+    return ret;
+}
+
+/** @internal @This returns a blank submission queue entry.
+ *
+ * @param uring_mgr pointer to upump_uring_mgr structure
+ * @return pointer to the entry, or NULL if the queue is full
+ */
+static struct io_uring_sqe *
+    upump_uring_mgr_get_sqe(struct upump_uring_mgr *uring_mgr)
+{
+    unsigned head = *uring_mgr->sq_khead;
+    __sync_synchronize();
+    if (uring_mgr->sq_tail - head >= uring_mgr->sq_entries) {
+        upump_uring_mgr_enter(uring_mgr, 0);
+        head = *uring_mgr->sq_khead;
+        __sync_synchronize();
+        if (uring_mgr->sq_tail - head >= uring_mgr->sq_entries)
+            return NULL;
+    }
+
+    unsigned idx = uring_mgr->sq_tail & uring_mgr->sq_mask;
+    struct io_uring_sqe *sqe = &uring_mgr->sqes[idx];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    uring_mgr->sq_array[idx] = idx;
+    return sqe;
+}
+
+/** @internal @This queues the last entry returned by
+ * @ref upump_uring_mgr_get_sqe. It is actually submitted on the next
+ * iteration of the loop.
+ *
+ * @param uring_mgr pointer to upump_uring_mgr structure
+ */
+static void upump_uring_mgr_push_sqe(struct upump_uring_mgr *uring_mgr)
+{
+    uring_mgr->sq_tail++;
+    __sync_synchronize();
+    *uring_mgr->sq_ktail = uring_mgr->sq_tail;
+    uring_mgr->sq_pending++;
+}
+
+/** @internal @This adds a number of 27 MHz ticks to a timespec.
+ *
+ * @param ts timespec to modify
+ * @param ticks number of ticks to add
+ */
+static void upump_uring_ts_add(struct __kernel_timespec *ts, uint64_t ticks)
+{
+    ts->tv_sec += ticks / UCLOCK_FREQ;
+    ts->tv_nsec += (ticks % UCLOCK_FREQ) * UINT64_C(1000000000) / UCLOCK_FREQ;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+/** @internal @This updates the number of started blocking pumps.
+ *
+ * @param upump_uring pointer to upump_uring structure
+ */
+static void upump_uring_update(struct upump_uring *upump_uring)
+{
+    struct upump_uring_mgr *uring_mgr =
+        upump_uring_mgr_from_upump_mgr(upump_uring->common.upump.mgr);
+    bool counted = upump_uring->real && upump_uring->blocking &&
+                   !upump_uring->expired;
+    if (upump_uring->event == UPUMP_URING_TYPE_READ)
+        counted = counted &&
+                  (upump_uring->buffer != NULL || upump_uring->completed);
+
+    if (counted && !upump_uring->counted)
+        uring_mgr->active++;
+    else if (!counted && upump_uring->counted)
+        uring_mgr->active--;
+    upump_uring->counted = counted;
+}
+
+/** @internal @This queues a pump whose operation could not be armed or
+ * cancelled because the submission queue is full, even after submitting its
+ * pending entries. The operation is retried on the next iteration of the
+ * loop.
+ *
+ * @param upump_uring pointer to upump_uring structure
+ * @param cancel true if the operation must be cancelled
+ */
+static void upump_uring_defer(struct upump_uring *upump_uring, bool cancel)
+{
+    struct upump_uring_mgr *uring_mgr =
+        upump_uring_mgr_from_upump_mgr(upump_uring->common.upump.mgr);
+    if (cancel)
+        upump_uring->defer_cancel = true;
+    else
+        upump_uring->defer_arm = true;
+
+    if (ulist_is_in(upump_uring_to_deferred(upump_uring)))
+        return;
+    ulist_add(&uring_mgr->deferred, upump_uring_to_deferred(upump_uring));
+}
+
+/** @internal @This arms the operation of a pump in the ring.
+ *
+ * @param upump_uring pointer to upump_uring structure
+ */
+static void upump_uring_arm(struct upump_uring *upump_uring)
+{
+    struct upump_uring_mgr *uring_mgr =
+        upump_uring_mgr_from_upump_mgr(upump_uring->common.upump.mgr);
+    if (upump_uring->armed || !upump_uring->real ||
+        upump_uring->event == UPUMP_TYPE_IDLER ||
+        (upump_uring->event == UPUMP_URING_TYPE_READ &&
+         upump_uring->buffer == NULL))
+        return;
+
+    struct io_uring_sqe *sqe = upump_uring_mgr_get_sqe(uring_mgr);
+    if (unlikely(sqe == NULL)) {
+        upump_uring_defer(upump_uring, false);
+        return;
+    }
+
+    switch (upump_uring->event) {
+        case UPUMP_TYPE_TIMER:
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = (uintptr_t)&upump_uring->ts;
+            sqe->len = 1;
+            sqe->timeout_flags = IORING_TIMEOUT_ABS;
+            break;
+        case UPUMP_TYPE_FD_READ:
+        case UPUMP_TYPE_SIGNAL:
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = upump_uring->fd;
+            sqe->poll_events = POLLIN;
+            break;
+        case UPUMP_TYPE_FD_WRITE:
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = upump_uring->fd;
+            sqe->poll_events = POLLOUT;
+            break;
+        case UPUMP_URING_TYPE_READ:
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = upump_uring->fd;
+            sqe->addr = (uintptr_t)upump_uring->buffer;
+            sqe->len = upump_uring->size;
+            sqe->off = (uint64_t)-1;
+            break;
+        default:
+            break;
+    }
+    sqe->user_data = (uintptr_t)upump_uring;
+    upump_uring_mgr_push_sqe(uring_mgr);
+    upump_uring->armed = true;
+}
+
+/** @internal @This cancels the operation of a pump in flight. The pump
+ * remains armed until the completion of the operation is reaped.
+ *
+ * @param upump_uring pointer to upump_uring structure
+ */
+static void upump_uring_cancel(struct upump_uring *upump_uring)
+{
+    struct upump_uring_mgr *uring_mgr =
+        upump_uring_mgr_from_upump_mgr(upump_uring->common.upump.mgr);
+    if (!upump_uring->armed || upump_uring->cancelling)
+        return;
+
+    struct io_uring_sqe *sqe = upump_uring_mgr_get_sqe(uring_mgr);
+    if (unlikely(sqe == NULL)) {
+        upump_uring_defer(upump_uring, true);
+        return;
+    }
+
+    switch (upump_uring->event) {
+        case UPUMP_TYPE_TIMER:
+            sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+            break;
+        case UPUMP_URING_TYPE_READ:
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            break;
+        default:
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            break;
+    }
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t)upump_uring;
+    sqe->user_data = 0;
+    upump_uring_mgr_push_sqe(uring_mgr);
+    upump_uring->cancelling = true;
+}
+
+/** @internal @This retries the operations deferred because the submission
+ * queue was full.
+ *
+ * @param uring_mgr pointer to upump_uring_mgr structure
+ */
+static void upump_uring_mgr_drain(struct upump_uring_mgr *uring_mgr)
+{
+    struct uchain *uchain;
+    while ((uchain = ulist_pop(&uring_mgr->deferred)) != NULL) {
+        struct upump_uring *upump_uring = upump_uring_from_deferred(uchain);
+        bool cancel = upump_uring->defer_cancel;
+        bool arm = upump_uring->defer_arm;
+        upump_uring->defer_cancel = upump_uring->defer_arm = false;
+        /* a stopped pump is not armed again, and a pump which was not
+         * armed is not cancelled */
+        if (cancel)
+            upump_uring_cancel(upump_uring);
+        if (arm)
+            upump_uring_arm(upump_uring);
+        if (ulist_is_in(uchain))
+            /* still full */
+            break;
+    }
+}
+
+/** @internal @This reaps the completion queue, and queues completed pumps
+ * for dispatching.
+ *
+ * @param uring_mgr pointer to upump_uring_mgr structure
+ */
+static void upump_uring_mgr_reap(struct upump_uring_mgr *uring_mgr)
+{
+    unsigned head = *uring_mgr->cq_khead;
+    unsigned tail = *uring_mgr->cq_ktail;
+    __sync_synchronize();
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &uring_mgr->cqes[head & uring_mgr->cq_mask];
+        struct upump_uring *upump_uring =
+            (struct upump_uring *)(uintptr_t)cqe->user_data;
+        int32_t res = cqe->res;
+        head++;
+        if (upump_uring == NULL)
+            continue;
+
+        /* a cancelled read may still have returned data */
+        bool cancelled = upump_uring->event == UPUMP_URING_TYPE_READ ?
+            res == -ECANCELED || (upump_uring->cancelling && res == -EINTR) :
+            upump_uring->cancelling;
+        upump_uring->armed = false;
+        upump_uring->cancelling = false;
+        if (!upump_uring->real) {
+            /* keep the data of a read that completed despite the stop */
+            if (upump_uring->event == UPUMP_URING_TYPE_READ && !cancelled) {
+                upump_uring->res = res;
+                upump_uring->completed = true;
+                upump_uring_update(upump_uring);
+            }
+            continue;
+        }
+        if (cancelled) {
+            /* stopped and started again in the meantime */
+            upump_uring_arm(upump_uring);
+            continue;
+        }
+        upump_uring->res = res;
+        ulist_add(&uring_mgr->ready, upump_uring_to_uchain(upump_uring));
+    }
+
+    __sync_synchronize();
+    *uring_mgr->cq_khead = head;
+}
+
+/** @internal @This dispatches a completed pump.
+ *
+ * @param upump_uring pointer to upump_uring structure
+ */
+static void upump_uring_dispatch(struct upump_uring *upump_uring)
+{
+    struct upump *upump = upump_uring_to_upump(upump_uring);
+
+    switch (upump_uring->event) {
+        case UPUMP_TYPE_TIMER:
+            if (upump_uring->repeat) {
+                upump_uring_ts_add(&upump_uring->ts, upump_uring->repeat);
+                upump_uring_arm(upump_uring);
+            } else {
+                upump_uring->expired = true;
+                upump_uring_update(upump_uring);
+            }
+            break;
+        case UPUMP_TYPE_SIGNAL: {
+            struct signalfd_siginfo siginfo;
+            while (read(upump_uring->fd, &siginfo, sizeof(siginfo)) > 0);
+            upump_uring_arm(upump_uring);
+            break;
+        }
+        case UPUMP_URING_TYPE_READ:
+            upump_uring->result = upump_uring->res;
+            upump_uring->buffer = NULL;
+            upump_uring->completed = false;
+            upump_uring_update(upump_uring);
+            break;
+        default:
+            upump_uring_arm(upump_uring);
+            break;
+    }
+
+    upump_common_dispatch(upump);
+}
+
+/** @This allocates a new upump_uring.
+ *
+ * @param mgr pointer to a upump_mgr structure wrapped into a
+ * upump_uring_mgr structure
+ * @param event type of event to watch for
+ * @param args optional parameters depending on event type
+ * @return pointer to allocated pump, or NULL in case of failure
+ */
+static struct upump *upump_uring_alloc(struct upump_mgr *mgr,
+                                       int event, va_list args)
+{
+    struct upump_uring_mgr *uring_mgr = upump_uring_mgr_from_upump_mgr(mgr);
+    struct upump_uring *upump_uring =
+        upool_alloc(&uring_mgr->common_mgr.upump_pool, struct upump_uring *);
+    if (unlikely(upump_uring == NULL))
+        return NULL;
+    struct upump *upump = upump_uring_to_upump(upump_uring);
+    upump_common_init(upump);
+
+    upump_uring->fd = -1;
+    upump_uring->signal = 0;
+    upump_uring->after = upump_uring->repeat = 0;
+    upump_uring->buffer = NULL;
+    upump_uring->size = 0;
+    upump_uring->result = 0;
+
+    switch (event) {
+        case UPUMP_TYPE_IDLER:
+            break;
+        case UPUMP_TYPE_TIMER:
+            upump_uring->after = va_arg(args, uint64_t);
+            upump_uring->repeat = va_arg(args, uint64_t);
+            upump_common_init_timer(upump, upump_uring->after,
+                                    upump_uring->repeat);
+            break;
+        case UPUMP_TYPE_FD_READ:
+        case UPUMP_TYPE_FD_WRITE:
+            upump_uring->fd = va_arg(args, int);
+            break;
+        case UPUMP_TYPE_SIGNAL: {
+            upump_uring->signal = va_arg(args, int);
+            sigset_t mask;
+            sigemptyset(&mask);
+            if (upump_uring->signal <= 0 || upump_uring->signal >= _NSIG ||
+                sigaddset(&mask, upump_uring->signal) < 0 ||
+                (upump_uring->fd = signalfd(-1, &mask,
+                                     SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+                upool_free(&uring_mgr->common_mgr.upump_pool, upump_uring);
+                return NULL;
+            }
+            break;
+        }
+        case UPUMP_URING_TYPE_READ:
+            if (va_arg(args, unsigned int) != UPUMP_URING_SIGNATURE) {
+                upool_free(&uring_mgr->common_mgr.upump_pool, upump_uring);
+                return NULL;
+            }
+            upump_uring->fd = va_arg(args, int);
+            break;
+        default:
+            upool_free(&uring_mgr->common_mgr.upump_pool, upump_uring);
+            return NULL;
+    }
+    upump_uring->event = event;
+    upump_uring->real = false;
+    upump_uring->blocking = false;
+    upump_uring->counted = false;
+    upump_uring->expired = false;
+    upump_uring->armed = false;
+    upump_uring->cancelling = false;
+    upump_uring->completed = false;
+    upump_uring->defer_arm = false;
+    upump_uring->defer_cancel = false;
+    uchain_init(upump_uring_to_uchain(upump_uring));
+    uchain_init(upump_uring_to_deferred(upump_uring));
+
+    return upump;
+}
+
+/** @This starts a pump.
+ *
+ * @param upump description structure of the pump
+ * @param status blocking status of the pump
+ */
+static void upump_uring_real_start(struct upump *upump, bool status)
+{
+    struct upump_uring *upump_uring = upump_uring_from_upump(upump);
+    struct upump_uring_mgr *uring_mgr =
+        upump_uring_mgr_from_upump_mgr(upump->mgr);
+
+    upump_uring->real = true;
+    upump_uring->blocking = status;
+
+    switch (upump_uring->event) {
+        case UPUMP_TYPE_IDLER:
+            ulist_add(&uring_mgr->idlers, upump_uring_to_uchain(upump_uring));
+            break;
+        case UPUMP_TYPE_TIMER: {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            upump_uring->ts.tv_sec = now.tv_sec;
+            upump_uring->ts.tv_nsec = now.tv_nsec;
+            upump_uring_ts_add(&upump_uring->ts, upump_uring->after);
+            upump_uring->expired = false;
+            break;
+        }
+        case UPUMP_TYPE_SIGNAL:
+            if (!uring_mgr->signals[upump_uring->signal]++) {
+                sigset_t mask;
+                sigemptyset(&mask);
+                sigaddset(&mask, upump_uring->signal);
+                sigprocmask(SIG_BLOCK, &mask, NULL);
+            }
+            break;
+        case UPUMP_URING_TYPE_READ:
+            if (upump_uring->completed)
+                ulist_add(&uring_mgr->ready,
+                          upump_uring_to_uchain(upump_uring));
+            break;
+        default:
+            break;
+    }
+
+    upump_uring_arm(upump_uring);
+    upump_uring_update(upump_uring);
+}
+
+/** @This stops a pump.
+ *
+ * @param upump description structure of the pump
+ * @param status blocking status of the pump
+ */
+static void upump_uring_real_stop(struct upump *upump, bool status)
+{
+    struct upump_uring *upump_uring = upump_uring_from_upump(upump);
+    struct upump_uring_mgr *uring_mgr =
+        upump_uring_mgr_from_upump_mgr(upump->mgr);
+    if (!upump_uring->real)
+        return;
+
+    upump_uring->real = false;
+    /* remove from the idlers or ready list */
+    if (ulist_is_in(upump_uring_to_uchain(upump_uring)))
+        ulist_delete(upump_uring_to_uchain(upump_uring));
+
+    switch (upump_uring->event) {
+        case UPUMP_TYPE_SIGNAL:
+            if (!--uring_mgr->signals[upump_uring->signal]) {
+                sigset_t mask;
+                sigemptyset(&mask);
+                sigaddset(&mask, upump_uring->signal);
+                sigprocmask(SIG_UNBLOCK, &mask, NULL);
+            }
+            break;
+        case UPUMP_URING_TYPE_READ:
+            /* the read may have completed but not been dispatched yet */
+            if (!upump_uring->armed && upump_uring->buffer != NULL)
+                upump_uring->completed = true;
+            break;
+        default:
+            break;
+    }
+
+    upump_uring_cancel(upump_uring);
+    upump_uring_update(upump_uring);
+}
+
+/** @This sets the buffer of the next read of a read pump.
+ *
+ * @param upump description structure of the pump
+ * @param buffer buffer to read into
+ * @param size size of the buffer
+ * @return an error code
+ */
+static int upump_uring_set_buffer_real(struct upump *upump,
+                                       void *buffer, size_t size)
+{
+    struct upump_uring *upump_uring = upump_uring_from_upump(upump);
+    if (upump_uring->event != UPUMP_URING_TYPE_READ ||
+        upump_uring->armed || upump_uring->completed)
+        return UBASE_ERR_BUSY;
+
+    upump_uring->buffer = buffer;
+    upump_uring->size = size;
+    upump_uring_arm(upump_uring);
+    upump_uring_update(upump_uring);
+    return UBASE_ERR_NONE;
+}
+
+/** @This released the memory space previously used by a pump.
+ * Please note that the pump must be stopped before.
+ *
+ * @param upump description structure of the pump
+ */
+static void upump_uring_free(struct upump *upump)
+{
+    struct upump_uring_mgr *uring_mgr =
+        upump_uring_mgr_from_upump_mgr(upump->mgr);
+    upump_stop(upump);
+    upump_common_clean(upump);
+    struct upump_uring *upump_uring = upump_uring_from_upump(upump);
+
+    /* wait for the cancellation, as the completion refers to the pump
+     * (other completions are queued and dispatched later) */
+    while (upump_uring->armed) {
+        upump_uring_mgr_drain(uring_mgr);
+        if (upump_uring_mgr_enter(uring_mgr, 1) < 0 && errno != EINTR)
+            break;
+        upump_uring_mgr_reap(uring_mgr);
+    }
+    if (ulist_is_in(upump_uring_to_deferred(upump_uring)))
+        ulist_delete(upump_uring_to_deferred(upump_uring));
+
+    if (upump_uring->event == UPUMP_TYPE_SIGNAL)
+        close(upump_uring->fd);
+    upool_free(&uring_mgr->common_mgr.upump_pool, upump_uring);
+}
+
+/** @internal @This allocates the data structure.
+ *
+ * @param upool pointer to upool
+ * @return pointer to upump_uring or NULL in case of allocation error
+ */
+static void *upump_uring_alloc_inner(struct upool *upool)
+{
+    struct upump_common_mgr *common_mgr =
+        upump_common_mgr_from_upump_pool(upool);
+    struct upump_uring *upump_uring = malloc(sizeof(struct upump_uring));
+    if (unlikely(upump_uring == NULL))
+        return NULL;
+    struct upump *upump = upump_uring_to_upump(upump_uring);
+    upump->mgr = upump_common_mgr_to_upump_mgr(common_mgr);
+    return upump_uring;
+}
+
+/** @internal @This frees a upump_uring.
+ *
+ * @param upool pointer to upool
+ * @param upump_uring pointer to a upump_uring structure to free
+ */
+static void upump_uring_free_inner(struct upool *upool, void *upump_uring)
+{
+    free(upump_uring);
+}
+
+/** @This processes control commands on a upump_uring.
+ *
+ * @param upump description structure of the pump
+ * @param command type of command to process
+ * @param args arguments of the command
+ * @return an error code
+ */
+static int upump_uring_control(struct upump *upump, int command, va_list args)
+{
+    switch (command) {
+        case UPUMP_START:
+            upump_common_start(upump);
+            return UBASE_ERR_NONE;
+        case UPUMP_STOP:
+            upump_common_stop(upump);
+            return UBASE_ERR_NONE;
+        case UPUMP_FREE:
+            upump_uring_free(upump);
+            return UBASE_ERR_NONE;
+        case UPUMP_GET_STATUS: {
+            int *status_p = va_arg(args, int *);
+            upump_common_get_status(upump, status_p);
+            return UBASE_ERR_NONE;
+        }
+        case UPUMP_SET_STATUS: {
+            int status = va_arg(args, int);
+            upump_common_set_status(upump, status);
+            return UBASE_ERR_NONE;
+        }
+        case UPUMP_ALLOC_BLOCKER: {
+            struct upump_blocker **p = va_arg(args, struct upump_blocker **);
+            *p = upump_common_blocker_alloc(upump);
+            return UBASE_ERR_NONE;
+        }
+        case UPUMP_FREE_BLOCKER: {
+            struct upump_blocker *blocker =
+                va_arg(args, struct upump_blocker *);
+            upump_common_blocker_free(blocker);
+            return UBASE_ERR_NONE;
+        }
+
+        case UPUMP_URING_SET_BUFFER: {
+            UBASE_SIGNATURE_CHECK(args, UPUMP_URING_SIGNATURE)
+            void *buffer = va_arg(args, void *);
+            size_t size = va_arg(args, size_t);
+            return upump_uring_set_buffer_real(upump, buffer, size);
+        }
+        case UPUMP_URING_GET_RESULT: {
+            UBASE_SIGNATURE_CHECK(args, UPUMP_URING_SIGNATURE)
+            ssize_t *result_p = va_arg(args, ssize_t *);
+            struct upump_uring *upump_uring = upump_uring_from_upump(upump);
+            *result_p = upump_uring->result;
+            return UBASE_ERR_NONE;
+        }
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** @internal @This runs an event loop.
+ *
+ * @param mgr pointer to a upump_mgr structure
+ * @param mutex mutual exclusion primitives to access the event loop
+ * @return an error code, including @ref UBASE_ERR_BUSY if a pump is still
+ * active
+ */
+static int upump_uring_mgr_run(struct upump_mgr *mgr, struct umutex *mutex)
+{
+    struct upump_uring_mgr *uring_mgr = upump_uring_mgr_from_upump_mgr(mgr);
+
+    if (mutex != NULL)
+        umutex_lock(mutex);
+
+    while (uring_mgr->active) {
+        upump_uring_mgr_drain(uring_mgr);
+        if (ulist_empty(&uring_mgr->ready)) {
+            bool idle = !ulist_empty(&uring_mgr->idlers);
+            if (mutex != NULL)
+                umutex_unlock(mutex);
+            int ret = upump_uring_mgr_enter(uring_mgr, idle ? 0 : 1);
+            if (mutex != NULL)
+                umutex_lock(mutex);
+            if (unlikely(ret < 0 && errno != EINTR && errno != EAGAIN &&
+                         errno != EBUSY)) {
+                if (mutex != NULL)
+                    umutex_unlock(mutex);
+                return UBASE_ERR_EXTERNAL;
+            }
+
+            upump_uring_mgr_reap(uring_mgr);
+            if (ulist_empty(&uring_mgr->ready) &&
+                !ulist_empty(&uring_mgr->idlers)) {
+                /* run the first idler and rotate the list */
+                struct uchain *uchain = ulist_pop(&uring_mgr->idlers);
+                ulist_add(&uring_mgr->idlers, uchain);
+                upump_common_dispatch(
+                    upump_uring_to_upump(upump_uring_from_uchain(uchain)));
+                continue;
+            }
+        }
+
+        struct uchain *uchain;
+        while ((uchain = ulist_pop(&uring_mgr->ready)) != NULL)
+            upump_uring_dispatch(upump_uring_from_uchain(uchain));
+    }
+
+    if (mutex != NULL)
+        umutex_unlock(mutex);
+
+    return UBASE_ERR_NONE;
+}
+
+/** @This processes control commands on a upump_uring_mgr.
+ *
+ * @param mgr pointer to a upump_mgr structure
+ * @param command type of command to process
+ * @param args arguments of the command
+ * @return an error code
+ */
+static int upump_uring_mgr_control(struct upump_mgr *mgr,
+                                   int command, va_list args)
+{
+    switch (command) {
+        case UPUMP_MGR_RUN: {
+            struct umutex *mutex = va_arg(args, struct umutex *);
+            return upump_uring_mgr_run(mgr, mutex);
+        }
+        case UPUMP_MGR_VACUUM:
+            upump_common_mgr_vacuum(mgr);
+            return UBASE_ERR_NONE;
+        case UPUMP_MGR_SET_TIMER_TICK: {
+            uint64_t tick = va_arg(args, uint64_t);
+            return upump_common_mgr_set_timer_tick(mgr, tick);
+        }
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** @internal @This unmaps the rings and closes the io_uring instance.
+ *
+ * @param uring_mgr pointer to upump_uring_mgr structure
+ */
+static void upump_uring_mgr_close(struct upump_uring_mgr *uring_mgr)
+{
+    if (uring_mgr->sqes != NULL && uring_mgr->sqes != MAP_FAILED)
+        munmap(uring_mgr->sqes, uring_mgr->sqes_size);
+    if (uring_mgr->cq_ring != NULL && uring_mgr->cq_ring != MAP_FAILED &&
+        uring_mgr->cq_ring != uring_mgr->sq_ring)
+        munmap(uring_mgr->cq_ring, uring_mgr->cq_ring_size);
+    if (uring_mgr->sq_ring != NULL && uring_mgr->sq_ring != MAP_FAILED)
+        munmap(uring_mgr->sq_ring, uring_mgr->sq_ring_size);
+    if (uring_mgr->ring_fd >= 0)
+        close(uring_mgr->ring_fd);
+}
+
+/** @internal @This opens the io_uring instance and maps the rings.
+ *
+ * @param uring_mgr pointer to upump_uring_mgr structure
+ * @return false in case of error
+ */
+static bool upump_uring_mgr_open(struct upump_uring_mgr *uring_mgr)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    uring_mgr->sq_ring = uring_mgr->cq_ring = NULL;
+    uring_mgr->sqes = NULL;
+    uring_mgr->ring_fd = syscall(__NR_io_uring_setup, UPUMP_URING_ENTRIES,
+                                 &params);
+    if (uring_mgr->ring_fd < 0)
+        return false;
+
+    uring_mgr->sq_ring_size = params.sq_off.array +
+                              params.sq_entries * sizeof(unsigned);
+    uring_mgr->cq_ring_size = params.cq_off.cqes +
+                              params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring_mgr->cq_ring_size > uring_mgr->sq_ring_size)
+            uring_mgr->sq_ring_size = uring_mgr->cq_ring_size;
+        uring_mgr->cq_ring_size = uring_mgr->sq_ring_size;
+    }
+
+    uring_mgr->sq_ring = mmap(NULL, uring_mgr->sq_ring_size,
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, uring_mgr->ring_fd,
+                              IORING_OFF_SQ_RING);
+    if (uring_mgr->sq_ring == MAP_FAILED)
+        goto upump_uring_mgr_open_err;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        uring_mgr->cq_ring = uring_mgr->sq_ring;
+    else {
+        uring_mgr->cq_ring = mmap(NULL, uring_mgr->cq_ring_size,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE,
+                                  uring_mgr->ring_fd, IORING_OFF_CQ_RING);
+        if (uring_mgr->cq_ring == MAP_FAILED)
+            goto upump_uring_mgr_open_err;
+    }
+
+    uring_mgr->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring_mgr->sqes = mmap(NULL, uring_mgr->sqes_size,
+                           PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           uring_mgr->ring_fd, IORING_OFF_SQES);
+    if (uring_mgr->sqes == MAP_FAILED)
+        goto upump_uring_mgr_open_err;
+
+    uint8_t *sq_ring = uring_mgr->sq_ring;
+    uring_mgr->sq_khead = (unsigned *)(sq_ring + params.sq_off.head);
+    uring_mgr->sq_ktail = (unsigned *)(sq_ring + params.sq_off.tail);
+    uring_mgr->sq_mask = *(unsigned *)(sq_ring + params.sq_off.ring_mask);
+    uring_mgr->sq_entries =
+        *(unsigned *)(sq_ring + params.sq_off.ring_entries);
+    uring_mgr->sq_array = (unsigned *)(sq_ring + params.sq_off.array);
+    uring_mgr->sq_tail = *uring_mgr->sq_ktail;
+    uring_mgr->sq_pending = 0;
+
+    uint8_t *cq_ring = uring_mgr->cq_ring;
+    uring_mgr->cq_khead = (unsigned *)(cq_ring + params.cq_off.head);
+    uring_mgr->cq_ktail = (unsigned *)(cq_ring + params.cq_off.tail);
+    uring_mgr->cq_mask = *(unsigned *)(cq_ring + params.cq_off.ring_mask);
+    uring_mgr->cqes = (struct io_uring_cqe *)(cq_ring + params.cq_off.cqes);
+    return true;
+
+upump_uring_mgr_open_err:
+    upump_uring_mgr_close(uring_mgr);
+    return false;
+}
+
+/** @This frees a upump manager.
+ *
+ * @param urefcount pointer to urefcount
+ */
+static void upump_uring_mgr_free(struct urefcount *urefcount)
+{
+    struct upump_uring_mgr *uring_mgr =
+        upump_uring_mgr_from_urefcount(urefcount);
+    upump_common_mgr_clean(upump_uring_mgr_to_upump_mgr(uring_mgr));
+    upump_uring_mgr_close(uring_mgr);
+    free(uring_mgr);
+}
+
+/** @This allocates and initializes a upump_mgr structure bound to a new
+ * io_uring instance.
+ *
+ * @param upump_pool_depth maximum number of upump structures in the pool
+ * @param upump_blocker_pool_depth maximum number of upump_blocker structures in
+ * the pool
+ * @return pointer to the wrapped upump_mgr structure, or NULL if io_uring is
+ * not available
+ */
+struct upump_mgr *upump_uring_mgr_alloc(uint16_t upump_pool_depth,
+                                        uint16_t upump_blocker_pool_depth)
+{
+    struct upump_uring_mgr *uring_mgr =
+        malloc(sizeof(struct upump_uring_mgr) +
+               upump_common_mgr_sizeof(upump_pool_depth,
+                                       upump_blocker_pool_depth));
+    if (unlikely(uring_mgr == NULL))
+        return NULL;
+
+    if (unlikely(!upump_uring_mgr_open(uring_mgr))) {
+        free(uring_mgr);
+        return NULL;
+    }
+
+    ulist_init(&uring_mgr->idlers);
+    ulist_init(&uring_mgr->ready);
+    ulist_init(&uring_mgr->deferred);
+    uring_mgr->active = 0;
+    memset(uring_mgr->signals, 0, sizeof(uring_mgr->signals));
+
+    struct upump_mgr *mgr = upump_uring_mgr_to_upump_mgr(uring_mgr);
+    mgr->signature = UPUMP_URING_SIGNATURE;
+    urefcount_init(upump_uring_mgr_to_urefcount(uring_mgr),
+                   upump_uring_mgr_free);
+    uring_mgr->common_mgr.mgr.refcount =
+        upump_uring_mgr_to_urefcount(uring_mgr);
+    uring_mgr->common_mgr.mgr.upump_alloc = upump_uring_alloc;
+    uring_mgr->common_mgr.mgr.upump_control = upump_uring_control;
+    uring_mgr->common_mgr.mgr.upump_mgr_control = upump_uring_mgr_control;
+
+    upump_common_mgr_init(mgr, upump_pool_depth, upump_blocker_pool_depth,
+                          uring_mgr->upool_extra,
+                          upump_uring_real_start, upump_uring_real_stop,
+                          upump_uring_alloc_inner, upump_uring_free_inner);
+    return mgr;
+}
@@ -131,6 +131,68 @@ int main(int argc, char **argv)
     udict_free(udict2);
 
     udict_free(udict1);
+
+    /* many attributes, indexed or not */
+    for (int nb = 8; nb <= 64; nb += 56) {
+        udict1 = udict_alloc(mgr, 0);
+        assert(udict1 != NULL);
+        char name[16];
+        for (int i = 0; i < nb; i++) {
+            snprintf(name, sizeof(name), "x.attr%d", i);
+            ubase_assert(udict_set_unsigned(udict1, i, UDICT_TYPE_UNSIGNED,
+                                            name));
+            ubase_assert(udict_set_string(udict1, "a", UDICT_TYPE_STRING,
+                                          name));
+        }
+        ubase_assert(udict_set_unsigned(udict1, nb, UDICT_TYPE_CLOCK_DURATION,
+                                        NULL));
+        for (int i = 0; i < nb; i += 2) {
+            snprintf(name, sizeof(name), "x.attr%d", i);
+            ubase_assert(udict_delete(udict1, UDICT_TYPE_UNSIGNED, name));
+            ubase_assert(udict_set_string(udict1, SALUTATION,
+                                          UDICT_TYPE_STRING, name));
+        }
+
+        udict2 = udict_dup(udict1);
+        assert(udict2 != NULL);
+        for (int i = 0; i < nb; i++) {
+            snprintf(name, sizeof(name), "x.attr%d", i);
+            if (i % 2) {
+                ubase_assert(udict_get_unsigned(udict1, &u,
+                                                UDICT_TYPE_UNSIGNED, name));
+                assert(u == i);
+                ubase_assert(udict_get_string(udict2, &string,
+                                              UDICT_TYPE_STRING, name));
+                assert(!strcmp(string, "a"));
+            } else {
+                ubase_nassert(udict_get_unsigned(udict1, &u,
+                                                 UDICT_TYPE_UNSIGNED, name));
+                ubase_assert(udict_get_string(udict2, &string,
+                                              UDICT_TYPE_STRING, name));
+                assert(!strcmp(string, SALUTATION));
+            }
+            ubase_nassert(udict_get_string(udict2, &string,
+                                           UDICT_TYPE_STRING, "x.attr"));
+        }
+        ubase_assert(udict_get_unsigned(udict2, &u, UDICT_TYPE_CLOCK_DURATION,
+                                        NULL));
+        assert(u == nb);
+
+        /* the copies are independent */
+        ubase_assert(udict_set_unsigned(udict2, 0, UDICT_TYPE_CLOCK_DURATION,
+                                        NULL));
+        ubase_assert(udict_delete(udict1, UDICT_TYPE_STRING, "x.attr1"));
+        ubase_assert(udict_get_unsigned(udict1, &u, UDICT_TYPE_CLOCK_DURATION,
+                                        NULL));
+        assert(u == nb);
+        ubase_assert(udict_get_string(udict2, &string, UDICT_TYPE_STRING,
+                                      "x.attr1"));
+        ubase_nassert(udict_get_string(udict1, &string, UDICT_TYPE_STRING,
+                                       "x.attr1"));
+        udict_free(udict2);
+        udict_free(udict1);
+    }
+
     udict_mgr_release(mgr);
 
     umem_mgr_release(umem_mgr);
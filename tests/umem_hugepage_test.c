@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for huge-page umem manager
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubase.h>
+#include <upipe/umem.h>
+#include <upipe/umem_hugepage.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#define ARENA_SIZE (4 << 20)
+
+int main(int argc, char **argv)
+{
+    struct umem_mgr *mgr = umem_hugepage_mgr_alloc(ARENA_SIZE - 1, -1);
+    assert(mgr != NULL);
+
+    struct umem_hugepage_usage usage;
+    ubase_assert(umem_hugepage_mgr_get_usage(mgr, &usage));
+    assert(usage.arena_size == ARENA_SIZE);
+    assert(usage.arena_used == 0);
+    assert(usage.arena_busy == 0);
+    assert(usage.fallbacks == 0);
+    printf("Arena of %zu octets (hugetlb: %d, node: %d)\n",
+           usage.arena_size, usage.hugetlb ? 1 : 0, usage.node);
+
+    /* small buffers are not allocated from the arena */
+    struct umem umem;
+    assert(umem_alloc(mgr, &umem, 42));
+    uint8_t *p = umem_buffer(&umem);
+    assert(p != NULL);
+    memset(p, 0x42, 42);
+    ubase_assert(umem_hugepage_mgr_get_usage(mgr, &usage));
+    assert(usage.fallbacks == 1);
+    assert(usage.arena_used == 0);
+    printf("Passed 1\n");
+
+    assert(umem_realloc(&umem, 8192));
+    p = umem_buffer(&umem);
+    assert(p != NULL);
+    assert(p[0] == 0x42);
+    assert(p[41] == 0x42);
+    memset(p + 42, 0x43, 8192 - 42);
+    ubase_assert(umem_hugepage_mgr_get_usage(mgr, &usage));
+    assert(usage.arena_used == 8192);
+    assert(usage.arena_busy == 8192);
+    printf("Passed 2\n");
+
+    assert(umem_realloc(&umem, 8000));
+    assert(umem_buffer(&umem) == p);
+    umem_free(&umem);
+    ubase_assert(umem_hugepage_mgr_get_usage(mgr, &usage));
+    assert(usage.arena_used == 8192);
+    assert(usage.arena_busy == 0);
+    printf("Passed 3\n");
+
+    /* freed buffers are recycled */
+    assert(umem_alloc(mgr, &umem, 5000));
+    assert(umem_buffer(&umem) == p);
+    umem_free(&umem);
+    printf("Passed 4\n");
+
+    /* exhaust the arena */
+    struct umem big[2];
+    assert(umem_alloc(mgr, &big[0], 2 << 20));
+    assert(umem_alloc(mgr, &big[1], 2 << 20));
+    ubase_assert(umem_hugepage_mgr_get_usage(mgr, &usage));
+    assert(usage.fallbacks == 2);
+    assert(usage.arena_busy == 2 << 20);
+    memset(umem_buffer(&big[0]), 0x44, 2 << 20);
+    memset(umem_buffer(&big[1]), 0x45, 2 << 20);
+    umem_free(&big[0]);
+    umem_free(&big[1]);
+    ubase_assert(umem_hugepage_mgr_get_usage(mgr, &usage));
+    assert(usage.arena_busy == 0);
+    printf("Passed 5\n");
+
+    umem_mgr_release(mgr);
+    return 0;
+}
@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2026 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for aes decrypt pipes
+ */
+
+#undef NDEBUG
+
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uprobe_ubuf_mem.h>
+#include <upipe/umem.h>
+#include <upipe/umem_alloc.h>
+#include <upipe/udict.h>
+#include <upipe/udict_inline.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block.h>
+#include <upipe/ubuf_block_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_block_flow.h>
+#include <upipe/uref_std.h>
+#include <upipe/upipe.h>
+#include <upipe-modules/upipe_aes_decrypt.h>
+#include <upipe-modules/uref_aes_flow.h>
+
+#include "../lib/upipe-modules/upipe_aes_cbc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#define UDICT_POOL_DEPTH 0
+#define UREF_POOL_DEPTH 0
+#define UBUF_POOL_DEPTH 0
+#define UPROBE_LOG_LEVEL UPROBE_LOG_VERBOSE
+
+/** AES-128 key of NIST SP800-38A */
+static const uint8_t key[16] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+    0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+
+/** initialization vector of NIST SP800-38A */
+static const uint8_t iv[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+
+/** bytes 0 to 159 encrypted in CBC mode */
+static const uint8_t ciphertext[160] = {
+    0x7d, 0xf7, 0x6b, 0x0c, 0x1a, 0xb8, 0x99, 0xb3,
+    0x3e, 0x42, 0xf0, 0x47, 0xb9, 0x1b, 0x54, 0x6f,
+    0x1c, 0xaa, 0x80, 0x18, 0xc8, 0x0b, 0x15, 0xb8,
+    0xe7, 0xae, 0xa8, 0x27, 0x94, 0xad, 0xcb, 0x00,
+    0xbb, 0xc1, 0xe2, 0x95, 0x91, 0x0b, 0x9d, 0xe4,
+    0xf1, 0x35, 0x8d, 0xcb, 0x42, 0x13, 0xbd, 0xd8,
+    0xee, 0xfa, 0x31, 0x54, 0x21, 0x5f, 0x47, 0x09,
+    0xaf, 0x46, 0x57, 0x3f, 0xc8, 0xcb, 0x07, 0xb9,
+    0x86, 0x0d, 0xc1, 0xdd, 0x67, 0xdd, 0xfd, 0x95,
+    0x2b, 0x41, 0xe3, 0xaa, 0x0c, 0xc4, 0x7a, 0x96,
+    0x48, 0x73, 0x85, 0x34, 0xd3, 0x7e, 0x5e, 0x29,
+    0xae, 0x21, 0x35, 0xaf, 0x75, 0x32, 0xe4, 0x1c,
+    0x14, 0x28, 0xb8, 0x47, 0xec, 0x62, 0x48, 0xfa,
+    0x03, 0x56, 0x8d, 0x55, 0x16, 0x3a, 0xa8, 0x98,
+    0x85, 0xe7, 0x57, 0xfd, 0x9c, 0x61, 0x99, 0x91,
+    0x78, 0xf9, 0x6a, 0x3c, 0x78, 0xf2, 0x6b, 0xef,
+    0xff, 0x9a, 0x03, 0x69, 0x1d, 0x10, 0xad, 0x99,
+    0x2b, 0x32, 0xf6, 0x74, 0xd0, 0x30, 0x94, 0xa6,
+    0x9b, 0x14, 0x87, 0x41, 0x26, 0x56, 0x3f, 0x8f,
+    0xf0, 0xa3, 0x03, 0x37, 0x8a, 0x36, 0xcb, 0xdd
+};
+
+static uint8_t plaintext[sizeof (ciphertext)];
+static size_t received = 0;
+
+/** definition of our uprobe */
+static int catch(struct uprobe *uprobe, struct upipe *upipe,
+                 int event, va_list args)
+{
+    switch (event) {
+        default:
+            assert(0);
+            break;
+        case UPROBE_READY:
+        case UPROBE_DEAD:
+        case UPROBE_NEW_FLOW_DEF:
+            break;
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** helper phony pipe */
+static struct upipe *test_alloc(struct upipe_mgr *mgr, struct uprobe *uprobe,
+                                uint32_t signature, va_list args)
+{
+    struct upipe *upipe = malloc(sizeof(struct upipe));
+    assert(upipe != NULL);
+    upipe_init(upipe, mgr, uprobe);
+    return upipe;
+}
+
+/** helper phony pipe */
+static void test_input(struct upipe *upipe, struct uref *uref,
+                       struct upump **upump_p)
+{
+    size_t size;
+    ubase_assert(uref_block_size(uref, &size));
+    assert(size % 16 == 0);
+    assert(received + size <= sizeof (plaintext));
+    ubase_assert(uref_block_extract(uref, 0, size, plaintext + received));
+    received += size;
+    uref_free(uref);
+}
+
+/** helper phony pipe */
+static int test_control(struct upipe *upipe, int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_SET_FLOW_DEF:
+            return UBASE_ERR_NONE;
+        case UPIPE_REGISTER_REQUEST: {
+            struct urequest *urequest = va_arg(args, struct urequest *);
+            return upipe_throw_provide_request(upipe, urequest);
+        }
+        case UPIPE_UNREGISTER_REQUEST:
+            return UBASE_ERR_NONE;
+        default:
+            assert(0);
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** helper phony pipe */
+static void test_free(struct upipe *upipe)
+{
+    upipe_clean(upipe);
+    free(upipe);
+}
+
+/** helper phony pipe */
+static struct upipe_mgr aes_decrypt_test_mgr = {
+    .refcount = NULL,
+    .upipe_alloc = test_alloc,
+    .upipe_input = test_input,
+    .upipe_control = test_control
+};
+
+/** decrypts the ciphertext with an implementation, in runs of 1 to 4
+ * blocks */
+static void test_cbc(const char *name, upipe_aes_cbc_decrypt cbc_decrypt)
+{
+    struct upipe_aes_cbc cbc;
+    uint8_t buffer[sizeof (ciphertext)];
+    unsigned int nb_blocks = sizeof (buffer) / 16;
+
+    printf("testing %s implementation\n", name);
+
+    /* whole buffer at once */
+    upipe_aes_cbc_init(&cbc, key, iv);
+    memcpy(buffer, ciphertext, sizeof (buffer));
+    cbc_decrypt(&cbc, buffer, nb_blocks);
+    for (unsigned i = 0; i < sizeof (buffer); i++)
+        assert(buffer[i] == i);
+    assert(!memcmp(cbc.iv, ciphertext + sizeof (ciphertext) - 16, 16));
+
+    /* runs of varying length, chaining the initialization vector */
+    upipe_aes_cbc_init(&cbc, key, iv);
+    memcpy(buffer, ciphertext, sizeof (buffer));
+    for (unsigned i = 0, run = 1; i < nb_blocks; i += run, run = run % 4 + 1) {
+        if (run > nb_blocks - i)
+            run = nb_blocks - i;
+        cbc_decrypt(&cbc, buffer + i * 16, run);
+    }
+    for (unsigned i = 0; i < sizeof (buffer); i++)
+        assert(buffer[i] == i);
+}
+
+/** allocates a block buffer holding a part of the ciphertext */
+static struct ubuf *alloc_ciphertext(struct ubuf_mgr *ubuf_mgr,
+                                     size_t offset, int size)
+{
+    struct ubuf *ubuf = ubuf_block_alloc(ubuf_mgr, size);
+    assert(ubuf != NULL);
+    uint8_t *buffer;
+    ubase_assert(ubuf_block_write(ubuf, 0, &size, &buffer));
+    memcpy(buffer, ciphertext + offset, size);
+    ubase_assert(ubuf_block_unmap(ubuf, 0));
+    return ubuf;
+}
+
+int main(int argc, char *argv[])
+{
+    test_cbc("c", upipe_aes_cbc_decrypt_c);
+#ifdef UPIPE_HAVE_X86_SIMD
+    if (__builtin_cpu_supports("aes"))
+        test_cbc("aesni", upipe_aes_cbc_decrypt_aesni);
+    if (__builtin_cpu_supports("aes") && __builtin_cpu_supports("vaes") &&
+        __builtin_cpu_supports("avx2"))
+        test_cbc("vaes", upipe_aes_cbc_decrypt_vaes);
+#endif
+
+    struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
+    assert(umem_mgr != NULL);
+    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(UDICT_POOL_DEPTH,
+                                                         umem_mgr, -1, -1);
+    assert(udict_mgr != NULL);
+    struct uref_mgr *uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH, udict_mgr,
+                                                   0);
+    assert(uref_mgr != NULL);
+    struct ubuf_mgr *ubuf_mgr = ubuf_block_mem_mgr_alloc(UBUF_POOL_DEPTH,
+                                                         UBUF_POOL_DEPTH,
+                                                         umem_mgr, 0, 0, 0, 0);
+    assert(ubuf_mgr != NULL);
+
+    struct uprobe uprobe;
+    uprobe_init(&uprobe, catch, NULL);
+    struct uprobe *logger = uprobe_stdio_alloc(&uprobe, stdout,
+                                               UPROBE_LOG_LEVEL);
+    assert(logger != NULL);
+    logger = uprobe_ubuf_mem_alloc(logger, umem_mgr, UBUF_POOL_DEPTH,
+                                   UBUF_POOL_DEPTH);
+    assert(logger != NULL);
+
+    struct upipe *upipe_sink = upipe_void_alloc(&aes_decrypt_test_mgr,
+                                                uprobe_use(logger));
+    assert(upipe_sink != NULL);
+
+    struct upipe_mgr *upipe_aes_decrypt_mgr = upipe_aes_decrypt_mgr_alloc();
+    assert(upipe_aes_decrypt_mgr != NULL);
+    struct upipe *upipe_aes_decrypt = upipe_void_alloc(upipe_aes_decrypt_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "aes"));
+    assert(upipe_aes_decrypt != NULL);
+    ubase_assert(upipe_set_output(upipe_aes_decrypt, upipe_sink));
+
+    struct uref *uref = uref_block_flow_alloc_def(uref_mgr, "aes.");
+    assert(uref != NULL);
+    ubase_assert(uref_aes_set_method(uref, "AES-128"));
+    ubase_assert(uref_aes_set_key(uref, key, sizeof (key)));
+    ubase_assert(uref_aes_set_iv(uref, iv, sizeof (iv)));
+    ubase_assert(upipe_set_flow_def(upipe_aes_decrypt, uref));
+    uref_free(uref);
+
+    /* incomplete block */
+    uref = uref_alloc(uref_mgr);
+    assert(uref != NULL);
+    uref_attach_ubuf(uref, alloc_ciphertext(ubuf_mgr, 0, 7));
+    upipe_input(upipe_aes_decrypt, uref, NULL);
+    assert(received == 0);
+
+    /* segmented buffer with blocks straddling segments */
+    struct ubuf *ubuf = alloc_ciphertext(ubuf_mgr, 7, 45);
+    ubase_assert(ubuf_block_append(ubuf,
+                                   alloc_ciphertext(ubuf_mgr, 52, 105)));
+    uref = uref_alloc(uref_mgr);
+    assert(uref != NULL);
+    uref_attach_ubuf(uref, ubuf);
+    upipe_input(upipe_aes_decrypt, uref, NULL);
+    assert(received == 144);
+
+    /* shared buffer */
+    ubuf = alloc_ciphertext(ubuf_mgr, 157, 3);
+    struct ubuf *dup = ubuf_dup(ubuf);
+    assert(dup != NULL);
+    uref = uref_alloc(uref_mgr);
+    assert(uref != NULL);
+    uref_attach_ubuf(uref, ubuf);
+    upipe_input(upipe_aes_decrypt, uref, NULL);
+    assert(received == sizeof (plaintext));
+
+    const uint8_t *buffer;
+    int size = 3;
+    ubase_assert(ubuf_block_read(dup, 0, &size, &buffer));
+    assert(!memcmp(buffer, ciphertext + 157, 3));
+    ubase_assert(ubuf_block_unmap(dup, 0));
+    ubuf_free(dup);
+
+    for (unsigned i = 0; i < sizeof (plaintext); i++)
+        assert(plaintext[i] == i);
+
+    upipe_release(upipe_aes_decrypt);
+    upipe_mgr_release(upipe_aes_decrypt_mgr); // nop
+
+    test_free(upipe_sink);
+
+    ubuf_mgr_release(ubuf_mgr);
+    uref_mgr_release(uref_mgr);
+    udict_mgr_release(udict_mgr);
+    umem_mgr_release(umem_mgr);
+    uprobe_release(logger);
+    uprobe_clean(&uprobe);
+
+    return 0;
+}
@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) 2026 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for the dvbcsa bitslice pipes and their pool of threads
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubase.h>
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uprobe_uref_mgr.h>
+#include <upipe/uprobe_upump_mgr.h>
+#include <upipe/uprobe_uclock.h>
+#include <upipe/uprobe_ubuf_mem.h>
+#include <upipe/umem.h>
+#include <upipe/umem_alloc.h>
+#include <upipe/udict.h>
+#include <upipe/udict_inline.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_block_flow.h>
+#include <upipe/uref_clock.h>
+#include <upipe/uref_std.h>
+#include <upipe/uclock.h>
+#include <upipe/uclock_std.h>
+#include <upipe/upump.h>
+#include <upump-ev/upump_ev.h>
+#include <upipe/upipe.h>
+#include <upipe-dvbcsa/upipe_dvbcsa_common.h>
+#include <upipe-dvbcsa/upipe_dvbcsa_bs_encrypt.h>
+#include <upipe-dvbcsa/upipe_dvbcsa_bs_decrypt.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <bitstream/mpeg/ts.h>
+
+#define UDICT_POOL_DEPTH 0
+#define UREF_POOL_DEPTH 0
+#define UBUF_POOL_DEPTH 0
+#define UPUMP_POOL 0
+#define UPUMP_BLOCKER_POOL 0
+#define UPROBE_LOG_LEVEL UPROBE_LOG_DEBUG
+#define NB_PACKETS 3000
+#define NB_THREADS 4
+/** scrambled PIDs, the last one is left in the clear */
+#define NB_PIDS 3
+static const uint16_t pids[NB_PIDS] = { 101, 102, 100 };
+#define KEY1 "0123456789ab"
+#define KEY2 "a5a5a55a5a5a"
+/** the key changes before this packet */
+#define KEY_CHANGE 1111
+/** maximum latency of the pipes */
+#define LATENCY (UCLOCK_FREQ / 50)
+/** datagrams of 7 packets */
+#define DATAGRAM 7
+/** interval between datagrams */
+#define INTERVAL (UCLOCK_FREQ / 3000)
+
+/** number of threads set before a packet */
+static const struct {
+    unsigned int packet;
+    unsigned int nb_threads;
+} thread_changes[] = {
+    { 900, 2 },
+    { 1500, 0 },
+    { 2000, 1 },
+    { 2600, NB_THREADS },
+};
+
+static struct uprobe *logger;
+static struct upump_mgr *upump_mgr;
+static struct uref_mgr *uref_mgr;
+static struct ubuf_mgr *ubuf_mgr;
+
+static uint8_t clear[NB_PACKETS][TS_SIZE];
+static uint8_t scrambled[NB_PACKETS][TS_SIZE];
+/** expected output, or NULL to record it */
+static uint8_t (*expected)[TS_SIZE];
+/** recorded output */
+static uint8_t (*recorded)[TS_SIZE];
+static unsigned int nb_output;
+
+/** definition of our uprobe */
+static int catch(struct uprobe *uprobe, struct upipe *upipe,
+                 int event, va_list args)
+{
+    switch (event) {
+        default:
+            assert(0);
+            break;
+        case UPROBE_READY:
+        case UPROBE_DEAD:
+        case UPROBE_NEW_FLOW_DEF:
+        case UPROBE_FREEZE_UPUMP_MGR:
+        case UPROBE_THAW_UPUMP_MGR:
+            break;
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** helper phony pipe */
+static struct upipe *test_alloc(struct upipe_mgr *mgr, struct uprobe *uprobe,
+                                uint32_t signature, va_list args)
+{
+    struct upipe *upipe = malloc(sizeof(struct upipe));
+    assert(upipe != NULL);
+    upipe_init(upipe, mgr, uprobe);
+    return upipe;
+}
+
+/** helper phony pipe */
+static void test_input(struct upipe *upipe, struct uref *uref,
+                       struct upump **upump_p)
+{
+    assert(nb_output < NB_PACKETS);
+    uint8_t buffer[TS_SIZE];
+    ubase_assert(uref_block_extract(uref, 0, TS_SIZE, buffer));
+    uref_free(uref);
+
+    if (expected == NULL)
+        memcpy(recorded[nb_output], buffer, TS_SIZE);
+    else
+        /* same content, in the same order */
+        assert(!memcmp(expected[nb_output], buffer, TS_SIZE));
+    nb_output++;
+}
+
+/** helper phony pipe */
+static int test_control(struct upipe *upipe, int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_SET_FLOW_DEF:
+            return UBASE_ERR_NONE;
+        case UPIPE_REGISTER_REQUEST: {
+            struct urequest *urequest = va_arg(args, struct urequest *);
+            return upipe_throw_provide_request(upipe, urequest);
+        }
+        case UPIPE_UNREGISTER_REQUEST:
+            return UBASE_ERR_NONE;
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** helper phony pipe */
+static void test_free(struct upipe *upipe)
+{
+    upipe_clean(upipe);
+    free(upipe);
+}
+
+/** helper phony pipe */
+static struct upipe_mgr test_mgr = {
+    .refcount = NULL,
+    .signature = 0,
+    .upipe_alloc = test_alloc,
+    .upipe_input = test_input,
+    .upipe_control = test_control
+};
+
+/** builds the clear packets, some of them with an adaptation field */
+static void build_clear(void)
+{
+    for (unsigned int i = 0; i < NB_PACKETS; i++) {
+        uint8_t *ts = clear[i];
+        ts_init(ts);
+        ts_set_pid(ts, pids[i % NB_PIDS]);
+        ts_set_cc(ts, i / NB_PIDS);
+        ts_set_payload(ts);
+        if (!(i % 5))
+            ts_set_adaptation(ts, i % 170);
+        uint8_t *payload = ts_payload(ts);
+        for (uint8_t *p = payload; p < ts + TS_SIZE; p++)
+            *p = i * 7 + (p - payload);
+    }
+}
+
+/** runs the packets through a pipe
+ *
+ * @param mgr manager of the pipe
+ * @param input packets to send
+ * @param nb_threads initial number of threads
+ * @param change_threads true to change the number of threads mid-stream
+ */
+static void run(struct upipe_mgr *mgr, uint8_t (*input)[TS_SIZE],
+                unsigned int nb_threads, bool change_threads)
+{
+    nb_output = 0;
+    struct upipe *upipe_sink = upipe_void_alloc(&test_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "sink"));
+    assert(upipe_sink != NULL);
+
+    struct uref *flow_def = uref_block_flow_alloc_def(uref_mgr, "mpegts.");
+    assert(flow_def != NULL);
+    struct upipe *upipe = upipe_void_alloc(mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "dvbcsa"));
+    assert(upipe != NULL);
+    ubase_assert(upipe_set_output(upipe, upipe_sink));
+    ubase_assert(upipe_set_flow_def(upipe, flow_def));
+    uref_free(flow_def);
+    ubase_assert(upipe_dvbcsa_set_max_latency(upipe, LATENCY));
+    for (unsigned int i = 0; i < NB_PIDS - 1; i++)
+        ubase_assert(upipe_dvbcsa_add_pid(upipe, pids[i]));
+    ubase_assert(upipe_dvbcsa_set_key(upipe, KEY1));
+    ubase_assert(upipe_dvbcsa_set_threads(upipe, nb_threads));
+
+    unsigned int change = 0;
+    for (unsigned int i = 0; i < NB_PACKETS; i++) {
+        if (i == KEY_CHANGE)
+            ubase_assert(upipe_dvbcsa_set_key(upipe, KEY2));
+        if (change_threads && change < UBASE_ARRAY_SIZE(thread_changes) &&
+            thread_changes[change].packet == i) {
+            /* the batches submitted to the pool are not output yet */
+            if (nb_threads)
+                assert(nb_output < i);
+            nb_threads = thread_changes[change++].nb_threads;
+            ubase_assert(upipe_dvbcsa_set_threads(upipe, nb_threads));
+        }
+
+        struct uref *uref = uref_block_alloc(uref_mgr, ubuf_mgr, TS_SIZE);
+        assert(uref != NULL);
+        uint8_t *buffer;
+        int size = -1;
+        ubase_assert(uref_block_write(uref, 0, &size, &buffer));
+        assert(size == TS_SIZE);
+        memcpy(buffer, input[i], TS_SIZE);
+        uref_block_unmap(uref, 0);
+        uref_clock_set_cr_sys(uref, (i / DATAGRAM) * INTERVAL);
+        upipe_input(upipe, uref, NULL);
+    }
+    assert(!change_threads || change == UBASE_ARRAY_SIZE(thread_changes));
+
+    /* the remaining packets are output once the maximum latency expires */
+    upipe_release(upipe);
+    upump_mgr_run(upump_mgr, NULL);
+    assert(nb_output == NB_PACKETS);
+    test_free(upipe_sink);
+}
+
+int main(int argc, char *argv[])
+{
+    struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
+    assert(umem_mgr != NULL);
+    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(UDICT_POOL_DEPTH,
+                                                         umem_mgr, -1, -1);
+    assert(udict_mgr != NULL);
+    uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH, udict_mgr, 0);
+    assert(uref_mgr != NULL);
+    ubuf_mgr = ubuf_block_mem_mgr_alloc(UBUF_POOL_DEPTH, UBUF_POOL_DEPTH,
+                                        umem_mgr, 0, 0, -1, 0);
+    assert(ubuf_mgr != NULL);
+    upump_mgr = upump_ev_mgr_alloc_default(UPUMP_POOL, UPUMP_BLOCKER_POOL);
+    assert(upump_mgr != NULL);
+    struct uclock *uclock = uclock_std_alloc(0);
+    assert(uclock != NULL);
+
+    struct uprobe uprobe;
+    uprobe_init(&uprobe, catch, NULL);
+    logger = uprobe_stdio_alloc(&uprobe, stdout, UPROBE_LOG_LEVEL);
+    assert(logger != NULL);
+    logger = uprobe_uref_mgr_alloc(logger, uref_mgr);
+    assert(logger != NULL);
+    logger = uprobe_upump_mgr_alloc(logger, upump_mgr);
+    assert(logger != NULL);
+    logger = uprobe_uclock_alloc(logger, uclock);
+    assert(logger != NULL);
+    logger = uprobe_ubuf_mem_alloc(logger, umem_mgr, UBUF_POOL_DEPTH,
+                                   UBUF_POOL_DEPTH);
+    assert(logger != NULL);
+
+    struct upipe_mgr *upipe_dvbcsa_bs_enc_mgr =
+        upipe_dvbcsa_bs_enc_mgr_alloc();
+    assert(upipe_dvbcsa_bs_enc_mgr != NULL);
+    struct upipe_mgr *upipe_dvbcsa_bs_dec_mgr =
+        upipe_dvbcsa_bs_dec_mgr_alloc();
+    assert(upipe_dvbcsa_bs_dec_mgr != NULL);
+
+    build_clear();
+
+    /* reference scrambling in the pipe thread */
+    expected = NULL;
+    recorded = scrambled;
+    run(upipe_dvbcsa_bs_enc_mgr, clear, 0, false);
+    for (unsigned int i = 0; i < NB_PACKETS; i++) {
+        if (i % NB_PIDS == NB_PIDS - 1) {
+            assert(!memcmp(scrambled[i], clear[i], TS_SIZE));
+            continue;
+        }
+        assert(ts_get_scrambling(scrambled[i]) == 0x2);
+        assert(memcmp(ts_payload(scrambled[i]), ts_payload(clear[i]),
+                      TS_SIZE - (ts_payload(clear[i]) - clear[i])));
+    }
+
+    /* the pool of threads scrambles the same way */
+    expected = scrambled;
+    run(upipe_dvbcsa_bs_enc_mgr, clear, NB_THREADS, false);
+    run(upipe_dvbcsa_bs_enc_mgr, clear, NB_THREADS, true);
+
+    /* descrambling with and without the pool gives back the clear packets */
+    expected = clear;
+    run(upipe_dvbcsa_bs_dec_mgr, scrambled, 0, false);
+    run(upipe_dvbcsa_bs_dec_mgr, scrambled, 0, true);
+    run(upipe_dvbcsa_bs_dec_mgr, scrambled, NB_THREADS, false);
+    run(upipe_dvbcsa_bs_dec_mgr, scrambled, NB_THREADS, true);
+
+    upipe_mgr_release(upipe_dvbcsa_bs_enc_mgr);
+    upipe_mgr_release(upipe_dvbcsa_bs_dec_mgr);
+
+    upump_mgr_release(upump_mgr);
+    uclock_release(uclock);
+    uref_mgr_release(uref_mgr);
+    ubuf_mgr_release(ubuf_mgr);
+    udict_mgr_release(udict_mgr);
+    umem_mgr_release(umem_mgr);
+    uprobe_release(logger);
+    uprobe_clean(&uprobe);
+
+    return 0;
+}
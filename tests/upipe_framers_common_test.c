@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2026 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for framers common utils
+ */
+
+#undef NDEBUG
+
+#include <upipe-framers/upipe_framers_common.h>
+#include "../lib/upipe-framers/upipe_framers_mpeg_scan.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#define BUFFER_SIZE 4096
+#define MAX_SEGMENTS 8
+#define ITERATIONS 2000
+
+typedef const uint8_t *(*scan_func)(const uint8_t *restrict,
+                                    const uint8_t *, uint32_t *restrict);
+
+/** helper to scan a buffer split in segments, as the framers do with
+ * the segments of a ubuf */
+static unsigned int scan(scan_func func, const uint8_t *buffer,
+                         const size_t *splits, unsigned int nb_splits,
+                         size_t *offsets, uint32_t *states)
+{
+    uint32_t state = 0xffffffff;
+    unsigned int found = 0;
+    size_t start = 0;
+    for (unsigned int i = 0; i <= nb_splits; i++) {
+        size_t stop = i < nb_splits ? splits[i] : BUFFER_SIZE;
+        const uint8_t *p = buffer + start;
+        const uint8_t *end = buffer + stop;
+        while (p < end) {
+            p = func(p, end, &state);
+            assert(p > buffer + start && p <= end);
+            if ((state & 0xffffff00) == 0x100) {
+                offsets[found] = p - buffer;
+                states[found] = state;
+                found++;
+            }
+        }
+        start = stop;
+    }
+    states[found] = state;
+    return found;
+}
+
+static int compare_size(const void *a, const void *b)
+{
+    size_t x = *(const size_t *)a, y = *(const size_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void test_scan(const char *name, scan_func func)
+{
+    static uint8_t buffer[BUFFER_SIZE];
+    static size_t offsets_c[BUFFER_SIZE], offsets[BUFFER_SIZE];
+    static uint32_t states_c[BUFFER_SIZE + 1], states[BUFFER_SIZE + 1];
+
+    printf("testing %s\n", name);
+    srand(42);
+    for (int iter = 0; iter < ITERATIONS; iter++) {
+        /* mostly zeroes and ones, to stress partial start codes */
+        int sparse = iter % 4;
+        for (int i = 0; i < BUFFER_SIZE; i++)
+            buffer[i] = sparse ? (rand() % (sparse * 8) ? rand() : 0) :
+                                 rand() % 3;
+
+        int nb_codes = rand() % 32;
+        for (int i = 0; i < nb_codes; i++) {
+            int pos = rand() % (BUFFER_SIZE - 3);
+            buffer[pos] = 0;
+            buffer[pos + 1] = 0;
+            buffer[pos + 2] = 1;
+        }
+
+        size_t splits[MAX_SEGMENTS];
+        unsigned int nb_splits = rand() % MAX_SEGMENTS;
+        for (unsigned int i = 0; i < nb_splits; i++)
+            splits[i] = 1 + rand() % (BUFFER_SIZE - 1);
+        qsort(splits, nb_splits, sizeof (size_t), compare_size);
+
+        unsigned int found_c = scan(upipe_framers_mpeg_scan_c, buffer,
+                                    splits, nb_splits, offsets_c, states_c);
+        unsigned int found = scan(func, buffer,
+                                  splits, nb_splits, offsets, states);
+        assert(found == found_c);
+        assert(!memcmp(offsets, offsets_c, found * sizeof (size_t)));
+        assert(!memcmp(states, states_c, (found + 1) * sizeof (uint32_t)));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    test_scan("dispatch", upipe_framers_mpeg_scan);
+#ifdef __SSE2__
+    test_scan("sse2", upipe_framers_mpeg_scan_sse2);
+#endif
+#ifdef UPIPE_HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2"))
+        test_scan("avx2", upipe_framers_mpeg_scan_avx2);
+#endif
+
+    return 0;
+}
@@ -0,0 +1,354 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for packet source pipe
+ */
+
+#undef NDEBUG
+
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uprobe_uref_mgr.h>
+#include <upipe/uprobe_upump_mgr.h>
+#include <upipe/uprobe_uclock.h>
+#include <upipe/umem.h>
+#include <upipe/umem_alloc.h>
+#include <upipe/udict.h>
+#include <upipe/udict_inline.h>
+#include <upipe/uclock.h>
+#include <upipe/uclock_std.h>
+#include <upipe/uref.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_clock.h>
+#include <upipe/uref_std.h>
+#include <upipe/upump.h>
+#include <upump-ev/upump_ev.h>
+#include <upipe/upipe.h>
+#include <upipe-modules/upipe_packet_source.h>
+#include <upipe/upipe_helper_upipe.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define UDICT_POOL_DEPTH 0
+#define UREF_POOL_DEPTH 0
+#define UPUMP_POOL 0
+#define UPUMP_BLOCKER_POOL 0
+#define UPROBE_LOG_LEVEL UPROBE_LOG_DEBUG
+#define BUF_SIZE 256
+#define NB_PACKETS 100
+#define PORT 42127
+#define OTHER_PORT 42128
+#define FORMAT "This is packet number %d"
+#define WATCHDOG (UCLOCK_FREQ * 10)
+
+static int sockfd;
+static struct sockaddr_in addr;
+static struct upump *write_pump;
+static struct upipe *upipe_pktsrc;
+static int counter = 0;
+static int received = 0;
+/* last buffer is kept until the end to check the ring outlives the pipe */
+static struct uref *last_uref = NULL;
+
+/** definition of our uprobe */
+static int catch(struct uprobe *uprobe, struct upipe *upipe,
+                 int event, va_list args)
+{
+    switch (event) {
+        default:
+            assert(0);
+            break;
+        case UPROBE_READY:
+        case UPROBE_DEAD:
+        case UPROBE_NEW_FLOW_DEF:
+        case UPROBE_SOURCE_END:
+            break;
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** helper phony pipe */
+struct pktsrc_test {
+    bool other;
+    struct upipe upipe;
+};
+
+/** helper phony pipe */
+UPIPE_HELPER_UPIPE(pktsrc_test, upipe, 0);
+
+/** helper phony pipe */
+static struct upipe *test_alloc(struct upipe_mgr *mgr, struct uprobe *uprobe,
+                                uint32_t signature, va_list args)
+{
+    struct pktsrc_test *pktsrc_test = malloc(sizeof(struct pktsrc_test));
+    assert(pktsrc_test != NULL);
+    pktsrc_test->other = false;
+    upipe_init(&pktsrc_test->upipe, mgr, uprobe);
+    upipe_throw_ready(&pktsrc_test->upipe);
+    return &pktsrc_test->upipe;
+}
+
+/** helper phony pipe */
+static void test_input(struct upipe *upipe, struct uref *uref,
+                       struct upump **upump_p)
+{
+    struct pktsrc_test *pktsrc_test = pktsrc_test_from_upipe(upipe);
+    char str[BUF_SIZE];
+    uint8_t buf[BUF_SIZE];
+    const uint8_t *rbuf;
+    size_t size;
+    uint64_t cr_sys;
+
+    assert(!pktsrc_test->other);
+    assert(received < NB_PACKETS);
+    ubase_assert(uref_block_size(uref, &size));
+    assert(size == BUF_SIZE);
+    ubase_assert(uref_clock_get_cr_sys(uref, &cr_sys));
+
+    rbuf = uref_block_peek(uref, 0, BUF_SIZE, buf);
+    assert(rbuf != NULL);
+    upipe_dbg_va(upipe, "Received string: %s", rbuf);
+    snprintf(str, sizeof(str), FORMAT, received);
+    assert(!strncmp(str, (const char *)rbuf, BUF_SIZE));
+    uref_block_peek_unmap(uref, 0, buf, rbuf);
+
+    /* the ring is shared with the kernel */
+    int write_size = -1;
+    uint8_t *wbuf;
+    assert(!ubase_check(uref_block_write(uref, 0, &write_size, &wbuf)));
+
+    if (last_uref != NULL)
+        uref_free(last_uref);
+    last_uref = uref;
+    received++;
+    if (received == NB_PACKETS)
+        upipe_set_uri(upipe_pktsrc, NULL);
+}
+
+/** helper phony pipe */
+static int test_control(struct upipe *upipe, int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_SET_FLOW_DEF:
+            return UBASE_ERR_NONE;
+        case UPIPE_REGISTER_REQUEST: {
+            struct urequest *urequest = va_arg(args, struct urequest *);
+            return upipe_throw_provide_request(upipe, urequest);
+        }
+        case UPIPE_UNREGISTER_REQUEST:
+            return UBASE_ERR_NONE;
+        default:
+            assert(0);
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** helper phony pipe */
+static void test_free(struct upipe *upipe)
+{
+    upipe_dbg_va(upipe, "releasing pipe %p", upipe);
+    upipe_throw_dead(upipe);
+    struct pktsrc_test *pktsrc_test = pktsrc_test_from_upipe(upipe);
+    upipe_clean(upipe);
+    free(pktsrc_test);
+}
+
+/** helper phony pipe */
+static struct upipe_mgr pktsrc_test_mgr = {
+    .refcount = NULL,
+    .signature = 0,
+    .upipe_alloc = test_alloc,
+    .upipe_input = test_input,
+    .upipe_control = test_control
+};
+
+/** fails the test if it does not complete in time */
+static void watchdog(struct upump *unused)
+{
+    fprintf(stderr, "timed out after %d packets\n", received);
+    abort();
+}
+
+/* packet generator */
+static void genpackets(struct upump *unused)
+{
+    uint8_t buf[BUF_SIZE];
+    if (counter >= NB_PACKETS) {
+        upump_stop(write_pump);
+        return;
+    }
+    for (int i = 0; i < 10; i++) {
+        /* datagrams to the other port must be filtered out */
+        addr.sin_port = htons(OTHER_PORT);
+        memset(buf, 0, sizeof(buf));
+        assert(sendto(sockfd, buf, BUF_SIZE, 0, (struct sockaddr *)&addr,
+                      sizeof(addr)) == BUF_SIZE);
+
+        snprintf((char *)buf, BUF_SIZE, FORMAT, counter);
+        counter++;
+        addr.sin_port = htons(PORT);
+        assert(sendto(sockfd, buf, BUF_SIZE, 0, (struct sockaddr *)&addr,
+                      sizeof(addr)) == BUF_SIZE);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    /* env */
+    struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
+    assert(umem_mgr != NULL);
+    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(UDICT_POOL_DEPTH,
+                                                         umem_mgr, -1, -1);
+    assert(udict_mgr != NULL);
+    struct uref_mgr *uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH,
+                                                   udict_mgr, 0);
+    assert(uref_mgr != NULL);
+    struct upump_mgr *upump_mgr = upump_ev_mgr_alloc_default(UPUMP_POOL,
+            UPUMP_BLOCKER_POOL);
+    assert(upump_mgr != NULL);
+    struct uclock *uclock = uclock_std_alloc(0);
+    assert(uclock != NULL);
+    struct uprobe uprobe;
+    uprobe_init(&uprobe, catch, NULL);
+    struct uprobe *logger = uprobe_stdio_alloc(&uprobe, stdout,
+                                               UPROBE_LOG_LEVEL);
+    assert(logger != NULL);
+    logger = uprobe_uref_mgr_alloc(logger, uref_mgr);
+    assert(logger != NULL);
+    logger = uprobe_upump_mgr_alloc(logger, upump_mgr);
+    assert(logger != NULL);
+    logger = uprobe_uclock_alloc(logger, uclock);
+    assert(logger != NULL);
+
+    struct upipe *pktsrc_test = upipe_void_alloc(&pktsrc_test_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "pktsrc_test"));
+    assert(pktsrc_test != NULL);
+    struct upipe *pktsrc_other = upipe_void_alloc(&pktsrc_test_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "pktsrc_other"));
+    assert(pktsrc_other != NULL);
+    pktsrc_test_from_upipe(pktsrc_other)->other = true;
+
+    /* pktsrc */
+    struct upipe_mgr *upipe_pktsrc_mgr = upipe_pktsrc_mgr_alloc();
+    assert(upipe_pktsrc_mgr != NULL);
+    upipe_pktsrc = upipe_void_alloc(upipe_pktsrc_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "packet source"));
+    assert(upipe_pktsrc != NULL);
+    ubase_assert(upipe_attach_uclock(upipe_pktsrc));
+
+    unsigned int block_size, block_nr;
+    ubase_assert(upipe_pktsrc_get_ring(upipe_pktsrc, &block_size, &block_nr));
+    ubase_nassert(upipe_pktsrc_set_ring(upipe_pktsrc, 1000, 4));
+    ubase_assert(upipe_pktsrc_set_ring(upipe_pktsrc, 64 * 1024, 8));
+    ubase_assert(upipe_pktsrc_get_ring(upipe_pktsrc, &block_size, &block_nr));
+    assert(block_size == 64 * 1024);
+    assert(block_nr == 8);
+
+    if (!ubase_check(upipe_set_uri(upipe_pktsrc, "lo"))) {
+        /* packet sockets need CAP_NET_RAW */
+        printf("unable to open packet socket, skipping\n");
+        upipe_release(upipe_pktsrc);
+        test_free(pktsrc_test);
+        test_free(pktsrc_other);
+        upump_mgr_release(upump_mgr);
+        uref_mgr_release(uref_mgr);
+        udict_mgr_release(udict_mgr);
+        umem_mgr_release(umem_mgr);
+        uclock_release(uclock);
+        uprobe_release(logger);
+        uprobe_clean(&uprobe);
+        return 77;
+    }
+
+    struct upipe *output = upipe_void_alloc_sub(upipe_pktsrc,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "packet source output"));
+    assert(output != NULL);
+    ubase_nassert(upipe_set_uri(output, "127.0.0.1:foo"));
+    ubase_assert(upipe_set_uri(output, "@127.0.0.1:42127"));
+    ubase_assert(upipe_set_output(output, pktsrc_test));
+
+    /* the other output only gets datagrams once it has a destination */
+    struct upipe *other = upipe_void_alloc_sub(upipe_pktsrc,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "packet source other"));
+    assert(other != NULL);
+    ubase_assert(upipe_set_output(other, pktsrc_other));
+
+    /* open client socket */
+    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    assert(sockfd != -1);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    write_pump = upump_alloc_idler(upump_mgr, genpackets, NULL, NULL);
+    assert(write_pump);
+    upump_start(write_pump);
+
+    /* does not keep the event loop running */
+    struct upump *watchdog_pump = upump_alloc_timer(upump_mgr, watchdog,
+                                                    NULL, NULL, WATCHDOG, 0);
+    assert(watchdog_pump != NULL);
+    upump_set_status(watchdog_pump, false);
+    upump_start(watchdog_pump);
+
+    /* fire */
+    upump_mgr_run(upump_mgr, NULL);
+
+    assert(received == NB_PACKETS);
+    close(sockfd);
+    upump_free(write_pump);
+    upump_free(watchdog_pump);
+
+    upipe_release(output);
+    upipe_release(other);
+    upipe_release(upipe_pktsrc);
+    uref_free(last_uref);
+
+    test_free(pktsrc_test);
+    test_free(pktsrc_other);
+    upump_mgr_release(upump_mgr);
+    uref_mgr_release(uref_mgr);
+    udict_mgr_release(udict_mgr);
+    umem_mgr_release(umem_mgr);
+    uclock_release(uclock);
+    uprobe_release(logger);
+    uprobe_clean(&uprobe);
+
+    return 0;
+}
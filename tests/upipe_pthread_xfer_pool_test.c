@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for upipe_pthread_xfer_pool
+ */
+
+#undef NDEBUG
+
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/upipe.h>
+#include <upipe/upump.h>
+#include <upipe-pthread/uprobe_pthread_upump_mgr.h>
+#include <upipe-pthread/upipe_pthread_xfer_pool.h>
+#include <upump-ev/upump_ev.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#define UPROBE_LOG_LEVEL UPROBE_LOG_DEBUG
+#define UPUMP_POOL 1
+#define UPUMP_BLOCKER_POOL 1
+#define XFER_QUEUE 255
+#define XFER_POOL 1
+#define NB_THREADS 4
+#define NB_PIPELINES 10
+
+int main(int argc, char **argv)
+{
+    struct upump_mgr *upump_mgr =
+        upump_ev_mgr_alloc_default(UPUMP_POOL, UPUMP_BLOCKER_POOL);
+    assert(upump_mgr != NULL);
+
+    struct uprobe *logger = uprobe_stdio_alloc(NULL, stdout, UPROBE_LOG_LEVEL);
+    assert(logger != NULL);
+    logger = uprobe_pthread_upump_mgr_alloc(logger);
+    assert(logger != NULL);
+    uprobe_pthread_upump_mgr_set(logger, upump_mgr);
+
+    struct upipe_pthread_xfer_pool *pool =
+        upipe_pthread_xfer_pool_alloc(NB_THREADS, true, true,
+                XFER_QUEUE, XFER_POOL, uprobe_use(logger),
+                upump_ev_mgr_alloc_loop, UPUMP_POOL, UPUMP_BLOCKER_POOL);
+    assert(pool != NULL);
+
+    /* without load, pipelines are spread evenly across threads */
+    struct upipe_mgr *xfer_mgrs[NB_PIPELINES];
+    for (int i = 0; i < NB_PIPELINES; i++) {
+        xfer_mgrs[i] = upipe_pthread_xfer_pool_get_mgr(pool);
+        assert(xfer_mgrs[i] != NULL);
+        if (i >= NB_THREADS)
+            assert(xfer_mgrs[i] == xfer_mgrs[i % NB_THREADS]);
+        else
+            for (int j = 0; j < i; j++)
+                assert(xfer_mgrs[i] != xfer_mgrs[j]);
+    }
+
+    for (unsigned int i = 0; i < NB_THREADS; i++) {
+        unsigned int load, assigned;
+        ubase_assert(upipe_pthread_xfer_pool_get_load(pool, i,
+                                                      &load, &assigned));
+        assert(assigned == NB_PIPELINES / NB_THREADS ||
+               assigned == NB_PIPELINES / NB_THREADS + 1);
+    }
+    ubase_nassert(upipe_pthread_xfer_pool_get_load(pool, NB_THREADS,
+                                                   NULL, NULL));
+
+    for (int i = 0; i < NB_PIPELINES; i++)
+        upipe_mgr_release(xfer_mgrs[i]);
+    upipe_pthread_xfer_pool_release(pool);
+
+    /* wait for the threads to exit */
+    upump_mgr_run(upump_mgr, NULL);
+
+    upump_mgr_release(upump_mgr);
+    uprobe_release(logger);
+    return 0;
+}
@@ -0,0 +1,512 @@
+/*
+ * Copyright (C) 2026 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for the RTP FEC (SMPTE 2022-1) pipe
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubase.h>
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uprobe_upump_mgr.h>
+#include <upipe/uprobe_uclock.h>
+#include <upipe/umem.h>
+#include <upipe/umem_alloc.h>
+#include <upipe/udict.h>
+#include <upipe/udict_inline.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_block_flow.h>
+#include <upipe/uref_clock.h>
+#include <upipe/uref_std.h>
+#include <upipe/uclock.h>
+#include <upipe/upump.h>
+#include <upump-ev/upump_ev.h>
+#include <upipe/upipe.h>
+#include <upipe-ts/upipe_rtp_fec.h>
+
+#include "../lib/upipe-ts/upipe_rtp_fec_xor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <bitstream/ietf/rtp.h>
+#include <bitstream/mpeg/ts.h>
+#include <bitstream/smpte/2022_1_fec.h>
+
+#define UDICT_POOL_DEPTH 0
+#define UREF_POOL_DEPTH 0
+#define UBUF_POOL_DEPTH 0
+#define UPUMP_POOL 0
+#define UPUMP_BLOCKER_POOL 0
+#define UPROBE_LOG_LEVEL UPROBE_LOG_DEBUG
+#define COLS 10
+#define ROWS 5
+#define MATRIX (COLS * ROWS)
+/** enough matrices for the rings to grow past their minimum size */
+#define NB_MATRICES 40
+/** packets sent before the first matrix, the first one being dropped */
+#define PRIMER 2
+#define NB_PACKETS (PRIMER + NB_MATRICES * MATRIX)
+/** the sequence numbers wrap in the middle of the row lost in matrix 4 */
+#define FIRST_SEQNUM 65309
+#define PAYLOAD_SIZE (7 * TS_SIZE)
+#define PACKET_SIZE (RTP_HEADER_SIZE + PAYLOAD_SIZE)
+#define FEC_TYPE 96
+#define INTERVAL (UCLOCK_FREQ / 1000)
+/** matrix with duplicate main and FEC packets */
+#define DUP_MATRIX 10
+/** matrix with reordered main packets */
+#define REORDER_MATRIX 14
+/** matrix with losses that cannot be recovered */
+#define LOST_MATRIX 8
+#define NB_RECOVERED 13
+#define NB_LOST 4
+
+static struct uref_mgr *uref_mgr;
+static struct ubuf_mgr *ubuf_mgr;
+static uint64_t now;
+
+static uint8_t packets[NB_PACKETS][PACKET_SIZE];
+/** payload size of the packets */
+static size_t sizes[NB_PACKETS];
+/** packets lost on the way */
+static bool dropped[NB_PACKETS];
+/** packets that cannot be recovered */
+static bool unrecoverable[NB_PACKETS];
+/** next packet expected by the sink, the primer is not output */
+static unsigned int next_output = PRIMER;
+static unsigned int nb_output;
+static uint16_t fec_seqnum;
+
+/** definition of our uprobe */
+static int catch(struct uprobe *uprobe, struct upipe *upipe,
+                 int event, va_list args)
+{
+    switch (event) {
+        default:
+            assert(0);
+            break;
+        case UPROBE_READY:
+        case UPROBE_DEAD:
+        case UPROBE_NEW_FLOW_DEF:
+            break;
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** helper uclock */
+static uint64_t test_now(struct uclock *uclock)
+{
+    return now;
+}
+
+/** helper phony pipe */
+static struct upipe *test_alloc(struct upipe_mgr *mgr, struct uprobe *uprobe,
+                                uint32_t signature, va_list args)
+{
+    struct upipe *upipe = malloc(sizeof(struct upipe));
+    assert(upipe != NULL);
+    upipe_init(upipe, mgr, uprobe);
+    return upipe;
+}
+
+/** helper phony pipe */
+static void test_input(struct upipe *upipe, struct uref *uref,
+                       struct upump **upump_p)
+{
+    while (next_output < NB_PACKETS && unrecoverable[next_output])
+        next_output++;
+    assert(next_output < NB_PACKETS);
+
+    /* same content, in the order of the sequence numbers */
+    const uint8_t *buffer;
+    int size = -1;
+    ubase_assert(uref_block_read(uref, 0, &size, &buffer));
+    assert(size == RTP_HEADER_SIZE + sizes[next_output]);
+    assert(!memcmp(buffer, packets[next_output], size));
+    uref_block_unmap(uref, 0);
+    uref_free(uref);
+    next_output++;
+    nb_output++;
+}
+
+/** helper phony pipe */
+static int test_control(struct upipe *upipe, int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_SET_FLOW_DEF:
+            return UBASE_ERR_NONE;
+        case UPIPE_REGISTER_REQUEST: {
+            struct urequest *urequest = va_arg(args, struct urequest *);
+            return upipe_throw_provide_request(upipe, urequest);
+        }
+        case UPIPE_UNREGISTER_REQUEST:
+            return UBASE_ERR_NONE;
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** helper phony pipe */
+static void test_free(struct upipe *upipe)
+{
+    upipe_clean(upipe);
+    free(upipe);
+}
+
+/** helper phony pipe */
+static struct upipe_mgr test_mgr = {
+    .refcount = NULL,
+    .signature = 0,
+    .upipe_alloc = test_alloc,
+    .upipe_input = test_input,
+    .upipe_control = test_control
+};
+
+/** returns the index of a packet of a matrix */
+static unsigned int packet_index(unsigned int matrix, unsigned int row,
+                                 unsigned int col)
+{
+    return PRIMER + matrix * MATRIX + row * COLS + col;
+}
+
+/** builds the main packets and the losses */
+static void build_packets(void)
+{
+    static const uint8_t ssrc[4] = { 0x12, 0x34, 0x56, 0x78 };
+    for (unsigned int i = 0; i < NB_PACKETS; i++) {
+        uint8_t *rtp = packets[i];
+        sizes[i] = PAYLOAD_SIZE;
+        memset(rtp, 0, RTP_HEADER_SIZE);
+        rtp_set_hdr(rtp);
+        rtp_set_type(rtp, RTP_TYPE_MP2T);
+        rtp_set_seqnum(rtp, FIRST_SEQNUM + i);
+        rtp_set_timestamp(rtp, UINT32_MAX - 900 * NB_PACKETS / 2 + 900 * i);
+        rtp_set_ssrc(rtp, ssrc);
+        for (unsigned int j = RTP_HEADER_SIZE; j < PACKET_SIZE; j++)
+            rtp[j] = rand();
+    }
+
+    /* a single short packet lost in a row, recovered by the row FEC, the
+     * row having another short packet */
+    sizes[packet_index(2, 1, 5)] = 4 * TS_SIZE;
+    sizes[packet_index(2, 1, 3)] = 3 * TS_SIZE;
+    dropped[packet_index(2, 1, 3)] = true;
+
+    /* a whole row, recovered by the column FEC */
+    for (unsigned int col = 0; col < COLS; col++)
+        dropped[packet_index(4, 2, col)] = true;
+
+    /* two packets in a column, recovered by the row FEC */
+    dropped[packet_index(6, 0, 5)] = true;
+    dropped[packet_index(6, 3, 5)] = true;
+
+    /* two packets in two rows and two columns cannot be recovered */
+    for (unsigned int row = 1; row <= 2; row++)
+        for (unsigned int col = 1; col <= 2; col++) {
+            dropped[packet_index(LOST_MATRIX, row, col)] = true;
+            unrecoverable[packet_index(LOST_MATRIX, row, col)] = true;
+        }
+}
+
+/** sends a main packet */
+static void send_main(struct upipe *upipe, unsigned int i)
+{
+    struct uref *uref = uref_block_alloc(uref_mgr, ubuf_mgr,
+                                         RTP_HEADER_SIZE + sizes[i]);
+    assert(uref != NULL);
+    uint8_t *buffer;
+    int size = -1;
+    ubase_assert(uref_block_write(uref, 0, &size, &buffer));
+    memcpy(buffer, packets[i], size);
+    uref_block_unmap(uref, 0);
+    now = i * INTERVAL;
+    uref_clock_set_date_sys(uref, now, UREF_DATE_CR);
+    upipe_input(upipe, uref, NULL);
+}
+
+/** sends a column or row FEC packet
+ *
+ * @param upipe col or row subpipe
+ * @param col true for a column FEC packet
+ * @param base index of the first packet of the matrix, possibly negative
+ * @param k column or row in the matrix
+ */
+static void send_fec(struct upipe *upipe, bool col, int base, unsigned int k)
+{
+    unsigned int nb = col ? ROWS : COLS;
+    int first = col ? base + k : base + k * COLS;
+    int step = col ? COLS : 1;
+
+    uint8_t payload[PAYLOAD_SIZE];
+    memset(payload, 0, sizeof(payload));
+    size_t size = 0;
+    uint16_t length_rec = 0;
+    uint32_t ts_rec = 0;
+    for (unsigned int j = 0; j < nb; j++) {
+        int i = first + j * step;
+        if (i < 0)
+            continue;
+        length_rec ^= sizes[i];
+        ts_rec ^= rtp_get_timestamp(packets[i]);
+        for (unsigned int l = 0; l < sizes[i]; l++)
+            payload[l] ^= packets[i][RTP_HEADER_SIZE + l];
+        if (size < sizes[i])
+            size = sizes[i];
+    }
+
+    struct uref *uref = uref_block_alloc(uref_mgr, ubuf_mgr,
+            RTP_HEADER_SIZE + SMPTE_2022_FEC_HEADER_SIZE + size);
+    assert(uref != NULL);
+    uint8_t *buffer;
+    int buffer_size = -1;
+    ubase_assert(uref_block_write(uref, 0, &buffer_size, &buffer));
+    memset(buffer, 0, RTP_HEADER_SIZE + SMPTE_2022_FEC_HEADER_SIZE);
+    rtp_set_hdr(buffer);
+    rtp_set_type(buffer, FEC_TYPE);
+    rtp_set_seqnum(buffer, fec_seqnum++);
+    uint8_t *fec = buffer + RTP_HEADER_SIZE;
+    smpte_fec_set_snbase_low(fec, FIRST_SEQNUM + first);
+    smpte_fec_set_length_rec(fec, length_rec);
+    smpte_fec_set_ts_recovery(fec, ts_rec);
+    if (!col)
+        smpte_fec_set_d(fec);
+    smpte_fec_set_offset(fec, col ? COLS : 1);
+    smpte_fec_set_na(fec, nb);
+    memcpy(fec + SMPTE_2022_FEC_HEADER_SIZE, payload, size);
+    uref_block_unmap(uref, 0);
+    upipe_input(upipe, uref, NULL);
+}
+
+/** sends a matrix, each row being followed by its row FEC packet and by
+ * two column FEC packets of the previous matrix */
+static void send_matrix(struct upipe *upipe_main, struct upipe *upipe_col,
+                        struct upipe *upipe_row, unsigned int matrix)
+{
+    int base = packet_index(matrix, 0, 0);
+    for (unsigned int r = 0; r < ROWS; r++) {
+        for (unsigned int c = 0; c < COLS; c++) {
+            unsigned int i = packet_index(matrix, r, c);
+            if (matrix == REORDER_MATRIX) {
+                /* swapped with the next packet, and moved to the next row */
+                if ((r == 2 && c == 0) || (r == 3 && c == COLS - 1))
+                    continue;
+                if (r == 2 && c == 1) {
+                    send_main(upipe_main, i);
+                    send_main(upipe_main, i - 1);
+                    continue;
+                }
+                if (r == 4 && c == 1) {
+                    send_main(upipe_main, i);
+                    send_main(upipe_main, packet_index(matrix, 3, COLS - 1));
+                    continue;
+                }
+            }
+            if (!dropped[i])
+                send_main(upipe_main, i);
+            if (matrix == DUP_MATRIX && r == 0)
+                send_main(upipe_main, i);
+        }
+
+        send_fec(upipe_row, false, base, r);
+        if (matrix == DUP_MATRIX && r == 1)
+            send_fec(upipe_row, false, base, r);
+
+        if (matrix) {
+            send_fec(upipe_col, true, base - MATRIX, 2 * r);
+            send_fec(upipe_col, true, base - MATRIX, 2 * r + 1);
+            if (matrix == DUP_MATRIX && r == 0)
+                send_fec(upipe_col, true, base - MATRIX, 0);
+        }
+
+        if (matrix == DUP_MATRIX && r == 2) {
+            /* duplicates of packets already processed */
+            send_main(upipe_main, packet_index(matrix - 1, 4, 5));
+            send_fec(upipe_row, false, base - MATRIX, 0);
+            send_fec(upipe_col, true, packet_index(LOST_MATRIX, 0, 0), 1);
+        }
+    }
+}
+
+/** checks the counters once everything is output */
+static void test_stop(struct upump *upump)
+{
+    struct upipe *upipe = upump_get_opaque(upump, struct upipe *);
+    assert(nb_output == NB_PACKETS - PRIMER - NB_LOST);
+
+    uint64_t value;
+    ubase_assert(upipe_rtp_fec_get_rows(upipe, &value));
+    assert(value == ROWS);
+    ubase_assert(upipe_rtp_fec_get_columns(upipe, &value));
+    assert(value == COLS);
+    ubase_assert(upipe_rtp_fec_get_packets_recovered(upipe, &value));
+    assert(value == NB_RECOVERED);
+    ubase_assert(upipe_rtp_fec_get_packets_lost(upipe, &value));
+    assert(value == NB_LOST);
+
+    struct upipe_rtp_fec_stats stats;
+    ubase_assert(upipe_rtp_fec_get_stats(upipe, &stats));
+    /* the last matrix is not closed */
+    assert(stats.matrices == NB_MATRICES - 1);
+    assert(stats.matrices_recovered == 3);
+    assert(stats.matrices_lost == 1);
+    assert(stats.max_recovered == COLS);
+    assert(stats.max_lost == NB_LOST);
+
+    /* the counters are reset once read */
+    ubase_assert(upipe_rtp_fec_get_packets_recovered(upipe, &value));
+    assert(!value);
+    ubase_assert(upipe_rtp_fec_get_packets_lost(upipe, &value));
+    assert(!value);
+    ubase_assert(upipe_rtp_fec_get_stats(upipe, &stats));
+    assert(!stats.matrices && !stats.max_recovered && !stats.max_lost);
+
+    upipe_release(upipe);
+}
+
+/** checks an implementation of the XOR against the reference */
+static void test_xor(const char *name,
+                     void (*fec_xor)(uint8_t *, const uint8_t *, size_t))
+{
+    uint8_t src[PAYLOAD_SIZE + 64], dst[PAYLOAD_SIZE + 64];
+    uint8_t ref[PAYLOAD_SIZE + 64];
+    static const size_t big_sizes[] = { 1024, PAYLOAD_SIZE - 1, PAYLOAD_SIZE };
+
+    for (size_t n = 0; n < 300 + UBASE_ARRAY_SIZE(big_sizes); n++) {
+        size_t size = n < 300 ? n : big_sizes[n - 300];
+        for (unsigned int dst_off = 0; dst_off < 4; dst_off++) {
+            unsigned int src_off = (dst_off * 7 + n) % 32;
+            for (unsigned int i = 0; i < sizeof(src); i++) {
+                src[i] = rand();
+                dst[i] = ref[i] = rand();
+            }
+            for (size_t i = 0; i < size; i++)
+                ref[dst_off + i] ^= src[src_off + i];
+            fec_xor(dst + dst_off, src + src_off, size);
+            /* nothing is written outside of the buffer */
+            assert(!memcmp(dst, ref, sizeof(dst)));
+        }
+    }
+    printf("%s XOR passed\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    test_xor("c", upipe_rtp_fec_xor_c);
+#ifdef UPIPE_HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2"))
+        test_xor("avx2", upipe_rtp_fec_xor_avx2);
+#endif
+
+    struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
+    assert(umem_mgr != NULL);
+    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(UDICT_POOL_DEPTH,
+                                                         umem_mgr, -1, -1);
+    assert(udict_mgr != NULL);
+    uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH, udict_mgr, 0);
+    assert(uref_mgr != NULL);
+    ubuf_mgr = ubuf_block_mem_mgr_alloc(UBUF_POOL_DEPTH, UBUF_POOL_DEPTH,
+                                        umem_mgr, 0, 0, -1, 0);
+    assert(ubuf_mgr != NULL);
+    struct upump_mgr *upump_mgr =
+        upump_ev_mgr_alloc_default(UPUMP_POOL, UPUMP_BLOCKER_POOL);
+    assert(upump_mgr != NULL);
+
+    struct uclock uclock;
+    uclock.refcount = NULL;
+    uclock.uclock_now = test_now;
+    uclock.uclock_to_real = uclock.uclock_from_real = NULL;
+
+    struct uprobe uprobe;
+    uprobe_init(&uprobe, catch, NULL);
+    struct uprobe *logger = uprobe_stdio_alloc(&uprobe, stdout,
+                                               UPROBE_LOG_LEVEL);
+    assert(logger != NULL);
+    logger = uprobe_upump_mgr_alloc(logger, upump_mgr);
+    assert(logger != NULL);
+    logger = uprobe_uclock_alloc(logger, &uclock);
+    assert(logger != NULL);
+
+    build_packets();
+
+    struct upipe *upipe_sink = upipe_void_alloc(&test_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "sink"));
+    assert(upipe_sink != NULL);
+
+    struct upipe_mgr *upipe_rtp_fec_mgr = upipe_rtp_fec_mgr_alloc();
+    assert(upipe_rtp_fec_mgr != NULL);
+    struct upipe *upipe_rtp_fec = upipe_rtp_fec_alloc(upipe_rtp_fec_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "fec"),
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "main"),
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "col"),
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "row"));
+    assert(upipe_rtp_fec != NULL);
+    ubase_assert(upipe_attach_uclock(upipe_rtp_fec));
+    ubase_assert(upipe_set_output(upipe_rtp_fec, upipe_sink));
+
+    struct upipe *upipe_main, *upipe_col, *upipe_row;
+    ubase_assert(upipe_rtp_fec_get_main_sub(upipe_rtp_fec, &upipe_main));
+    ubase_assert(upipe_rtp_fec_get_col_sub(upipe_rtp_fec, &upipe_col));
+    ubase_assert(upipe_rtp_fec_get_row_sub(upipe_rtp_fec, &upipe_row));
+    struct uref *flow_def = uref_block_flow_alloc_def(uref_mgr, "rtp.");
+    assert(flow_def != NULL);
+    ubase_assert(upipe_set_flow_def(upipe_main, flow_def));
+    uref_free(flow_def);
+
+    /* the FEC matrix is announced before the first packet */
+    send_fec(upipe_col, true, PRIMER - MATRIX, 0);
+    for (unsigned int i = 0; i < PRIMER; i++)
+        send_main(upipe_main, i);
+    for (unsigned int matrix = 0; matrix < NB_MATRICES; matrix++)
+        send_matrix(upipe_main, upipe_col, upipe_row, matrix);
+    /* the packets are held for the latency */
+    assert(!nb_output);
+
+    now = UINT64_MAX / 2;
+    struct upump *upump = upump_alloc_timer(upump_mgr, test_stop,
+                                            upipe_rtp_fec, NULL,
+                                            UCLOCK_FREQ / 10, 0);
+    assert(upump != NULL);
+    upump_start(upump);
+    upump_mgr_run(upump_mgr, NULL);
+    upump_free(upump);
+
+    test_free(upipe_sink);
+    upump_mgr_release(upump_mgr);
+    uref_mgr_release(uref_mgr);
+    ubuf_mgr_release(ubuf_mgr);
+    udict_mgr_release(udict_mgr);
+    umem_mgr_release(umem_mgr);
+    uprobe_release(logger);
+    uprobe_clean(&uprobe);
+
+    return 0;
+}
@@ -0,0 +1,415 @@
+/*
+ * Copyright (C) 2026 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for the RTP reorder pipe with redundant inputs
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubase.h>
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uprobe_upump_mgr.h>
+#include <upipe/uprobe_uclock.h>
+#include <upipe/umem.h>
+#include <upipe/umem_alloc.h>
+#include <upipe/udict.h>
+#include <upipe/udict_inline.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_block_flow.h>
+#include <upipe/uref_clock.h>
+#include <upipe/uref_std.h>
+#include <upipe/uclock.h>
+#include <upipe/upump.h>
+#include <upump-ev/upump_ev.h>
+#include <upipe/upipe.h>
+#include <upipe-modules/upipe_rtp_reorder.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <bitstream/ietf/rtp.h>
+
+#define UDICT_POOL_DEPTH 0
+#define UREF_POOL_DEPTH 0
+#define UBUF_POOL_DEPTH 0
+#define UPUMP_POOL 0
+#define UPUMP_BLOCKER_POOL 0
+#define UPROBE_LOG_LEVEL UPROBE_LOG_DEBUG
+#define PAYLOAD_SIZE 16
+#define NB_LEGS 3
+/** date of the packets that are due */
+#define NOW (UCLOCK_FREQ * 1000)
+/** size of the reorder ring once it cannot grow anymore */
+#define RING_MAX 16384
+/** number of packets of the redundant test */
+#define NB_REDUNDANT 3000
+/** number of packets of the full ring test */
+#define NB_FULL (RING_MAX + 1000)
+
+static struct uprobe *logger;
+static struct upump_mgr *upump_mgr;
+static struct uref_mgr *uref_mgr;
+static struct ubuf_mgr *ubuf_mgr;
+static uint64_t now = NOW;
+
+static struct upipe *upipe_sink;
+static struct upipe *upipe_rtpr;
+static struct upipe *legs[NB_LEGS];
+
+/** sequence number of the first packet of the test */
+static uint16_t first_seqnum;
+/** packets expected at the output */
+static bool expected[NB_FULL];
+/** index of the next packet expected at the output */
+static unsigned int next_output;
+static unsigned int nb_output;
+
+/** definition of our uprobe */
+static int catch(struct uprobe *uprobe, struct upipe *upipe,
+                 int event, va_list args)
+{
+    switch (event) {
+        default:
+            assert(0);
+            break;
+        case UPROBE_READY:
+        case UPROBE_DEAD:
+        case UPROBE_NEW_FLOW_DEF:
+            break;
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** helper uclock */
+static uint64_t test_now(struct uclock *uclock)
+{
+    return now;
+}
+
+/** helper phony pipe */
+static struct upipe *test_alloc(struct upipe_mgr *mgr, struct uprobe *uprobe,
+                                uint32_t signature, va_list args)
+{
+    struct upipe *upipe = malloc(sizeof(struct upipe));
+    assert(upipe != NULL);
+    upipe_init(upipe, mgr, uprobe);
+    return upipe;
+}
+
+/** helper phony pipe */
+static void test_input(struct upipe *upipe, struct uref *uref,
+                       struct upump **upump_p)
+{
+    while (next_output < NB_FULL && !expected[next_output])
+        next_output++;
+    assert(next_output < NB_FULL);
+
+    /* each packet once, in the order of the sequence numbers */
+    const uint8_t *buffer;
+    int size = -1;
+    ubase_assert(uref_block_read(uref, 0, &size, &buffer));
+    assert(size == RTP_HEADER_SIZE + PAYLOAD_SIZE);
+    assert(rtp_get_seqnum(buffer) == (uint16_t)(first_seqnum + next_output));
+    for (unsigned int i = 0; i < PAYLOAD_SIZE; i++)
+        assert(buffer[RTP_HEADER_SIZE + i] == (uint8_t)(next_output + i));
+    uref_block_unmap(uref, 0);
+    uref_free(uref);
+    next_output++;
+    nb_output++;
+}
+
+/** helper phony pipe */
+static int test_control(struct upipe *upipe, int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_SET_FLOW_DEF:
+            return UBASE_ERR_NONE;
+        case UPIPE_REGISTER_REQUEST: {
+            struct urequest *urequest = va_arg(args, struct urequest *);
+            return upipe_throw_provide_request(upipe, urequest);
+        }
+        case UPIPE_UNREGISTER_REQUEST:
+            return UBASE_ERR_NONE;
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** helper phony pipe */
+static void test_free(struct upipe *upipe)
+{
+    upipe_clean(upipe);
+    free(upipe);
+}
+
+/** helper phony pipe */
+static struct upipe_mgr test_mgr = {
+    .refcount = NULL,
+    .signature = 0,
+    .upipe_alloc = test_alloc,
+    .upipe_input = test_input,
+    .upipe_control = test_control
+};
+
+/** allocates the reorder pipe and its legs */
+static void start(uint16_t seqnum)
+{
+    first_seqnum = seqnum;
+    memset(expected, 0, sizeof(expected));
+    next_output = 0;
+    nb_output = 0;
+
+    struct upipe_mgr *upipe_rtpr_mgr = upipe_rtpr_mgr_alloc();
+    assert(upipe_rtpr_mgr != NULL);
+    upipe_rtpr = upipe_void_alloc(upipe_rtpr_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "rtpr"));
+    assert(upipe_rtpr != NULL);
+    ubase_assert(upipe_attach_uclock(upipe_rtpr));
+    ubase_assert(upipe_set_output(upipe_rtpr, upipe_sink));
+    ubase_assert(upipe_rtpr_set_delay(upipe_rtpr, 0));
+    uint64_t delay;
+    ubase_assert(upipe_rtpr_get_delay(upipe_rtpr, &delay));
+    assert(!delay);
+
+    struct uref *flow_def = uref_block_flow_alloc_def(uref_mgr, "rtp.");
+    assert(flow_def != NULL);
+    for (unsigned int i = 0; i < NB_LEGS; i++) {
+        legs[i] = upipe_void_alloc_sub(upipe_rtpr,
+                uprobe_pfx_alloc_va(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                                    "leg %u", i));
+        assert(legs[i] != NULL);
+        ubase_assert(upipe_set_flow_def(legs[i], flow_def));
+    }
+    uref_free(flow_def);
+}
+
+/** releases the reorder pipe and its legs */
+static void stop(void)
+{
+    for (unsigned int i = 0; i < NB_LEGS; i++)
+        upipe_release(legs[i]);
+    upipe_release(upipe_rtpr);
+}
+
+/** sends a packet on a leg
+ *
+ * @param leg index of the leg
+ * @param i index of the packet in the test
+ * @param date_sys date of the packet
+ */
+static void send(unsigned int leg, unsigned int i, uint64_t date_sys)
+{
+    struct uref *uref = uref_block_alloc(uref_mgr, ubuf_mgr,
+                                         RTP_HEADER_SIZE + PAYLOAD_SIZE);
+    assert(uref != NULL);
+    uint8_t *buffer;
+    int size = -1;
+    ubase_assert(uref_block_write(uref, 0, &size, &buffer));
+    memset(buffer, 0, RTP_HEADER_SIZE);
+    rtp_set_hdr(buffer);
+    rtp_set_type(buffer, RTP_TYPE_MP2T);
+    rtp_set_seqnum(buffer, first_seqnum + i);
+    rtp_set_timestamp(buffer, i * 900);
+    for (unsigned int j = 0; j < PAYLOAD_SIZE; j++)
+        buffer[RTP_HEADER_SIZE + j] = i + j;
+    uref_block_unmap(uref, 0);
+    uref_clock_set_date_sys(uref, date_sys, UREF_DATE_CR);
+    upipe_input(legs[leg], uref, NULL);
+}
+
+/* Every packet received on at least one leg is output once and in order,
+ * whatever the duplicates and the reordering between and within the
+ * legs. */
+static void test_redundant(void)
+{
+    /* the sequence numbers wrap */
+    start(65000);
+
+    /* each one inserted before the first packet of the ring */
+    for (unsigned int i = 3; i > 0; i--) {
+        send(0, i - 1, NOW);
+        expected[i - 1] = true;
+    }
+
+    /* each leg loses a quarter of the packets, some being lost on all
+     * of them, and swaps neighbouring packets */
+    unsigned int order[NB_LEGS][NB_REDUNDANT];
+    unsigned int nb[NB_LEGS] = { 0 };
+    for (unsigned int i = 3; i < NB_REDUNDANT; i++) {
+        for (unsigned int leg = 0; leg < NB_LEGS; leg++) {
+            if (i % 97 == 50 || !(rand() % 4))
+                continue;
+            order[leg][nb[leg]++] = i;
+            expected[i] = true;
+        }
+    }
+    for (unsigned int leg = 0; leg < NB_LEGS; leg++)
+        for (unsigned int j = 0; j + 3 < nb[leg]; j++)
+            if (!(rand() % 8)) {
+                unsigned int k = j + 1 + rand() % 3;
+                unsigned int tmp = order[leg][j];
+                order[leg][j] = order[leg][k];
+                order[leg][k] = tmp;
+            }
+
+    /* the legs are interleaved with different delays */
+    unsigned int pos[NB_LEGS] = { 0 };
+    for ( ; ; ) {
+        unsigned int leg = rand() % NB_LEGS;
+        if (pos[leg] == nb[leg]) {
+            for (leg = 0; leg < NB_LEGS && pos[leg] == nb[leg]; leg++);
+            if (leg == NB_LEGS)
+                break;
+        }
+        unsigned int i = order[leg][pos[leg]++];
+        send(leg, i, NOW - UCLOCK_FREQ + i);
+    }
+
+    /* the ring grew to hold all the packets */
+    assert(!nb_output);
+    upump_mgr_run(upump_mgr, NULL);
+
+    unsigned int nb_expected = 0;
+    for (unsigned int i = 0; i < NB_REDUNDANT; i++)
+        nb_expected += expected[i];
+    assert(nb_output == nb_expected);
+    stop();
+    printf("redundant legs passed\n");
+}
+
+/* The oldest packets are output early when the ring cannot grow anymore,
+ * and their copies arriving later are dropped. */
+static void test_full(void)
+{
+    /* the sequence numbers wrap */
+    start(60000);
+
+    for (unsigned int i = 0; i < NB_FULL; i++) {
+        send(0, i, NOW - UCLOCK_FREQ + i);
+        expected[i] = true;
+        assert(nb_output == (i < RING_MAX ? 0 : i + 1 - RING_MAX));
+    }
+
+    /* late copies of packets already output, the last one included, and a
+     * copy of a queued packet */
+    for (unsigned int i = 0; i < 10; i++)
+        send(1, i, NOW);
+    send(1, NB_FULL - RING_MAX - 1, NOW);
+    send(2, NB_FULL - 1, NOW);
+    assert(nb_output == NB_FULL - RING_MAX);
+
+    upump_mgr_run(upump_mgr, NULL);
+    assert(nb_output == NB_FULL);
+    stop();
+    printf("full ring passed\n");
+}
+
+/** checks the output once the timer of the pipe had time to trigger */
+static void test_rearm_check(struct upump *upump)
+{
+    /* only the packet inserted before the first one is output */
+    assert(nb_output == 1);
+    assert(next_output == 2);
+    stop();
+}
+
+/* The timer armed for a packet in the future is re-armed right away when
+ * a packet without date becomes the first of the ring. */
+static void test_rearm(void)
+{
+    start(1000);
+
+    /* due in an hour */
+    send(0, 2, NOW + UCLOCK_FREQ * 3600);
+    send(1, 3, NOW + UCLOCK_FREQ * 3600);
+    expected[2] = expected[3] = true;
+    /* reordered, so its date is dropped */
+    send(2, 1, NOW + UCLOCK_FREQ * 3600);
+    expected[1] = true;
+
+    struct upump *upump = upump_alloc_timer(upump_mgr, test_rearm_check,
+                                            NULL, NULL, UCLOCK_FREQ / 50, 0);
+    assert(upump != NULL);
+    upump_start(upump);
+    upump_mgr_run(upump_mgr, NULL);
+    upump_free(upump);
+    assert(nb_output == 1);
+    printf("timer re-arm passed\n");
+}
+
+int main(int argc, char *argv[])
+{
+    struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
+    assert(umem_mgr != NULL);
+    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(UDICT_POOL_DEPTH,
+                                                         umem_mgr, -1, -1);
+    assert(udict_mgr != NULL);
+    uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH, udict_mgr, 0);
+    assert(uref_mgr != NULL);
+    ubuf_mgr = ubuf_block_mem_mgr_alloc(UBUF_POOL_DEPTH, UBUF_POOL_DEPTH,
+                                        umem_mgr, 0, 0, -1, 0);
+    assert(ubuf_mgr != NULL);
+    upump_mgr = upump_ev_mgr_alloc_default(UPUMP_POOL, UPUMP_BLOCKER_POOL);
+    assert(upump_mgr != NULL);
+
+    struct uclock uclock;
+    uclock.refcount = NULL;
+    uclock.uclock_now = test_now;
+    uclock.uclock_to_real = uclock.uclock_from_real = NULL;
+
+    struct uprobe uprobe;
+    uprobe_init(&uprobe, catch, NULL);
+    logger = uprobe_stdio_alloc(&uprobe, stdout, UPROBE_LOG_LEVEL);
+    assert(logger != NULL);
+    logger = uprobe_upump_mgr_alloc(logger, upump_mgr);
+    assert(logger != NULL);
+    logger = uprobe_uclock_alloc(logger, &uclock);
+    assert(logger != NULL);
+
+    upipe_sink = upipe_void_alloc(&test_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "sink"));
+    assert(upipe_sink != NULL);
+
+    test_redundant();
+    test_full();
+    test_rearm();
+
+    test_free(upipe_sink);
+    upump_mgr_release(upump_mgr);
+    uref_mgr_release(uref_mgr);
+    ubuf_mgr_release(ubuf_mgr);
+    udict_mgr_release(udict_mgr);
+    umem_mgr_release(umem_mgr);
+    uprobe_release(logger);
+    uprobe_clean(&uprobe);
+
+    return 0;
+}
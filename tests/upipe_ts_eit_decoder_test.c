@@ -70,6 +70,7 @@
 static uint64_t sid = 41;
 static uint64_t tsid = 42;
 static uint64_t onid = 43;
+static uint8_t running_status_1 = 5;
 static bool complete = false;
 
 /** definition of our uprobe */
@@ -142,7 +143,7 @@ static int catch(struct uprobe *uprobe, struct upipe *upipe,
             tm.tm_isdst = 0;
             assert(start == (uint64_t)mktime(&tm) * UCLOCK_FREQ);
             assert(duration == (uint64_t)60 * UCLOCK_FREQ);
-            assert(running_status == 5);
+            assert(running_status == running_status_1);
             assert(!strcmp(name, "meuh"));
             assert(!strcmp(description, "coin"));
 
@@ -153,6 +154,22 @@ static int catch(struct uprobe *uprobe, struct upipe *upipe,
     return UBASE_ERR_NONE;
 }
 
+/** allocates a uref containing a copy of a section */
+static struct uref *section_alloc(struct uref_mgr *uref_mgr,
+                                  struct ubuf_mgr *ubuf_mgr,
+                                  const uint8_t *section, int section_size)
+{
+    struct uref *uref = uref_block_alloc(uref_mgr, ubuf_mgr, section_size);
+    assert(uref != NULL);
+    uint8_t *buffer;
+    int size = -1;
+    ubase_assert(uref_block_write(uref, 0, &size, &buffer));
+    assert(size == section_size);
+    memcpy(buffer, section, size);
+    uref_block_unmap(uref, 0);
+    return uref;
+}
+
 int main(int argc, char *argv[])
 {
     setenv("TZ", "UTC", 1);
@@ -220,6 +237,9 @@ int main(int argc, char *argv[])
     eitn_set_running(eit_event, 3);
     eitn_set_desclength(eit_event, 0);
     psi_set_crc(buffer);
+    uint8_t section0[PSI_MAX_SIZE + PSI_HEADER_SIZE];
+    int section0_size = size;
+    memcpy(section0, buffer, size);
     uref_block_unmap(uref, 0);
     upipe_input(upipe_ts_eitd, uref, NULL);
 
@@ -261,11 +281,40 @@ int main(int argc, char *argv[])
     desc4d_set_text(desc, (const uint8_t *)"coin", strlen("coin"));
     desc4d_set_length(desc);
     psi_set_crc(buffer);
+    uint8_t section3[PSI_MAX_SIZE + PSI_HEADER_SIZE];
+    int section3_size = size;
+    memcpy(section3, buffer, size);
     uref_block_unmap(uref, 0);
     complete = true;
     upipe_input(upipe_ts_eitd, uref, NULL);
     assert(!complete);
 
+    /* repeated sections are ignored */
+    uref = section_alloc(uref_mgr, ubuf_mgr, section3, section3_size);
+    upipe_input(upipe_ts_eitd, uref, NULL);
+    uref = section_alloc(uref_mgr, ubuf_mgr, section0, section0_size);
+    upipe_input(upipe_ts_eitd, uref, NULL);
+
+    /* new version with the first event unchanged */
+    psi_set_version(section0, 1);
+    psi_set_crc(section0);
+    uref = section_alloc(uref_mgr, ubuf_mgr, section0, section0_size);
+    upipe_input(upipe_ts_eitd, uref, NULL);
+
+    psi_set_version(section3, 1);
+    eitn_set_running(eit_get_event(section3, 0), 4);
+    psi_set_crc(section3);
+    running_status_1 = 4;
+    uref = section_alloc(uref_mgr, ubuf_mgr, section3, section3_size);
+    complete = true;
+    upipe_input(upipe_ts_eitd, uref, NULL);
+    assert(!complete);
+
+    unsigned int max_events;
+    ubase_assert(upipe_ts_eitd_get_max_events(upipe_ts_eitd, &max_events));
+    assert(max_events == 0);
+    ubase_assert(upipe_ts_eitd_set_max_events(upipe_ts_eitd, 100));
+
     upipe_release(upipe_ts_eitd);
 
     upipe_mgr_release(upipe_ts_eitd_mgr); // nop
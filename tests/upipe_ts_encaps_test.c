@@ -57,6 +57,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <inttypes.h>
 #include <assert.h>
@@ -68,12 +69,15 @@
 #define UREF_POOL_DEPTH 0
 #define UBUF_POOL_DEPTH 0
 #define UPROBE_LOG_LEVEL UPROBE_LOG_VERBOSE
+/** number of sections in the PSI cache of ts_encaps */
+#define PSI_CACHE_SIZE 32
 
 static unsigned int last_cc;
 static uint64_t next_cr_sys = UINT64_MAX;
 static uint64_t next_dts_sys = UINT64_MAX;
 static uint64_t next_pcr_sys = UINT64_MAX;
 static bool next_ready = false;
+static uint64_t psi_sys = UINT32_MAX;
 
 /** definition of our uprobe */
 static int catch(struct uprobe *uprobe, struct upipe *upipe,
@@ -234,6 +238,107 @@ static void check_ubuf(struct ubuf *ubuf, uint8_t stream_id, bool unitstart,
     }
 }
 
+/** sends a new PSI flow definition to an encaps pipe */
+static void psi_set_pid(struct upipe *upipe, struct uref_mgr *uref_mgr,
+                        uint16_t pid)
+{
+    struct uref *flow_def = uref_block_flow_alloc_def(uref_mgr, "mpegtspsi.");
+    assert(flow_def != NULL);
+    ubase_assert(uref_block_flow_set_octetrate(flow_def, 1024));
+    ubase_assert(uref_ts_flow_set_tb_rate(flow_def, 2050));
+    ubase_assert(uref_ts_flow_set_pid(flow_def, pid));
+    ubase_assert(upipe_set_flow_def(upipe, flow_def));
+    uref_free(flow_def);
+}
+
+/** allocates a PSI encaps pipe; the uncached one has PCRs enabled, which
+ * bypasses the PSI cache, but with an interval so large that no PCR is
+ * ever due */
+static struct upipe *psi_alloc(struct upipe_mgr *upipe_ts_encaps_mgr,
+                               struct uprobe *logger,
+                               struct uref_mgr *uref_mgr, bool cached)
+{
+    struct upipe *upipe = upipe_void_alloc(upipe_ts_encaps_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             cached ? "ts encaps cached" : "ts encaps"));
+    assert(upipe != NULL);
+    psi_set_pid(upipe, uref_mgr, 68);
+    if (!cached)
+        ubase_assert(upipe_ts_mux_set_pcr_interval(upipe, UINT64_MAX / 2));
+    return upipe;
+}
+
+/** sends a PSI section filled with a pattern to an encaps pipe, and returns
+ * the number of TS packets it takes */
+static unsigned int psi_input(struct upipe *upipe, struct uref_mgr *uref_mgr,
+                              struct ubuf_mgr *ubuf_mgr, uint8_t seed,
+                              int size)
+{
+    struct uref *uref = uref_block_alloc(uref_mgr, ubuf_mgr, size);
+    assert(uref != NULL);
+    uint8_t *buffer;
+    int buffer_size = -1;
+    ubase_assert(uref_block_write(uref, 0, &buffer_size, &buffer));
+    assert(buffer_size == size);
+    for (int i = 0; i < size; i++)
+        buffer[i] = seed + i;
+    uref_block_unmap(uref, 0);
+    uref_clock_set_cr_sys(uref, psi_sys);
+    /* mandatory with PCRs */
+    uref_clock_set_cr_prog(uref, UCLOCK_FREQ);
+    uref_block_set_start(uref);
+    upipe_input(upipe, uref, NULL);
+    return (size + 1 + TS_SIZE - TS_HEADER_SIZE - 1) /
+           (TS_SIZE - TS_HEADER_SIZE);
+}
+
+/** splices TS packets from an encaps pipe into a buffer, one per second
+ * so that the TB buffer never overflows */
+static void psi_splice(struct upipe *upipe, uint8_t *buffer,
+                       unsigned int nb_ts, uint64_t mux_sys)
+{
+    for (unsigned int i = 0; i < nb_ts; i++) {
+        struct ubuf *ubuf;
+        uint64_t dts_sys;
+        mux_sys += UCLOCK_FREQ;
+        ubase_assert(upipe_ts_encaps_splice(upipe, mux_sys, mux_sys,
+                                            &ubuf, &dts_sys));
+        assert(ubuf != NULL);
+        size_t size;
+        ubase_assert(ubuf_block_size(ubuf, &size));
+        assert(size == TS_SIZE);
+        ubase_assert(ubuf_block_extract(ubuf, 0, TS_SIZE,
+                                        buffer + i * TS_SIZE));
+        ubuf_free(ubuf);
+    }
+}
+
+/** compares the output of a cached and an uncached encaps pipe for a PSI
+ * section, and checks the continuity counters and PID */
+static void psi_check(struct upipe *cached, struct upipe *uncached,
+                      struct uref_mgr *uref_mgr, struct ubuf_mgr *ubuf_mgr,
+                      uint8_t seed, int size, uint16_t pid)
+{
+    unsigned int nb_ts = psi_input(cached, uref_mgr, ubuf_mgr, seed, size);
+    assert(psi_input(uncached, uref_mgr, ubuf_mgr, seed, size) == nb_ts);
+
+    uint8_t buffer[nb_ts * TS_SIZE], reference[nb_ts * TS_SIZE];
+    psi_splice(cached, buffer, nb_ts, psi_sys);
+    psi_splice(uncached, reference, nb_ts, psi_sys);
+    psi_sys += nb_ts * UCLOCK_FREQ;
+    assert(!memcmp(buffer, reference, nb_ts * TS_SIZE));
+
+    for (unsigned int i = 0; i < nb_ts; i++) {
+        const uint8_t *ts = buffer + i * TS_SIZE;
+        last_cc++;
+        last_cc &= 0xf;
+        assert(ts_validate(ts));
+        assert(ts_get_pid(ts) == pid);
+        assert(ts_get_cc(ts) == last_cc);
+        assert(ts_get_unitstart(ts) == !i);
+    }
+}
+
 int main(int argc, char *argv[])
 {
     struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
@@ -626,6 +731,39 @@ int main(int argc, char *argv[])
 
     upipe_release(upipe_ts_encaps);
 
+    /* PSI cache: repeated, modified and evicted sections, and flow def
+     * changes, must give the same packets as the uncached path */
+    struct upipe *cached = psi_alloc(upipe_ts_encaps_mgr, logger, uref_mgr,
+                                     true);
+    struct upipe *uncached = psi_alloc(upipe_ts_encaps_mgr, logger, uref_mgr,
+                                       false);
+    last_cc = 5;
+    ubase_assert(upipe_ts_mux_set_cc(cached, last_cc));
+    ubase_assert(upipe_ts_mux_set_cc(uncached, last_cc));
+
+    /* miss, hits, then a section spanning fewer packets */
+    for (i = 0; i < 3; i++)
+        psi_check(cached, uncached, uref_mgr, ubuf_mgr, 1, 1024, 68);
+    psi_check(cached, uncached, uref_mgr, ubuf_mgr, 2, 100, 68);
+    psi_check(cached, uncached, uref_mgr, ubuf_mgr, 1, 1024, 68);
+    /* same size, different contents */
+    psi_check(cached, uncached, uref_mgr, ubuf_mgr, 3, 1024, 68);
+    psi_check(cached, uncached, uref_mgr, ubuf_mgr, 1, 1024, 68);
+
+    /* evict the first section from the cache */
+    for (i = 0; i <= PSI_CACHE_SIZE; i++)
+        psi_check(cached, uncached, uref_mgr, ubuf_mgr, 4 + i, 183, 68);
+    psi_check(cached, uncached, uref_mgr, ubuf_mgr, 1, 1024, 68);
+
+    /* a new flow definition invalidates the cache */
+    psi_set_pid(cached, uref_mgr, 69);
+    psi_set_pid(uncached, uref_mgr, 69);
+    psi_check(cached, uncached, uref_mgr, ubuf_mgr, 1, 1024, 69);
+    psi_check(cached, uncached, uref_mgr, ubuf_mgr, 1, 1024, 69);
+
+    upipe_release(cached);
+    upipe_release(uncached);
+
     upipe_mgr_release(upipe_ts_encaps_mgr); // nop
 
     uref_mgr_release(uref_mgr);
@@ -0,0 +1,417 @@
+/*
+ * Copyright (C) 2026 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for the bulk output mode of TS mux
+ *
+ * The same stream is muxed twice in file mode, first packet by packet, then
+ * in bulk mode, and the bulk blocks are checked against the packets of the
+ * first run.
+ */
+
+#undef NDEBUG
+
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uprobe_uref_mgr.h>
+#include <upipe/uprobe_ubuf_mem.h>
+#include <upipe/umem.h>
+#include <upipe/umem_alloc.h>
+#include <upipe/uclock.h>
+#include <upipe/udict.h>
+#include <upipe/udict_inline.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block.h>
+#include <upipe/ubuf_block_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_flow.h>
+#include <upipe/uref_block_flow.h>
+#include <upipe/uref_pic_flow.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_clock.h>
+#include <upipe/uref_std.h>
+#include <upipe/upipe.h>
+#include <upipe-ts/upipe_ts_mux.h>
+#include <upipe-ts/uref_ts_flow.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include <bitstream/mpeg/ts.h>
+
+#define UDICT_POOL_DEPTH 0
+#define UREF_POOL_DEPTH 0
+#define UBUF_POOL_DEPTH 0
+#define UPROBE_LOG_LEVEL UPROBE_LOG_NOTICE
+/** size of the output packets */
+#define MTU (7 * TS_SIZE)
+/** alignment and size granularity of the blocks in bulk mode */
+#define BULK_ALIGN 4096
+/** requested size of the blocks, rounded up by the mux */
+#define BULK_SIZE 1
+/** number of frames of the stream */
+#define NB_FRAMES 200
+/** frame before which the input is flushed */
+#define FLUSH_FRAME 107
+/** frame rate */
+#define FPS 25
+/** octet rate of the stream */
+#define OCTETRATE 1000000
+/** size of the frames */
+#define FRAME_SIZE (OCTETRATE / FPS)
+
+static struct uref_mgr *uref_mgr;
+static struct ubuf_mgr *ubuf_mgr;
+
+/** packets output in the first run */
+static struct {
+    uint8_t *data;
+    size_t size;
+    uint64_t *cr_sys;
+    unsigned int nb;
+    /** size output when the flush returned */
+    size_t flush_size;
+    /** size output when the input was released */
+    size_t end_size;
+} ref;
+
+/** state of the second run */
+static struct {
+    /** true in the second run */
+    bool enabled;
+    /** size of the blocks */
+    unsigned int size;
+    /** true while a partial block may be output */
+    bool partial;
+    /** size checked so far */
+    size_t offset;
+    /** number of packets checked so far */
+    unsigned int nb;
+    /** number of full blocks */
+    unsigned int full;
+    /** number of partial blocks */
+    unsigned int partials;
+} bulk;
+
+/** definition of our uprobe */
+static int catch(struct uprobe *uprobe, struct upipe *upipe,
+                 int event, va_list args)
+{
+    switch (event) {
+        case UPROBE_TS_MUX_LAST_CC:
+            UBASE_SIGNATURE_CHECK(args, UPIPE_TS_MUX_SIGNATURE)
+            break;
+        default:
+            break;
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** records a packet of the first run */
+static void ref_input(struct uref *uref)
+{
+    size_t size;
+    ubase_assert(uref_block_size(uref, &size));
+    /* bulk mode copies packets of the mtu */
+    assert(size == MTU);
+    uint64_t cr_sys;
+    ubase_assert(uref_clock_get_cr_sys(uref, &cr_sys));
+
+    ref.data = realloc(ref.data, ref.size + size);
+    assert(ref.data != NULL);
+    ubase_assert(uref_block_extract(uref, 0, size, ref.data + ref.size));
+    ref.size += size;
+    ref.cr_sys = realloc(ref.cr_sys, (ref.nb + 1) * sizeof(uint64_t));
+    assert(ref.cr_sys != NULL);
+    ref.cr_sys[ref.nb++] = cr_sys;
+}
+
+/** checks a block of the second run against the packets of the first run */
+static void bulk_input(struct uref *uref)
+{
+    size_t size;
+    ubase_assert(uref_block_size(uref, &size));
+    assert(size <= bulk.size);
+    if (size == bulk.size)
+        bulk.full++;
+    else {
+        /* only on flush and at the end of the stream */
+        assert(bulk.partial);
+        bulk.partials++;
+    }
+
+    uint64_t chunk_size;
+    ubase_assert(uref_block_get_chunk_size(uref, &chunk_size));
+    assert(chunk_size == MTU);
+    unsigned int nb_chunks;
+    ubase_assert(uref_block_get_chunks(uref, &nb_chunks));
+    assert(nb_chunks);
+    assert(nb_chunks * chunk_size == size);
+
+    const uint8_t *buffer;
+    int read_size = -1;
+    ubase_assert(uref_block_read(uref, 0, &read_size, &buffer));
+    /* contiguous and aligned */
+    assert(read_size == size);
+    assert(!((uintptr_t)buffer % BULK_ALIGN));
+
+    uint64_t cr_sys;
+    ubase_assert(uref_clock_get_cr_sys(uref, &cr_sys));
+    for (unsigned int i = 0; i < nb_chunks; i++) {
+        uint64_t delay;
+        ubase_assert(uref_block_get_chunk_delay(uref, i, &delay));
+        assert(bulk.nb < ref.nb);
+        assert(cr_sys + delay == ref.cr_sys[bulk.nb]);
+        for (unsigned int j = 0; j < MTU; j += TS_SIZE)
+            assert(ts_validate(buffer + i * MTU + j));
+        bulk.nb++;
+    }
+    assert(bulk.offset + size <= ref.size);
+    assert(!memcmp(buffer, ref.data + bulk.offset, size));
+    bulk.offset += size;
+    uref_block_unmap(uref, 0);
+}
+
+/** helper phony pipe */
+static struct upipe *test_alloc(struct upipe_mgr *mgr, struct uprobe *uprobe,
+                                uint32_t signature, va_list args)
+{
+    struct upipe *upipe = malloc(sizeof(struct upipe));
+    assert(upipe != NULL);
+    upipe_init(upipe, mgr, uprobe);
+    return upipe;
+}
+
+/** helper phony pipe */
+static void test_input(struct upipe *upipe, struct uref *uref,
+                       struct upump **upump_p)
+{
+    assert(uref != NULL);
+    if (bulk.enabled)
+        bulk_input(uref);
+    else
+        ref_input(uref);
+    uref_free(uref);
+}
+
+/** helper phony pipe */
+static int test_control(struct upipe *upipe, int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_SET_FLOW_DEF:
+            return UBASE_ERR_NONE;
+        case UPIPE_REGISTER_REQUEST: {
+            struct urequest *urequest = va_arg(args, struct urequest *);
+            return upipe_throw_provide_request(upipe, urequest);
+        }
+        case UPIPE_UNREGISTER_REQUEST:
+            return UBASE_ERR_NONE;
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** helper phony pipe */
+static void test_free(struct upipe *upipe)
+{
+    upipe_clean(upipe);
+    free(upipe);
+}
+
+/** helper phony pipe */
+static struct upipe_mgr test_mgr = {
+    .refcount = NULL,
+    .upipe_alloc = test_alloc,
+    .upipe_input = test_input,
+    .upipe_control = test_control
+};
+
+/** allocates a frame of the stream */
+static struct uref *frame_alloc(unsigned int frame)
+{
+    struct uref *uref = uref_block_alloc(uref_mgr, ubuf_mgr, FRAME_SIZE);
+    assert(uref != NULL);
+    uint8_t *buffer;
+    int size = -1;
+    ubase_assert(uref_block_write(uref, 0, &size, &buffer));
+    assert(size == FRAME_SIZE);
+    for (int i = 0; i < size; i++)
+        buffer[i] = frame + i;
+    uref_block_unmap(uref, 0);
+
+    uint64_t dts = UCLOCK_FREQ + frame * UCLOCK_FREQ / FPS;
+    uref_clock_set_dts_sys(uref, dts);
+    uref_clock_set_dts_prog(uref, dts);
+    uref_clock_set_dts_pts_delay(uref, 0);
+    uref_clock_set_duration(uref, UCLOCK_FREQ / FPS);
+    uref_block_set_start(uref);
+    if (!(frame % FPS))
+        uref_flow_set_random(uref);
+    return uref;
+}
+
+/** muxes the stream, packet by packet or in bulk mode */
+static void test_mux(struct upipe_mgr *upipe_ts_mux_mgr, struct uprobe *logger,
+                     bool bulk_mode)
+{
+    struct upipe *upipe_ts_mux = upipe_void_alloc(upipe_ts_mux_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "ts mux"));
+    assert(upipe_ts_mux != NULL);
+    struct uref *flow_def = uref_alloc_control(uref_mgr);
+    assert(flow_def != NULL);
+    ubase_assert(uref_flow_set_def(flow_def, "void."));
+    ubase_assert(upipe_set_flow_def(upipe_ts_mux, flow_def));
+    uref_free(flow_def);
+    ubase_assert(upipe_ts_mux_set_mode(upipe_ts_mux,
+                                       UPIPE_TS_MUX_MODE_CAPPED));
+    ubase_assert(upipe_set_output_size(upipe_ts_mux, MTU));
+
+    unsigned int bulk_size;
+    ubase_assert(upipe_ts_mux_get_bulk_size(upipe_ts_mux, &bulk_size));
+    assert(!bulk_size);
+    if (bulk_mode) {
+        ubase_assert(upipe_ts_mux_set_bulk_size(upipe_ts_mux, BULK_SIZE));
+        ubase_assert(upipe_ts_mux_get_bulk_size(upipe_ts_mux, &bulk_size));
+        assert(bulk_size >= BULK_SIZE);
+        assert(!(bulk_size % BULK_ALIGN));
+        assert(!(bulk_size % MTU));
+        /* the stream fills several blocks */
+        assert(bulk_size * 2 < NB_FRAMES * FRAME_SIZE);
+        bulk.size = bulk_size;
+        bulk.enabled = true;
+    }
+
+    struct upipe *upipe_sink = upipe_void_alloc(&test_mgr,
+                                                uprobe_use(logger));
+    assert(upipe_sink != NULL);
+    ubase_assert(upipe_set_output(upipe_ts_mux, upipe_sink));
+
+    struct upipe *program = upipe_void_alloc_sub(upipe_ts_mux,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "ts mux program"));
+    assert(program != NULL);
+    flow_def = uref_alloc_control(uref_mgr);
+    assert(flow_def != NULL);
+    ubase_assert(uref_flow_set_def(flow_def, "void."));
+    ubase_assert(uref_flow_set_id(flow_def, 1));
+    ubase_assert(uref_ts_flow_set_pid(flow_def, 256));
+    ubase_assert(upipe_set_flow_def(program, flow_def));
+    uref_free(flow_def);
+
+    struct upipe *input = upipe_void_alloc_sub(program,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "ts mux input"));
+    assert(input != NULL);
+    flow_def = uref_block_flow_alloc_def(uref_mgr, "mpeg2video.pic.");
+    assert(flow_def != NULL);
+    ubase_assert(uref_block_flow_set_octetrate(flow_def, OCTETRATE));
+    ubase_assert(uref_block_flow_set_buffer_size(flow_def, 229376));
+    struct urational fps = { .num = FPS, .den = 1 };
+    ubase_assert(uref_pic_flow_set_fps(flow_def, fps));
+    ubase_assert(upipe_set_flow_def(input, flow_def));
+    uref_free(flow_def);
+
+    for (unsigned int i = 0; i < NB_FRAMES; i++) {
+        if (i == FLUSH_FRAME) {
+            bulk.partial = true;
+            ubase_assert(upipe_flush(input));
+            bulk.partial = false;
+            /* nothing is kept in a partial block */
+            if (bulk_mode)
+                assert(bulk.offset == ref.flush_size);
+            else
+                ref.flush_size = ref.size;
+        }
+        upipe_input(input, frame_alloc(i), NULL);
+    }
+
+    /* end of stream */
+    bulk.partial = true;
+    upipe_release(input);
+    if (bulk_mode)
+        assert(bulk.offset == ref.end_size);
+    else
+        ref.end_size = ref.size;
+    upipe_release(program);
+    upipe_release(upipe_ts_mux);
+    bulk.partial = false;
+    test_free(upipe_sink);
+
+    if (bulk_mode) {
+        assert(bulk.offset == ref.size);
+        assert(bulk.nb == ref.nb);
+        assert(bulk.full >= 2);
+        assert(bulk.partials >= 1);
+        bulk.enabled = false;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
+    assert(umem_mgr != NULL);
+    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(UDICT_POOL_DEPTH,
+                                                         umem_mgr, -1, -1);
+    assert(udict_mgr != NULL);
+    uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH, udict_mgr, 0);
+    assert(uref_mgr != NULL);
+    ubuf_mgr = ubuf_block_mem_mgr_alloc(UBUF_POOL_DEPTH, UBUF_POOL_DEPTH,
+                                        umem_mgr, 0, 0, -1, 0);
+    assert(ubuf_mgr != NULL);
+
+    struct uprobe uprobe;
+    uprobe_init(&uprobe, catch, NULL);
+    struct uprobe *logger = uprobe_stdio_alloc(&uprobe, stdout,
+                                               UPROBE_LOG_LEVEL);
+    assert(logger != NULL);
+    logger = uprobe_uref_mgr_alloc(logger, uref_mgr);
+    assert(logger != NULL);
+    logger = uprobe_ubuf_mem_alloc(logger, umem_mgr, UBUF_POOL_DEPTH,
+                                   UBUF_POOL_DEPTH);
+    assert(logger != NULL);
+
+    struct upipe_mgr *upipe_ts_mux_mgr = upipe_ts_mux_mgr_alloc();
+    assert(upipe_ts_mux_mgr != NULL);
+
+    test_mux(upipe_ts_mux_mgr, logger, false);
+    assert(ref.nb);
+    assert(ref.flush_size && ref.flush_size <= ref.end_size);
+    test_mux(upipe_ts_mux_mgr, logger, true);
+
+    free(ref.data);
+    free(ref.cr_sys);
+    upipe_mgr_release(upipe_ts_mux_mgr);
+    ubuf_mgr_release(ubuf_mgr);
+    uref_mgr_release(uref_mgr);
+    udict_mgr_release(udict_mgr);
+    umem_mgr_release(umem_mgr);
+    uprobe_release(logger);
+    uprobe_clean(&uprobe);
+
+    return 0;
+}
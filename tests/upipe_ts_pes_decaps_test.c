@@ -70,6 +70,7 @@ static int end = UBASE_ERR_NONE;
 static size_t payload_size = 12;
 static bool expect_lost = false;
 static bool expect_acquired = true;
+static struct ubuf_mgr *linearize_mgr = NULL;
 
 /** definition of our uprobe */
 static int catch(struct uprobe *uprobe, struct upipe *upipe,
@@ -126,6 +127,11 @@ static void test_input(struct upipe *upipe, struct uref *uref,
     assert(size == payload_size);
     assert(dataalignment == uref_flow_get_random(uref));
     assert(end == uref_block_get_end(uref));
+    if (linearize_mgr != NULL) {
+        ubase_assert(uref_block_linearize(uref, linearize_mgr));
+        ubase_assert(uref_block_size_linear(uref, 0, &size));
+        assert(size == payload_size);
+    }
     uref_free(uref);
     nb_packets--;
 }
@@ -350,7 +356,105 @@ int main(int argc, char *argv[])
     assert(!nb_packets);
     assert(!expect_lost);
 
+    /* assembled PES */
+    bool assemble;
+    ubase_assert(upipe_ts_pesd_get_assemble(upipe_ts_pesd, &assemble));
+    assert(!assemble);
+    ubase_assert(upipe_ts_pesd_set_assemble(upipe_ts_pesd, true));
+    ubase_assert(upipe_ts_pesd_get_assemble(upipe_ts_pesd, &assemble));
+    assert(assemble);
+    linearize_mgr = ubuf_mgr;
+
+    uref = uref_block_alloc(uref_mgr, ubuf_mgr, PES_HEADER_SIZE_NOPTS + 10);
+    assert(uref != NULL);
+    size = -1;
+    ubase_assert(uref_block_write(uref, 0, &size, &buffer));
+    pes_init(buffer);
+    pes_set_streamid(buffer, PES_STREAM_ID_VIDEO_MPEG);
+    pes_set_length(buffer, PES_HEADER_SIZE_NOPTS + 30 - PES_HEADER_SIZE);
+    pes_set_headerlength(buffer, 0);
+    pes_set_dataalignment(buffer);
+    uref_block_unmap(uref, 0);
+    uref_block_set_start(uref);
+    upipe_input(upipe_ts_pesd, uref, NULL);
+
+    uref = uref_block_alloc(uref_mgr, ubuf_mgr, 10);
+    assert(uref != NULL);
+    upipe_input(upipe_ts_pesd, uref, NULL);
+
+    uref = uref_block_alloc(uref_mgr, ubuf_mgr, 10);
+    assert(uref != NULL);
+    payload_size = 30;
+    dataalignment = UBASE_ERR_NONE;
+    end = UBASE_ERR_NONE;
+    nb_packets++;
+    upipe_input(upipe_ts_pesd, uref, NULL);
+    assert(!nb_packets);
+
+    /* unbounded PES, output when the next one starts */
+    uref = uref_block_alloc(uref_mgr, ubuf_mgr, PES_HEADER_SIZE_NOPTS + 5);
+    assert(uref != NULL);
+    size = -1;
+    ubase_assert(uref_block_write(uref, 0, &size, &buffer));
+    pes_init(buffer);
+    pes_set_streamid(buffer, PES_STREAM_ID_VIDEO_MPEG);
+    pes_set_length(buffer, 0);
+    pes_set_headerlength(buffer, 0);
+    uref_block_unmap(uref, 0);
+    uref_block_set_start(uref);
+    upipe_input(upipe_ts_pesd, uref, NULL);
+
+    uref = uref_block_alloc(uref_mgr, ubuf_mgr, 7);
+    assert(uref != NULL);
+    upipe_input(upipe_ts_pesd, uref, NULL);
+
+    uref = uref_block_alloc(uref_mgr, ubuf_mgr, PES_HEADER_SIZE_NOPTS + 3);
+    assert(uref != NULL);
+    size = -1;
+    ubase_assert(uref_block_write(uref, 0, &size, &buffer));
+    pes_init(buffer);
+    pes_set_streamid(buffer, PES_STREAM_ID_VIDEO_MPEG);
+    pes_set_length(buffer, 0);
+    pes_set_headerlength(buffer, 0);
+    uref_block_unmap(uref, 0);
+    uref_block_set_start(uref);
+    payload_size = 12;
+    dataalignment = UBASE_ERR_INVALID;
+    end = UBASE_ERR_INVALID;
+    nb_packets++;
+    upipe_input(upipe_ts_pesd, uref, NULL);
+    assert(!nb_packets);
+
+    /* the pending PES is output when assembly is disabled */
+    payload_size = 3;
+    nb_packets++;
+    ubase_assert(upipe_ts_pesd_set_assemble(upipe_ts_pesd, false));
+    assert(!nb_packets);
+
+    /* the pending PES is output when the pipe is released */
+    ubase_assert(upipe_ts_pesd_set_assemble(upipe_ts_pesd, true));
+    uref = uref_block_alloc(uref_mgr, ubuf_mgr, PES_HEADER_SIZE_NOPTS + 5);
+    assert(uref != NULL);
+    size = -1;
+    ubase_assert(uref_block_write(uref, 0, &size, &buffer));
+    pes_init(buffer);
+    pes_set_streamid(buffer, PES_STREAM_ID_VIDEO_MPEG);
+    pes_set_length(buffer, 0);
+    pes_set_headerlength(buffer, 0);
+    uref_block_unmap(uref, 0);
+    uref_block_set_start(uref);
+    upipe_input(upipe_ts_pesd, uref, NULL);
+
+    uref = uref_block_alloc(uref_mgr, ubuf_mgr, 7);
+    assert(uref != NULL);
+    upipe_input(upipe_ts_pesd, uref, NULL);
+    assert(!nb_packets);
+
+    payload_size = 12;
+    nb_packets++;
     upipe_release(upipe_ts_pesd);
+    assert(!nb_packets);
+    linearize_mgr = NULL;
     upipe_mgr_release(upipe_ts_pesd_mgr); // nop
 
     test_free(upipe_sink);
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2013-2017 OpenHeadend S.A.R.L.
+ *
+ * Authors: Christophe Massiot
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for the table-driven CRC32 of the TS PSI decoder
+ */
+
+#undef NDEBUG
+
+#include "../lib/upipe-ts/upipe_ts_psi_decoder.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <bitstream/mpeg/psi.h>
+
+/** maximum misalignment of the sections, in octets */
+#define MAX_OFFSET 8
+
+int main(int argc, char *argv[])
+{
+    uint8_t buffer[PSI_PRIVATE_MAX_SIZE + PSI_HEADER_SIZE + MAX_OFFSET];
+    srand(42);
+
+    /* every section from 3 octets covered by the CRC up to 4096 octets
+     * in total, at every offset from an aligned address */
+    for (uint16_t length = PSI_CRC_SIZE; length <= PSI_PRIVATE_MAX_SIZE;
+         length++) {
+        for (unsigned int offset = 0; offset < MAX_OFFSET; offset++) {
+            uint8_t *section = buffer + offset;
+            size_t size = length + PSI_HEADER_SIZE - PSI_CRC_SIZE;
+            for (size_t i = 0; i < size; i++)
+                section[i] = rand();
+            psi_set_length(section, length);
+            psi_set_crc(section);
+
+            const uint8_t *crc = section + size;
+            assert(upipe_ts_psid_crc32(section, size) ==
+                   (((uint32_t)crc[0] << 24) | ((uint32_t)crc[1] << 16) |
+                    ((uint32_t)crc[2] << 8) | crc[3]));
+            assert(psi_check_crc(section));
+            assert(upipe_ts_psid_check_crc(section));
+
+            /* known-bad CRC */
+            unsigned int bit = rand() % (PSI_CRC_SIZE * 8);
+            section[size + bit / 8] ^= 1 << (bit % 8);
+            assert(!psi_check_crc(section));
+            assert(!upipe_ts_psid_check_crc(section));
+        }
+    }
+
+    /* a single corrupted octet in the payload is detected as well */
+    uint8_t *section = buffer + 1;
+    uint16_t length = PSI_PRIVATE_MAX_SIZE;
+    size_t size = length + PSI_HEADER_SIZE - PSI_CRC_SIZE;
+    memset(section, 0, size);
+    psi_set_length(section, length);
+    psi_set_crc(section);
+    assert(upipe_ts_psid_check_crc(section));
+    section[size - 1] ^= 0x80;
+    assert(!psi_check_crc(section));
+    assert(!upipe_ts_psid_check_crc(section));
+
+    return 0;
+}
@@ -51,6 +51,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <inttypes.h>
 #include <assert.h>
@@ -94,7 +95,10 @@ static int catch(struct uprobe *uprobe, struct upipe *upipe,
 
 struct test {
     uint16_t pid;
+    bool aligned;
     bool got_packet;
+    unsigned int nb_urefs;
+    unsigned int nb_packets;
     struct upipe upipe;
 };
 
@@ -108,7 +112,11 @@ static struct upipe *test_alloc(struct upipe_mgr *mgr, struct uprobe *uprobe,
     struct test *test = malloc(sizeof(struct test));
     assert(test != NULL);
     upipe_init(&test->upipe, mgr, uprobe);
+    test->aligned = ubase_check(uref_flow_match_def(flow_def,
+                                                    "block.mpegtsaligned."));
     test->got_packet = false;
+    test->nb_urefs = 0;
+    test->nb_packets = 0;
     test->pid = pid;
     return &test->upipe;
 }
@@ -120,13 +128,17 @@ static void test_input(struct upipe *upipe, struct uref *uref,
     struct test *test = container_of(upipe, struct test, upipe);
     assert(uref != NULL);
     test->got_packet = true;
-    const uint8_t *buffer;
-    int size = -1;
-    ubase_assert(uref_block_read(uref, 0, &size, &buffer));
-    assert(size == TS_SIZE); //because of the way we allocated it
-    assert(ts_validate(buffer));
-    assert(ts_get_pid(buffer) == test->pid);
-    uref_block_unmap(uref, 0);
+    size_t total;
+    ubase_assert(uref_block_size(uref, &total));
+    assert(total == TS_SIZE || (test->aligned && !(total % TS_SIZE)));
+    for (int offset = 0; offset < total; offset += TS_SIZE) {
+        uint8_t buffer[TS_HEADER_SIZE];
+        ubase_assert(uref_block_extract(uref, offset, TS_HEADER_SIZE, buffer));
+        assert(ts_validate(buffer));
+        assert(ts_get_pid(buffer) == test->pid);
+        test->nb_packets++;
+    }
+    test->nb_urefs++;
     uref_free(uref);
 }
 
@@ -236,6 +248,75 @@ int main(int argc, char *argv[])
     uref_block_unmap(uref, 0);
     upipe_input(upipe_ts_split, uref, NULL);
 
+    upipe_release(upipe_ts_split_output68);
+    upipe_release(upipe_ts_split_output69);
+    upipe_release(upipe_ts_split);
+
+    test_free(upipe_sink68);
+    test_free(upipe_sink69);
+
+    /* runs of aligned packets */
+    uref = uref_block_flow_alloc_def(uref_mgr, "mpegtsaligned.");
+    assert(uref != NULL);
+    upipe_ts_split = upipe_void_alloc(upipe_ts_split_mgr,
+            uprobe_pfx_alloc(uprobe_use(uprobe_stdio), UPROBE_LOG_LEVEL,
+                             "ts split aligned"));
+    assert(upipe_ts_split != NULL);
+    ubase_assert(upipe_set_flow_def(upipe_ts_split, uref));
+
+    ubase_assert(uref_ts_flow_set_pid(uref, 69));
+    upipe_sink69 = upipe_flow_alloc(&test_mgr, uprobe_use(uprobe_stdio), uref);
+    assert(upipe_sink69 != NULL);
+    upipe_ts_split_output69 = upipe_flow_alloc_sub(upipe_ts_split,
+            uprobe_pfx_alloc(uprobe_use(uprobe_stdio), UPROBE_LOG_LEVEL,
+                             "ts split aligned output 69"), uref);
+    assert(upipe_ts_split_output69 != NULL);
+    ubase_assert(upipe_set_output(upipe_ts_split_output69, upipe_sink69));
+
+    ubase_assert(uref_flow_set_def(uref, "block.mpegts."));
+    ubase_assert(uref_ts_flow_set_pid(uref, 68));
+    upipe_sink68 = upipe_flow_alloc(&test_mgr, uprobe_use(uprobe_stdio), uref);
+    assert(upipe_sink68 != NULL);
+    upipe_ts_split_output68 = upipe_flow_alloc_sub(upipe_ts_split,
+            uprobe_pfx_alloc(uprobe_use(uprobe_stdio), UPROBE_LOG_LEVEL,
+                             "ts split aligned output 68"), uref);
+    assert(upipe_ts_split_output68 != NULL);
+    ubase_assert(upipe_set_output(upipe_ts_split_output68, upipe_sink68));
+    uref_free(uref);
+
+    /* two segments, the second one starting in the middle of a header */
+    static const uint16_t pids[] = { 68, 69, 69, 68, 68, 69, 70, 69 };
+    const int nb = sizeof(pids) / sizeof(pids[0]);
+    const int split = 3 * TS_SIZE + 1;
+    uint8_t packets[nb * TS_SIZE];
+    for (int i = 0; i < nb; i++) {
+        ts_pad(packets + i * TS_SIZE);
+        ts_set_pid(packets + i * TS_SIZE, pids[i]);
+    }
+    uref = uref_block_alloc(uref_mgr, ubuf_mgr, split);
+    assert(uref != NULL);
+    size = -1;
+    ubase_assert(uref_block_write(uref, 0, &size, &buffer));
+    assert(size == split);
+    memcpy(buffer, packets, split);
+    uref_block_unmap(uref, 0);
+    struct ubuf *ubuf = ubuf_block_alloc(ubuf_mgr, nb * TS_SIZE - split);
+    assert(ubuf != NULL);
+    size = -1;
+    ubase_assert(ubuf_block_write(ubuf, 0, &size, &buffer));
+    assert(size == nb * TS_SIZE - split);
+    memcpy(buffer, packets + split, size);
+    ubuf_block_unmap(ubuf, 0);
+    ubase_assert(uref_block_append(uref, ubuf));
+    upipe_input(upipe_ts_split, uref, NULL);
+
+    struct test *test68 = container_of(upipe_sink68, struct test, upipe);
+    struct test *test69 = container_of(upipe_sink69, struct test, upipe);
+    assert(test68->nb_packets == 3);
+    assert(test68->nb_urefs == 3);
+    assert(test69->nb_packets == 4);
+    assert(test69->nb_urefs == 3);
+
     upipe_release(upipe_ts_split_output68);
     upipe_release(upipe_ts_split_output69);
     upipe_release(upipe_ts_split);
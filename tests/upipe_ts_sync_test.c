@@ -50,6 +50,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <inttypes.h>
 #include <assert.h>
@@ -62,6 +63,7 @@
 #define UPROBE_LOG_LEVEL UPROBE_LOG_DEBUG
 
 static unsigned int nb_packets = 0;
+static unsigned int last_packets = 0;
 static int expect_loss = -1;
 
 /** definition of our uprobe */
@@ -101,16 +103,20 @@ static void test_input(struct upipe *upipe, struct uref *uref,
     assert(uref != NULL);
     size_t size;
     ubase_assert(uref_block_size(uref, &size));
-    assert(size == TS_SIZE);
+    assert(size && !(size % TS_SIZE));
 
-    const uint8_t *buffer;
-    int rsize = 1;
-    ubase_assert(uref_block_read(uref, 0, &rsize, &buffer));
-    assert(rsize == 1);
-    assert(ts_validate(buffer));
-    uref_block_unmap(uref, 0);
+    for (int offset = 0; offset < size; offset += TS_SIZE) {
+        const uint8_t *buffer;
+        int rsize = 1;
+        ubase_assert(uref_block_read(uref, offset, &rsize, &buffer));
+        assert(rsize == 1);
+        assert(ts_validate(buffer));
+        uref_block_unmap(uref, offset);
+        assert(nb_packets);
+        nb_packets--;
+    }
+    last_packets = size / TS_SIZE;
     uref_free(uref);
-    nb_packets--;
 }
 
 /** helper phony pipe */
@@ -233,6 +239,102 @@ int main(int argc, char *argv[])
     nb_packets++;
     upipe_release(upipe_ts_sync);
     assert(!nb_packets);
+
+    /* batched output */
+    uref = uref_block_flow_alloc_def(uref_mgr, NULL);
+    assert(uref != NULL);
+    upipe_ts_sync = upipe_void_alloc(upipe_ts_sync_mgr,
+            uprobe_pfx_alloc(uprobe_use(uprobe_stdio), UPROBE_LOG_LEVEL,
+                             "ts sync batch"));
+    assert(upipe_ts_sync != NULL);
+    ubase_assert(upipe_set_flow_def(upipe_ts_sync, uref));
+    ubase_assert(upipe_set_output(upipe_ts_sync, upipe_sink));
+    uref_free(uref);
+
+    unsigned int batch;
+    ubase_assert(upipe_ts_sync_get_batch(upipe_ts_sync, &batch));
+    assert(batch == 1);
+    ubase_nassert(upipe_ts_sync_set_batch(upipe_ts_sync, 0));
+    ubase_assert(upipe_ts_sync_set_batch(upipe_ts_sync, 4));
+    ubase_assert(upipe_ts_sync_get_batch(upipe_ts_sync, &batch));
+    assert(batch == 4);
+    struct uref *flow_def;
+    const char *def;
+    ubase_assert(upipe_get_flow_def(upipe_ts_sync, &flow_def));
+    ubase_assert(uref_flow_get_def(flow_def, &def));
+    assert(!strcmp(def, "block.mpegtsaligned."));
+
+    uref = uref_block_alloc(uref_mgr, ubuf_mgr, 7 * TS_SIZE);
+    assert(uref != NULL);
+    size = -1;
+    ubase_assert(uref_block_write(uref, 0, &size, &buffer));
+    assert(size == 7 * TS_SIZE);
+    for (int i = 0; i < 7; i++)
+        ts_pad(buffer + i * TS_SIZE);
+    uref_block_unmap(uref, 0);
+    /* the last packet waits for the next sync word */
+    nb_packets += 6;
+    upipe_input(upipe_ts_sync, uref, NULL);
+    assert(!nb_packets);
+    assert(last_packets == 2);
+
+    nb_packets++;
+    upipe_release(upipe_ts_sync);
+    assert(!nb_packets);
+
+    /* resync on a noisy, segmented input */
+    uref = uref_block_flow_alloc_def(uref_mgr, NULL);
+    assert(uref != NULL);
+    upipe_ts_sync = upipe_void_alloc(upipe_ts_sync_mgr,
+            uprobe_pfx_alloc(uprobe_use(uprobe_stdio), UPROBE_LOG_LEVEL,
+                             "ts sync resync"));
+    assert(upipe_ts_sync != NULL);
+    ubase_assert(upipe_set_flow_def(upipe_ts_sync, uref));
+    ubase_assert(upipe_set_output(upipe_ts_sync, upipe_sink));
+    ubase_assert(upipe_ts_sync_set_sync(upipe_ts_sync, 3));
+    uref_free(uref);
+
+    const int junk = 37;
+    uint8_t noisy[junk + 10 * TS_SIZE];
+    memset(noisy, 0, junk);
+    noisy[0] = noisy[5] = noisy[20] = noisy[junk - 1] = 0x47;
+    for (int i = 0; i < 10; i++)
+        ts_pad(noisy + junk + i * TS_SIZE);
+    static const int segments[] = { 50, 300, 7, 188, 1, 500 };
+    uref = NULL;
+    int done = 0;
+    for (int i = 0; i < sizeof(segments) / sizeof(segments[0]); i++) {
+        struct ubuf *ubuf = ubuf_block_alloc(ubuf_mgr, segments[i]);
+        assert(ubuf != NULL);
+        size = -1;
+        ubase_assert(ubuf_block_write(ubuf, 0, &size, &buffer));
+        memcpy(buffer, noisy + done, segments[i]);
+        ubuf_block_unmap(ubuf, 0);
+        done += segments[i];
+        if (uref == NULL) {
+            uref = uref_block_alloc(uref_mgr, ubuf_mgr, 0);
+            assert(uref != NULL);
+            uref_attach_ubuf(uref, ubuf);
+        } else
+            ubase_assert(uref_block_append(uref, ubuf));
+    }
+    struct ubuf *ubuf = ubuf_block_alloc(ubuf_mgr, sizeof(noisy) - done);
+    assert(ubuf != NULL);
+    size = -1;
+    ubase_assert(ubuf_block_write(ubuf, 0, &size, &buffer));
+    memcpy(buffer, noisy + done, sizeof(noisy) - done);
+    ubuf_block_unmap(ubuf, 0);
+    ubase_assert(uref_block_append(uref, ubuf));
+
+    /* the last two packets wait for the next sync words */
+    nb_packets += 8;
+    expect_loss = 8;
+    upipe_input(upipe_ts_sync, uref, NULL);
+    assert(!nb_packets);
+
+    nb_packets += 2;
+    upipe_release(upipe_ts_sync);
+    assert(!nb_packets);
     upipe_mgr_release(upipe_ts_sync_mgr); // nop
 
     test_free(upipe_sink);
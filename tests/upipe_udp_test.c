@@ -49,6 +49,7 @@
 #include <upipe/ubuf_block_mem.h>
 #include <upipe/uref.h>
 #include <upipe/uref_block.h>
+#include <upipe/uref_clock.h>
 #include <upipe/uref_flow.h>
 #include <upipe/uref_block_flow.h>
 #include <upipe/uref_std.h>
@@ -80,6 +81,12 @@
 #define UPROBE_LOG_LEVEL UPROBE_LOG_DEBUG
 #define BUF_SIZE 256
 #define FORMAT "This is packet number %d"
+/* time between the sending and the reception of datagrams */
+#define BURST_PAUSE 20000
+/* accuracy of the conversion of kernel timestamps */
+#define TIMESTAMP_TOLERANCE (UCLOCK_FREQ / 1000)
+/* delay before the sink outputs packets */
+#define BATCH_DELAY (UCLOCK_FREQ / 200)
 
 /* FIXME: uncomment or remove */
 /*static void usage(const char *argv0) {
@@ -102,6 +109,10 @@ struct addrinfo hints, *servinfo, *p;
 struct upipe *upipe_udpsrc;
 struct upipe *upipe_udpsink;
 static int counter = 0;
+static struct uclock *uclock;
+/* system times around the sending of the last burst of datagrams */
+static uint64_t burst_start = UINT64_MAX;
+static uint64_t burst_end;
 
 /** definition of our uprobe */
 static int catch(struct uprobe *uprobe, struct upipe *upipe,
@@ -153,14 +164,27 @@ static void test_input(struct upipe *upipe, struct uref *uref,
     struct udpsrc_test *udpsrc_test = udpsrc_test_from_upipe(upipe);
     assert(uref != NULL);
 
+    uint64_t cr_sys;
+    ubase_assert(uref_clock_get_cr_sys(uref, &cr_sys));
+    if (burst_start != UINT64_MAX) {
+        /* kernel timestamp, not the time of the wakeup */
+        assert(cr_sys + TIMESTAMP_TOLERANCE >= burst_start);
+        assert(cr_sys <= burst_end + TIMESTAMP_TOLERANCE);
+    }
+
+    size_t size;
+    ubase_assert(uref_block_size(uref, &size));
+    assert(size == BUF_SIZE);
     if ((rbuf = uref_block_peek(uref, 0, -1, buf))) {
         upipe_dbg_va(upipe, "Received string: %s", rbuf);
+        memset(str, 0, sizeof(str));
         snprintf((char *)str, sizeof(str), FORMAT, udpsrc_test->counter);
-        assert(strncmp((char *)str, (char *)rbuf, BUF_SIZE) == 0);
+        assert(memcmp(str, rbuf, BUF_SIZE) == 0);
         udpsrc_test->counter++;
         uref_block_peek_unmap(uref, 0, buf, rbuf);
     }
-    if (udpsrc_test->counter == 110 || udpsrc_test->counter == 210) {
+    if (udpsrc_test->counter == 110 || udpsrc_test->counter == 210 ||
+        udpsrc_test->counter == 310) {
         upipe_set_uri(upipe_udpsrc, NULL);
     }
 
@@ -237,6 +261,31 @@ static void genpackets2(struct upump *upump)
         return;
     }
 
+    /* packets wait for their date in the sink, then are sent in batches */
+    uint64_t cr_sys = uclock_now(uclock) + BATCH_DELAY;
+
+    if (counter == 150) {
+        /* send a bulk block made of 10 chunks */
+        uint8_t delays[10 * 4];
+        int bulk_size = -1;
+        uref = uref_block_alloc(uref_mgr, ubuf_mgr, BUF_SIZE * 10);
+        uref_block_write(uref, 0, &bulk_size, &buf);
+        assert(bulk_size == BUF_SIZE * 10);
+        memset(buf, 0, bulk_size);
+        for (i = 0; i < 10; i++) {
+            snprintf((char *)buf + i * BUF_SIZE, BUF_SIZE, FORMAT, counter);
+            uref_block_set_chunk_delay(delays, i, 0);
+            counter++;
+        }
+        uref_block_unmap(uref, 0);
+        ubase_assert(uref_block_set_chunk_size(uref, BUF_SIZE));
+        ubase_assert(uref_block_set_chunk_delays(uref, delays,
+                                                 sizeof(delays)));
+        uref_clock_set_cr_sys(uref, cr_sys);
+        upipe_input(upipe_udpsink, uref, NULL);
+        return;
+    }
+
     for (i=0; i < 10; i++) {
         uref = uref_block_alloc(uref_mgr, ubuf_mgr, BUF_SIZE);
         uref_block_write(uref, 0, &size, &buf);
@@ -244,11 +293,33 @@ static void genpackets2(struct upump *upump)
         memset(buf, 0, size);
         snprintf((char *)buf, BUF_SIZE, FORMAT, counter);
         uref_block_unmap(uref, 0);
+        uref_clock_set_cr_sys(uref, cr_sys);
         counter++;
         upipe_input(upipe_udpsink, uref, NULL);
     }
 }
 
+/* packet generator, leaving time between the sending and the reception */
+static void genpackets3(struct upump *unused)
+{
+    int i;
+    uint8_t buf[BUF_SIZE];
+    memset(buf, 0, sizeof(buf));
+    printf("Counter: %d\n", counter);
+    if (counter > 300) {
+        upump_stop(write_pump);
+        return;
+    }
+    burst_start = uclock_now(uclock);
+    for (i=0; i < 10; i++) {
+        snprintf((char *)buf, BUF_SIZE, FORMAT, counter);
+        counter++;
+        sendto(sockfd, buf, BUF_SIZE, 0, p->ai_addr, p->ai_addrlen);
+    }
+    burst_end = uclock_now(uclock);
+    usleep(BURST_PAUSE);
+}
+
 int main(int argc, char *argv[])
 {
     char udp_uri[512], port_str[8];
@@ -269,7 +340,7 @@ int main(int argc, char *argv[])
     struct upump_mgr *upump_mgr = upump_ev_mgr_alloc_default(UPUMP_POOL,
             UPUMP_BLOCKER_POOL);
     assert(upump_mgr != NULL);
-    struct uclock *uclock = uclock_std_alloc(0);
+    uclock = uclock_std_alloc(0);
     assert(uclock != NULL);
     struct uprobe uprobe;
     uprobe_init(&uprobe, catch, NULL);
@@ -352,6 +423,13 @@ int main(int argc, char *argv[])
     ubase_assert(upipe_set_flow_def(upipe_udpsink, flow_def));
     uref_free(flow_def);
 
+    /* receive in batches where supported */
+    unsigned int batch = 1;
+    if (ubase_check(upipe_udpsrc_set_batch(upipe_udpsrc, 8))) {
+        ubase_assert(upipe_udpsrc_get_batch(upipe_udpsrc, &batch));
+        assert(batch == 8);
+    }
+
     /* reset source uri */
     for (i=0; i < 10; i++) {
         port = ((rand() % 40000) + 1024);
@@ -363,6 +441,9 @@ int main(int argc, char *argv[])
     }
     assert(ret);
     ubase_assert(upipe_set_uri(upipe_udpsink, udp_uri+1));
+    ubase_assert(upipe_attach_uclock(upipe_udpsink));
+    bool batch_output = ubase_check(upipe_udpsink_set_batch_window(
+                upipe_udpsink, UCLOCK_FREQ / 1000));
 
     /* redefine write pump */
     write_pump = upump_alloc_idler(upump_mgr, genpackets2, NULL, NULL);
@@ -372,8 +453,52 @@ int main(int argc, char *argv[])
     /* fire again */
     upump_mgr_run(upump_mgr, NULL);
 
-    /* release */
+    /* all datagrams were received, in order */
+    assert(udpsrc_test_from_upipe(udpsrc_test)->counter == 210);
+    if (batch_output) {
+        struct upipe_udpsink_stats stats;
+        ubase_assert(upipe_udpsink_get_stats(upipe_udpsink, &stats));
+        assert(stats.datagrams == 100);
+        /* datagrams were sent several at a time */
+        assert(stats.syscalls * 4 <= stats.datagrams);
+        uint64_t batched = 0;
+        for (i = 1; i < UPIPE_UDPSINK_BATCH_BUCKETS; i++)
+            batched += stats.batch_sizes[i];
+        assert(batched > 0);
+    }
     upump_free(write_pump);
+
+    /* batched datagrams are dated with kernel timestamps */
+    if (batch > 1) {
+        for (i=0; i < 10; i++) {
+            port = ((rand() % 40000) + 1024);
+            snprintf(udp_uri, sizeof(udp_uri), "@127.0.0.1:%d", port);
+            printf("Trying uri: %s ...\n", udp_uri);
+            if (( ret = ubase_check(upipe_set_uri(upipe_udpsrc, udp_uri)) )) {
+                break;
+            }
+        }
+        assert(ret);
+
+        freeaddrinfo(servinfo);
+        snprintf(port_str, sizeof(port_str), "%d", port);
+        assert(getaddrinfo("127.0.0.1", port_str, &hints, &servinfo) == 0);
+        p = servinfo;
+        sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        assert(sockfd != -1);
+
+        write_pump = upump_alloc_idler(upump_mgr, genpackets3, NULL, NULL);
+        assert(write_pump);
+        upump_start(write_pump);
+
+        upump_mgr_run(upump_mgr, NULL);
+
+        assert(udpsrc_test_from_upipe(udpsrc_test)->counter == 310);
+        close(sockfd);
+        upump_free(write_pump);
+    }
+
+    /* release */
     upipe_release(upipe_udpsrc);
     upipe_release(upipe_udpsink);
     test_free(udpsrc_test);
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for upool per-thread caches
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubase.h>
+#include <upipe/uatomic.h>
+#include <upipe/urefcount.h>
+#include <upipe/upool.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+
+#define UPOOL_DEPTH 128
+#define NB_ELEMS 1000
+#define NB_LOOPS 10
+#define NB_POOLS 100
+
+static struct urefcount refcount;
+static struct upool upool;
+static uint8_t upool_extra[upool_sizeof(UPOOL_DEPTH)];
+static uatomic_uint32_t nb_allocs;
+static uatomic_uint32_t nb_frees;
+static void *elems[NB_ELEMS];
+
+static void *elem_alloc(struct upool *upool)
+{
+    uatomic_fetch_add(&nb_allocs, 1);
+    return malloc(1);
+}
+
+static void elem_free(struct upool *upool, void *elem)
+{
+    uatomic_fetch_add(&nb_frees, 1);
+    free(elem);
+}
+
+static void *producer(void *unused)
+{
+    for (int i = 0; i < NB_ELEMS; i++) {
+        elems[i] = upool_alloc(&upool, void *);
+        assert(elems[i] != NULL);
+    }
+    return NULL;
+}
+
+static void *consumer(void *unused)
+{
+    for (int i = 0; i < NB_ELEMS; i++)
+        upool_free(&upool, elems[i]);
+    return NULL;
+}
+
+static void *cacher(void *unused)
+{
+    for (int i = 0; i < UPOOL_MAGAZINE_SIZE; i++)
+        elems[i] = upool_alloc(&upool, void *);
+    for (int i = 0; i < UPOOL_MAGAZINE_SIZE; i++)
+        upool_free(&upool, elems[i]);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    urefcount_init(&refcount, NULL);
+    uatomic_init(&nb_allocs, 0);
+    uatomic_init(&nb_frees, 0);
+    upool_init(&upool, &refcount, UPOOL_DEPTH, upool_extra,
+               elem_alloc, elem_free);
+    ubase_assert(upool_cache_init(&upool));
+
+    /* same thread */
+    void *elem = upool_alloc(&upool, void *);
+    assert(elem != NULL);
+    upool_free(&upool, elem);
+    assert(upool_alloc(&upool, void *) == elem);
+    upool_free(&upool, elem);
+
+    /* elements allocated in a thread and released in another */
+    for (int i = 0; i < NB_LOOPS; i++) {
+        pthread_t id;
+        assert(pthread_create(&id, NULL, producer, NULL) == 0);
+        assert(pthread_join(id, NULL) == 0);
+        assert(pthread_create(&id, NULL, consumer, NULL) == 0);
+        assert(pthread_join(id, NULL) == 0);
+    }
+
+    struct upool_stats stats;
+    ubase_assert(upool_get_stats(&upool, &stats));
+    assert(stats.local_hits > 0);
+    assert(stats.remote_frees > 0);
+    assert(stats.depot_allocs > 0);
+    assert(stats.spills > 0);
+    /* magazines handed over by the consumers were reused */
+    assert(uatomic_load(&nb_allocs) < NB_ELEMS * NB_LOOPS);
+
+    upool_clean(&upool);
+    assert(upool.depot == NULL);
+    assert(uatomic_load(&nb_allocs) == uatomic_load(&nb_frees));
+
+    /* elements cached by an exited thread are handed back to the depot */
+    upool_init(&upool, &refcount, UPOOL_DEPTH, upool_extra,
+               elem_alloc, elem_free);
+    ubase_assert(upool_cache_init(&upool));
+    pthread_t id;
+    assert(pthread_create(&id, NULL, cacher, NULL) == 0);
+    assert(pthread_join(id, NULL) == 0);
+    uint32_t allocs = uatomic_load(&nb_allocs);
+    for (int i = 0; i < UPOOL_MAGAZINE_SIZE; i++)
+        elems[i] = upool_alloc(&upool, void *);
+    assert(uatomic_load(&nb_allocs) == allocs);
+    for (int i = 0; i < UPOOL_MAGAZINE_SIZE; i++)
+        upool_free(&upool, elems[i]);
+    upool_clean(&upool);
+    assert(uatomic_load(&nb_allocs) == uatomic_load(&nb_frees));
+
+    /* there is no limit to the number of pools with caches */
+    static struct upool upools[NB_POOLS];
+    static uint8_t upools_extra[NB_POOLS][upool_sizeof(UPOOL_DEPTH)];
+    for (int i = 0; i < NB_POOLS; i++) {
+        upool_init(&upools[i], &refcount, UPOOL_DEPTH, upools_extra[i],
+                   elem_alloc, elem_free);
+        ubase_assert(upool_cache_init(&upools[i]));
+        upool_free(&upools[i], upool_alloc(&upools[i], void *));
+        ubase_assert(upool_get_stats(&upools[i], &stats));
+        assert(stats.local_hits == 1);
+    }
+    for (int i = 0; i < NB_POOLS; i++)
+        upool_clean(&upools[i]);
+    assert(uatomic_load(&nb_allocs) == uatomic_load(&nb_frees));
+    urefcount_clean(&refcount);
+    return 0;
+}
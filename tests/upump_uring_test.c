@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for upump manager with io_uring event loop
+ */
+
+#undef NDEBUG
+
+#include <upipe/uclock.h>
+#include <upipe/uclock_std.h>
+#include <upipe/upump.h>
+#include <upipe/upump_blocker.h>
+#include <upump-uring/upump_uring.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+
+#define UPUMP_POOL 1
+#define UPUMP_BLOCKER_POOL 1
+
+static uint64_t timeout = UINT64_C(27000000); /* 1 s */
+static const char *padding = "This is an initialized bit of space used to pad sufficiently !";
+/* This is an arbitrarily large number that is just supposed to be bigger than
+ * the buffer space of a pipe. */
+#define MIN_READ (128*1024)
+/* number of timers in the timer wheel test */
+#define WHEEL_TIMERS 1000
+/* resolution of the timer wheel */
+#define WHEEL_TICK (UCLOCK_FREQ / 1000)
+
+static int pipefd[2];
+static struct upump_mgr *mgr;
+static struct upump *write_idler;
+static struct upump *read_timer;
+static struct upump *write_watcher;
+static struct upump *read_watcher;
+static struct upump *read_pump;
+static struct upump_blocker *blocker = NULL;
+static ssize_t bytes_written = 0, bytes_read = 0;
+static char read_buffer[128];
+static struct uclock *uclock;
+static struct upump *wheel_timers[WHEEL_TIMERS];
+static uint64_t wheel_dates[WHEEL_TIMERS];
+static unsigned int wheel_triggered = 0;
+static struct upump *wheel_repeat;
+static unsigned int wheel_repeated = 0;
+/* number of watchers exceeding the size of the submission queue */
+#define MANY_WATCHERS 2048
+static struct upump *many_watchers[MANY_WATCHERS];
+static unsigned int many_triggered = 0;
+
+static void blocker_cb(struct upump_blocker *blocker)
+{
+    upump_blocker_free(blocker);
+}
+
+static void write_idler_cb(struct upump *upump)
+{
+    ssize_t ret = write(pipefd[1], padding, strlen(padding) + 1);
+    if (ret == -1 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+        printf("write idler blocked\n");
+        blocker = upump_blocker_alloc(write_idler, blocker_cb, NULL, NULL);
+        assert(blocker != NULL);
+        upump_start(write_watcher);
+        upump_start(read_timer);
+    } else {
+        assert(ret != -1);
+        bytes_written += ret;
+    }
+}
+
+static void write_watcher_cb(struct upump *unused)
+{
+    printf("write watcher passed\n");
+    upump_blocker_free(blocker);
+    upump_stop(write_watcher);
+}
+
+static void read_timer_cb(struct upump *unused)
+{
+    printf("read timer passed\n");
+    upump_start(read_watcher);
+    /* The timer is automatically stopped */
+}
+
+static void read_watcher_cb(struct upump *unused)
+{
+    char buffer[strlen(padding) + 1];
+    ssize_t ret = read(pipefd[0], buffer, strlen(padding) + 1);
+    assert(ret != -1);
+    bytes_read += ret;
+    if (bytes_read > MIN_READ) {
+        printf("read watcher passed\n");
+        upump_stop(write_idler);
+        upump_stop(read_watcher);
+    }
+}
+
+static void read_pump_cb(struct upump *upump)
+{
+    ssize_t result;
+    ubase_assert(upump_uring_get_result(upump, &result));
+    assert(result == strlen(padding) + 1);
+    assert(!strcmp(read_buffer, padding));
+    printf("read pump passed\n");
+    upump_stop(upump);
+}
+
+static void many_watcher_cb(struct upump *upump)
+{
+    many_triggered++;
+    upump_stop(upump);
+}
+
+static void wheel_timer_cb(struct upump *upump)
+{
+    uint64_t *date = upump_get_opaque(upump, uint64_t *);
+    assert(uclock_now(uclock) >= *date);
+    wheel_triggered++;
+}
+
+static void wheel_repeat_cb(struct upump *upump)
+{
+    if (++wheel_repeated == 5) {
+        printf("timer wheel repeat passed\n");
+        upump_stop(upump);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long flags;
+    mgr = upump_uring_mgr_alloc(UPUMP_POOL, UPUMP_BLOCKER_POOL);
+    if (mgr == NULL) {
+        printf("io_uring is not available\n");
+        return 77;
+    }
+
+    /* Create a pipe with non-blocking write */
+    assert(pipe(pipefd) != -1);
+    flags = fcntl(pipefd[1], F_GETFL);
+    assert(flags != -1);
+    flags |= O_NONBLOCK;
+    assert(fcntl(pipefd[1], F_SETFL, flags) != -1);
+
+    /* Create watchers */
+    write_idler = upump_alloc_idler(mgr, write_idler_cb, NULL, NULL);
+    assert(write_idler != NULL);
+    write_watcher = upump_alloc_fd_write(mgr, write_watcher_cb, NULL, NULL,
+                                         pipefd[1]);
+    assert(write_watcher != NULL);
+    read_timer = upump_alloc_timer(mgr, read_timer_cb, NULL, NULL, timeout, 0);
+    assert(read_timer != NULL);
+    read_watcher = upump_alloc_fd_read(mgr, read_watcher_cb, NULL, NULL,
+                                       pipefd[0]);
+    assert(read_watcher != NULL);
+
+    /* Start tests */
+    upump_start(write_idler);
+    upump_mgr_run(mgr, NULL);
+    assert(bytes_read);
+    assert(bytes_read == bytes_written);
+
+    /* Completion-based read */
+    read_pump = upump_uring_alloc_read(mgr, read_pump_cb, NULL, NULL,
+                                       pipefd[0]);
+    assert(read_pump != NULL);
+    ubase_assert(upump_uring_set_buffer(read_pump, read_buffer,
+                                        sizeof(read_buffer)));
+    upump_start(read_pump);
+    assert(write(pipefd[1], padding, strlen(padding) + 1) ==
+           strlen(padding) + 1);
+    upump_mgr_run(mgr, NULL);
+
+    /* More operations in flight than entries in the submission queue */
+    for (int i = 0; i < MANY_WATCHERS; i++) {
+        many_watchers[i] = upump_alloc_fd_write(mgr, many_watcher_cb, NULL,
+                                                NULL, pipefd[1]);
+        assert(many_watchers[i] != NULL);
+        upump_start(many_watchers[i]);
+    }
+    upump_mgr_run(mgr, NULL);
+    assert(many_triggered == MANY_WATCHERS);
+    for (int i = 0; i < MANY_WATCHERS; i++)
+        upump_free(many_watchers[i]);
+    printf("many watchers passed\n");
+
+    /* Timer wheel */
+    uclock = uclock_std_alloc(0);
+    assert(uclock != NULL);
+    ubase_assert(upump_mgr_set_timer_tick(mgr, WHEEL_TICK));
+    for (int i = 0; i < WHEEL_TIMERS; i++) {
+        /* some timers go beyond the first level of the wheel */
+        uint64_t after = (i % 100 == 1 ? 200 : i % 50) * UCLOCK_FREQ / 1000 +
+                         i;
+        wheel_dates[i] = uclock_now(uclock) + after;
+        wheel_timers[i] = upump_alloc_timer(mgr, wheel_timer_cb,
+                                            &wheel_dates[i], NULL, after, 0);
+        assert(wheel_timers[i] != NULL);
+        upump_start(wheel_timers[i]);
+    }
+    /* stopped timers must not trigger */
+    for (int i = 0; i < WHEEL_TIMERS; i += 10)
+        upump_stop(wheel_timers[i]);
+    wheel_repeat = upump_alloc_timer(mgr, wheel_repeat_cb, NULL, NULL,
+                                     0, UCLOCK_FREQ / 100);
+    assert(wheel_repeat != NULL);
+    upump_start(wheel_repeat);
+    upump_mgr_run(mgr, NULL);
+    assert(wheel_triggered == WHEEL_TIMERS - WHEEL_TIMERS / 10);
+    assert(wheel_repeated == 5);
+    printf("timer wheel passed\n");
+
+    for (int i = 0; i < WHEEL_TIMERS; i++)
+        upump_free(wheel_timers[i]);
+    upump_free(wheel_repeat);
+    uclock_release(uclock);
+
+    /* Clean up */
+    upump_free(write_idler);
+    upump_free(write_watcher);
+    upump_free(read_timer);
+    upump_free(read_watcher);
+    upump_free(read_pump);
+    upump_mgr_release(mgr);
+
+    return 0;
+}
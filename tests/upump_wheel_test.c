@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for the timer wheel of upump_common
+ */
+
+#undef NDEBUG
+
+#include <upipe/uclock.h>
+#include <upipe/uclock_std.h>
+#include <upipe/upump.h>
+#include <upump-ev/upump_ev.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#define UPUMP_POOL 1
+#define UPUMP_BLOCKER_POOL 1
+/** resolution of the wheel: one level covers 640 us, two levels 41 ms */
+#define TICK (UCLOCK_FREQ / 100000)
+/** number of timers of the ordering test */
+#define NB_TIMERS 64
+/** spacing of the timers of the ordering test, in ticks */
+#define SPACING 20
+/** a date beyond the range of the four levels of the wheel */
+#define FAR (TICK << 26)
+
+static struct uclock *uclock;
+
+/** timer of the tests */
+struct wheel_timer {
+    struct upump *upump;
+    /** date at which the timer was started */
+    uint64_t start;
+    /** delay of the timer */
+    uint64_t after;
+    /** number of triggers */
+    unsigned int triggered;
+};
+
+static struct wheel_timer timers[NB_TIMERS];
+static unsigned int order[NB_TIMERS];
+static unsigned int nb_triggered = 0;
+
+static void wheel_timer_start(struct wheel_timer *timer)
+{
+    timer->start = uclock_now(uclock);
+    upump_start(timer->upump);
+}
+
+static void wheel_timer_alloc(struct upump_mgr *mgr, struct wheel_timer *timer,
+                              upump_cb cb, uint64_t after, uint64_t repeat)
+{
+    timer->upump = upump_alloc_timer(mgr, cb, timer, NULL, after, repeat);
+    assert(timer->upump != NULL);
+    timer->after = after;
+    timer->triggered = 0;
+}
+
+static void order_cb(struct upump *upump)
+{
+    struct wheel_timer *timer = upump_get_opaque(upump, struct wheel_timer *);
+    /* timers never trigger early */
+    assert(uclock_now(uclock) >= timer->start + timer->after);
+    assert(!timer->triggered);
+    timer->triggered++;
+    order[nb_triggered++] = timer - timers;
+}
+
+/* Timers started in random order trigger in the order of their expiry,
+ * including timers moved down from the higher levels of the wheel. */
+static void test_order(struct upump_mgr *mgr)
+{
+    for (unsigned int i = 0; i < NB_TIMERS; i++) {
+        uint64_t after = i * SPACING * TICK;
+        /* the last timers start in the third level */
+        if (i >= NB_TIMERS - 4)
+            after = (i - NB_TIMERS + 5) * 10000 * TICK;
+        wheel_timer_alloc(mgr, &timers[i], order_cb, after, 0);
+    }
+
+    unsigned int shuffle[NB_TIMERS];
+    for (unsigned int i = 0; i < NB_TIMERS; i++)
+        shuffle[i] = i;
+    for (unsigned int i = NB_TIMERS - 1; i > 0; i--) {
+        unsigned int j = rand() % (i + 1);
+        unsigned int tmp = shuffle[i];
+        shuffle[i] = shuffle[j];
+        shuffle[j] = tmp;
+    }
+    for (unsigned int i = 0; i < NB_TIMERS; i++)
+        wheel_timer_start(&timers[shuffle[i]]);
+    /* the tick cannot be changed while timers are armed */
+    ubase_nassert(upump_mgr_set_timer_tick(mgr, TICK * 2));
+
+    upump_mgr_run(mgr, NULL);
+    assert(nb_triggered == NB_TIMERS);
+    for (unsigned int i = 0; i < NB_TIMERS; i++)
+        assert(order[i] == i);
+
+    for (unsigned int i = 0; i < NB_TIMERS; i++)
+        upump_free(timers[i].upump);
+    printf("ordering passed\n");
+}
+
+static void cascade_cb(struct upump *upump)
+{
+    struct wheel_timer *timer = upump_get_opaque(upump, struct wheel_timer *);
+    assert(uclock_now(uclock) >= timer->start + timer->after);
+    timer->triggered++;
+}
+
+/* Timers straddling the boundaries of the slots and levels are moved down
+ * without being lost or triggered twice, and timers beyond the range of the
+ * wheel go to the overflow list. */
+static void test_cascade(struct upump_mgr *mgr)
+{
+    static const uint64_t afters[] = {
+        63 * TICK, 64 * TICK, 65 * TICK, 127 * TICK, 128 * TICK,
+        4095 * TICK, 4096 * TICK, 4097 * TICK, 8191 * TICK, 8192 * TICK,
+    };
+    unsigned int nb = sizeof(afters) / sizeof(afters[0]);
+    for (unsigned int i = 0; i < nb; i++) {
+        wheel_timer_alloc(mgr, &timers[i], cascade_cb, afters[i], 0);
+        wheel_timer_start(&timers[i]);
+    }
+    /* beyond the highest level, stopped before it triggers */
+    struct wheel_timer far;
+    wheel_timer_alloc(mgr, &far, cascade_cb, FAR, 0);
+    wheel_timer_start(&far);
+    upump_stop(far.upump);
+
+    upump_mgr_run(mgr, NULL);
+    for (unsigned int i = 0; i < nb; i++) {
+        assert(timers[i].triggered == 1);
+        upump_free(timers[i].upump);
+    }
+    assert(!far.triggered);
+    upump_free(far.upump);
+    printf("cascading passed\n");
+}
+
+static struct wheel_timer *stopped, *restarted, *repeated;
+
+static void dispatch_first_cb(struct upump *upump)
+{
+    struct wheel_timer *timer = upump_get_opaque(upump, struct wheel_timer *);
+    timer->triggered++;
+    if (timer->triggered == 1) {
+        /* both expire in the same tick as this one */
+        upump_stop(stopped->upump);
+        upump_stop(restarted->upump);
+        wheel_timer_start(restarted);
+        /* a one-shot timer may be restarted from its callback */
+        wheel_timer_start(timer);
+    }
+}
+
+static void dispatch_other_cb(struct upump *upump)
+{
+    struct wheel_timer *timer = upump_get_opaque(upump, struct wheel_timer *);
+    assert(timer != stopped);
+    assert(uclock_now(uclock) >= timer->start + timer->after);
+    timer->triggered++;
+}
+
+static void dispatch_repeat_cb(struct upump *upump)
+{
+    struct wheel_timer *timer = upump_get_opaque(upump, struct wheel_timer *);
+    timer->triggered++;
+    if (timer->triggered == 3)
+        upump_stop(upump);
+}
+
+/* Timers stopped and restarted from the callback of a timer expiring in the
+ * same tick are handled consistently. */
+static void test_dispatch(struct upump_mgr *mgr)
+{
+    /* a coarser tick so that the timers started in a row share a slot */
+    ubase_assert(upump_mgr_set_timer_tick(mgr, TICK * 100));
+    stopped = &timers[1];
+    restarted = &timers[2];
+    repeated = &timers[3];
+    wheel_timer_alloc(mgr, &timers[0], dispatch_first_cb, 1000 * TICK, 0);
+    wheel_timer_alloc(mgr, stopped, dispatch_other_cb, 1000 * TICK, 0);
+    wheel_timer_alloc(mgr, restarted, dispatch_other_cb, 1000 * TICK, 0);
+    wheel_timer_alloc(mgr, repeated, dispatch_repeat_cb, 0, 1000 * TICK);
+    for (unsigned int i = 0; i < 4; i++)
+        wheel_timer_start(&timers[i]);
+
+    upump_mgr_run(mgr, NULL);
+    assert(timers[0].triggered == 2);
+    assert(!stopped->triggered);
+    assert(restarted->triggered == 1);
+    assert(repeated->triggered == 3);
+
+    for (unsigned int i = 0; i < 4; i++)
+        upump_free(timers[i].upump);
+    ubase_assert(upump_mgr_set_timer_tick(mgr, TICK));
+    printf("stop and restart while dispatching passed\n");
+}
+
+static void never_cb(struct upump *upump)
+{
+    assert(0);
+}
+
+/* A manager is released while timers are still armed in its wheel, and
+ * freed along with the last of them. */
+static void test_teardown(void)
+{
+    struct upump_mgr *mgr = upump_ev_mgr_alloc_loop(UPUMP_POOL,
+                                                    UPUMP_BLOCKER_POOL);
+    assert(mgr != NULL);
+    ubase_assert(upump_mgr_set_timer_tick(mgr, TICK));
+    /* in the first level, in higher levels, repeating and in overflow */
+    wheel_timer_alloc(mgr, &timers[0], never_cb, UCLOCK_FREQ / 1000, 0);
+    wheel_timer_alloc(mgr, &timers[1], never_cb, UCLOCK_FREQ, 0);
+    wheel_timer_alloc(mgr, &timers[2], never_cb, UCLOCK_FREQ, UCLOCK_FREQ);
+    wheel_timer_alloc(mgr, &timers[3], never_cb, FAR, 0);
+    for (unsigned int i = 0; i < 4; i++)
+        wheel_timer_start(&timers[i]);
+    upump_mgr_release(mgr);
+    /* the last one frees the manager */
+    for (unsigned int i = 0; i < 4; i++)
+        upump_free(timers[i].upump);
+    printf("teardown with armed timers passed\n");
+}
+
+int main(int argc, char **argv)
+{
+    uclock = uclock_std_alloc(0);
+    assert(uclock != NULL);
+    struct upump_mgr *mgr = upump_ev_mgr_alloc_loop(UPUMP_POOL,
+                                                    UPUMP_BLOCKER_POOL);
+    assert(mgr != NULL);
+    ubase_assert(upump_mgr_set_timer_tick(mgr, TICK));
+
+    test_order(mgr);
+    test_cascade(mgr);
+    test_dispatch(mgr);
+    upump_mgr_release(mgr);
+
+    test_teardown();
+
+    uclock_release(uclock);
+    return 0;
+}